@@ -9,6 +9,7 @@
 #include <vector>
 
 #include <load-common/EventLoop.h>
+#include <load-common/Utils/Mmsg.h>
 
 struct cbor_item_t;
 
@@ -26,8 +27,10 @@ struct RpcHeader;
  */
 class ClientBase {
     public:
-        ClientBase(const std::filesystem::path &socket) : ClientBase(socket, EventLoop::Current()) {}
-        ClientBase(const std::filesystem::path &socket, const std::shared_ptr<EventLoop> &ev);
+        ClientBase(const std::filesystem::path &socket, const bool batchedIo = false) :
+            ClientBase(socket, EventLoop::Current(), batchedIo) {}
+        ClientBase(const std::filesystem::path &socket, const std::shared_ptr<EventLoop> &ev,
+                const bool batchedIo = false);
         virtual ~ClientBase();
 
     protected:
@@ -57,8 +60,14 @@ class ClientBase {
     private:
         int connectSocket();
 
+        void initBatchedIo(struct event_base *);
+
         void bevRead(struct bufferevent *);
         void bevEvent(struct bufferevent *, const uintptr_t);
+        void batchRead();
+        void batchFlush();
+
+        void handleDatagram(std::span<const std::byte>);
 
     private:
         /// filesystem path for the RPC socket
@@ -73,6 +82,19 @@ class ClientBase {
 
         /// Packet receive buffer
         std::vector<std::byte> rxBuf;
+
+        /// Batched IO: outgoing messages waiting to be flushed (null if not batching)
+        struct evbuffer *batchTxBuf{nullptr};
+        /// Batched IO: socket readable event
+        struct event *batchReadEvent{nullptr};
+        /// Batched IO: socket writable event (to resume sending after it would block)
+        struct event *batchWriteEvent{nullptr};
+        /// Batched IO: event to flush output at the end of an event loop iteration
+        struct event *batchFlushEvent{nullptr};
+        /// Batched IO: transmit counters
+        Util::Mmsg::Stats batchTxStats;
+        /// Batched IO: receive counters
+        Util::Mmsg::Stats batchRxStats;
 };
 }
 
@@ -29,6 +29,8 @@ constexpr inline static uint64_t CborReadUint(const cbor_item_t *item) {
         case CBOR_INT_64:
             return cbor_get_uint64(item);
     }
+
+    throw std::runtime_error("invalid integer width");
 }
 
 /**
@@ -0,0 +1,221 @@
+#ifndef PLCOMMON_UTIL_MMSG_H
+#define PLCOMMON_UTIL_MMSG_H
+
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+
+#include <event2/buffer.h>
+
+namespace PlCommon::Util {
+/**
+ * @brief Batched datagram IO helpers
+ *
+ * These move multiple RPC messages per syscall over a SOCK_SEQPACKET socket, using `sendmmsg` and
+ * `recvmmsg`. Each message is still sent as its own datagram.
+ */
+namespace Mmsg {
+/// Maximum number of messages moved per syscall
+constexpr static const size_t kBatchSize{16};
+/// Maximum size of a single message (limited by the 16-bit header length field)
+constexpr static const size_t kMaxMessageSize{0x10000};
+/// Maximum number of buffer segments a single outgoing message may be split across
+constexpr static const size_t kMaxSegments{4};
+
+/**
+ * @brief Syscall counters for batched IO
+ */
+struct Stats {
+    /// Number of sendmmsg/recvmmsg calls made
+    size_t syscalls{0};
+    /// Number of messages moved by those calls
+    size_t messages{0};
+};
+
+/// Result of a batched receive
+enum class RecvResult {
+    /// Received at least one message; there may be more waiting
+    Ok,
+    /// No messages are waiting
+    WouldBlock,
+    /// The remote end closed the connection
+    Closed,
+};
+
+/**
+ * @brief Send all messages in a buffer
+ *
+ * Walk the buffer, which holds back-to-back messages (each prefixed with a `Header`) and send
+ * them in batches with `sendmmsg`, directly out of the buffer's memory. Sent messages are then
+ * drained from the buffer.
+ *
+ * @tparam Header Message header type; its `length` member is the total message length
+ *
+ * @param fd Socket to send on (should be non-blocking)
+ * @param buf Buffer holding messages to send
+ * @param stats Counters to update
+ * @param limit Only send the messages in this many bytes at the start of the buffer
+ *
+ * @return Whether the buffer (up to the limit) was fully sent; if not, the socket would block.
+ */
+template<typename Header>
+inline bool SendBuffer(const int fd, struct evbuffer *buf, Stats &stats,
+        size_t limit = SIZE_MAX) {
+    std::array<struct mmsghdr, kBatchSize> msgs;
+    std::array<size_t, kBatchSize> msgLens;
+    std::array<struct evbuffer_iovec, kBatchSize * kMaxSegments> iovs;
+
+    while(const size_t pending = std::min(evbuffer_get_length(buf), limit)) {
+        size_t numMsgs{0}, numIovs{0}, offset{0};
+
+        // gather as many messages as fit in a batch
+        while(numMsgs < kBatchSize && (offset + sizeof(Header)) <= pending) {
+            struct evbuffer_ptr pos;
+            Header hdr;
+
+            evbuffer_ptr_set(buf, &pos, offset, EVBUFFER_PTR_SET);
+            if(evbuffer_copyout_from(buf, &pos, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+                throw std::runtime_error("failed to read message header from send buffer");
+            }
+
+            const size_t msgLen = hdr.length;
+            if(msgLen < sizeof(hdr)) {
+                throw std::runtime_error("invalid message length in send buffer");
+            } else if(offset + msgLen > pending) {
+                throw std::runtime_error("truncated message in send buffer");
+            }
+
+            const int segments = evbuffer_peek(buf, msgLen, &pos, &iovs[numIovs],
+                    iovs.size() - numIovs);
+            if(segments < 0 || static_cast<size_t>(segments) > (iovs.size() - numIovs)) {
+                // message is too fragmented: make it contiguous, unless it's the first one
+                if(numMsgs) {
+                    break;
+                }
+                evbuffer_pullup(buf, offset + msgLen);
+                continue;
+            }
+
+            // the last segment runs to the end of its chain, which may hold further messages
+            size_t remaining{msgLen};
+            for(int i = 0; i < segments; i++) {
+                auto &iov = iovs[numIovs + i];
+                iov.iov_len = std::min(iov.iov_len, remaining);
+                remaining -= iov.iov_len;
+            }
+
+            auto &msg = msgs[numMsgs].msg_hdr;
+            msg = {};
+            msg.msg_iov = reinterpret_cast<struct iovec *>(&iovs[numIovs]);
+            msg.msg_iovlen = segments;
+
+            msgLens[numMsgs] = msgLen;
+            numIovs += segments;
+            numMsgs++;
+            offset += msgLen;
+        }
+
+        if(!numMsgs) {
+            break;
+        }
+
+        // send them off
+        const int sent = sendmmsg(fd, msgs.data(), numMsgs, MSG_NOSIGNAL | MSG_DONTWAIT);
+        stats.syscalls++;
+
+        if(sent == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
+            } else if(errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "sendmmsg");
+        }
+
+        size_t sentBytes{0};
+        for(int i = 0; i < sent; i++) {
+            sentBytes += msgLens[i];
+        }
+
+        if(evbuffer_drain(buf, sentBytes) == -1) {
+            throw std::runtime_error("failed to drain send buffer");
+        }
+        limit -= sentBytes;
+        stats.messages += sent;
+
+        if(static_cast<size_t>(sent) < numMsgs) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief Receive a batch of messages
+ *
+ * Read up to `kBatchSize` datagrams with a single `recvmmsg` call, and invoke the callback for
+ * each of them.
+ *
+ * @param fd Socket to receive from (should be non-blocking)
+ * @param slab Receive buffer; must be at least `kBatchSize * kMaxMessageSize` bytes
+ * @param stats Counters to update
+ * @param callback Invoked with the contents of each received datagram
+ */
+template<typename Callback>
+inline RecvResult Receive(const int fd, std::span<std::byte> slab, Stats &stats,
+        Callback &&callback) {
+    std::array<struct mmsghdr, kBatchSize> msgs{};
+    std::array<struct iovec, kBatchSize> iovs;
+
+    if(slab.size() < (kBatchSize * kMaxMessageSize)) {
+        throw std::invalid_argument("receive slab too small");
+    }
+
+    for(size_t i = 0; i < kBatchSize; i++) {
+        iovs[i].iov_base = slab.data() + (i * kMaxMessageSize);
+        iovs[i].iov_len = kMaxMessageSize;
+
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int received;
+    do {
+        received = recvmmsg(fd, msgs.data(), kBatchSize, MSG_DONTWAIT, nullptr);
+    } while(received == -1 && errno == EINTR);
+
+    stats.syscalls++;
+
+    if(received == -1) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return RecvResult::WouldBlock;
+        }
+        throw std::system_error(errno, std::generic_category(), "recvmmsg");
+    }
+
+    for(int i = 0; i < received; i++) {
+        // zero length datagram indicates the connection was closed
+        if(!msgs[i].msg_len) {
+            return RecvResult::Closed;
+        } else if(msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            throw std::runtime_error("received truncated message");
+        }
+
+        stats.messages++;
+        callback(slab.subspan(i * kMaxMessageSize, msgs[i].msg_len));
+    }
+
+    return received ? RecvResult::Ok : RecvResult::Closed;
+}
+}
+}
+
+#endif
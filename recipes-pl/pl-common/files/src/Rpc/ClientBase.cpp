@@ -22,9 +22,14 @@ using namespace PlCommon::Rpc;
 
 /**
  * @brief Create a pinball client instance
+ *
+ * @param rpcSocketPath Path of the RPC socket to connect to
+ * @param ev Event loop to run the client on
+ * @param batchedIo Move multiple messages per syscall (with sendmmsg/recvmmsg)
  */
 ClientBase::ClientBase(const std::filesystem::path &rpcSocketPath,
-        const std::shared_ptr<PlCommon::EventLoop> &ev) : socketPath(rpcSocketPath) {
+        const std::shared_ptr<PlCommon::EventLoop> &ev, const bool batchedIo) :
+        socketPath(rpcSocketPath) {
     int err;
     auto evbase = ev->getEvBase();
 
@@ -60,6 +65,12 @@ ClientBase::ClientBase(const std::filesystem::path &rpcSocketPath,
         }
     }, this);
 
+    // with batched IO, the bufferevent is only used for events; we do the reading and writing
+    if(batchedIo) {
+        this->initBatchedIo(evbase);
+        return;
+    }
+
     // add events to run loop
     err = bufferevent_enable(this->bev, EV_READ);
     if(err == -1) {
@@ -68,10 +79,57 @@ ClientBase::ClientBase(const std::filesystem::path &rpcSocketPath,
 
 }
 
+/**
+ * @brief Set up batched IO
+ *
+ * Outgoing messages are buffered and sent with `sendmmsg` at the end of the current event loop
+ * iteration, while incoming messages are read in batches with `recvmmsg`.
+ */
+void ClientBase::initBatchedIo(struct event_base *evbase) {
+    this->rxBuf.resize(Util::Mmsg::kBatchSize * Util::Mmsg::kMaxMessageSize);
+
+    this->batchTxBuf = evbuffer_new();
+    if(!this->batchTxBuf) {
+        throw std::runtime_error("failed to allocate batch transmit buffer");
+    }
+
+    this->batchReadEvent = event_new(evbase, this->fd, EV_READ | EV_PERSIST,
+            [](auto, auto, auto ctx) {
+        try {
+            reinterpret_cast<ClientBase *>(ctx)->batchRead();
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "Failed to handle read: " << e.what();
+        }
+    }, this);
+    this->batchWriteEvent = event_new(evbase, this->fd, EV_WRITE, [](auto, auto, auto ctx) {
+        reinterpret_cast<ClientBase *>(ctx)->batchFlush();
+    }, this);
+    this->batchFlushEvent = event_new(evbase, -1, 0, [](auto, auto, auto ctx) {
+        reinterpret_cast<ClientBase *>(ctx)->batchFlush();
+    }, this);
+
+    if(!this->batchReadEvent || !this->batchWriteEvent || !this->batchFlushEvent) {
+        throw std::runtime_error("failed to allocate batched io events");
+    }
+
+    event_add(this->batchReadEvent, nullptr);
+}
+
 /**
  * @brief Clean up client resources
  */
 ClientBase::~ClientBase() {
+    if(this->batchTxBuf) {
+        PLOG_DEBUG << fmt::format("RPC sent {} messages in {} syscalls, received {} in {} syscalls",
+                this->batchTxStats.messages, this->batchTxStats.syscalls,
+                this->batchRxStats.messages, this->batchRxStats.syscalls);
+
+        event_free(this->batchReadEvent);
+        event_free(this->batchWriteEvent);
+        event_free(this->batchFlushEvent);
+        evbuffer_free(this->batchTxBuf);
+    }
+
     if(this->bev) {
         bufferevent_free(this->bev);
     }
@@ -139,17 +197,43 @@ void ClientBase::bevRead(struct bufferevent *ev) {
         throw std::runtime_error("failed to drain read buffer");
     }
 
+    this->handleDatagram({this->rxBuf.data(), static_cast<size_t>(read)});
+}
+
+/**
+ * @brief Read a batch of messages (batched IO)
+ *
+ * Read up to a batch worth of datagrams from the socket with a single syscall.
+ */
+void ClientBase::batchRead() {
+    const auto result = Util::Mmsg::Receive(this->fd, this->rxBuf, this->batchRxStats,
+            [&](auto datagram) {
+        this->handleDatagram(datagram);
+    });
+
+    if(result == Util::Mmsg::RecvResult::Closed) {
+        event_del(this->batchReadEvent);
+        this->bevEvent(this->bev, BEV_EVENT_EOF);
+    }
+}
+
+/**
+ * @brief Process a single received datagram
+ *
+ * Validate the packet header, then invoke the message handler.
+ */
+void ClientBase::handleDatagram(std::span<const std::byte> datagram) {
     // validate header
-    if(pending < sizeof(struct RpcHeader)) {
-        PLOG_WARNING << fmt::format("insufficient RPC read (got {})", pending);
+    if(datagram.size() < sizeof(struct RpcHeader)) {
+        PLOG_WARNING << fmt::format("insufficient RPC read (got {})", datagram.size());
         return;
     }
 
-    auto hdr = reinterpret_cast<const struct RpcHeader *>(this->rxBuf.data());
+    auto hdr = reinterpret_cast<const struct RpcHeader *>(datagram.data());
     if(hdr->version != kRpcVersionLatest) {
         PLOG_WARNING << fmt::format("unknown rpc version ${:04x}", hdr->version);
         return;
-    } else if(hdr->length < sizeof(struct RpcHeader)) {
+    } else if(hdr->length < sizeof(struct RpcHeader) || hdr->length > datagram.size()) {
         PLOG_WARNING << fmt::format("invalid rpc packet size ({} bytes)", hdr->length);
         return;
     }
@@ -184,12 +268,38 @@ void ClientBase::bevEvent(struct bufferevent *, const uintptr_t flags) {
  * This assumes the packet already has a `struct RpcHeader` prepended.
  */
 void ClientBase::sendRaw(std::span<const std::byte> payload) {
+    // batched IO: queue it, to be sent at the end of this event loop iteration
+    if(this->batchTxBuf) {
+        if(evbuffer_add(this->batchTxBuf, payload.data(), payload.size()) == -1) {
+            throw std::runtime_error("failed to queue rpc packet");
+        }
+
+        event_active(this->batchFlushEvent, EV_TIMEOUT, 0);
+        return;
+    }
+
     int err = write(this->fd, payload.data(), payload.size());
     if(err == -1) {
         throw std::system_error(errno, std::generic_category(), "write");
     }
 }
 
+/**
+ * @brief Send all queued packets (batched IO)
+ *
+ * If the socket would block, wait for it to become writable again before continuing.
+ */
+void ClientBase::batchFlush() {
+    try {
+        if(!Util::Mmsg::SendBuffer<RpcHeader>(this->fd, this->batchTxBuf, this->batchTxStats)) {
+            event_add(this->batchWriteEvent, nullptr);
+        }
+    } catch(const std::exception &e) {
+        PLOG_ERROR << "Failed to send: " << e.what();
+        this->handleIoError(BEV_EVENT_WRITING | BEV_EVENT_ERROR);
+    }
+}
+
 /**
  * @brief Send a packet to the remote, adding a packet header
  *
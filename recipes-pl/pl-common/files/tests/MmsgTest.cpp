@@ -0,0 +1,174 @@
+/**
+ * @file
+ *
+ * @brief Tests for the batched datagram IO helpers
+ *
+ * Messages are queued into an evbuffer in various layouts, sent over a sequenced packet socket
+ * pair, and each received datagram is checked to hold exactly one message.
+ */
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <event2/buffer.h>
+
+#include "load-common/Utils/Mmsg.h"
+
+namespace {
+namespace Mmsg = PlCommon::Util::Mmsg;
+
+/// Minimal message header; the helpers only care about the `length` field
+struct Header {
+    uint16_t length;
+    uint16_t index;
+} __attribute__((packed));
+
+/// Number of failed checks
+int gFailures{0};
+
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        gFailures++; \
+    } \
+} while(0)
+
+/**
+ * @brief Build a message with the given index and total length
+ *
+ * The payload is filled with the index, so that overruns into the next message are detected.
+ */
+std::vector<std::byte> MakeMessage(const uint16_t index, const size_t length) {
+    std::vector<std::byte> msg(length, static_cast<std::byte>(index));
+    const Header hdr{static_cast<uint16_t>(length), index};
+    memcpy(msg.data(), &hdr, sizeof(hdr));
+    return msg;
+}
+
+/**
+ * @brief Receive all pending datagrams, and verify each one is exactly the expected message
+ *
+ * @param fd Socket to read from
+ * @param lengths Expected length of each message, in order
+ */
+void ExpectDatagrams(const int fd, const std::vector<size_t> &lengths) {
+    std::vector<std::byte> buf(Mmsg::kMaxMessageSize);
+
+    for(size_t i = 0; i < lengths.size(); i++) {
+        const auto len = recv(fd, buf.data(), buf.size(), MSG_DONTWAIT);
+        CHECK(len == static_cast<ssize_t>(lengths[i]));
+        if(len < static_cast<ssize_t>(sizeof(Header))) {
+            return;
+        }
+
+        Header hdr;
+        memcpy(&hdr, buf.data(), sizeof(hdr));
+        CHECK(hdr.length == lengths[i]);
+        CHECK(hdr.index == i);
+
+        const auto expected = MakeMessage(static_cast<uint16_t>(i), lengths[i]);
+        CHECK(!memcmp(buf.data(), expected.data(), std::min<size_t>(len, expected.size())));
+    }
+
+    // nothing else may have been sent
+    CHECK(recv(fd, buf.data(), buf.size(), MSG_DONTWAIT) == -1);
+}
+
+/**
+ * @brief Several messages in one contiguous chain
+ */
+void TestSingleChain(const int tx, const int rx) {
+    const std::vector<size_t> lengths{12, 12, 12, 40, 5};
+
+    std::vector<std::byte> blob;
+    for(size_t i = 0; i < lengths.size(); i++) {
+        const auto msg = MakeMessage(static_cast<uint16_t>(i), lengths[i]);
+        blob.insert(blob.end(), msg.begin(), msg.end());
+    }
+
+    auto buf = evbuffer_new();
+    evbuffer_add(buf, blob.data(), blob.size());
+
+    Mmsg::Stats stats;
+    CHECK(Mmsg::SendBuffer<Header>(tx, buf, stats));
+    CHECK(!evbuffer_get_length(buf));
+    CHECK(stats.messages == lengths.size());
+
+    ExpectDatagrams(rx, lengths);
+    evbuffer_free(buf);
+}
+
+/**
+ * @brief Messages split across chains, which also hold the start of the next message
+ */
+void TestSplitChains(const int tx, const int rx) {
+    const std::vector<size_t> lengths{30, 30, 30};
+
+    std::vector<std::byte> blob;
+    for(size_t i = 0; i < lengths.size(); i++) {
+        const auto msg = MakeMessage(static_cast<uint16_t>(i), lengths[i]);
+        blob.insert(blob.end(), msg.begin(), msg.end());
+    }
+
+    // chains of 20 bytes, so no chain boundary lines up with a message boundary
+    auto buf = evbuffer_new();
+    for(size_t off = 0; off < blob.size(); off += 20) {
+        evbuffer_add_reference(buf, blob.data() + off, std::min<size_t>(20, blob.size() - off),
+                nullptr, nullptr);
+    }
+
+    Mmsg::Stats stats;
+    CHECK(Mmsg::SendBuffer<Header>(tx, buf, stats));
+    CHECK(!evbuffer_get_length(buf));
+
+    ExpectDatagrams(rx, lengths);
+    evbuffer_free(buf);
+}
+
+/**
+ * @brief Only messages within the limit are sent
+ */
+void TestLimit(const int tx, const int rx) {
+    auto buf = evbuffer_new();
+    for(uint16_t i = 0; i < 3; i++) {
+        const auto msg = MakeMessage(i, 16);
+        evbuffer_add(buf, msg.data(), msg.size());
+    }
+
+    Mmsg::Stats stats;
+    CHECK(Mmsg::SendBuffer<Header>(tx, buf, stats, 32));
+    CHECK(evbuffer_get_length(buf) == 16);
+
+    ExpectDatagrams(rx, {16, 16});
+    evbuffer_free(buf);
+}
+}
+
+
+
+int main() {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK, 0, fds) == -1) {
+        perror("socketpair");
+        return 1;
+    }
+
+    TestSingleChain(fds[0], fds[1]);
+    TestSplitChains(fds[0], fds[1]);
+    TestLimit(fds[0], fds[1]);
+
+    close(fds[0]);
+    close(fds[1]);
+
+    if(gFailures) {
+        fprintf(stderr, "%d check(s) failed\n", gFailures);
+        return 1;
+    }
+    return 0;
+}
@@ -1,5 +1,9 @@
 #include <array>
+#include <cstdint>
+#include <map>
 #include <stdexcept>
+#include <type_traits>
+#include <variant>
 #include <vector>
 
 #include <event2/event.h>
@@ -22,6 +26,66 @@
 
 using namespace Gui;
 
+namespace {
+using Indicator = Rpc::PinballClient::Indicator;
+using Color = Rpc::PinballClient::IndicatorColor;
+
+/**
+ * @brief Indicator states for each step of the indicator test
+ *
+ * The first step must set every indicator that the test uses. The indicators remain in the state
+ * of the last step once the test is complete.
+ */
+const std::array<const std::vector<Rpc::PinballClient::IndicatorChange>, 5> kLedTestSteps{{
+    {
+        { Indicator::Trigger, false },
+        { Indicator::Overheat, false },
+        { Indicator::Overcurrent, false },
+        { Indicator::Error, false },
+
+        { Indicator::BtnModeCc, true },
+        { Indicator::BtnModeCv, true },
+        { Indicator::BtnModeCw, true },
+        { Indicator::BtnModeExt, true },
+        { Indicator::BtnLoadOn, Color{1., 0., 0.} },
+        { Indicator::BtnMenu, true },
+
+        { Indicator::Status, Color{1., 0., 0.} },
+    },
+    {
+        { Indicator::BtnModeCc, false },
+        { Indicator::BtnModeCv, false },
+        { Indicator::BtnModeCw, false },
+        { Indicator::BtnModeExt, false },
+        { Indicator::BtnLoadOn, Color{0., 1., 0.} },
+        { Indicator::BtnMenu, false },
+
+        { Indicator::Status, Color{0., 1., 0.} },
+        { Indicator::Trigger, Color{1., 0., 0.} },
+        { Indicator::Overheat, true },
+        { Indicator::Overcurrent, true },
+        { Indicator::Error, true },
+    },
+    {
+        { Indicator::BtnLoadOn, false },
+
+        { Indicator::Status, Color{0., 0., 1.} },
+        { Indicator::Trigger, Color{0., 1., 0.} },
+        { Indicator::Overheat, false },
+        { Indicator::Overcurrent, false },
+        { Indicator::Error, false },
+    },
+    {
+        { Indicator::Status, false },
+        { Indicator::Trigger, false },
+    },
+    // stage 4: lmao
+    {
+        { Indicator::Status, Color{.2, .2, .2} },
+    },
+}};
+}
+
 /**
  * @brief Initialize the home screen
  */
@@ -63,31 +127,31 @@ VersionScreen::~VersionScreen() {
 }
 
 /**
- * @brief Initialize the periodic timer
+ * @brief Initialize the dismiss timer
  *
- * This timer fires roughly every 500ms, and is used to process the indicator test. It will also
- * be used to dismiss the view.
+ * This timer fires once the indicator test is complete, and dismisses the view.
  */
 void VersionScreen::initTimer() {
     auto evbase = PlCommon::EventLoop::Current()->getEvBase();
-    this->timerEvent = event_new(evbase, -1, EV_PERSIST, [](auto, auto, auto ctx) {
+    this->timerEvent = evtimer_new(evbase, [](auto, auto, auto ctx) {
         reinterpret_cast<VersionScreen *>(ctx)->timerCallback();
     }, this);
     if(!this->timerEvent) {
         throw std::runtime_error("failed to allocate timer event");
     }
 
+    const auto usec = static_cast<uint64_t>(kLedTestStepInterval * 1'000'000.) *
+        (kLedTestSteps.size() - 1);
     struct timeval tv{
-        .tv_sec  = static_cast<time_t>(0),
-        .tv_usec = static_cast<suseconds_t>(500'000),
+        .tv_sec  = static_cast<time_t>(usec / 1'000'000),
+        .tv_usec = static_cast<suseconds_t>(usec % 1'000'000),
     };
 
-    this->timerCount = 0;
     evtimer_add(this->timerEvent, &tv);
 }
 
 /**
- * @brief Remove the periodic timer
+ * @brief Remove the dismiss timer
  */
 void VersionScreen::removeTimer() {
     if(this->timerEvent) {
@@ -97,83 +161,69 @@ void VersionScreen::removeTimer() {
 }
 
 /**
- * @brief Timer periodic callback
+ * @brief Timer callback
  *
- * Drive the indicator test state machine, and dismiss the screen after the indicator test is
- * complete.
+ * The indicator test is complete, so dismiss the screen.
  */
 void VersionScreen::timerCallback() {
-    const auto done = this->runLedTest(++this->timerCount);
-    if(done) {
-        auto screen = this->root->getScreen();
+    auto screen = this->root->getScreen();
 
-        auto home = std::make_shared<Gui::HomeScreen>();
-        screen->setRootViewController(home);
+    auto home = std::make_shared<Gui::HomeScreen>();
+    screen->setRootViewController(home);
 
-        this->removeTimer();
-    }
+    this->removeTimer();
 }
 
 /**
- * @brief Update the state of the indicators according to the current step
+ * @brief Start the indicator test
  *
- * @return Whether we've reached the last entry in the LED test sequence
+ * Each indicator's states over the steps of the test are turned into a color sequence, which
+ * pinballd plays back by itself. The state of the last step is set beforehand, so indicators
+ * return to it once their sequence ends.
  */
-bool VersionScreen::runLedTest(const size_t step) {
-    using Indicator = Rpc::PinballClient::Indicator;
-    using Color = Rpc::PinballClient::IndicatorColor;
-
-    static const std::array<const std::vector<const Rpc::PinballClient::IndicatorChange>, 5> gIndicatorStates{{
-        {
-            { Indicator::Trigger, false },
-            { Indicator::Overheat, false },
-            { Indicator::Overcurrent, false },
-            { Indicator::Error, false },
-
-            { Indicator::BtnModeCc, true },
-            { Indicator::BtnModeCv, true },
-            { Indicator::BtnModeCw, true },
-            { Indicator::BtnModeExt, true },
-            { Indicator::BtnLoadOn, Color{1., 0., 0.} },
-            { Indicator::BtnMenu, true },
-
-            { Indicator::Status, Color{1., 0., 0.} },
-        },
-        {
-            { Indicator::BtnModeCc, false },
-            { Indicator::BtnModeCv, false },
-            { Indicator::BtnModeCw, false },
-            { Indicator::BtnModeExt, false },
-            { Indicator::BtnLoadOn, Color{0., 1., 0.} },
-            { Indicator::BtnMenu, false },
-
-            { Indicator::Status, Color{0., 1., 0.} },
-            { Indicator::Trigger, Color{1., 0., 0.} },
-            { Indicator::Overheat, true },
-            { Indicator::Overcurrent, true },
-            { Indicator::Error, true },
-        },
-        {
-            { Indicator::BtnLoadOn, false },
-
-            { Indicator::Status, Color{0., 0., 1.} },
-            { Indicator::Trigger, Color{0., 1., 0.} },
-            { Indicator::Overheat, false },
-            { Indicator::Overcurrent, false },
-            { Indicator::Error, false },
-        },
-        {
-            { Indicator::Status, false },
-            { Indicator::Trigger, false },
-        },
-        // stage 4: lmao
-        {
-            { Indicator::Status, Color{.2, .2, .2} },
-        },
-    }};
-
-    // set the appropriate indicator state
-    SharedState::gRpcPinball->setIndicatorState(gIndicatorStates.at(step));
-
-    return step == (gIndicatorStates.size() - 1);
+void VersionScreen::startLedTest() {
+    auto toColor = [](const Rpc::PinballClient::IndicatorValue &value) -> Color {
+        return std::visit([](const auto &v) -> Color {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr(std::is_same_v<T, bool>) {
+                return v ? Color{1., 1., 1.} : Color{0., 0., 0.};
+            } else if constexpr(std::is_same_v<T, double>) {
+                return {v, v, v};
+            } else {
+                return v;
+            }
+        }, value);
+    };
+
+    // collect each indicator's color for every step but the last
+    std::map<Indicator, Rpc::PinballClient::IndicatorValue> current;
+    std::map<Indicator, Rpc::PinballClient::IndicatorAnimation> sequences;
+
+    for(size_t i = 0; i < kLedTestSteps.size() - 1; i++) {
+        for(const auto &[which, value] : kLedTestSteps[i]) {
+            current[which] = value;
+        }
+
+        for(const auto &[which, value] : current) {
+            sequences[which].colors.push_back(toColor(value));
+        }
+    }
+
+    // the last step becomes the indicators' state
+    for(const auto &[which, value] : kLedTestSteps.back()) {
+        current[which] = value;
+    }
+
+    const std::vector<Rpc::PinballClient::IndicatorChange> state(current.begin(),
+            current.end());
+    SharedState::gRpcPinball->setIndicatorState(state);
+
+    // then play back the preceding steps
+    for(auto &[which, animation] : sequences) {
+        animation.type = Rpc::PinballClient::IndicatorAnimation::Type::Sequence;
+        animation.period = kLedTestStepInterval;
+        animation.repeat = 1;
+
+        SharedState::gRpcPinball->setIndicatorAnimation(which, animation);
+    }
 }
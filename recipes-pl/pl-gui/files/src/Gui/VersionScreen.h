@@ -43,12 +43,12 @@ class VersionScreen: public shittygui::ViewController {
         }
 
         /**
-         * @brief Install the periodic timer callback
+         * @brief Start the indicator test, and install the timer to dismiss the view after it
          */
         void viewWillAppear(const bool isAnimated) override {
             ViewController::viewWillAppear(isAnimated);
             this->initTimer();
-            this->runLedTest(0);
+            this->startLedTest();
         }
         /**
          * @brief Remove the timer callback
@@ -62,7 +62,7 @@ class VersionScreen: public shittygui::ViewController {
         void initTimer();
         void removeTimer();
         void timerCallback();
-        bool runLedTest(const size_t step);
+        void startLedTest();
 
     private:
         /// Heading label font
@@ -75,11 +75,12 @@ class VersionScreen: public shittygui::ViewController {
         /// Heading label font size
         constexpr static const double kVersionFontSize{24.};
 
+        /// Duration of each step of the indicator test (seconds)
+        constexpr static const double kLedTestStepInterval{.5};
+
     private:
         /// Timer event
         struct event *timerEvent{nullptr};
-        /// Number of times the timer has fired
-        size_t timerCount{0};
 
         /// Root widget for the screen
         std::shared_ptr<shittygui::Widget> root;
@@ -25,8 +25,24 @@ enum RpcEndpoint: uint8_t {
     kRpcEndpointBroadcastConfig         = 0x01,
     kRpcEndpointUiEvent                 = 0x02,
     kRpcEndpointIndicator               = 0x03,
+    kRpcEndpointIndicatorAnimation      = 0x05,
 };
 
+/// Mapping of indicator -> key name
+static const std::unordered_map<PinballClient::Indicator, std::string_view> kIndicatorNames{{
+    {PinballClient::Indicator::Status,          "status"},
+    {PinballClient::Indicator::Trigger,         "trigger"},
+    {PinballClient::Indicator::Overheat,        "overheat"},
+    {PinballClient::Indicator::Overcurrent,     "overcurrent"},
+    {PinballClient::Indicator::Error,           "error"},
+    {PinballClient::Indicator::BtnModeCc,       "modeCc"},
+    {PinballClient::Indicator::BtnModeCv,       "modeCv"},
+    {PinballClient::Indicator::BtnModeCw,       "modeCw"},
+    {PinballClient::Indicator::BtnModeExt,      "modeExt"},
+    {PinballClient::Indicator::BtnLoadOn,       "loadOn"},
+    {PinballClient::Indicator::BtnMenu,         "menu"},
+}};
+
 /**
  * @brief Handle a received message
  */
@@ -295,21 +311,6 @@ void PinballClient::setDesiredBroadcasts(const PinballBroadcastType mask) {
  * @param changes Block of memory containing one or more indicator change requests
  */
 void PinballClient::setIndicatorState(std::span<const IndicatorChange> changes) {
-    // mapping of indicator -> key name
-    static const std::unordered_map<Indicator, std::string_view> kIndicatorNames{{
-        {Indicator::Status,             "status"},
-        {Indicator::Trigger,            "trigger"},
-        {Indicator::Overheat,           "overheat"},
-        {Indicator::Overcurrent,        "overcurrent"},
-        {Indicator::Error,              "error"},
-        {Indicator::BtnModeCc,          "modeCc"},
-        {Indicator::BtnModeCv,          "modeCv"},
-        {Indicator::BtnModeCw,          "modeCw"},
-        {Indicator::BtnModeExt,         "modeExt"},
-        {Indicator::BtnLoadOn,          "loadOn"},
-        {Indicator::BtnMenu,            "menu"},
-    }};
-
     // validate args
     if(changes.empty()) {
         // honestly, what kind of idiot would make this call?
@@ -365,3 +366,80 @@ void PinballClient::setIndicatorState(std::span<const IndicatorChange> changes)
         throw;
     }
 }
+
+/**
+ * @brief Start or stop an indicator's animation
+ *
+ * @param which Indicator to update
+ * @param animation Animation to start, or `nullptr` to stop the current animation
+ */
+void PinballClient::sendIndicatorAnimation(const Indicator which,
+        const IndicatorAnimation *animation) {
+    // mapping of animation type -> name
+    static const std::unordered_map<IndicatorAnimation::Type, std::string_view> kTypeNames{{
+        {IndicatorAnimation::Type::Blink,       "blink"},
+        {IndicatorAnimation::Type::Fade,        "fade"},
+        {IndicatorAnimation::Type::Breathe,     "breathe"},
+        {IndicatorAnimation::Type::Sequence,    "sequence"},
+        {IndicatorAnimation::Type::Flash,       "flash"},
+    }};
+
+    // build the animation description (or null, to clear it)
+    cbor_item_t *payload{nullptr};
+
+    if(animation) {
+        auto colors = cbor_new_definite_array(animation->colors.size());
+        for(const auto &[cR, cG, cB] : animation->colors) {
+            auto array = cbor_new_definite_array(3);
+            cbor_array_push(array, cbor_move(cbor_build_float4(cR)));
+            cbor_array_push(array, cbor_move(cbor_build_float4(cG)));
+            cbor_array_push(array, cbor_move(cbor_build_float4(cB)));
+            cbor_array_push(colors, cbor_move(array));
+        }
+
+        payload = cbor_new_definite_map(5);
+        cbor_map_add(payload, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("type")),
+            .value = cbor_move(cbor_build_string(kTypeNames.at(animation->type).data())),
+        });
+        cbor_map_add(payload, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("colors")),
+            .value = cbor_move(colors),
+        });
+        cbor_map_add(payload, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("period")),
+            .value = cbor_move(cbor_build_float4(animation->period)),
+        });
+        cbor_map_add(payload, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("duty")),
+            .value = cbor_move(cbor_build_float4(animation->duty)),
+        });
+        cbor_map_add(payload, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("repeat")),
+            .value = cbor_move(cbor_build_uint32(animation->repeat)),
+        });
+    } else {
+        payload = cbor_new_null();
+    }
+
+    auto root = cbor_new_definite_map(1);
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string(kIndicatorNames.at(which).data())),
+        .value = cbor_move(payload)
+    });
+
+    // send the packet
+    size_t rootBufLen;
+    unsigned char *rootBuf{nullptr};
+    const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
+    cbor_decref(&root);
+
+    try {
+        this->sendPacket(kRpcEndpointIndicatorAnimation,
+                {reinterpret_cast<std::byte *>(rootBuf), serializedBytes});
+        free(rootBuf);
+    } catch(const std::exception &e) {
+        free(rootBuf);
+        throw;
+    }
+}
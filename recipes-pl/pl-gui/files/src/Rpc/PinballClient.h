@@ -8,6 +8,7 @@
 #include <tuple>
 #include <utility>
 #include <variant>
+#include <vector>
 
 #include <load-common/Rpc/ClientBase.h>
 
@@ -63,6 +64,34 @@ class PinballClient: public PlCommon::Rpc::ClientBase {
         using IndicatorValue = std::variant<bool, double, IndicatorColor>;
         using IndicatorChange = std::pair<Indicator, IndicatorValue>;
 
+        /**
+         * @brief An indicator animation
+         *
+         * This is played back by pinballd by itself; see its LedManager::Animation for details
+         * on how each type uses the colors.
+         */
+        struct IndicatorAnimation {
+            /// Types of animation
+            enum class Type {
+                Blink,
+                Fade,
+                Breathe,
+                Sequence,
+                Flash,
+            };
+
+            /// Type of animation
+            Type type{Type::Blink};
+            /// Colors used by the animation (at least one is required)
+            std::vector<IndicatorColor> colors;
+            /// Blink/breathe period, fade/flash duration, or time per sequence step (seconds)
+            double period{1.};
+            /// Fraction of the blink period for which the first color is shown
+            double duty{.5};
+            /// Number of cycles to play; 0 repeats until cleared
+            size_t repeat{0};
+        };
+
     public:
         PinballClient(const std::filesystem::path &path) : ClientBase(path) {};
 
@@ -97,11 +126,30 @@ class PinballClient: public PlCommon::Rpc::ClientBase {
         }
         void setIndicatorState(std::span<const IndicatorChange> changes);
 
+        /**
+         * @brief Start playing an animation on an indicator
+         *
+         * It plays until it ends by itself, another animation is started, or the indicator's
+         * state is set.
+         */
+        inline void setIndicatorAnimation(const Indicator which,
+                const IndicatorAnimation &animation) {
+            this->sendIndicatorAnimation(which, &animation);
+        }
+        /**
+         * @brief Stop an indicator's animation, and return it to its last set state
+         */
+        inline void clearIndicatorAnimation(const Indicator which) {
+            this->sendIndicatorAnimation(which, nullptr);
+        }
+
     protected:
         void handleIncomingMessage(const PlCommon::Rpc::RpcHeader &header,
                 const struct cbor_item_t *message) override final;
 
     private:
+        void sendIndicatorAnimation(const Indicator which, const IndicatorAnimation *animation);
+
         void processUiEvent(const struct cbor_item_t *);
         void processUiTouchEvent(const struct cbor_item_t *);
         void processUiButtonEvent(const struct cbor_item_t *);
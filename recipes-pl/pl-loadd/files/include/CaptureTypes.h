@@ -0,0 +1,80 @@
+/**
+ * @file
+ *
+ * @brief Layout of rpmsg capture files
+ *
+ * loadd can capture the messages exchanged with the coprocessor into an in-memory ring, which is
+ * enabled and written out to a file via the `kRpcEndpointCapture` RPC endpoint. Capture files can
+ * then be replayed through the endpoint handlers offline.
+ *
+ * A capture file consists of a header, followed by records in the order they were captured. Each
+ * record is a record header, immediately followed by the message data; records aren't padded.
+ */
+#ifndef LOADD_CAPTURETYPES_H
+#define LOADD_CAPTURETYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Magic value identifying a capture file ('RCAP')
+#define kCaptureFileMagic 0x52434150
+/// Current capture file layout version
+#define kCaptureFileVersion 0x0100
+
+/**
+ * @brief Coprocessor channels that messages are captured on
+ */
+enum capture_channel {
+    /// Load control endpoint (pl.control)
+    kCaptureChannelControl              = 0x00,
+    /// confd endpoint
+    kCaptureChannelConfd                = 0x01,
+};
+
+/**
+ * @brief Direction of a captured message
+ */
+enum capture_direction {
+    /// Message received from the coprocessor
+    kCaptureFromRemote                  = 0x00,
+    /// Message sent to the coprocessor
+    kCaptureToRemote                    = 0x01,
+};
+
+/**
+ * @brief Capture file header
+ */
+struct capture_file_header {
+    /// magic value: kCaptureFileMagic
+    uint32_t magic;
+    /// file layout version: kCaptureFileVersion
+    uint16_t version;
+    /// size of this header, in bytes (offset to the first record)
+    uint16_t headerSize;
+
+    /// number of records in the file
+    uint32_t numRecords;
+    /// number of records that were lost because the capture ring overflowed
+    uint32_t numDropped;
+} __attribute__((packed));
+
+/**
+ * @brief Capture record header
+ */
+struct capture_record_header {
+    /// CLOCK_MONOTONIC timestamp at which the message was captured, in nanoseconds
+    uint64_t timestamp;
+    /// channel the message was captured on (a `capture_channel` value)
+    uint8_t channel;
+    /// direction of the message (a `capture_direction` value)
+    uint8_t direction;
+    /// number of bytes of message data following this header
+    uint16_t length;
+    /// original length of the message, if it was truncated; otherwise the same as `length`
+    uint16_t originalLength;
+
+    /// reserved, set to 0
+    uint16_t reserved;
+} __attribute__((packed));
+
+#endif
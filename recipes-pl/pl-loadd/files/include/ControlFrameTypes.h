@@ -0,0 +1,98 @@
+/**
+ * @file
+ *
+ * @brief Fixed layout binary frames on the load control endpoint
+ *
+ * High rate messages from the coprocessor (currently, measurement reports) are sent as packed
+ * binary frames rather than CBOR, so neither side has to encode or decode (and allocate) anything
+ * for them. A frame directly follows the `rpc_header`, which has the `kRpcFlagBinary` flag set;
+ * all other messages still carry a CBOR payload.
+ *
+ * Each frame begins with a version byte; a receiver must drop frames with a version it doesn't
+ * know. Fields may only be appended, in which case the version is bumped, and receivers should
+ * accept frames longer than they expect.
+ *
+ * This header is shared with the coprocessor firmware, and so must remain valid C. The layout is
+ * verified at compile time on both sides.
+ */
+#ifndef LOADD_CONTROLFRAMETYPES_H
+#define LOADD_CONTROLFRAMETYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "RpcTypes.h"
+
+#ifdef __cplusplus
+#define CONTROL_FRAME_ASSERT(cond, msg) static_assert(cond, msg)
+#else
+#define CONTROL_FRAME_ASSERT(cond, msg) _Static_assert(cond, msg)
+#endif
+
+/// Current binary frame version
+#define kControlFrameVersion 0x01
+
+/**
+ * @brief Load status bits
+ *
+ * Reported in the `status` field of each measurement frame.
+ */
+enum control_status_bits {
+    /// The load is enabled (sinking current)
+    kControlStatusEnabled               = (1 << 0),
+    /// Over current protection tripped
+    kControlStatusOverCurrent           = (1 << 1),
+    /// Over temperature protection tripped
+    kControlStatusOverTemperature       = (1 << 2),
+    /// Input voltage is below the undervoltage lockout threshold
+    kControlStatusUnderVoltage          = (1 << 3),
+};
+
+/**
+ * @brief Measurement report frame
+ *
+ * Sent by the coprocessor as a broadcast on `kRpcEndpointMeasurement`.
+ */
+struct control_measurement_frame {
+    /// frame version: kControlFrameVersion
+    uint8_t version;
+    /// reserved, set to 0
+    uint8_t reserved;
+    /// load status bits (see `control_status_bits`)
+    uint16_t status;
+    /// incremented for each measurement; gaps indicate lost frames
+    uint32_t sequence;
+
+    /// input voltage, in volts
+    float voltage;
+    /// input current, in amps
+    float current;
+    /// temperature, in °C
+    float temperature;
+} __attribute__((packed));
+
+/*
+ * Layout checks: these must hold for both the coprocessor and the host, since the frames are
+ * copied straight out of the message.
+ */
+CONTROL_FRAME_ASSERT(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+        "binary frames are little endian");
+CONTROL_FRAME_ASSERT(sizeof(float) == 4, "binary frames require 32-bit floats");
+CONTROL_FRAME_ASSERT(sizeof(struct rpc_header) == 8, "unexpected rpc_header size");
+
+CONTROL_FRAME_ASSERT(offsetof(struct control_measurement_frame, version) == 0,
+        "unexpected control_measurement_frame layout");
+CONTROL_FRAME_ASSERT(offsetof(struct control_measurement_frame, status) == 2,
+        "unexpected control_measurement_frame layout");
+CONTROL_FRAME_ASSERT(offsetof(struct control_measurement_frame, sequence) == 4,
+        "unexpected control_measurement_frame layout");
+CONTROL_FRAME_ASSERT(offsetof(struct control_measurement_frame, voltage) == 8,
+        "unexpected control_measurement_frame layout");
+CONTROL_FRAME_ASSERT(offsetof(struct control_measurement_frame, current) == 12,
+        "unexpected control_measurement_frame layout");
+CONTROL_FRAME_ASSERT(offsetof(struct control_measurement_frame, temperature) == 16,
+        "unexpected control_measurement_frame layout");
+CONTROL_FRAME_ASSERT(sizeof(struct control_measurement_frame) == 20,
+        "unexpected control_measurement_frame size");
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ * @file
+ *
+ * @brief Layout of the shared memory measurement ring
+ *
+ * loadd publishes measurements received from the coprocessor into a ring buffer in a memfd, which
+ * local clients can map (read-only) after retrieving it via the `kRpcEndpointMeasurementRing`
+ * RPC endpoint.
+ *
+ * The ring has a single producer (loadd) and any number of consumers. Each record carries a
+ * sequence number, which is zeroed while the record is being written, and set to its index plus
+ * one after. To read the record at index `n`, a consumer should:
+ *
+ * 1. Load the record's `sequence` (acquire); if it isn't `n + 1`, the record isn't available yet,
+ *    or has already been overwritten.
+ * 2. Copy out the record's data.
+ * 3. Issue an acquire fence, then load the record's `sequence` again; if it changed, the data is
+ *    torn and the reader has fallen behind by more than the ring capacity.
+ *
+ * The fence in step 3 is required: an acquire load on its own doesn't keep the loads of step 2
+ * from being performed after it, so on weakly ordered CPUs (such as ARM) a torn record could
+ * otherwise pass the check. `measurement_ring_read()` implements this protocol.
+ *
+ * The `writeIndex` field in the header is the index of the next record to be written; it is only
+ * advanced after that record has been completely written.
+ */
+#ifndef LOADD_MEASUREMENTRINGTYPES_H
+#define LOADD_MEASUREMENTRINGTYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/// Magic value identifying a measurement ring ('MRNG')
+#define kMeasurementRingMagic 0x4D524E47
+/// Current measurement ring layout version
+#define kMeasurementRingVersion 0x0100
+
+/**
+ * @brief Measurement ring header
+ *
+ * Located at the very start of the shared memory region, and immediately followed by the array of
+ * records.
+ */
+struct measurement_ring_header {
+    /// magic value: kMeasurementRingMagic
+    uint32_t magic;
+    /// ring layout version: kMeasurementRingVersion
+    uint16_t version;
+    /// size of this header, in bytes (offset to the first record)
+    uint16_t headerSize;
+
+    /// size of a single record, in bytes
+    uint32_t recordSize;
+    /// total number of records in the ring (always a power of two)
+    uint32_t capacity;
+
+    /// index of the next record to be written (accessed atomically)
+    uint64_t writeIndex;
+
+    /// reserved, set to 0
+    uint8_t reserved[40];
+} __attribute__((aligned(64)));
+
+/**
+ * @brief A single measurement record
+ */
+struct measurement_record {
+    /// record index plus one; 0 while the record is being written (accessed atomically)
+    uint64_t sequence;
+    /// time at which the measurement was received, in nanoseconds (CLOCK_MONOTONIC)
+    uint64_t timestamp;
+
+    /// input voltage, in volts
+    float voltage;
+    /// input current, in amps
+    float current;
+    /// temperature, in °C
+    float temperature;
+
+    /// load status bits (see `control_status_bits` in ControlFrameTypes.h; 0 if not reported)
+    uint32_t status;
+} __attribute__((aligned(8)));
+
+/**
+ * @brief Read a record from the ring
+ *
+ * Copy out the record at the given index, following the reader protocol described above.
+ *
+ * @param header Ring header, at the start of the mapped ring
+ * @param index Index of the record to read
+ * @param out Receives the record; its contents are undefined if the read fails
+ *
+ * @return 0 if the record was read, -1 if it isn't available (not yet written, or overwritten
+ *         before or while it was read)
+ */
+static inline int measurement_ring_read(const struct measurement_ring_header *header,
+        const uint64_t index, struct measurement_record *out) {
+    const uint8_t *base = (const uint8_t *) header + header->headerSize;
+    const struct measurement_record *slot = (const struct measurement_record *)
+        (base + (index & (header->capacity - 1)) * header->recordSize);
+
+    if(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != index + 1) {
+        return -1;
+    }
+
+    memcpy(out, slot, sizeof(*out));
+
+    // keep the copy above from being performed after the check below
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != index + 1) {
+        return -1;
+    }
+
+    return 0;
+}
+
+#endif
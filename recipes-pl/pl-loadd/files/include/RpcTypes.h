@@ -21,6 +21,8 @@
 enum rpc_flags {
     kRpcFlagReply                       = (1 << 0),
     kRpcFlagBroadcast                   = (1 << 1),
+    /// Payload is a fixed layout binary frame, rather than CBOR (see ControlFrameTypes.h)
+    kRpcFlagBinary                      = (1 << 2),
 };
 
 /**
@@ -54,7 +56,8 @@ struct rpc_header {
      * The following flags are defined:
      *
      * - (1 << 0): Set for replies to a previous request
-     * - (1 << 7): Indicates the message is a broadcast message
+     * - (1 << 1): Indicates the message is a broadcast message
+     * - (1 << 2): Payload is a binary frame rather than CBOR
      */
     uint8_t flags;
 
@@ -69,7 +72,81 @@ struct rpc_header {
  * @brief RPC message endpoints
  */
 enum rpc_endpoint {
-    // TODO: define message types
+    /// Does nothing; the payload (if any) is ignored
+    kRpcEndpointNoOp                    = 0x00,
+    /// Measurement broadcast (from the coprocessor)
+    kRpcEndpointMeasurement             = 0x10,
+    /**
+     * @brief Conflated measurement summary broadcast
+     *
+     * Sent (at the requested rate) to clients subscribed via `kRpcEndpointMeasurementSubscribe`
+     * in place of the individual measurement broadcasts. The payload is a map with the keys `n`
+     * (number of measurements aggregated), `t0` and `t1` (timestamps of the first and last of
+     * them, in nanoseconds) and `v`, `i` and `t` (voltage, current and temperature.) Each of the
+     * latter is a map with the keys `last`, `min`, `max` and `mean`.
+     */
+    kRpcEndpointMeasurementSummary      = 0x11,
+    /**
+     * @brief Coprocessor link state broadcast
+     *
+     * Sent when the coprocessor crashed (and its endpoints went away) and again once it has been
+     * recovered. The payload is a map with the key `up` (whether the link is up) and, once it
+     * came back up, `recoveryTime` (time taken to recover, in nanoseconds.)
+     */
+    kRpcEndpointLinkState               = 0x12,
+    /**
+     * @brief Retrieve the shared memory measurement ring
+     *
+     * The reply carries two file descriptors (as SCM_RIGHTS ancillary data): the memfd holding
+     * the ring, and an eventfd that's signalled whenever new measurements are published.
+     *
+     * @seeAlso MeasurementRingTypes.h
+     */
+    kRpcEndpointMeasurementRing         = 0x20,
+    /**
+     * @brief Lease a coprocessor channel
+     *
+     * Request payload is a map with the key `name`, the endpoint name of a retrievable channel.
+     * The reply carries the channel's rpmsg chrdev file descriptor as SCM_RIGHTS ancillary data.
+     * The lease is held until the client disconnects, at which point the channel is revoked.
+     */
+    kRpcEndpointRetrieveChannel         = 0x21,
+    /**
+     * @brief Retrieve message statistics
+     *
+     * Reply payload is a CBOR map with latency histogram percentiles, message sizes and rates,
+     * for each endpoint of the local RPC, rpmsg and confd message paths. The request payload may
+     * optionally be a map with the key `reset`; if true, all statistics are cleared after the
+     * snapshot is taken.
+     */
+    kRpcEndpointStats                   = 0x22,
+    /**
+     * @brief Control rpmsg message capture
+     *
+     * Request payload is a map with any of the following keys:
+     *
+     * - enable: If present, enables (true) or disables (false) capturing
+     * - clear: If true, discard all captured messages
+     * - write: If true, write the captured messages to a new file in the capture directory
+     *
+     * The reply is a map with the keys `enabled` and `records` (the number of captured messages)
+     * and, if a capture file was written, `path` with its path.
+     *
+     * @seeAlso CaptureTypes.h
+     */
+    kRpcEndpointCapture                 = 0x23,
+    /**
+     * @brief Subscribe to conflated measurement summaries
+     *
+     * Request payload is a map with the key `rate`, the rate (in Hz) at which summaries are
+     * delivered; if 0, a summary is delivered for every measurement. Subscribed clients no longer
+     * receive individual measurement broadcasts. Specifying the key `unsubscribe` (set to true)
+     * instead cancels the subscription.
+     *
+     * The reply is a map with the key `rate`, the effective delivery rate (0 for full rate, or
+     * if not subscribed.)
+     */
+    kRpcEndpointMeasurementSubscribe    = 0x24,
 };
 
 #endif
@@ -0,0 +1,142 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <plog/Log.h>
+
+#include "Capture.h"
+#include "Stats.h"
+
+std::atomic_bool Capture::gEnabled{false};
+std::mutex Capture::gLock;
+std::vector<Capture::Slot> Capture::gSlots;
+uint64_t Capture::gWriteIndex{0};
+
+/**
+ * @brief Enable or disable capturing
+ *
+ * The capture ring is allocated the first time capturing is enabled; it's retained (along with
+ * its records) when capturing is disabled again, so it can still be written out.
+ */
+void Capture::SetEnabled(const bool enabled) {
+    if(enabled) {
+        std::lock_guard lg(gLock);
+        if(gSlots.empty()) {
+            gSlots.resize(kNumSlots);
+        }
+    }
+
+    gEnabled = enabled;
+    PLOG_INFO << "rpmsg capture " << (enabled ? "enabled" : "disabled");
+}
+
+/**
+ * @brief Discard all captured records
+ */
+void Capture::Clear() {
+    std::lock_guard lg(gLock);
+    gWriteIndex = 0;
+}
+
+/**
+ * @brief Get the number of records currently held in the ring
+ */
+size_t Capture::GetNumRecords() {
+    std::lock_guard lg(gLock);
+    return std::min<uint64_t>(gWriteIndex, kNumSlots);
+}
+
+/**
+ * @brief Write a record into the ring
+ *
+ * If the ring is full, the oldest record is overwritten. Messages larger than a slot are
+ * truncated.
+ */
+void Capture::Append(const Channel channel, const Direction direction,
+        std::span<const std::byte> message) {
+    const auto length = std::min(message.size(), kMaxRecordData);
+    const auto now = Stats::Now();
+
+    std::lock_guard lg(gLock);
+    if(gSlots.empty()) {
+        return;
+    }
+
+    auto &slot = gSlots[gWriteIndex++ & (kNumSlots - 1)];
+
+    slot.hdr = {
+        .timestamp = now,
+        .channel = static_cast<uint8_t>(channel),
+        .direction = static_cast<uint8_t>(direction),
+        .length = static_cast<uint16_t>(length),
+        .originalLength = static_cast<uint16_t>(message.size()),
+        .reserved = 0,
+    };
+    memcpy(slot.data.data(), message.data(), length);
+}
+
+/**
+ * @brief Write all captured records to a file
+ *
+ * The records are copied out of the ring first, so capturing isn't held up by the file IO.
+ *
+ * @param path Path of the capture file to create (it's replaced if it exists)
+ */
+void Capture::WriteTo(const std::filesystem::path &path) {
+    std::vector<std::byte> out;
+    struct capture_file_header hdr{
+        .magic = kCaptureFileMagic,
+        .version = kCaptureFileVersion,
+        .headerSize = sizeof(struct capture_file_header),
+    };
+
+    out.resize(sizeof(hdr));
+
+    // copy out records, oldest first
+    {
+        std::lock_guard lg(gLock);
+
+        const uint64_t first = (gWriteIndex > kNumSlots) ? (gWriteIndex - kNumSlots) : 0;
+        hdr.numRecords = static_cast<uint32_t>(gWriteIndex - first);
+        hdr.numDropped = static_cast<uint32_t>(first);
+
+        for(uint64_t i = first; i < gWriteIndex; i++) {
+            const auto &slot = gSlots[i & (kNumSlots - 1)];
+            const auto hdrBytes = std::as_bytes(std::span{&slot.hdr, 1});
+
+            out.insert(out.end(), hdrBytes.begin(), hdrBytes.end());
+            out.insert(out.end(), slot.data.begin(), slot.data.begin() + slot.hdr.length);
+        }
+    }
+
+    memcpy(out.data(), &hdr, sizeof(hdr));
+
+    // then write them to the file
+    int fd = open(path.native().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "open capture file");
+    }
+
+    for(size_t written = 0; written < out.size();) {
+        const auto err = write(fd, out.data() + written, out.size() - written);
+        if(err == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+
+            close(fd);
+            throw std::system_error(errno, std::generic_category(), "write capture file");
+        }
+
+        written += err;
+    }
+
+    close(fd);
+
+    PLOG_INFO << "wrote " << hdr.numRecords << " captured messages to " << path.native()
+        << " (" << hdr.numDropped << " dropped)";
+}
@@ -0,0 +1,98 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include "CaptureTypes.h"
+
+/**
+ * @brief Binary capture of coprocessor messages
+ *
+ * Messages on the coprocessor channels are recorded into a ring of fixed size slots, with a
+ * timestamp and the channel and direction of the message. Capturing can be toggled at runtime;
+ * while it's off, recording a message costs only a single relaxed load.
+ *
+ * The ring can be written to a file (see CaptureTypes.h for its format), which can be fed back
+ * through the endpoint handlers with the replay tool.
+ *
+ * @remark Messages are captured on the rpmsg thread, while the capture is controlled from the RPC
+ *         thread; the ring is protected by a lock.
+ */
+class Capture {
+    public:
+        /// Channels that messages are captured on
+        enum class Channel: uint8_t {
+            Control                     = kCaptureChannelControl,
+            Confd                       = kCaptureChannelConfd,
+        };
+
+        /// Direction of a captured message
+        enum class Direction: uint8_t {
+            FromRemote                  = kCaptureFromRemote,
+            ToRemote                    = kCaptureToRemote,
+        };
+
+        /**
+         * @brief Is capturing enabled?
+         */
+        static inline bool IsEnabled() {
+            return gEnabled.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Capture a message, if capturing is enabled
+         *
+         * @param channel Channel the message was sent or received on
+         * @param direction Direction of the message
+         * @param message Complete message (including header)
+         */
+        static inline void Record(const Channel channel, const Direction direction,
+                std::span<const std::byte> message) {
+            if(IsEnabled()) {
+                Append(channel, direction, message);
+            }
+        }
+
+        static void SetEnabled(const bool enabled);
+        static void Clear();
+        static size_t GetNumRecords();
+
+        static void WriteTo(const std::filesystem::path &path);
+
+    private:
+        static void Append(const Channel channel, const Direction direction,
+                std::span<const std::byte> message);
+
+    private:
+        /// Maximum number of message bytes stored per record (the rpmsg payload limit)
+        constexpr static const size_t kMaxRecordData{496};
+        /// Number of records in the ring (must be a power of two)
+        constexpr static const size_t kNumSlots{2048};
+
+        /**
+         * @brief A single record in the capture ring
+         */
+        struct Slot {
+            struct capture_record_header hdr;
+            std::array<std::byte, kMaxRecordData> data;
+        };
+
+        /// Whether messages are currently captured
+        static std::atomic_bool gEnabled;
+
+        /// Protects the ring
+        static std::mutex gLock;
+        /// Capture ring (allocated when capturing is first enabled)
+        static std::vector<Slot> gSlots;
+        /// Total number of records written to the ring since it was last cleared
+        static uint64_t gWriteIndex;
+};
+
+#endif
@@ -0,0 +1,106 @@
+#include <cstring>
+
+#include <plog/Log.h>
+
+#include "ConfdCache.h"
+#include "RpcTypes.h"
+
+/**
+ * @brief Look up the reply to a query
+ *
+ * @param request Complete query message (including header)
+ *
+ * @return A copy of the cached reply, with its tag set to that of the request; or nothing if
+ *         the query isn't in the cache.
+ */
+std::optional<std::vector<std::byte>> ConfdCache::lookup(std::span<const std::byte> request) {
+    auto it = this->entries.find(MakeKey(request));
+    if(it == this->entries.end()) {
+        this->misses++;
+        return std::nullopt;
+    }
+
+    this->hits++;
+
+    std::vector<std::byte> reply(it->second);
+    auto replyHdr = reinterpret_cast<struct rpc_header *>(reply.data());
+    replyHdr->tag = reinterpret_cast<const struct rpc_header *>(request.data())->tag;
+
+    return reply;
+}
+
+/**
+ * @brief Note that a query is being forwarded to confd
+ *
+ * Its reply (matched by tag) will be stored in the cache when it arrives.
+ *
+ * @param request Complete query message (including header)
+ */
+void ConfdCache::expect(std::span<const std::byte> request) {
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(request.data());
+
+    this->pending[hdr->tag] = PendingFill{
+        .key = MakeKey(request),
+        .generation = this->generation,
+    };
+}
+
+/**
+ * @brief Handle a reply from confd
+ *
+ * If the reply is for a query we're expecting, store it; unless the cache has been invalidated
+ * since the query was forwarded, since the reply may then be stale.
+ *
+ * @param reply Complete reply message (including header)
+ *
+ * @return Whether the reply was stored in the cache
+ */
+bool ConfdCache::fill(std::span<const std::byte> reply) {
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(reply.data());
+
+    auto &slot = this->pending[hdr->tag];
+    if(!slot) {
+        return false;
+    }
+
+    auto fill = std::move(*slot);
+    slot.reset();
+
+    if(fill.generation != this->generation || this->entries.size() >= kMaxEntries) {
+        return false;
+    }
+
+    this->entries.insert_or_assign(std::move(fill.key),
+            std::vector<std::byte>(reply.begin(), reply.end()));
+    return true;
+}
+
+/**
+ * @brief Discard all cached replies
+ *
+ * Replies to queries that are currently outstanding won't be cached either.
+ */
+void ConfdCache::invalidate() {
+    if(!this->entries.empty()) {
+        PLOG_DEBUG << "invalidating " << this->entries.size() << " cached confd replies";
+    }
+
+    this->entries.clear();
+    this->generation++;
+}
+
+/**
+ * @brief Build the cache key for a query
+ *
+ * It consists of the query's endpoint, followed by its payload.
+ */
+std::string ConfdCache::MakeKey(std::span<const std::byte> message) {
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(message.data());
+    const auto payload = message.subspan(sizeof(struct rpc_header));
+
+    std::string key(1 + payload.size(), '\0');
+    key[0] = static_cast<char>(hdr->endpoint);
+    memcpy(key.data() + 1, payload.data(), payload.size());
+
+    return key;
+}
@@ -0,0 +1,69 @@
+#ifndef CONFDCACHE_H
+#define CONFDCACHE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct rpc_header;
+
+/**
+ * @brief Read-through cache of confd query replies
+ *
+ * Replies to configuration queries made by the M4 are cached, keyed by the query's endpoint and
+ * payload; repeated queries can then be answered without a round trip to confd. The cache doesn't
+ * interpret the queries: any change notification from confd (or write made through us)
+ * invalidates it entirely, as config changes are rare compared to reads.
+ *
+ * @remark This is only accessed from the rpmsg thread.
+ */
+class ConfdCache {
+    public:
+        std::optional<std::vector<std::byte>> lookup(std::span<const std::byte> request);
+        void expect(std::span<const std::byte> request);
+        bool fill(std::span<const std::byte> reply);
+        void invalidate();
+
+        /// Number of queries answered from the cache
+        constexpr inline auto getHits() const {
+            return this->hits;
+        }
+        /// Number of queries that had to be forwarded to confd
+        constexpr inline auto getMisses() const {
+            return this->misses;
+        }
+
+    private:
+        static std::string MakeKey(std::span<const std::byte> message);
+
+    private:
+        /// Maximum number of cached replies; further replies aren't cached until invalidated
+        constexpr static const size_t kMaxEntries{256};
+
+        /**
+         * @brief A query whose reply is to be cached
+         */
+        struct PendingFill {
+            /// Cache key of the query
+            std::string key;
+            /// Cache generation at the time the query was forwarded
+            uint32_t generation;
+        };
+
+        /// Cached reply messages, keyed by query
+        std::unordered_map<std::string, std::vector<std::byte>> entries;
+        /// Queries forwarded to confd, indexed by tag
+        std::array<std::optional<PendingFill>, 256> pending;
+        /// Incremented on every invalidation, so that replies to older queries aren't cached
+        uint32_t generation{0};
+
+        /// Number of cache hits and misses
+        size_t hits{0}, misses{0};
+};
+
+#endif
@@ -1,9 +1,13 @@
 #include <unistd.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <sys/socket.h>
 
+#include <algorithm>
 #include <cerrno>
+#include <cstring>
 #include <system_error>
+#include <utility>
 
 #include <event2/event.h>
 #include <event2/buffer.h>
@@ -11,21 +15,32 @@
 #include <fmt/format.h>
 #include <plog/Log.h>
 
+#include "Capture.h"
 #include "ConfdEpHandler.h"
+#include "Config.h"
 #include "Coprocessor.h"
 #include "RpcServer.h"
 #include "RpcTypes.h"
+#include "RpmsgLoop.h"
+#include "Stats.h"
 
 /**
  * @brief Initialize the confd endpoint handler
  *
- * Open a client connection to the confd daemon, then prepare buffer events for reading from both
- * channels which will forward the data to the other end.
+ * Prepare buffer events for reading from both channels which will forward the data to the other
+ * end, then start connecting to the confd daemon. Messages from the M4 are queued until the
+ * connection is established.
+ *
+ * @param fd rpmsg channel file descriptor
+ * @param loop Run loop to handle the channel on
+ * @param lrpc Local RPC server
+ * @param confdFd Connected confd socket to use (the handler takes ownership) or -1 to dial confd
  */
-ConfdEpHandler::ConfdEpHandler(const int fd, const std::shared_ptr<RpcServer> &lrpc) :
-    Coprocessor::EndpointHandler(fd), lrpc(lrpc) {
+ConfdEpHandler::ConfdEpHandler(const int fd, RpmsgLoop &loop,
+        const std::shared_ptr<RpcServer> &lrpc, const int confdFd) :
+        Coprocessor::EndpointHandler(fd), lrpc(lrpc) {
     int err;
-    auto evbase = lrpc->getEvBase();
+    auto evbase = loop.getEvBase();
 
     // send an empty message to notify rpmsg channel we're alive
     struct rpc_header hdr{
@@ -37,17 +52,26 @@ ConfdEpHandler::ConfdEpHandler(const int fd, const std::shared_ptr<RpcServer> &l
         throw std::system_error(errno, std::generic_category(), "write confd wake-up packet");
     }
 
-    // establish confd connection and create a read event
-    this->confdSocket = this->connectToConfd();
-    PLOG_VERBOSE << "confd client socket: " << this->confdSocket;
+    // create the confd bufferevent; the socket is created when connecting, unless provided
+    if(confdFd != -1 && evutil_make_socket_nonblocking(confdFd) == -1) {
+        close(confdFd);
+        throw std::system_error(errno, std::generic_category(),
+                "evutil_make_socket_nonblocking (confd)");
+    }
 
-    this->confdBev = bufferevent_socket_new(evbase, this->confdSocket, 0);
+    this->confdBev = bufferevent_socket_new(evbase, confdFd, BEV_OPT_CLOSE_ON_FREE);
     if(!this->confdBev) {
+        if(confdFd != -1) {
+            close(confdFd);
+        }
         throw std::runtime_error("failed to create bufferevent (confd)");
     }
+    this->isConfdFdProvided = (confdFd != -1);
 
     bufferevent_setwatermark(this->confdBev, EV_READ, sizeof(struct rpc_header),
             EV_RATE_LIMIT_MAX);
+    // write callback fires once the output drains enough to resume reading from rpmsg
+    bufferevent_setwatermark(this->confdBev, EV_WRITE, kLowWatermark, 0);
 
     bufferevent_setcb(this->confdBev, [](auto bev, auto ctx) {
         try {
@@ -56,7 +80,13 @@ ConfdEpHandler::ConfdEpHandler(const int fd, const std::shared_ptr<RpcServer> &l
             PLOG_ERROR << "Failed to handle confd read: " << e.what();
             // TODO: abort program
         }
-    }, nullptr, [](auto bev, auto what, auto ctx) {
+    }, [](auto bev, auto ctx) {
+        try {
+            reinterpret_cast<ConfdEpHandler *>(ctx)->handleConfdWrite(bev);
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "Failed to handle confd write: " << e.what();
+        }
+    }, [](auto bev, auto what, auto ctx) {
         try {
             reinterpret_cast<ConfdEpHandler *>(ctx)->handleConfdEvent(bev, what);
         } catch(const std::exception &e) {
@@ -65,6 +95,33 @@ ConfdEpHandler::ConfdEpHandler(const int fd, const std::shared_ptr<RpcServer> &l
         }
     }, this);
 
+    // track how much of the output buffer has been written, to find unsent messages on disconnect
+    auto confdOut = bufferevent_get_output(this->confdBev);
+    if(!evbuffer_add_cb(confdOut, [](auto, auto info, auto ctx) {
+        if(info->n_deleted) {
+            reinterpret_cast<ConfdEpHandler *>(ctx)->handleConfdDrained(info->n_deleted);
+        }
+    }, this)) {
+        throw std::runtime_error("failed to add confd output buffer callback");
+    }
+
+    // set up reconnection timer and the queue for messages while disconnected
+    this->reconnectEvent = evtimer_new(evbase, [](auto, auto, auto ctx) {
+        try {
+            reinterpret_cast<ConfdEpHandler *>(ctx)->beginConnect();
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "Failed to reconnect to confd: " << e.what();
+        }
+    }, this);
+    if(!this->reconnectEvent) {
+        throw std::runtime_error("failed to allocate confd reconnect event");
+    }
+
+    this->pendingBuf = evbuffer_new();
+    if(!this->pendingBuf) {
+        throw std::runtime_error("failed to allocate confd pending buffer");
+    }
+
     // create event for the rpmsg channel
     err = evutil_make_socket_nonblocking(fd);
     if(err == -1) {
@@ -88,87 +145,209 @@ ConfdEpHandler::ConfdEpHandler(const int fd, const std::shared_ptr<RpcServer> &l
             // TODO: abort program
         }
     }, nullptr, [](auto bev, auto what, auto ctx) {
-        PLOG_ERROR << "rpmsg event (unhandled): " << what;
+        if(what & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+            PLOG_WARNING << "rpmsg channel hung up: " << what;
+            reinterpret_cast<ConfdEpHandler *>(ctx)->notifyLinkDown();
+        } else {
+            PLOG_ERROR << "rpmsg event (unhandled): " << what;
+        }
     }, this);
 
-    // add events to rpc server's run loop
-    err = bufferevent_enable(this->confdBev, EV_READ);
-    if(err == -1) {
-        throw std::runtime_error("failed to enable bufferevent (confd)");
+    /*
+     * Messages to the M4 are written by us rather than by the bufferevent, since it would merge
+     * several messages into a single rpmsg message. They're queued in a separate buffer, and we
+     * wait for the chrdev to become writable if it would block.
+     */
+    this->rpmsgTxBuf = evbuffer_new();
+    if(!this->rpmsgTxBuf) {
+        throw std::runtime_error("failed to allocate rpmsg transmit buffer");
     }
+
+    this->rpmsgWriteEvent = event_new(evbase, fd, EV_WRITE, [](auto, auto, auto ctx) {
+        try {
+            reinterpret_cast<ConfdEpHandler *>(ctx)->flushRpmsg();
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "Failed to write rpmsg: " << e.what();
+        }
+    }, this);
+    if(!this->rpmsgWriteEvent) {
+        throw std::runtime_error("failed to allocate rpmsg write event");
+    }
+
+    // add events to the rpmsg run loop (confd is enabled once connected)
     err = bufferevent_enable(this->rpmsgBev, EV_READ);
     if(err == -1) {
         throw std::runtime_error("failed to enable bufferevent (rpmsg)");
     }
+    bufferevent_disable(this->rpmsgBev, EV_WRITE);
+
+    if(this->isConfdFdProvided) {
+        this->handleConfdConnected();
+    } else {
+        this->beginConnect();
+    }
 }
 
 /**
- * @brief Establish connection to confd
+ * @brief Clean up the handler
  *
- * @return File descriptor for a domain socket connected to confd daemon
+ * Close the confd client connection and remove all associated libevent resources.
  */
-int ConfdEpHandler::connectToConfd() {
-    int fd, err;
-
-    // TODO: read the path from config
-    constexpr static const std::string_view kSocketPath{"/var/run/confd/rpc.sock"};
+ConfdEpHandler::~ConfdEpHandler() {
+    PLOG_DEBUG << "confd cache: " << this->cache.getHits() << " hits, "
+        << this->cache.getMisses() << " misses";
 
-    // create the socket
-    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
-    if(fd == -1) {
-        throw std::system_error(errno, std::generic_category(), "create confd socket");
+    // release memory
+    if(this->confdBev) {
+        bufferevent_free(this->confdBev);
+    }
+    if(this->rpmsgBev) {
+        bufferevent_free(this->rpmsgBev);
+    }
+    if(this->rpmsgWriteEvent) {
+        event_free(this->rpmsgWriteEvent);
+    }
+    if(this->rpmsgTxBuf) {
+        evbuffer_free(this->rpmsgTxBuf);
+    }
+    if(this->reconnectEvent) {
+        event_free(this->reconnectEvent);
     }
+    if(this->pendingBuf) {
+        evbuffer_free(this->pendingBuf);
+    }
+}
+
+
+
+/**
+ * @brief Start connecting to confd
+ *
+ * The connection is made asynchronously; once it completes (or fails) the confd event callback
+ * is invoked.
+ */
+void ConfdEpHandler::beginConnect() {
+    const auto &path = Config::GetConfdSocketPath();
 
     struct sockaddr_un addr;
     memset(&addr, 0, sizeof(addr));
     addr.sun_family = AF_UNIX;
 
-    strncpy(addr.sun_path, kSocketPath.data(), sizeof(addr.sun_path) - 1);
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    this->confdState = ConfdState::Connecting;
 
-    // dial it
-    err = connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+    const auto err = bufferevent_socket_connect(this->confdBev,
+            reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
     if(err == -1) {
-        close(fd);
-        throw std::system_error(errno, std::generic_category(), "dial confd socket");
+        // failed immediately (for example, the socket doesn't exist yet) so try again later
+        PLOG_VERBOSE << "failed to dial confd";
+
+        this->confdState = ConfdState::Disconnected;
+        this->scheduleReconnect();
     }
+}
 
-    // mark the socket to use non-blocking IO (for libevent)
-    err = evutil_make_socket_nonblocking(fd);
-    if(err == -1) {
-        close(fd);
-        throw std::system_error(errno, std::generic_category(),
-                "evutil_make_socket_nonblocking (confd)");
+/**
+ * @brief Connection to confd was established
+ *
+ * Replay all messages that were queued while we were disconnected, in order, then start
+ * reading from confd.
+ */
+void ConfdEpHandler::handleConfdConnected() {
+    PLOG_INFO << "connected to confd (fd " << bufferevent_getfd(this->confdBev) << "), "
+        << this->numPending << " message(s) queued";
+
+    this->confdState = ConfdState::Connected;
+    this->reconnectDelay = kReconnectMinDelay;
+
+    this->subscribeToChanges();
+
+    struct rpc_header hdr;
+    while(PeekMessage(this->pendingBuf, hdr)) {
+        this->forwardToConfd(this->pendingBuf, hdr);
+    }
+    this->numPending = 0;
+
+    // unless the M4 is still behind on replies, start reading from confd
+    if(evbuffer_get_length(this->rpmsgTxBuf) < kHighWatermark) {
+        bufferevent_enable(this->confdBev, EV_READ);
     }
+    bufferevent_enable(this->confdBev, EV_WRITE);
 
-    // it's been connected :D
-    return fd;
+    // forward anything that arrived while connecting (and apply backpressure if needed)
+    this->handleRpmsgRead(this->rpmsgBev);
 }
 
 /**
- * @brief Clean up the handler
+ * @brief Connection to confd was lost (or could not be established)
  *
- * Close the confd client connection and remove all associated libevent resources.
+ * Close the socket and discard any partially received replies. Requests that had not been
+ * entirely written to confd are moved back into the pending queue, to be replayed once we've
+ * reconnected; the remainder of a partially written request can't be recovered, so it's dropped.
  */
-ConfdEpHandler::~ConfdEpHandler() {
-    // remove events (if RPC server is still alive)
-    if(auto ptr = lrpc.lock()) {
-        PLOG_DEBUG << "removing events";
-
-        (void) ptr;
+void ConfdEpHandler::handleConfdDisconnected() {
+    const auto fd = bufferevent_getfd(this->confdBev);
+    bufferevent_disable(this->confdBev, EV_READ | EV_WRITE);
+    bufferevent_setfd(this->confdBev, -1);
+    if(fd != -1) {
+        close(fd);
     }
 
-    // release memory
-    if(this->confdBev) {
-        bufferevent_free(this->confdBev);
+    auto input = bufferevent_get_input(this->confdBev);
+    evbuffer_drain(input, evbuffer_get_length(input));
+
+    // take the in flight lengths first; moving messages out invokes the drain callback
+    auto output = bufferevent_get_output(this->confdBev);
+    auto inflight = std::move(this->inflightLengths);
+    const auto headWritten = std::exchange(this->inflightHeadWritten, 0);
+    this->inflightLengths.clear();
+
+    if(headWritten && !inflight.empty()) {
+        PLOG_WARNING << "dropping partially written confd message";
+        evbuffer_drain(output, inflight.front() - headWritten);
+        inflight.pop_front();
+        this->numDropped++;
     }
-    if(this->rpmsgBev) {
-        bufferevent_free(this->rpmsgBev);
+
+    this->numPending += inflight.size();
+    evbuffer_prepend_buffer(this->pendingBuf, output);
+    this->trimPending();
+
+    this->confdState = ConfdState::Disconnected;
+    this->subscribeTag.reset();
+
+    // resume reading from the M4 if confd was throttling us; messages get queued in the meantime
+    if(!(bufferevent_get_enabled(this->rpmsgBev) & EV_READ)) {
+        bufferevent_enable(this->rpmsgBev, EV_READ);
+        this->handleRpmsgRead(this->rpmsgBev);
     }
 
-    // close sockets
-    if(this->confdSocket != -1) {
-        close(this->confdSocket);
+    this->scheduleReconnect();
+}
+
+/**
+ * @brief Arm the reconnect timer
+ *
+ * The delay doubles with every attempt, up to a maximum; it's reset once a connection succeeds.
+ * A provided confd socket can't be dialed again, so messages stay queued if it's lost.
+ */
+void ConfdEpHandler::scheduleReconnect() {
+    if(this->isConfdFdProvided) {
+        PLOG_WARNING << "lost provided confd socket, not reconnecting";
+        return;
     }
+
+    const auto delay = this->reconnectDelay;
+    PLOG_DEBUG << "reconnecting to confd in " << delay.count() << " ms";
+
+    struct timeval tv{
+        .tv_sec  = static_cast<time_t>(delay.count() / 1000),
+        .tv_usec = static_cast<suseconds_t>((delay.count() % 1000) * 1000),
+    };
+    evtimer_add(this->reconnectEvent, &tv);
+
+    this->reconnectDelay = std::min(delay * 2, kReconnectMaxDelay);
 }
 
 
@@ -176,91 +355,431 @@ ConfdEpHandler::~ConfdEpHandler() {
 /**
  * @brief Handles data available to read on the confd client connection
  *
- * Read all of the data in the confd client buffer and transmit it to the rpmsg connection.
+ * Move each complete message in the confd input buffer (which is a stream) to the rpmsg transmit
+ * queue, then try to send them. Partial messages are left in the input buffer until the rest of
+ * the message arrives.
  */
 void ConfdEpHandler::handleConfdRead(struct bufferevent *bev) {
-    int err;
-
-    // pull it out and into our read buffer
+    const auto start = Stats::Now();
     auto buf = bufferevent_get_input(bev);
-    const size_t pending = evbuffer_get_length(buf);
 
-    this->confdRxBuf.resize(pending);
-    int read = evbuffer_remove(buf, static_cast<void *>(this->confdRxBuf.data()), pending);
+    struct rpc_header hdr;
+    while(PeekMessage(buf, hdr)) {
+        if(kDumpConfdPackets) {
+            DumpPacket(">>> confd", {reinterpret_cast<const std::byte *>(
+                        evbuffer_pullup(buf, hdr.length)), hdr.length});
+        }
 
-    if(read == -1) {
-        throw std::runtime_error("failed to drain confd read buffer");
-    }
+        if(this->filterConfdMessage(buf, hdr)) {
+            continue;
+        }
+
+        const int moved = evbuffer_remove_buffer(buf, this->rpmsgTxBuf, hdr.length);
+        if(moved != static_cast<int>(hdr.length)) {
+            throw std::runtime_error("failed to move confd->m4 message");
+        }
+
+        // update stats; if this is a reply to a request we forwarded, record the round trip too
+        Stats::RecordSince(Stats::Source::ConfdReply, hdr.endpoint, start, hdr.length);
 
-    if(kDumpRpmsgPackets) {
-        DumpPacket(">>> confd", this->confdRxBuf);
+        if(auto &requestStart = this->requestStart[hdr.tag]) {
+            Stats::RecordSince(Stats::Source::ConfdRoundTrip, hdr.endpoint, requestStart,
+                    hdr.length);
+            requestStart = 0;
+        }
     }
 
-    // send it (TODO: why can't we write using bufferevent?)
-    err = write(this->remoteEp, this->confdRxBuf.data(), this->confdRxBuf.size());
-    if(err < 0) {
-        throw std::runtime_error("failed to write confd->m4 message");
+    this->flushRpmsg();
+}
+
+/**
+ * @brief The confd output buffer has drained below the low watermark
+ *
+ * If we stopped reading from the rpmsg endpoint because confd wasn't keeping up, resume.
+ */
+void ConfdEpHandler::handleConfdWrite(struct bufferevent *) {
+    if(bufferevent_get_enabled(this->rpmsgBev) & EV_READ) {
+        return;
     }
+
+    bufferevent_enable(this->rpmsgBev, EV_READ);
+
+    // process any messages that were already read while we were throttled
+    this->handleRpmsgRead(this->rpmsgBev);
 }
 
 /**
  * @brief Handle an event occurring on the confd socket
  */
-void ConfdEpHandler::handleConfdEvent(struct bufferevent *bev, const uintptr_t flags) {
+void ConfdEpHandler::handleConfdEvent(struct bufferevent *, const uintptr_t flags) {
+    if(flags & BEV_EVENT_CONNECTED) {
+        this->handleConfdConnected();
+        return;
+    } else if(!(flags & (BEV_EVENT_EOF | BEV_EVENT_ERROR))) {
+        return;
+    }
+
+    // failed connection attempt
+    if(this->confdState == ConfdState::Connecting) {
+        PLOG_VERBOSE << "failed to connect to confd: flags=" << flags;
+    }
     // connection closed
-    if(flags & BEV_EVENT_EOF) {
+    else if(flags & BEV_EVENT_EOF) {
         PLOG_WARNING << "confd closed connection :(";
-
-        this->needsNewSocket = true;
-        this->confdSocket = 0;
     }
     // IO error
-    else if(flags & BEV_EVENT_ERROR) {
+    else {
         PLOG_WARNING << "confd io error: flags=" << flags;
     }
 
+    this->handleConfdDisconnected();
 }
 
 /**
  * @brief Handles data available to read on the rpmsg endpoint
  *
- * All data available to read is pushed to the confd socket.
+ * Move all complete messages from the rpmsg input buffer to the confd output buffer, without
+ * copying them. If confd isn't keeping up with the messages, we stop reading from the rpmsg
+ * endpoint until its output buffer drains.
+ *
+ * While not connected to confd, messages are instead moved to the pending queue.
  */
 void ConfdEpHandler::handleRpmsgRead(struct bufferevent *bev) {
-    int err{0};
-
+    const auto start = Stats::Now();
     auto buf = bufferevent_get_input(bev);
-    const size_t pending = evbuffer_get_length(buf);
+    const bool isConnected = (this->confdState == ConfdState::Connected);
+    bool hasCachedReplies{false};
+
+    // forward messages
+    struct rpc_header hdr;
+    while(PeekMessage(buf, hdr)) {
+        if(kDumpRpmsgPackets) {
+            DumpPacket(">>> rpmsg", {reinterpret_cast<const std::byte *>(
+                        evbuffer_pullup(buf, hdr.length)), hdr.length});
+        }
+        if(Capture::IsEnabled()) {
+            Capture::Record(Capture::Channel::Confd, Capture::Direction::FromRemote,
+                    {reinterpret_cast<const std::byte *>(evbuffer_pullup(buf, hdr.length)),
+                    hdr.length});
+        }
+
+        Stats::RecordSince(Stats::Source::ConfdRpmsg, hdr.endpoint, start, hdr.length);
+
+        if(this->handleCachedQuery(buf, hdr, start)) {
+            hasCachedReplies = true;
+            continue;
+        }
+
+        this->requestStart[hdr.tag] = start;
+
+        if(isConnected) {
+            this->forwardToConfd(buf, hdr);
+        } else {
+            this->queuePending(buf, hdr);
+        }
+    }
+
+    if(hasCachedReplies) {
+        this->flushRpmsg();
+    }
+
+    // apply backpressure if confd is slow
+    if(isConnected && evbuffer_get_length(bufferevent_get_output(this->confdBev)) >=
+            kHighWatermark) {
+        bufferevent_disable(bev, EV_READ);
+    }
+}
+
+/**
+ * @brief Move a message to the confd output buffer
+ *
+ * @param buf Buffer that starts with the message
+ * @param hdr Header of the message
+ */
+void ConfdEpHandler::forwardToConfd(struct evbuffer *buf, const struct rpc_header &hdr) {
+    const int moved = evbuffer_remove_buffer(buf, bufferevent_get_output(this->confdBev),
+            hdr.length);
+    if(moved != static_cast<int>(hdr.length)) {
+        throw std::runtime_error("failed to move m4->confd message");
+    }
+
+    this->inflightLengths.push_back(hdr.length);
+}
+
+/**
+ * @brief Hold a message until we're connected to confd
+ *
+ * If the queue is full, the oldest message is dropped.
+ *
+ * @param buf Buffer that starts with the message
+ * @param hdr Header of the message
+ */
+void ConfdEpHandler::queuePending(struct evbuffer *buf, const struct rpc_header &hdr) {
+    const int moved = evbuffer_remove_buffer(buf, this->pendingBuf, hdr.length);
+    if(moved != static_cast<int>(hdr.length)) {
+        throw std::runtime_error("failed to queue m4->confd message");
+    }
+
+    this->numPending++;
+    this->trimPending();
+}
+
+/**
+ * @brief Drop the oldest pending messages until the queue is within its size limit
+ */
+void ConfdEpHandler::trimPending() {
+    struct rpc_header hdr;
 
-    this->rpmsgRxBuf.resize(pending);
-    int read = evbuffer_remove(buf, static_cast<void *>(this->rpmsgRxBuf.data()), pending);
+    while(this->numPending > kMaxPendingMessages && PeekMessage(this->pendingBuf, hdr)) {
+        evbuffer_drain(this->pendingBuf, hdr.length);
+        this->numPending--;
+        this->numDropped++;
 
-    if(read == -1) {
-        throw std::runtime_error("failed to drain confd read buffer");
+        PLOG_WARNING << "confd pending queue full, dropped message (" << this->numDropped
+            << " total)";
     }
+}
 
-    if(kDumpRpmsgPackets) {
-        DumpPacket(">>> rpmsg", this->rpmsgRxBuf);
+/**
+ * @brief Bytes were removed from the confd output buffer
+ *
+ * Advance past all in flight messages that have been written entirely.
+ *
+ * @param bytes Number of bytes removed
+ */
+void ConfdEpHandler::handleConfdDrained(const size_t bytes) {
+    size_t written{bytes + this->inflightHeadWritten};
+
+    while(!this->inflightLengths.empty() && written >= this->inflightLengths.front()) {
+        written -= this->inflightLengths.front();
+        this->inflightLengths.pop_front();
     }
 
-    // re-create confd socket if needed
-    bool yes{true}, no{false};
-    if(this->needsNewSocket.compare_exchange_strong(yes, no)) {
-        // make the socket…
-        this->confdSocket = this->connectToConfd();
-        PLOG_VERBOSE << "re-created confd client socket: " << this->confdSocket;
+    this->inflightHeadWritten = this->inflightLengths.empty() ? 0 : written;
+}
 
-        // …and replace it on the bufevent
-        err = bufferevent_setfd(this->confdBev, this->confdSocket);
-        if(err) {
-            throw std::runtime_error("bufferevent_setfd failed");
+/**
+ * @brief Send messages queued for the rpmsg endpoint
+ *
+ * Each message must be written to the rpmsg chrdev with a single write, as each write produces
+ * exactly one rpmsg message; so the message is gathered with `writev` straight out of the queue's
+ * memory. If the endpoint would block, we wait for it to become writable again.
+ *
+ * While the queue is above the high watermark, we stop reading from confd.
+ */
+void ConfdEpHandler::flushRpmsg() {
+    struct rpc_header hdr;
+    std::array<struct evbuffer_iovec, kMaxSegments> iov;
+
+    while(PeekMessage(this->rpmsgTxBuf, hdr)) {
+        int segments = evbuffer_peek(this->rpmsgTxBuf, hdr.length, nullptr, iov.data(),
+                iov.size());
+        if(segments > static_cast<int>(iov.size())) {
+            // too fragmented, make it contiguous
+            evbuffer_pullup(this->rpmsgTxBuf, hdr.length);
+            segments = evbuffer_peek(this->rpmsgTxBuf, hdr.length, nullptr, iov.data(),
+                    iov.size());
         }
+
+        // the last segment may extend past the end of this message
+        size_t remaining{hdr.length};
+        for(int i = 0; i < segments; i++) {
+            iov[i].iov_len = std::min(iov[i].iov_len, remaining);
+            remaining -= iov[i].iov_len;
+        }
+
+        const auto written = writev(this->remoteEp, reinterpret_cast<struct iovec *>(iov.data()),
+                segments);
+        if(written == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                event_add(this->rpmsgWriteEvent, nullptr);
+                break;
+            } else if(errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "write confd->m4 message");
+        }
+
+        if(Capture::IsEnabled()) {
+            Capture::Record(Capture::Channel::Confd, Capture::Direction::ToRemote,
+                    {reinterpret_cast<const std::byte *>(evbuffer_pullup(this->rpmsgTxBuf,
+                        hdr.length)), hdr.length});
+        }
+        evbuffer_drain(this->rpmsgTxBuf, hdr.length);
     }
 
-    // send it
-    err = bufferevent_write(this->confdBev, this->rpmsgRxBuf.data(), pending);
+    // throttle reading from confd if the M4 isn't keeping up
+    const auto pending = evbuffer_get_length(this->rpmsgTxBuf);
+    const bool isReading = bufferevent_get_enabled(this->confdBev) & EV_READ;
+
+    if(isReading && pending >= kHighWatermark) {
+        bufferevent_disable(this->confdBev, EV_READ);
+    } else if(!isReading && pending <= kLowWatermark &&
+            this->confdState == ConfdState::Connected) {
+        bufferevent_enable(this->confdBev, EV_READ);
 
-    if(err != 0) {
-        throw std::runtime_error("failed to write confd->m4 message");
+        // process any messages that were already read while we were throttled
+        if(evbuffer_get_length(bufferevent_get_input(this->confdBev))) {
+            this->handleConfdRead(this->confdBev);
+        }
     }
 }
+
+
+
+/**
+ * @brief Subscribe to confd change notifications
+ *
+ * Since changes may have been missed while we weren't connected, the cache is invalidated too.
+ * The request uses a tag that no outstanding M4 request is using, so we can pick out its reply.
+ */
+void ConfdEpHandler::subscribeToChanges() {
+    if(!Config::GetConfdCacheEnabled()) {
+        return;
+    }
+
+    this->cache.invalidate();
+
+    uint8_t tag{0xFF};
+    while(tag && this->requestStart[tag]) {
+        tag--;
+    }
+
+    const struct rpc_header hdr{
+        .version = kRpcVersionLatest,
+        .length = sizeof(rpc_header),
+        .endpoint = Config::GetConfdSubscribeEndpoint(),
+        .tag = tag,
+    };
+
+    if(evbuffer_add(bufferevent_get_output(this->confdBev), &hdr, sizeof(hdr))) {
+        throw std::runtime_error("failed to queue confd subscribe request");
+    }
+
+    this->inflightLengths.push_back(sizeof(hdr));
+    this->subscribeTag = tag;
+}
+
+/**
+ * @brief Try to answer a message from the M4 from the cache
+ *
+ * Queries that are in the cache are answered directly; otherwise, the cache is told to expect
+ * their reply. Any other message (apart from no-ops) may change the config, so it invalidates the
+ * cache.
+ *
+ * @param buf Buffer that starts with the message
+ * @param hdr Header of the message
+ * @param start Timestamp at which the message was read
+ *
+ * @return Whether the message was answered (and removed from the buffer)
+ */
+bool ConfdEpHandler::handleCachedQuery(struct evbuffer *buf, const struct rpc_header &hdr,
+        const uint64_t start) {
+    if(!Config::GetConfdCacheEnabled() || (hdr.flags & kRpcFlagReply) ||
+            hdr.endpoint == kRpcEndpointNoOp) {
+        return false;
+    } else if(hdr.endpoint == Config::GetConfdSubscribeEndpoint()) {
+        this->isM4Subscribed = true;
+        return false;
+    } else if(hdr.endpoint != Config::GetConfdQueryEndpoint()) {
+        this->cache.invalidate();
+        return false;
+    }
+
+    const std::span<const std::byte> message{reinterpret_cast<const std::byte *>(
+            evbuffer_pullup(buf, hdr.length)), hdr.length};
+
+    auto reply = this->cache.lookup(message);
+    if(!reply) {
+        this->cache.expect(message);
+        return false;
+    }
+
+    evbuffer_drain(buf, hdr.length);
+    if(evbuffer_add(this->rpmsgTxBuf, reply->data(), reply->size())) {
+        throw std::runtime_error("failed to queue cached confd reply");
+    }
+
+    Stats::RecordSince(Stats::Source::ConfdCacheHit, hdr.endpoint, start, reply->size());
+    return true;
+}
+
+/**
+ * @brief Process a message from confd before it's forwarded to the M4
+ *
+ * Change notifications invalidate the cache; they're only forwarded if the M4 subscribed to them
+ * itself. Replies to our own subscription request are consumed, and replies to queries are
+ * offered to the cache.
+ *
+ * @param buf Buffer that starts with the message
+ * @param hdr Header of the message
+ *
+ * @return Whether the message was consumed (and removed from the buffer)
+ */
+bool ConfdEpHandler::filterConfdMessage(struct evbuffer *buf, const struct rpc_header &hdr) {
+    if(!Config::GetConfdCacheEnabled()) {
+        return false;
+    }
+
+    if(hdr.flags & kRpcFlagBroadcast) {
+        this->cache.invalidate();
+
+        if(!this->isM4Subscribed) {
+            evbuffer_drain(buf, hdr.length);
+            return true;
+        }
+        return false;
+    } else if(!(hdr.flags & kRpcFlagReply)) {
+        return false;
+    }
+
+    // reply to a subscription request we made (possibly one replayed after a reconnect)
+    if(hdr.endpoint == Config::GetConfdSubscribeEndpoint() &&
+            (!this->isM4Subscribed || static_cast<uint8_t>(hdr.tag) == this->subscribeTag)) {
+        PLOG_VERBOSE << "subscribed to confd change notifications";
+
+        this->subscribeTag.reset();
+        evbuffer_drain(buf, hdr.length);
+        return true;
+    }
+
+    // cache replies to queries
+    const std::span<const std::byte> message{reinterpret_cast<const std::byte *>(
+            evbuffer_pullup(buf, hdr.length)), hdr.length};
+
+    if(this->cache.fill(message) && this->requestStart[hdr.tag]) {
+        Stats::RecordSince(Stats::Source::ConfdCacheMiss, hdr.endpoint,
+                this->requestStart[hdr.tag], hdr.length);
+    }
+
+    return false;
+}
+
+
+
+/**
+ * @brief Check whether a buffer starts with a complete message
+ *
+ * Messages are forwarded without being parsed; we only need the header to find the boundaries of
+ * messages, and to attribute them in the message statistics.
+ *
+ * @param buf Buffer to examine
+ * @param outHdr Variable to receive the message's header
+ *
+ * @return Whether the entire message is in the buffer
+ */
+bool ConfdEpHandler::PeekMessage(struct evbuffer *buf, struct rpc_header &outHdr) {
+    const auto pending = evbuffer_get_length(buf);
+    if(pending < sizeof(struct rpc_header)) {
+        return false;
+    }
+
+    if(evbuffer_copyout(buf, &outHdr, sizeof(outHdr)) != sizeof(outHdr)) {
+        throw std::runtime_error("failed to read message header");
+    } else if(outHdr.length < sizeof(struct rpc_header)) {
+        throw std::runtime_error(fmt::format("invalid message length ({})",
+                    static_cast<size_t>(outHdr.length)));
+    }
+
+    return pending >= outHdr.length;
+}
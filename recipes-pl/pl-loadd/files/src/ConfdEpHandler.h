@@ -1,34 +1,81 @@
 #ifndef CONFDEPHANDLER_H
 #define CONFDEPHANDLER_H
 
-#include <atomic>
+#include <array>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <memory>
+#include <optional>
 #include <span>
 #include <string_view>
-#include <vector>
 
+#include "ConfdCache.h"
 #include "Coprocessor.h"
+#include "RpcTypes.h"
 
 class RpcServer;
+class RpmsgLoop;
 
 /**
  * @brief Config endpoint handler
  *
  * This handler proxies requests made via the confd channel to confd, via its local RPC socket.
+ *
+ * The connection to confd is established asynchronously, and re-established (with exponential
+ * backoff) whenever it's lost. While disconnected, messages from the M4 are held in a bounded
+ * queue, which is replayed in order once the connection is back.
+ *
+ * Config queries from the M4 are answered from a local cache where possible; it's invalidated by
+ * subscribing to confd's change notifications.
+ *
+ * Rather than dialing confd, the handler may also be given an already connected socket (such as
+ * one end of a socket pair, for the replay tool.) It's used as is, and not reconnected if lost.
  */
 class ConfdEpHandler: public Coprocessor::EndpointHandler {
     public:
-        ConfdEpHandler(const int fd, const std::shared_ptr<RpcServer> &lrpc);
+        ConfdEpHandler(const int fd, RpmsgLoop &loop, const std::shared_ptr<RpcServer> &lrpc,
+                const int confdFd = -1);
         ~ConfdEpHandler() override;
 
     private:
-        int connectToConfd();
+        /**
+         * @brief State of the confd client connection
+         */
+        enum class ConfdState {
+            /// Not connected; waiting for the reconnect timer
+            Disconnected,
+            /// Connection attempt in progress
+            Connecting,
+            /// Connected; messages are forwarded directly
+            Connected,
+        };
+
+    private:
+        void beginConnect();
+        void handleConfdConnected();
+        void handleConfdDisconnected();
+        void scheduleReconnect();
+
+        void forwardToConfd(struct evbuffer *buf, const struct rpc_header &hdr);
+        void queuePending(struct evbuffer *buf, const struct rpc_header &hdr);
+        void trimPending();
+        void handleConfdDrained(const size_t bytes);
+
+        void subscribeToChanges();
+        bool handleCachedQuery(struct evbuffer *buf, const struct rpc_header &hdr,
+                const uint64_t start);
+        bool filterConfdMessage(struct evbuffer *buf, const struct rpc_header &hdr);
 
         void handleConfdRead(struct bufferevent *bev);
+        void handleConfdWrite(struct bufferevent *bev);
         void handleConfdEvent(struct bufferevent *bev, const uintptr_t what);
 
         void handleRpmsgRead(struct bufferevent *bev);
+        void flushRpmsg();
+
+        static bool PeekMessage(struct evbuffer *buf, struct rpc_header &outHdr);
 
     private:
         /// Should confd received packets be dumped to log?
@@ -36,23 +83,67 @@ class ConfdEpHandler: public Coprocessor::EndpointHandler {
         /// Should rpmsg received packets be dumped to log?
         constexpr static const bool kDumpRpmsgPackets{false};
 
-        /// when set, the socket needs to be re-created for the next request
-        std::atomic_bool needsNewSocket{false};
-        /// File descriptor of our client connection to confd
-        int confdSocket{-1};
+        /// Stop reading from one side once this many bytes are waiting to go to the other side
+        constexpr static const size_t kHighWatermark{16 * 1024};
+        /// Resume reading once the pending bytes drop to this level
+        constexpr static const size_t kLowWatermark{4 * 1024};
+        /// Maximum number of buffer segments an outgoing rpmsg message is gathered from
+        constexpr static const size_t kMaxSegments{4};
+
+        /// Delay before the first reconnect attempt after the connection is lost
+        constexpr static const std::chrono::milliseconds kReconnectMinDelay{10};
+        /// Upper bound for the reconnect delay (it doubles with each failed attempt)
+        constexpr static const std::chrono::milliseconds kReconnectMaxDelay{5000};
+        /// Maximum number of messages held for confd while disconnected (oldest are dropped)
+        constexpr static const size_t kMaxPendingMessages{64};
+
+        /// Current state of the confd connection
+        ConfdState confdState{ConfdState::Disconnected};
         /// event wrapping the confd socket
         struct bufferevent *confdBev{nullptr};
+        /// Timer event to retry connecting to confd
+        struct event *reconnectEvent{nullptr};
+        /// Delay before the next reconnect attempt
+        std::chrono::milliseconds reconnectDelay{kReconnectMinDelay};
+        /// Set if the confd socket was provided to us, rather than dialed (it's never reconnected)
+        bool isConfdFdProvided{false};
 
-        /// event wrapping the local rpmsg channel
+        /// Messages from the M4 waiting for the confd connection to be (re-)established
+        struct evbuffer *pendingBuf{nullptr};
+        /// Number of messages in the pending buffer
+        size_t numPending{0};
+        /// Number of messages dropped because the pending buffer was full
+        size_t numDropped{0};
+
+        /**
+         * @brief Lengths of messages in the confd output buffer
+         *
+         * Used to find the message boundaries in the output buffer if the connection is lost, so
+         * that messages that haven't been (entirely) written yet can be replayed.
+         */
+        std::deque<uint16_t> inflightLengths;
+        /// Number of bytes of the first in flight message that have already been written
+        size_t inflightHeadWritten{0};
+
+        /// event wrapping the local rpmsg channel (only used for reading)
         struct bufferevent *rpmsgBev{nullptr};
+        /// Messages waiting to be written to the rpmsg channel
+        struct evbuffer *rpmsgTxBuf{nullptr};
+        /// rpmsg channel writable event (used when the transmit queue couldn't be flushed)
+        struct event *rpmsgWriteEvent{nullptr};
 
         /// Local RPC server
         std::weak_ptr<RpcServer> lrpc;
 
-        /// Read buffer for messages from confd
-        std::vector<std::byte> confdRxBuf;
-        /// Read buffer for messages from rpmsg
-        std::vector<std::byte> rpmsgRxBuf;
+        /// Timestamp at which each outstanding request (by tag) was forwarded to confd
+        std::array<uint64_t, 256> requestStart{};
+
+        /// Replies to config queries
+        ConfdCache cache;
+        /// Tag of our change notification subscription request, while it's outstanding
+        std::optional<uint8_t> subscribeTag;
+        /// Set once the M4 subscribes to change notifications itself (so they're forwarded)
+        bool isM4Subscribed{false};
 };
 
 #endif
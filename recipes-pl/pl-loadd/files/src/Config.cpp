@@ -3,4 +3,22 @@
 #include "Config.h"
 
 std::string Config::gSocketPath{"/var/run/loadd/rpc.sock"};
+std::string Config::gConfdSocketPath{"/var/run/confd/rpc.sock"};
+std::string Config::gChannelLeaseGroup{"load"};
+std::string Config::gCaptureDirectory{"/tmp"};
 
+size_t Config::gBroadcastHighWatermark{256 * 1024};
+size_t Config::gBroadcastLowWatermark{64 * 1024};
+size_t Config::gBroadcastQueueDepth{16};
+Config::BroadcastOverflowPolicy Config::gBroadcastOverflowPolicy{
+    Config::BroadcastOverflowPolicy::DropOldest};
+
+bool Config::gRpcBatchedIo{false};
+
+bool Config::gConfdCacheEnabled{true};
+uint8_t Config::gConfdQueryEndpoint{0x01};
+uint8_t Config::gConfdSubscribeEndpoint{0x03};
+
+double Config::gMeasurementSummaryMaxRate{250.};
+
+std::chrono::milliseconds Config::gCoprocessorCheckInterval{250};
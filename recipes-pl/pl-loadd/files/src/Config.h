@@ -1,6 +1,9 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <string>
 
 /**
@@ -8,6 +11,21 @@
  */
 class Config {
     public:
+        /**
+         * @brief Action to take when a client's broadcast queue overflows
+         *
+         * This only applies to measurement broadcasts; all others (such as link state changes)
+         * are always queued.
+         */
+        enum class BroadcastOverflowPolicy {
+            /// Discard the oldest queued measurement to make room for the new one
+            DropOldest,
+            /// Keep only the most recent queued measurement per endpoint
+            Conflate,
+            /// Disconnect the client
+            Disconnect,
+        };
+
         /**
          * @brief Get the file path for the RPC listening socket
          *
@@ -16,9 +34,185 @@ class Config {
         static const std::string &GetRpcSocketPath() {
             return gSocketPath;
         }
+        /**
+         * @brief Override the file path for the RPC listening socket
+         *
+         * This is used by the replay tool, so it won't conflict with a running daemon.
+         */
+        static void SetRpcSocketPath(const std::string &path) {
+            gSocketPath = path;
+        }
+
+        /**
+         * @brief Get the file path of confd's RPC socket
+         *
+         * The coprocessor's config endpoint is bridged to this socket.
+         *
+         * @todo Actually read this from a configuration
+         */
+        static const std::string &GetConfdSocketPath() {
+            return gConfdSocketPath;
+        }
+
+        /**
+         * @brief Get the client output buffer high watermark
+         *
+         * Once this many bytes are waiting to be sent to a client, broadcasts are no longer
+         * written to its socket, but held in its broadcast queue instead.
+         *
+         * @todo Actually read this from a configuration
+         */
+        static size_t GetBroadcastHighWatermark() {
+            return gBroadcastHighWatermark;
+        }
+
+        /**
+         * @brief Get the client output buffer low watermark
+         *
+         * When a congested client's output buffer drains below this many bytes, its queued
+         * broadcasts are written to its socket again.
+         *
+         * @todo Actually read this from a configuration
+         */
+        static size_t GetBroadcastLowWatermark() {
+            return gBroadcastLowWatermark;
+        }
+
+        /**
+         * @brief Get the maximum number of measurements queued for a congested client
+         *
+         * @todo Actually read this from a configuration
+         */
+        static size_t GetBroadcastQueueDepth() {
+            return gBroadcastQueueDepth;
+        }
+
+        /**
+         * @brief Get the policy applied when a client's broadcast queue is full
+         *
+         * @todo Actually read this from a configuration
+         */
+        static BroadcastOverflowPolicy GetBroadcastOverflowPolicy() {
+            return gBroadcastOverflowPolicy;
+        }
+
+        /**
+         * @brief Get the name of the group whose members may lease coprocessor channels
+         *
+         * @todo Actually read this from a configuration
+         */
+        static const std::string &GetChannelLeaseGroup() {
+            return gChannelLeaseGroup;
+        }
+
+        /**
+         * @brief Whether RPC clients use batched IO
+         *
+         * When set, messages to a client are queued during an event loop iteration, and sent
+         * at its end with a single `sendmmsg` call; likewise, multiple messages are read per
+         * wake-up with `recvmmsg`.
+         *
+         * @todo Actually read this from a configuration
+         */
+        static bool GetRpcBatchedIo() {
+            return gRpcBatchedIo;
+        }
+        /**
+         * @brief Enable or disable batched IO for RPC clients
+         *
+         * Only clients that connect after the change are affected.
+         */
+        static void SetRpcBatchedIo(const bool enabled) {
+            gRpcBatchedIo = enabled;
+        }
+
+        /**
+         * @brief Whether replies to config queries from the M4 are cached
+         *
+         * @todo Actually read this from a configuration
+         */
+        static bool GetConfdCacheEnabled() {
+            return gConfdCacheEnabled;
+        }
+        /**
+         * @brief Enable or disable the confd query cache
+         *
+         * This must be set before the coprocessor is started.
+         */
+        static void SetConfdCacheEnabled(const bool enabled) {
+            gConfdCacheEnabled = enabled;
+        }
+
+        /**
+         * @brief Get the confd RPC endpoint used to query config values
+         *
+         * Replies to messages on this endpoint are cached; messages to any other endpoint are
+         * assumed to modify the config, and invalidate the cache.
+         *
+         * @todo Actually read this from a configuration
+         */
+        static uint8_t GetConfdQueryEndpoint() {
+            return gConfdQueryEndpoint;
+        }
+
+        /**
+         * @brief Get the confd RPC endpoint used to subscribe to config change notifications
+         *
+         * @todo Actually read this from a configuration
+         */
+        static uint8_t GetConfdSubscribeEndpoint() {
+            return gConfdSubscribeEndpoint;
+        }
+
+        /**
+         * @brief Get the directory that rpmsg capture files are written to
+         *
+         * @todo Actually read this from a configuration
+         */
+        static const std::string &GetCaptureDirectory() {
+            return gCaptureDirectory;
+        }
+
+        /**
+         * @brief Get the maximum rate at which measurement summaries are delivered to a client
+         *
+         * Clients requesting a higher rate receive a summary for every measurement instead.
+         *
+         * @todo Actually read this from a configuration
+         */
+        static double GetMeasurementSummaryMaxRate() {
+            return gMeasurementSummaryMaxRate;
+        }
+
+        /**
+         * @brief Get the interval at which the coprocessor's state is checked for crashes
+         *
+         * @todo Actually read this from a configuration
+         */
+        static std::chrono::milliseconds GetCoprocessorCheckInterval() {
+            return gCoprocessorCheckInterval;
+        }
 
     private:
         static std::string gSocketPath;
+        static std::string gConfdSocketPath;
+        static std::string gChannelLeaseGroup;
+        static std::string gCaptureDirectory;
+
+        static size_t gBroadcastHighWatermark;
+        static size_t gBroadcastLowWatermark;
+        static size_t gBroadcastQueueDepth;
+        static BroadcastOverflowPolicy gBroadcastOverflowPolicy;
+
+        static bool gRpcBatchedIo;
+
+        static bool gConfdCacheEnabled;
+        static uint8_t gConfdQueryEndpoint;
+        static uint8_t gConfdSubscribeEndpoint;
+
+        static double gMeasurementSummaryMaxRate;
+
+        static std::chrono::milliseconds gCoprocessorCheckInterval;
 };
 
 #endif
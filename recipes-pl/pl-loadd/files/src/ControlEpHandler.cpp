@@ -3,6 +3,8 @@
 #include <sys/socket.h>
 
 #include <cerrno>
+#include <cstring>
+#include <optional>
 #include <system_error>
 
 #include <event2/event.h>
@@ -11,10 +13,15 @@
 #include <fmt/format.h>
 #include <plog/Log.h>
 
+#include "Capture.h"
 #include "ControlEpHandler.h"
 #include "Coprocessor.h"
+#include "MeasurementCodec.h"
+#include "MeasurementRingTypes.h"
 #include "RpcServer.h"
 #include "RpcTypes.h"
+#include "RpmsgLoop.h"
+#include "Stats.h"
 
 /**
  * @brief Initialize the control endpoint handler
@@ -22,10 +29,11 @@
  * Prepare a buffer event for receiving messages from the remote control endpoint, then send a nop
  * message to prepare the endpoint.
  */
-ControlEpHandler::ControlEpHandler(const int fd, const std::shared_ptr<RpcServer> &lrpc) :
-    Coprocessor::EndpointHandler(fd), lrpc(lrpc) {
+ControlEpHandler::ControlEpHandler(const int fd, RpmsgLoop &loop,
+        const std::shared_ptr<RpcServer> &lrpc) : Coprocessor::EndpointHandler(fd), lrpc(lrpc),
+    loop(loop), createdAt(Stats::Now()) {
     int err;
-    auto evbase = lrpc->getEvBase();
+    auto evbase = loop.getEvBase();
 
     // send an empty message to notify rpmsg channel we're alive
     struct rpc_header hdr{
@@ -60,10 +68,15 @@ ControlEpHandler::ControlEpHandler(const int fd, const std::shared_ptr<RpcServer
             // TODO: abort program
         }
     }, nullptr, [](auto bev, auto what, auto ctx) {
-        PLOG_ERROR << "rpmsg event (unhandled): " << what;
+        if(what & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+            PLOG_WARNING << "rpmsg channel hung up: " << what;
+            reinterpret_cast<ControlEpHandler *>(ctx)->notifyLinkDown();
+        } else {
+            PLOG_ERROR << "rpmsg event (unhandled): " << what;
+        }
     }, this);
 
-    // add events to rpc server's run loop
+    // add events to the rpmsg run loop
     err = bufferevent_enable(this->rpmsgBev, EV_READ);
     if(err == -1) {
         throw std::runtime_error("failed to enable bufferevent (rpmsg)");
@@ -74,6 +87,8 @@ ControlEpHandler::ControlEpHandler(const int fd, const std::shared_ptr<RpcServer
  * @brief Clean up control endpoint resources
  */
 ControlEpHandler::~ControlEpHandler() {
+    PLOG_DEBUG << "control: " << this->lostFrames << " measurement frame(s) lost";
+
     if(this->rpmsgBev) {
         bufferevent_free(this->rpmsgBev);
     }
@@ -84,8 +99,12 @@ ControlEpHandler::~ControlEpHandler() {
  *
  * All data available to read is sent either to a remote client connected to our local RPC
  * interface or broadcasted to all connected clients.
+ *
+ * This runs on the rpmsg thread; anything involving the RPC server is passed to its loop.
  */
 void ControlEpHandler::handleRpmsgRead(struct bufferevent *bev) {
+    const auto start = Stats::Now();
+
     auto buf = bufferevent_get_input(bev);
     const size_t pending = evbuffer_get_length(buf);
 
@@ -99,6 +118,8 @@ void ControlEpHandler::handleRpmsgRead(struct bufferevent *bev) {
     if(kDumpRpmsgPackets) {
         DumpPacket(">>> rpmsg", this->rpmsgRxBuf);
     }
+    Capture::Record(Capture::Channel::Control, Capture::Direction::FromRemote,
+            this->rpmsgRxBuf);
 
     /*
      * Inspect the header of the packet to route it appropriately. If it's a broadcast packet,
@@ -121,15 +142,102 @@ void ControlEpHandler::handleRpmsgRead(struct bufferevent *bev) {
             DumpPacket("<<< rpmsg broadcast", this->rpmsgRxBuf);
         }
 
-        // flood broadcasts to all clients
-        if(auto rpc = this->lrpc.lock()) {
-            rpc->broadcastPacket(this->rpmsgRxBuf);
-        } else {
-            PLOG_WARNING << "no RPC handler to broadcast rpmsg packet!";
+        // decode measurements here, so the RPC loop only has to publish them
+        const bool isBinary = (hdr->flags & kRpcFlagBinary);
+        std::optional<struct measurement_record> measurement;
+
+        if(hdr->endpoint == kRpcEndpointMeasurement) {
+            const auto payload = std::span(this->rpmsgRxBuf).subspan(sizeof(rpc_header));
+            if(isBinary) {
+                uint32_t sequence;
+                measurement = MeasurementCodec::DecodeFrame(payload, &sequence);
+                this->checkFrameSequence(sequence);
+            } else {
+                measurement = MeasurementCodec::DecodeCbor(payload);
+            }
+            measurement->timestamp = start;
+
+            // the first measurement indicates the coprocessor finished booting
+            if(!this->isReady) {
+                Stats::RecordSince(Stats::Source::CoprocessorReady, 0, this->createdAt, 0);
+                PLOG_INFO << "coprocessor ready after "
+                    << (Stats::Now() - this->createdAt) / 1'000'000U << " ms";
+                this->isReady = true;
+            }
+        }
+
+        /*
+         * Flood broadcasts to all clients (from the RPC loop.) Binary frames aren't part of the
+         * local RPC protocol, so measurements received as such are re-encoded as CBOR there,
+         * and only if any client wants them; other binary broadcasts aren't forwarded.
+         */
+        RpcServer::SharedPacket packet;
+        if(!isBinary) {
+            packet = std::make_shared<const std::vector<std::byte>>(this->rpmsgRxBuf);
+        }
+
+        const bool posted = this->loop.postToRpc([lrpc = this->lrpc, packet, measurement]() {
+            auto rpc = lrpc.lock();
+            if(!rpc) {
+                PLOG_WARNING << "no RPC handler to broadcast rpmsg packet!";
+                return;
+            }
+
+            const auto start = Stats::Now();
+
+            if(packet) {
+                const auto hdr = reinterpret_cast<const rpc_header *>(packet->data());
+                rpc->broadcastPacket(packet);
+                Stats::RecordSince(Stats::Source::Broadcast, hdr->endpoint, start,
+                        packet->size());
+            } else if(measurement) {
+                const auto size = rpc->broadcastMeasurement(*measurement);
+                Stats::RecordSince(Stats::Source::Broadcast, kRpcEndpointMeasurement, start,
+                        size);
+            }
+
+            if(measurement) {
+                rpc->publishMeasurement(*measurement);
+            }
+        });
+
+        if(!posted) {
+            PLOG_WARNING_IF(!this->droppedBroadcasts) << "RPC queue full, dropping broadcasts";
+            this->droppedBroadcasts++;
         }
     } else {
         // TODO: normal packet processing
         PLOG_WARNING << "received packet " << fmt::format("tag {:02x} type {:02x}",
                 hdr->tag, hdr->endpoint) << ", not yet handled!";
     }
+
+    Stats::RecordSince(Stats::Source::ControlRpmsg, hdr->endpoint, start,
+            this->rpmsgRxBuf.size());
+}
+
+/**
+ * @brief Check a binary measurement frame's sequence number for gaps
+ *
+ * The coprocessor increments the sequence number for every frame, so any gap indicates lost
+ * frames. Frames that appear to go backwards (duplicated or reordered) are only logged.
+ *
+ * @param sequence Sequence number of the frame just received
+ */
+void ControlEpHandler::checkFrameSequence(const uint32_t sequence) {
+    if(this->lastFrameSequence) {
+        const uint32_t expected = *this->lastFrameSequence + 1;
+        const uint32_t gap = sequence - expected;
+
+        if(gap && gap < (1U << 31)) {
+            this->lostFrames += gap;
+            PLOG_WARNING << "lost " << gap << " measurement frame(s) (expected " << expected
+                << ", got " << sequence << "; " << this->lostFrames << " total)";
+        } else if(gap) {
+            PLOG_WARNING << "measurement frame out of order (expected " << expected << ", got "
+                << sequence << ")";
+            return;
+        }
+    }
+
+    this->lastFrameSequence = sequence;
 }
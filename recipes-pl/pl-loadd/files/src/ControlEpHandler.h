@@ -2,12 +2,17 @@
 #define CONTROLEPHANDLER_H
 
 #include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <span>
 #include <vector>
 
 #include "Coprocessor.h"
+#include "MeasurementRingTypes.h"
 
 class RpcServer;
+class RpmsgLoop;
 
 /**
  * @brief Control endpoint handler
@@ -16,11 +21,12 @@ class RpcServer;
  */
 class ControlEpHandler: public Coprocessor::EndpointHandler {
     public:
-        ControlEpHandler(const int fd, const std::shared_ptr<RpcServer> &lrpc);
+        ControlEpHandler(const int fd, RpmsgLoop &loop, const std::shared_ptr<RpcServer> &lrpc);
         ~ControlEpHandler() override;
 
     private:
         void handleRpmsgRead(struct bufferevent *bev);
+        void checkFrameSequence(const uint32_t sequence);
 
     private:
         /// Should rpmsg received packets be dumped to log?
@@ -33,8 +39,23 @@ class ControlEpHandler: public Coprocessor::EndpointHandler {
         /// Read buffer for messages from rpmsg
         std::vector<std::byte> rpmsgRxBuf;
 
-        /// Local RPC server
+        /// Local RPC server (only access from its loop)
         std::weak_ptr<RpcServer> lrpc;
+        /// Event loop we run on
+        RpmsgLoop &loop;
+
+        /// Number of broadcasts dropped because the RPC loop's queue was full
+        size_t droppedBroadcasts{0};
+
+        /// Sequence number of the last binary measurement frame, if any were received
+        std::optional<uint32_t> lastFrameSequence;
+        /// Number of binary measurement frames lost, as indicated by sequence number gaps
+        size_t lostFrames{0};
+
+        /// Timestamp at which the handler was created (the coprocessor's endpoints appeared)
+        uint64_t createdAt{0};
+        /// Set once the first measurement has been received from the coprocessor
+        bool isReady{false};
 };
 
 #endif
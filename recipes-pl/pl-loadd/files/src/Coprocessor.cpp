@@ -1,22 +1,23 @@
-#include <fcntl.h>
 #include <unistd.h>
-#include <linux/rpmsg.h>
-#include <sys/ioctl.h>
+#include <cbor.h>
 
-#include <cerrno>
+#include <algorithm>
 #include <cstring>
 #include <iomanip>
-#include <regex>
 #include <sstream>
 #include <string>
-#include <system_error>
+#include <utility>
 
+#include <event2/event.h>
 #include <fmt/format.h>
 #include <plog/Log.h>
 
+#include "Config.h"
 #include "ConfdEpHandler.h"
 #include "ControlEpHandler.h"
 #include "Coprocessor.h"
+#include "RpcServer.h"
+#include "RpcTypes.h"
 
 const std::array<Coprocessor::EndpointInfo, Coprocessor::kNumRpcEndpoints> Coprocessor::kRpcChannels{{
     /// load control (consumed by loadd)
@@ -25,8 +26,8 @@ const std::array<Coprocessor::EndpointInfo, Coprocessor::kNumRpcEndpoints> Copro
         .address = 0x420,
         .isLoadControl = true,
         .isRetrievable = false,
-        .makeHandler = [](auto fd, auto lrpc, auto outHandler) {
-            outHandler = std::make_shared<ControlEpHandler>(fd, lrpc);
+        .makeHandler = [](auto fd, auto &loop, auto lrpc, auto outHandler) {
+            outHandler = std::make_shared<ControlEpHandler>(fd, loop, lrpc);
         },
     },
     /// Interface to confd
@@ -35,10 +36,18 @@ const std::array<Coprocessor::EndpointInfo, Coprocessor::kNumRpcEndpoints> Copro
         .address = 0x421,
         .isLoadControl = false,
         .isRetrievable = false,
-        .makeHandler = [](auto fd, auto lrpc, auto outHandler) {
-            outHandler = std::make_shared<ConfdEpHandler>(fd, lrpc);
+        .makeHandler = [](auto fd, auto &loop, auto lrpc, auto outHandler) {
+            outHandler = std::make_shared<ConfdEpHandler>(fd, loop, lrpc);
         },
     },
+    /// direct load control access (leased to clients; not handled by loadd)
+    {
+        .name = "pl.direct",
+        .address = 0x422,
+        .isLoadControl = false,
+        .isRetrievable = true,
+        .makeHandler = nullptr,
+    },
 }};
 
 
@@ -51,6 +60,13 @@ const std::array<Coprocessor::EndpointInfo, Coprocessor::kNumRpcEndpoints> Copro
  * will be interrupted when they're killed.
  */
 Coprocessor::~Coprocessor() {
+    // stop monitoring
+    for(auto event : {this->checkEvent, this->stateEvent, this->recoveryEvent}) {
+        if(event) {
+            event_free(event);
+        }
+    }
+
     // shut down the coproc; ignore any errors though
     try {
         if(this->coprocState == State::Running) {
@@ -61,11 +77,12 @@ Coprocessor::~Coprocessor() {
     }
 
     // simply close all open endpoint descriptors
+    this->unregisterChannels();
+    this->destroyHandlers();
+
     for(auto it = this->rpcChannels.rbegin(); it != this->rpcChannels.rend(); ++it) {
         auto &info = *it;
 
-        info.handler.reset();
-
         if(info.chrdevFd != -1) {
             close(info.chrdevFd);
         }
@@ -80,68 +97,80 @@ Coprocessor::~Coprocessor() {
 void Coprocessor::loadFirmware(const std::filesystem::path &fwPath) {
     PLOG_INFO << "loading coproc fw from " << fwPath.native();
 
-    this->setFirmwareDirectory(fwPath.parent_path().native());
-    this->setFirmwareFilename(fwPath.filename().native());
+    this->backend->loadFirmware(fwPath);
+    this->fwPath = fwPath;
 }
 
+
+
 /**
- * @brief Write a coprocessor management file
+ * @brief Initialize RPC communications
+ *
+ * Have the backend create channels for all of the supported RPC endpoints, as defined in the
+ * `kRpcChannels` array. (On the real hardware, we'll take advantage of the `rpmsg_chrdev` driver
+ * to create character devices for them.)
+ *
+ * Once the channels are set up, open file descriptors for all of them. One of the channels will be
+ * managed and handled internally by our event loop (this is the main load-specific message
+ * channel, which we re-export with an RPC interface on a domain socket) while the others will just
+ * be chilling, until a task checks in and requests it.
  *
- * Write the specified string into a coprocessor management file.
+ * Endpoint handlers run on a dedicated rpmsg event loop and thread, which is started once all
+ * channels have been set up.
  *
- * @param base Base directory to (or full path of) the management file
- * @param name Name of the management file (or empty if full path is specified)
- * @param value String to write to the file
+ * @remark This blocks until the backend has created all channels; during recovery, channels are
+ *         instead created asynchronously (see initRpcAsync) so the RPC loop keeps running.
  */
-void Coprocessor::writeFile(const std::string_view &base, const std::string_view &name,
-        const std::string_view &value) {
-    int fd, err;
-
-    // figure out full path
-    std::filesystem::path path(base);
+void Coprocessor::initRpc(const std::shared_ptr<RpcServer> &lrpc) {
+    this->prepareRpc(lrpc);
 
-    if(!name.empty()) {
-        path /= name;
-    }
+    const auto addresses = GetEndpointAddresses();
+    auto endpoints = this->backend->createEndpoints(addresses);
 
-    PLOG_VERBOSE << "writing coproc file " << path.native() << " = '" << value << "'";
+    this->setupChannels(lrpc, endpoints);
+}
 
-    // open file
-    fd = open(path.native().c_str(), O_RDWR);
-    if(fd == -1) {
-        throw std::system_error(errno, std::generic_category(), "open coproc file");
-    }
+/**
+ * @brief Initialize RPC communications, without blocking
+ *
+ * Works like initRpc(), but the backend creates the channels asynchronously, waiting for them on
+ * the RPC server's loop. Once all channels are set up (or this failed) the callback is invoked.
+ *
+ * @param lrpc Local RPC server
+ * @param callback Invoked with the error that occurred (if any) once done
+ */
+void Coprocessor::initRpcAsync(const std::shared_ptr<RpcServer> &lrpc,
+        std::function<void(std::exception_ptr)> &&callback) {
+    this->prepareRpc(lrpc);
+
+    const auto addresses = GetEndpointAddresses();
+    this->backend->createEndpointsAsync(lrpc->getEvBase(), addresses,
+            [this, callback = std::move(callback)](auto &&endpoints, auto error) {
+        if(!error) {
+            try {
+                auto lrpc = this->lrpc.lock();
+                if(!lrpc) {
+                    throw std::runtime_error("RPC server went away");
+                }
 
-    // write the value
-    try {
-        err = write(fd, value.data(), value.length());
-        if(err == -1) {
-            throw std::system_error(errno, std::generic_category(), "write coproc file");
+                this->setupChannels(lrpc, endpoints);
+            } catch(const std::exception &) {
+                error = std::current_exception();
+            }
         }
-    } catch(const std::exception &) {
-        // ensure file is closed
-        close(fd);
-        throw;
-    }
 
-    // clean up
-    close(fd);
+        callback(error);
+    });
 }
 
-
-
 /**
- * @brief Initialize RPC communications
+ * @brief Get ready to set up the RPC channels
  *
- * We'll take advantage of the `rpmsg_chrdev` driver to create character devices for all of the
- * supported RPC endpoints, as defined in the `kRpcChannels` array.
- *
- * Once the channels are set up, open file descriptors for all of them. One of the channels will be
- * managed and handled internally by our event loop (this is the main load-specific message
- * channel, which we re-export with an RPC interface on a domain socket) while the others will just
- * be chilling, until a task checks in and requests it.
+ * Destroy any endpoints left over, and create the rpmsg loop if needed.
  */
-void Coprocessor::initRpc(const std::shared_ptr<RpcServer> &lrpc) {
+void Coprocessor::prepareRpc(const std::shared_ptr<RpcServer> &lrpc) {
+    this->lrpc = lrpc;
+
     // close any endpoints that are still open (leftovers)
     try {
         const auto numClosed = this->destroyAllRpcEndpoints();
@@ -150,39 +179,55 @@ void Coprocessor::initRpc(const std::shared_ptr<RpcServer> &lrpc) {
         PLOG_WARNING << "failed to destroy endpoints: " << e.what();
     }
 
-    // open control device if needed
-    if(this->rpmsgCtrlFd == -1) {
-        PLOG_DEBUG << "opening rpmsg_ctrl at " << kRpmsgCtrlDev;
-
-        this->rpmsgCtrlFd = open(kRpmsgCtrlDev.data(), O_RDWR);
-        if(this->rpmsgCtrlFd == -1) {
-            throw std::system_error(errno, std::generic_category(), "open rpmsg_ctrl");
-        }
+    // create the event loop for the endpoint handlers
+    if(!this->rpmsgLoop) {
+        this->rpmsgLoop = std::make_unique<RpmsgLoop>(lrpc->getEvBase());
     }
 
+}
+
+/**
+ * @brief Get the addresses of all RPC endpoints, for the backend to create
+ */
+std::array<CoprocessorBackend::EndpointAddress, Coprocessor::kNumRpcEndpoints>
+Coprocessor::GetEndpointAddresses() {
+    std::array<CoprocessorBackend::EndpointAddress, kNumRpcEndpoints> addresses;
+    std::transform(kRpcChannels.begin(), kRpcChannels.end(), addresses.begin(),
+            [](const auto &detail) {
+        return CoprocessorBackend::EndpointAddress{detail.name, detail.address};
+    });
+
+    return addresses;
+}
+
+/**
+ * @brief Set up the RPC channels, once the backend created them
+ *
+ * Instantiate the handlers for all channels, register retrievable channels with the RPC server,
+ * then start the rpmsg loop (and crash detection, if not already running.)
+ *
+ * @param lrpc Local RPC server
+ * @param endpoints Endpoints created by the backend; their file descriptors are taken over
+ */
+void Coprocessor::setupChannels(const std::shared_ptr<RpcServer> &lrpc,
+        std::vector<CoprocessorBackend::Endpoint> &endpoints) {
     // initialize each channel
-    for(const auto &detail : kRpcChannels) {
-        int fd{-1};
+    for(size_t i = 0; i < kNumRpcEndpoints; i++) {
+        const auto &detail = kRpcChannels[i];
+        const auto &devPath = endpoints[i].path;
+        int fd = std::exchange(endpoints[i].fd, -1);
 
         try {
-            std::filesystem::path devPath;
             std::shared_ptr<EndpointHandler> handler;
 
-            this->connectRpcEndpoint(detail.name, detail.address, devPath);
             PLOG_DEBUG << "opened endpoint " << fmt::format("{}:{:x}", detail.name, detail.address)
                        << " = " << devPath.native();
 
-            // try to open the device
-            fd = open(devPath.native().c_str(), O_RDWR);
-            if(fd == -1) {
-                throw std::system_error(errno, std::generic_category(), "open rpmsg_chrdev");
-            }
-
             // if a handler class was specified for the channel, instantiate it
             if(detail.makeHandler) {
                 // provide detailed logging if handler init fails
                 try {
-                    detail.makeHandler(fd, lrpc, handler);
+                    detail.makeHandler(fd, *this->rpmsgLoop, lrpc, handler);
 
                     if(!handler) {
                         throw std::runtime_error(fmt::format("invalid handler for '{}'", detail.name));
@@ -194,6 +239,16 @@ void Coprocessor::initRpc(const std::shared_ptr<RpcServer> &lrpc) {
                 }
             }
 
+            // get notified if its channel hangs up (ignoring reports from before a recovery)
+            if(handler) {
+                handler->setLinkDownCallback([this, loop = this->rpmsgLoop.get(),
+                        generation = this->generation]() {
+                    loop->postToRpc([this, generation]() {
+                        this->handleLinkDown(generation);
+                    });
+                });
+            }
+
             // insert an info struct for it
             this->rpcChannels.emplace_back(RpcChannelInfo{
                 .epName = detail.name,
@@ -202,6 +257,14 @@ void Coprocessor::initRpc(const std::shared_ptr<RpcServer> &lrpc) {
                 .isRetrievable = !!detail.isRetrievable,
                 .handler = handler,
             });
+
+            // allow clients to retrieve the channel
+            if(detail.isRetrievable) {
+                const auto name = detail.name;
+                lrpc->registerChannel(name, fd, [this, name]() {
+                    return this->revokeChannel(name);
+                });
+            }
         } catch(const std::exception &e) {
             PLOG_FATAL << "failed to initialize rpc endpoint '" << detail.name << "': "
                        << e.what();
@@ -210,150 +273,404 @@ void Coprocessor::initRpc(const std::shared_ptr<RpcServer> &lrpc) {
                 // ensure we don't leak the fd (if handler can't initialize)
                 close(fd);
             }
+            for(const auto &endpoint : endpoints) {
+                if(endpoint.fd != -1) {
+                    close(endpoint.fd);
+                }
+            }
 
             throw;
         }
     }
+
+    if(this->startedAt) {
+        const auto elapsed = Stats::Now() - this->startedAt;
+        Stats::Record(Stats::Source::EndpointsReady, 0, elapsed, 0);
+        PLOG_INFO << "rpmsg endpoints ready " << elapsed / 1'000'000U << " ms after start";
+    }
+
+    // then start processing messages
+    this->rpmsgLoop->start();
+
+    if(!this->checkEvent) {
+        this->initMonitor(lrpc->getEvBase());
+    }
 }
 
+
+
 /**
- * @brief Create a character device for the given endpoint
+ * @brief Set up crash detection
  *
- * Invoke an ioctl on the rpmsg_ctrl device to create a new character device corresponding to an
- * RPC endpoint with the given name and address.
+ * The coprocessor's state is checked periodically, as well as whenever the backend indicates it
+ * may have changed (for example, on uevents.) Endpoint handlers also report when their channel
+ * hangs up, which is usually the quickest way to notice a crash.
  *
- * @param name ns name the service shall be advertised under
- * @param address Numeric endpoint address of the service on the M4 side
- * @param outChrdevPath Output variable to receive the path of the chardev
+ * All of this runs on the RPC server's loop.
+ *
+ * @param evbase Event loop to run on
  */
-void Coprocessor::connectRpcEndpoint(const std::string_view &name, const uint32_t address,
-        std::filesystem::path &outChrdevPath) {
-    int err;
-    struct rpmsg_endpoint_info ept{};
-    size_t nextChrdevNum{0};
-
-    // figure out the highest chardev number available (aka the path of this next chardev)
-    const std::regex kNameRegex{"rpmsg(\\d+)"};
-    for(const auto &dent : std::filesystem::directory_iterator{"/dev/"}) {
-        std::smatch m;
-        if(!std::regex_match(dent.path().filename().native(), m, kNameRegex) || m.empty()) {
-            continue;
+void Coprocessor::initMonitor(struct event_base *evbase) {
+    this->checkEvent = event_new(evbase, -1, EV_PERSIST, [](auto, auto, auto ctx) {
+        try {
+            reinterpret_cast<Coprocessor *>(ctx)->checkState();
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "failed to check coprocessor state: " << e.what();
         }
+    }, this);
+    this->recoveryEvent = evtimer_new(evbase, [](auto, auto, auto ctx) {
+        reinterpret_cast<Coprocessor *>(ctx)->recover();
+    }, this);
 
-        // extract the digit and compare
-        const auto &sm = m[1];
-        const auto num = std::stoul(sm.str());
+    if(!this->checkEvent || !this->recoveryEvent) {
+        throw std::runtime_error("failed to allocate coprocessor monitor events");
+    }
 
-        if(num >= nextChrdevNum) {
-            nextChrdevNum = num + 1;
+    const auto usec = std::chrono::duration_cast<std::chrono::microseconds>(
+            Config::GetCoprocessorCheckInterval()).count();
+    const struct timeval tv{
+        .tv_sec  = static_cast<time_t>(usec / 1'000'000U),
+        .tv_usec = static_cast<suseconds_t>(usec % 1'000'000U),
+    };
+    evtimer_add(this->checkEvent, &tv);
+
+    // also check whenever the backend signals a state change
+    if(const auto fd = this->backend->getStateEventFd(); fd != -1) {
+        this->stateEvent = event_new(evbase, fd, EV_READ | EV_PERSIST, [](auto, auto, auto ctx) {
+            auto cop = reinterpret_cast<Coprocessor *>(ctx);
+
+            try {
+                cop->backend->drainStateEvents();
+                cop->checkState();
+            } catch(const std::exception &e) {
+                PLOG_ERROR << "failed to check coprocessor state: " << e.what();
+            }
+        }, this);
+        if(!this->stateEvent) {
+            throw std::runtime_error("failed to allocate coprocessor state event");
         }
-    }
 
-    // create endpoint
-    ept.src = -1;
-    ept.dst = address;
-    strncpy(ept.name, name.data(), sizeof(ept.name));
-    ept.name[sizeof(ept.name) - 1] = '\0';
+        event_add(this->stateEvent, nullptr);
+    }
+}
 
-    err = ioctl(this->rpmsgCtrlFd, RPMSG_CREATE_EPT_IOCTL, &ept);
-    if(err < 0) {
-        throw std::system_error(errno, std::generic_category(), "RPMSG_CREATE_EPT_IOCTL");
+/**
+ * @brief Check whether the coprocessor is still running
+ *
+ * If it should be running, but the backend reports otherwise, it crashed.
+ */
+void Coprocessor::checkState() {
+    if(this->coprocState != State::Running) {
+        return;
     }
 
-    // validate the device was created where we expected it to
-    std::filesystem::path path{kRpmsgChrdevBase};
-    path += std::to_string(nextChrdevNum);
+    if(!this->backend->isRunning()) {
+        this->beginRecovery("coprocessor crashed");
+    }
+}
 
-    if(!std::filesystem::exists(path)) {
-        throw std::runtime_error("rpmsg_chrdev not created where we expected!");
-    } else if(!std::filesystem::is_character_file(path)) {
-        throw std::runtime_error("rpmsg_chrdev is not a character device!");
+/**
+ * @brief An endpoint handler reported that its channel hung up
+ *
+ * @param generation Generation of the channels at the time the handler was created; if they've
+ *        been re-created since, the report is stale and ignored.
+ */
+void Coprocessor::handleLinkDown(const size_t generation) {
+    if(generation != this->generation || this->coprocState != State::Running) {
+        return;
     }
 
-    outChrdevPath = path;
+    this->beginRecovery("endpoint hung up");
 }
 
-
 /**
- * @brief Close any open RPC endpoints
+ * @brief Begin recovering from a crash
  *
- * We'll iterate first through any endpoints we opened (and thus have the paths for) and then
- * iterate through all /dev/rpmsg* devices left over in /dev to destroy.
+ * Notify clients that the control link went down, and then schedule recovery. It's not run
+ * right away since we may have been called from work posted by the rpmsg loop, which recovery
+ * will destroy. If a previous recovery is still waiting for its channels, it's abandoned.
  *
- * @return Number of endpoints destroyed
+ * @param reason Description of how the crash was detected
  */
-size_t Coprocessor::destroyAllRpcEndpoints() {
-    size_t count{0};
+void Coprocessor::beginRecovery(const std::string_view &reason) {
+    PLOG_ERROR << "lost coprocessor (" << reason << "), recovering";
 
-    // start with any stored endpoints
-    for(auto it = this->rpcChannels.rbegin(); it != this->rpcChannels.rend(); ++it) {
-        const auto &info = *it;
-        PLOG_VERBOSE << "destroying endpoint " << info.epName << " (" << info.chrdevPath.native()
-                   << ")";
+    this->backend->cancelCreateEndpoints();
+
+    this->coprocState = State::Crashed;
+    this->crashedAt = Stats::Now();
+    this->generation++;
+    this->recoveryDelay = kRecoveryMinDelay;
+
+    this->broadcastLinkState(false);
+
+    const struct timeval tv{0, 0};
+    evtimer_add(this->recoveryEvent, &tv);
+}
+
+/**
+ * @brief Recover from a crash
+ *
+ * Tear down all endpoint handlers and channels, then reload the firmware and restart the
+ * coprocessor, and start re-establishing all channels. The RPC loop keeps running while we wait
+ * for the new channels to appear; recovery completes in finishRecovery().
+ */
+void Coprocessor::recover() {
+    // tear down the old channels; they're dead anyways, so ignore errors
+    try {
+        this->destroyAllRpcEndpoints();
+    } catch(const std::exception &e) {
+        PLOG_WARNING << "failed to destroy endpoints: " << e.what();
+    }
+
+    try {
+        this->backend->stop();
+    } catch(const std::exception &e) {
+        PLOG_DEBUG << "failed to stop coprocessor: " << e.what();
+    }
+
+    // restart it
+    try {
+        auto lrpc = this->lrpc.lock();
+        if(!lrpc) {
+            throw std::runtime_error("RPC server went away");
+        }
+
+        this->loadFirmware(this->fwPath);
+        this->start();
+        this->initRpcAsync(lrpc, [this](auto error) {
+            this->finishRecovery(error);
+        });
+    } catch(const std::exception &e) {
+        this->retryRecovery(e.what());
+    }
+}
 
+/**
+ * @brief Complete recovery, once all channels were re-established (or that failed)
+ *
+ * On success, clients are told the link is back up; otherwise, recovery is retried.
+ *
+ * @param error Error that occurred while setting up the channels, if any
+ */
+void Coprocessor::finishRecovery(std::exception_ptr error) {
+    if(error) {
         try {
-            this->destroyRpcEndpoint(info.chrdevFd);
-            count++;
+            std::rethrow_exception(error);
         } catch(const std::exception &e) {
-            PLOG_ERROR << "failed to destroy ep '" << info.epName << "': " << e.what();
+            this->retryRecovery(e.what());
         }
+        return;
+    }
 
-        // either way, close the fd
-        close(info.chrdevFd);
+    // it's back
+    const auto elapsed = Stats::Now() - this->crashedAt;
+    Stats::Record(Stats::Source::CoprocessorRecovery, 0, elapsed, 0);
+
+    this->numRecoveries++;
+    PLOG_WARNING << "coprocessor recovered in " << elapsed / 1'000'000U << " ms ("
+        << this->numRecoveries << " recoveries total)";
+
+    this->broadcastLinkState(true, elapsed);
+}
+
+/**
+ * @brief Schedule another recovery attempt after a failed one
+ *
+ * The delay doubles with each failure, up to a maximum.
+ *
+ * @param what Description of the failure
+ */
+void Coprocessor::retryRecovery(const std::string_view &what) {
+    PLOG_ERROR << "failed to recover coprocessor (retrying in " << this->recoveryDelay.count()
+        << " ms): " << what;
+
+    this->coprocState = State::Crashed;
+
+    const auto usec = std::chrono::duration_cast<std::chrono::microseconds>(
+            this->recoveryDelay).count();
+    const struct timeval tv{
+        .tv_sec  = static_cast<time_t>(usec / 1'000'000U),
+        .tv_usec = static_cast<suseconds_t>(usec % 1'000'000U),
+    };
+    evtimer_add(this->recoveryEvent, &tv);
+
+    this->recoveryDelay = std::min(this->recoveryDelay * 2, kRecoveryMaxDelay);
+}
+
+/**
+ * @brief Tell clients the control link went down, or came back up
+ *
+ * @param isUp Whether the link is up
+ * @param recoveryTime Time taken to recover, in nanoseconds (only if up)
+ *
+ * @seeAlso kRpcEndpointLinkState
+ */
+void Coprocessor::broadcastLinkState(const bool isUp, const uint64_t recoveryTime) {
+    auto lrpc = this->lrpc.lock();
+    if(!lrpc) {
+        return;
     }
 
-    this->rpcChannels.clear();
+    auto root = cbor_new_definite_map(isUp ? 2 : 1);
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("up")),
+        .value = cbor_move(cbor_build_bool(isUp)),
+    });
+    if(isUp) {
+        cbor_map_add(root, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("recoveryTime")),
+            .value = cbor_move(cbor_build_uint64(recoveryTime)),
+        });
+    }
 
-    // iterate the directory and check if names are "rpmsgN"
-    const std::regex kNameRegex{"rpmsg\\d+"};
-    for(const auto &dent : std::filesystem::directory_iterator{"/dev/"}) {
-        std::smatch m;
-        if(!std::regex_match(dent.path().filename().native(), m, kNameRegex)) {
-            continue;
-        }
+    std::array<std::byte, 64> buf;
+    const auto payloadLen = cbor_serialize(root, reinterpret_cast<unsigned char *>(buf.data()) +
+            sizeof(struct rpc_header), buf.size() - sizeof(struct rpc_header));
+    cbor_decref(&root);
 
-        // try to open the file; then destroy the endpoint
-        try {
-            PLOG_VERBOSE << "destroying leftover ep " << dent.path().native();
+    if(!payloadLen) {
+        PLOG_ERROR << "failed to serialize link state";
+        return;
+    }
 
-            this->destroyRpcEndpoint(dent.path());
-            count++;
+    const struct rpc_header hdr{
+        .version = kRpcVersionLatest,
+        .length = static_cast<uint16_t>(sizeof(struct rpc_header) + payloadLen),
+        .endpoint = kRpcEndpointLinkState,
+        .tag = 0,
+        .flags = kRpcFlagBroadcast,
+    };
+    memcpy(buf.data(), &hdr, sizeof(hdr));
+
+    lrpc->broadcastPacket({buf.data(), hdr.length});
+}
+
+
+/**
+ * @brief Revoke a retrievable channel
+ *
+ * Destroy the channel's endpoint, which invalidates any file descriptors to it that a client may
+ * still hold, then create it anew.
+ *
+ * @param name Endpoint name of the channel to revoke
+ *
+ * @return File descriptor for the newly created channel
+ */
+int Coprocessor::revokeChannel(const std::string_view &name) {
+    auto info = std::find_if(this->rpcChannels.begin(), this->rpcChannels.end(),
+            [&](const auto &info) { return info.epName == name; });
+    auto detail = std::find_if(kRpcChannels.begin(), kRpcChannels.end(),
+            [&](const auto &detail) { return detail.name == name; });
+
+    if(info == this->rpcChannels.end() || detail == kRpcChannels.end()) {
+        throw std::invalid_argument(fmt::format("unknown channel '{}'", name));
+    }
+
+    // destroy the existing endpoint
+    if(info->chrdevFd != -1) {
+        try {
+            this->backend->destroyEndpoint(info->chrdevFd);
         } catch(const std::exception &e) {
-            PLOG_ERROR << "failed to destroy ep '" << dent.path() << "': " << e.what();
+            PLOG_ERROR << "failed to destroy ep '" << name << "': " << e.what();
         }
+
+        close(info->chrdevFd);
+        info->chrdevFd = -1;
     }
 
-    return count;
+    // then re-create it
+    const CoprocessorBackend::EndpointAddress address{detail->name, detail->address};
+    auto endpoint = this->backend->createEndpoints({&address, 1}).front();
+
+    info->chrdevPath = endpoint.path;
+    info->chrdevFd = endpoint.fd;
+
+    PLOG_DEBUG << "re-created endpoint " << fmt::format("{}:{:x}", detail->name, detail->address)
+               << " = " << info->chrdevPath.native();
+
+    return info->chrdevFd;
+}
+
+/**
+ * @brief Remove all retrievable channels from the RPC server
+ *
+ * This should be done before the channels are destroyed, so that they can't be leased anymore.
+ */
+void Coprocessor::unregisterChannels() {
+    auto rpc = this->lrpc.lock();
+    if(!rpc) {
+        return;
+    }
+
+    for(const auto &info : this->rpcChannels) {
+        if(info.isRetrievable) {
+            rpc->unregisterChannel(info.epName);
+        }
+    }
 }
 
 /**
- * @brief Destroy an RPC endpoint, given its path
+ * @brief Stop the rpmsg loop and destroy all endpoint handlers
  *
- * @param path Path to the rpmsg_chrdev device to destroy
+ * The loop's thread is stopped first, so that handlers are never destroyed while they may be
+ * running.
  */
-void Coprocessor::destroyRpcEndpoint(const std::filesystem::path &path) {
-    int fd = open(path.native().c_str(), O_RDWR);
-    if(fd == -1) {
-        throw std::system_error(errno, std::generic_category(), "open rpmsg_chrdev");
+void Coprocessor::destroyHandlers() {
+    if(this->rpmsgLoop) {
+        this->rpmsgLoop->stop();
     }
 
-    this->destroyRpcEndpoint(fd);
+    for(auto it = this->rpcChannels.rbegin(); it != this->rpcChannels.rend(); ++it) {
+        it->handler.reset();
+    }
 
-    close(fd);
+    this->rpmsgLoop.reset();
 }
 
 /**
- * @brief Destroy an RPC endpoint, given an open file descriptor
+ * @brief Close any open RPC endpoints
  *
- * This invokes the `RPMSG_DESTROY_EPT_IOCTL` ioctl which will remove this device.
+ * We'll iterate first through any endpoints we opened (and thus have the paths for) and then
+ * have the backend destroy any that were left over.
  *
- * @param fd File descriptor to invoke the destroy ioctl on
+ * @return Number of endpoints destroyed
  */
-void Coprocessor::destroyRpcEndpoint(const int fd) {
-    int err = ioctl(fd, RPMSG_DESTROY_EPT_IOCTL, nullptr);
-    if(err < 0) {
-        throw std::system_error(errno, std::generic_category(), "RPMSG_DESTROY_EPT_IOCTL");
+size_t Coprocessor::destroyAllRpcEndpoints() {
+    size_t count{0};
+
+    this->unregisterChannels();
+    this->destroyHandlers();
+
+    // start with any stored endpoints
+    for(auto it = this->rpcChannels.rbegin(); it != this->rpcChannels.rend(); ++it) {
+        const auto &info = *it;
+        PLOG_VERBOSE << "destroying endpoint " << info.epName << " (" << info.chrdevPath.native()
+                   << ")";
+
+        // a failed revoke leaves the channel without an endpoint
+        if(info.chrdevFd < 0) {
+            PLOG_WARNING << "ep '" << info.epName << "' has no fd (revoke failed), skipping";
+            continue;
+        }
+
+        try {
+            this->backend->destroyEndpoint(info.chrdevFd);
+            count++;
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "failed to destroy ep '" << info.epName << "': " << e.what();
+        }
+
+        // either way, close the fd
+        close(info.chrdevFd);
     }
+
+    this->rpcChannels.clear();
+
+    // then any other endpoints
+    count += this->backend->destroyLeftoverEndpoints();
+
+    return count;
 }
 
 
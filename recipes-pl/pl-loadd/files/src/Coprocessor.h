@@ -2,9 +2,12 @@
 #define COPROCESSOR_H
 
 #include <array>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <exception>
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <span>
 #include <stdexcept>
@@ -12,13 +15,21 @@
 #include <string_view>
 #include <vector>
 
+#include "CoprocessorBackend.h"
+#include "RpmsgLoop.h"
+#include "Stats.h"
+
 class RpcServer;
+struct event;
+struct event_base;
 
 /**
  * @brief Coprocessor wrapper class
  *
- * This is a thin wrapper around the coproc interface (exported to usermode via sysfs) and serves
- * to load the firmware, and start/stop the processor.
+ * This is a thin wrapper around the coproc interface and serves to load the firmware, start/stop
+ * the processor, and set up the handlers for its RPC endpoints. All access to the coprocessor
+ * itself goes through a backend; either the real hardware (exported to usermode via sysfs and the
+ * rpmsg chrdev) or a simulator.
  */
 class Coprocessor {
     public:
@@ -42,15 +53,45 @@ class Coprocessor {
                 }
                 virtual ~EndpointHandler() = default;
 
+                /**
+                 * @brief Callback invoked when the endpoint's channel hangs up
+                 *
+                 * This is invoked on the rpmsg thread.
+                 */
+                using LinkDownCallback = std::function<void()>;
+
+                /**
+                 * @brief Set the callback to invoke when the endpoint's channel hangs up
+                 */
+                void setLinkDownCallback(LinkDownCallback &&callback) {
+                    this->linkDownCallback = std::move(callback);
+                }
+
             protected:
                 static void DumpPacket(const std::string_view &what,
                         std::span<const std::byte> packet);
 
+                /**
+                 * @brief Notify the coprocessor that the endpoint's channel hung up
+                 *
+                 * Handlers should call this when reading from the channel fails, or it's closed;
+                 * this usually means the coprocessor crashed.
+                 */
+                void notifyLinkDown() {
+                    if(this->linkDownCallback) {
+                        this->linkDownCallback();
+                    }
+                }
+
                 /// File descriptor of the rpmsg_chrdev we'll handle messages for
                 int remoteEp;
+                /// Invoked when the channel hangs up
+                LinkDownCallback linkDownCallback;
         };
 
     public:
+        Coprocessor(std::unique_ptr<CoprocessorBackend> &&backend) :
+            backend(std::move(backend)) {}
         ~Coprocessor();
 
         /// States for the coprocessor to be in
@@ -67,6 +108,7 @@ class Coprocessor {
          * @brief Start the coprocessor
          */
         void start() {
+            this->startedAt = Stats::Now();
             this->setState(State::Running);
         }
 
@@ -79,6 +121,11 @@ class Coprocessor {
 
         void initRpc(const std::shared_ptr<RpcServer> &lrpc);
 
+        /// Get the number of times the coprocessor was recovered after a crash
+        constexpr inline auto getNumRecoveries() const {
+            return this->numRecoveries;
+        }
+
     private:
         /**
          * @brief Information for an RPC channel endpoint to establish during initialization
@@ -105,10 +152,12 @@ class Coprocessor {
              * processing all incoming messages on the endpoint.
              *
              * @param fd File descriptor of the rpmsg_chrdev
-             * @param lrpc Local RPC server (to get libevent loop from)
+             * @param loop rpmsg event loop the handler runs on
+             * @param lrpc Local RPC server (only to be accessed from its own loop)
              * @param outHandler Variable to receive the initialized handler
              */
-            void (*makeHandler)(const int fd, const std::shared_ptr<RpcServer> &lrpc,
+            void (*makeHandler)(const int fd, RpmsgLoop &loop,
+                    const std::shared_ptr<RpcServer> &lrpc,
                     std::shared_ptr<EndpointHandler> &outHandler);
         };
 
@@ -134,10 +183,10 @@ class Coprocessor {
         void setState(const State newState) {
             switch(newState) {
                 case State::Running:
-                    this->writeFile(kRprocSysfsBase, "state", "start");
+                    this->backend->start();
                     break;
                 case State::Stopped:
-                    this->writeFile(kRprocSysfsBase, "state", "stop");
+                    this->backend->stop();
                     break;
 
                 default:
@@ -147,48 +196,71 @@ class Coprocessor {
             this->coprocState = newState;
         }
 
-        /// Set the directory to search for firmware in
-        void setFirmwareDirectory(const std::string_view &directory) {
-            this->writeFile(kFirmwareSysfsBase, "path", directory);
-        }
-        /// Set the firmware file name to load
-        void setFirmwareFilename(const std::string_view &filename) {
-            this->writeFile(kRprocSysfsBase, "firmware", filename);
-        }
+        void initRpcAsync(const std::shared_ptr<RpcServer> &lrpc,
+                std::function<void(std::exception_ptr)> &&callback);
+        void prepareRpc(const std::shared_ptr<RpcServer> &lrpc);
+        void setupChannels(const std::shared_ptr<RpcServer> &lrpc,
+                std::vector<CoprocessorBackend::Endpoint> &endpoints);
 
-        void writeFile(const std::string_view &, const std::string_view &,
-                const std::string_view &);
+        void initMonitor(struct event_base *evbase);
+        void checkState();
+        void handleLinkDown(const size_t generation);
+        void beginRecovery(const std::string_view &reason);
+        void recover();
+        void finishRecovery(std::exception_ptr error);
+        void retryRecovery(const std::string_view &what);
+        void broadcastLinkState(const bool isUp, const uint64_t recoveryTime = 0);
 
-        void connectRpcEndpoint(const std::string_view &name, const uint32_t address,
-                std::filesystem::path &outChrdevPath);
+        int revokeChannel(const std::string_view &name);
+        void unregisterChannels();
+        void destroyHandlers();
 
         size_t destroyAllRpcEndpoints();
-        void destroyRpcEndpoint(const std::filesystem::path &chrdevPath);
-        void destroyRpcEndpoint(const int fd);
 
     private:
         /// Number of endpoints to establish devices for
-        constexpr static const size_t kNumRpcEndpoints{2};
+        constexpr static const size_t kNumRpcEndpoints{3};
         /// RPC endpoints to establish during connection
         static const std::array<EndpointInfo, kNumRpcEndpoints> kRpcChannels;
 
-        /// Path of the "firmware base path" sysfs variable
-        constexpr static const std::string_view kFirmwareSysfsBase{"/sys/module/firmware_class/parameters/"};
-        /// Remoteproc base path
-        constexpr static const std::string_view kRprocSysfsBase{"/dev/remoteproc/m4/"};
-
-        /// rpmsg control device file
-        constexpr static const std::string_view kRpmsgCtrlDev{"/dev/rpmsg_ctrl0"};
-        /// base path of the rpmsg chrdev files
-        constexpr static const std::string_view kRpmsgChrdevBase{"/dev/rpmsg"};
+        static std::array<CoprocessorBackend::EndpointAddress, kNumRpcEndpoints>
+            GetEndpointAddresses();
 
-        /// file descriptor to the rpmsg control interface
-        int rpmsgCtrlFd{-1};
+        /// Backend providing access to the coprocessor
+        std::unique_ptr<CoprocessorBackend> backend;
         /// most recently set coprocessor state
         State coprocState{State::Unknown};
+        /// Timestamp at which the coprocessor was last started
+        uint64_t startedAt{0};
+        /// Firmware most recently loaded (reloaded to recover from a crash)
+        std::filesystem::path fwPath;
+
+        /// Shortest delay before retrying a failed recovery
+        constexpr static const std::chrono::milliseconds kRecoveryMinDelay{100};
+        /// Longest delay before retrying a failed recovery
+        constexpr static const std::chrono::milliseconds kRecoveryMaxDelay{10'000};
+
+        /// Timer to periodically check whether the coprocessor is still running
+        struct event *checkEvent{nullptr};
+        /// Backend state change notification event (if the backend supports it)
+        struct event *stateEvent{nullptr};
+        /// Timer to run (or retry) recovery after a crash
+        struct event *recoveryEvent{nullptr};
+        /// Delay before the next recovery attempt (if it fails)
+        std::chrono::milliseconds recoveryDelay{kRecoveryMinDelay};
+        /// Incremented whenever the channels are torn down; stale link down reports are ignored
+        size_t generation{0};
+        /// Timestamp at which the crash being recovered from was detected
+        uint64_t crashedAt{0};
+        /// Number of successful recoveries
+        size_t numRecoveries{0};
 
+        /// Event loop (and thread) on which all endpoint handlers run
+        std::unique_ptr<RpmsgLoop> rpmsgLoop;
         /// initialized RPC channels
         std::vector<RpcChannelInfo> rpcChannels;
+        /// Local RPC server (retrievable channels are registered with it)
+        std::weak_ptr<RpcServer> lrpc;
 };
 
 #endif
@@ -0,0 +1,133 @@
+#ifndef COPROCESSORBACKEND_H
+#define COPROCESSORBACKEND_H
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+struct event_base;
+
+/**
+ * @brief Interface between the `Coprocessor` and the (real or simulated) hardware
+ *
+ * A backend manages the coprocessor's firmware and run state, and creates the channels for its
+ * RPC endpoints. Each channel is a file descriptor that carries one message per read or write,
+ * like the rpmsg chrdev does.
+ */
+class CoprocessorBackend {
+    public:
+        /**
+         * @brief Identifies an endpoint to create
+         */
+        struct EndpointAddress {
+            /// Endpoint name
+            std::string_view name;
+            /// Endpoint address (fixed in firmware)
+            uint32_t address;
+        };
+
+        /**
+         * @brief An endpoint that was created
+         */
+        struct Endpoint {
+            /// Path to the endpoint's device (for diagnostics)
+            std::filesystem::path path;
+            /// File descriptor for the endpoint's channel; owned by the caller
+            int fd{-1};
+        };
+
+        /// Invoked once endpoints were created asynchronously; the error is set if that failed
+        using CreateEndpointsCallback = std::function<void(std::vector<Endpoint> &&,
+                std::exception_ptr)>;
+
+        virtual ~CoprocessorBackend() = default;
+
+        /**
+         * @brief Select the firmware to run on the coprocessor
+         */
+        virtual void loadFirmware(const std::filesystem::path &fwPath) = 0;
+        /**
+         * @brief Start the coprocessor
+         */
+        virtual void start() = 0;
+        /**
+         * @brief Stop the coprocessor
+         */
+        virtual void stop() = 0;
+        /**
+         * @brief Determine whether the coprocessor is running
+         *
+         * Used to detect crashes: a coprocessor that was started but isn't running has crashed.
+         */
+        virtual bool isRunning() = 0;
+
+        /**
+         * @brief Get a file descriptor that becomes readable when the state may have changed
+         *
+         * @return File descriptor (owned by the backend) or -1 if not supported, in which case
+         *         the state is only checked periodically
+         */
+        virtual int getStateEventFd() {
+            return -1;
+        }
+        /**
+         * @brief Discard pending state change notifications
+         *
+         * Called once the state event file descriptor became readable.
+         */
+        virtual void drainStateEvents() {}
+
+        /**
+         * @brief Create and open the given endpoints
+         *
+         * @return Opened endpoints, in the same order as the addresses
+         */
+        virtual std::vector<Endpoint> createEndpoints(
+                std::span<const EndpointAddress> addresses) = 0;
+        /**
+         * @brief Create and open the given endpoints, without blocking
+         *
+         * Any waiting is done on the given event loop, and the callback is invoked on it once the
+         * endpoints were opened (in the same order as the addresses) or creating them failed.
+         * Starting another request cancels one still in progress, without invoking its callback.
+         *
+         * The default implementation creates the endpoints right away, so the callback is invoked
+         * before this returns.
+         */
+        virtual void createEndpointsAsync(struct event_base *,
+                std::span<const EndpointAddress> addresses, CreateEndpointsCallback &&callback) {
+            std::vector<Endpoint> endpoints;
+
+            try {
+                endpoints = this->createEndpoints(addresses);
+            } catch(const std::exception &) {
+                callback({}, std::current_exception());
+                return;
+            }
+
+            callback(std::move(endpoints), nullptr);
+        }
+        /**
+         * @brief Cancel an asynchronous endpoint creation that's in progress, if any
+         */
+        virtual void cancelCreateEndpoints() {}
+        /**
+         * @brief Destroy an endpoint, given its file descriptor
+         *
+         * @remark The file descriptor must still be closed by the caller.
+         */
+        virtual void destroyEndpoint(const int fd) = 0;
+        /**
+         * @brief Destroy any endpoints left over (from a previous run)
+         *
+         * @return Number of endpoints destroyed
+         */
+        virtual size_t destroyLeftoverEndpoints() = 0;
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include <cbor.h>
+
+#include <cstring>
+#include <stdexcept>
+
+#include <fmt/format.h>
+
+#include "ControlFrameTypes.h"
+#include "MeasurementCodec.h"
+
+/**
+ * @brief Decode a binary measurement frame
+ *
+ * The frame is simply copied out of the payload; frames longer than we know about (from newer
+ * firmware) are accepted, with the additional fields ignored.
+ *
+ * @param payload Payload of the measurement broadcast
+ * @param sequence If not null, receives the frame's sequence number
+ */
+struct measurement_record MeasurementCodec::DecodeFrame(std::span<const std::byte> payload,
+        uint32_t *sequence) {
+    struct control_measurement_frame frame;
+
+    if(payload.size() < sizeof(frame)) {
+        throw std::runtime_error(fmt::format("measurement frame too short ({} bytes)",
+                    payload.size()));
+    }
+    memcpy(&frame, payload.data(), sizeof(frame));
+
+    if(frame.version != kControlFrameVersion) {
+        throw std::runtime_error(fmt::format("unsupported measurement frame version ${:02x}",
+                    frame.version));
+    }
+
+    if(sequence) {
+        *sequence = frame.sequence;
+    }
+
+    return {
+        .voltage = frame.voltage,
+        .current = frame.current,
+        .temperature = frame.temperature,
+        .status = frame.status,
+    };
+}
+
+/**
+ * @brief Decode a CBOR measurement message
+ *
+ * Decode the measurement values from the broadcast's CBOR payload, a map with the keys "v", "i"
+ * and "t" (voltage, current and temperature) into a record for the shared memory ring.
+ *
+ * @param payload Payload of the measurement broadcast
+ */
+struct measurement_record MeasurementCodec::DecodeCbor(std::span<const std::byte> payload) {
+    struct measurement_record record{};
+
+    // decode the payload
+    struct cbor_load_result result{};
+    auto item = cbor_load(reinterpret_cast<const cbor_data>(payload.data()), payload.size(),
+            &result);
+    if(result.error.code != CBOR_ERR_NONE) {
+        throw std::runtime_error(fmt::format("cbor_load failed: {} (at ${:x})", result.error.code,
+                    result.error.position));
+    }
+
+    if(!cbor_isa_map(item)) {
+        cbor_decref(&item);
+        throw std::runtime_error("invalid measurement payload: expected map");
+    }
+
+    auto pairs = cbor_map_handle(item);
+    for(size_t i = 0; i < cbor_map_size(item); i++) {
+        const auto &pair = pairs[i];
+        if(!cbor_isa_string(pair.key) || cbor_string_length(pair.key) != 1 ||
+                !cbor_isa_float_ctrl(pair.value) || !cbor_is_float(pair.value)) {
+            continue;
+        }
+
+        const auto value = static_cast<float>(cbor_float_get_float(pair.value));
+
+        switch(*cbor_string_handle(pair.key)) {
+            case 'v':
+                record.voltage = value;
+                break;
+            case 'i':
+                record.current = value;
+                break;
+            case 't':
+                record.temperature = value;
+                break;
+        }
+    }
+
+    cbor_decref(&item);
+
+    return record;
+}
+
+/**
+ * @brief Encode a measurement as CBOR
+ *
+ * Produces the same map that older firmware sends (with the keys "v", "i" and "t") plus the
+ * status bits under the key "s". It's written with the streaming encoder, so nothing is
+ * allocated.
+ *
+ * @param record Measurement to encode
+ * @param out Buffer to receive the payload
+ *
+ * @return Number of bytes written, or 0 if the buffer is too small
+ */
+size_t MeasurementCodec::EncodeCbor(const struct measurement_record &record,
+        std::span<std::byte> out) {
+    auto buf = reinterpret_cast<unsigned char *>(out.data());
+    size_t offset{0};
+    bool overflow{false};
+
+    // encode one item; encoders return 0 if it doesn't fit
+    auto encode = [&](auto encoder, auto value) {
+        if(overflow) {
+            return;
+        }
+
+        const auto written = encoder(value, buf + offset, out.size() - offset);
+        overflow = !written;
+        offset += written;
+    };
+    auto encodeKey = [&](const char key) {
+        encode(cbor_encode_string_start, 1);
+        if(overflow || offset == out.size()) {
+            overflow = true;
+            return;
+        }
+        buf[offset++] = static_cast<unsigned char>(key);
+    };
+
+    encode(cbor_encode_map_start, 4);
+    encodeKey('v');
+    encode(cbor_encode_single, record.voltage);
+    encodeKey('i');
+    encode(cbor_encode_single, record.current);
+    encodeKey('t');
+    encode(cbor_encode_single, record.temperature);
+    encodeKey('s');
+    encode(cbor_encode_uint32, record.status);
+
+    return overflow ? 0 : offset;
+}
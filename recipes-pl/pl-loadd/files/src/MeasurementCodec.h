@@ -0,0 +1,30 @@
+#ifndef MEASUREMENTCODEC_H
+#define MEASUREMENTCODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "MeasurementRingTypes.h"
+
+/**
+ * @brief Encoding and decoding of measurement messages
+ *
+ * The coprocessor reports measurements either as fixed layout binary frames, or (for older
+ * firmware) as a CBOR map. Local RPC clients always receive the CBOR form.
+ *
+ * Decoded records don't have their timestamp or sequence set; that's up to the caller.
+ *
+ * @seeAlso ControlFrameTypes.h
+ */
+class MeasurementCodec {
+    public:
+        static struct measurement_record DecodeFrame(std::span<const std::byte> payload,
+                uint32_t *sequence = nullptr);
+        static struct measurement_record DecodeCbor(std::span<const std::byte> payload);
+
+        static size_t EncodeCbor(const struct measurement_record &record,
+                std::span<std::byte> out);
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include <cbor.h>
+
+#include <algorithm>
+
+#include "MeasurementConflator.h"
+
+/**
+ * @brief Add a measurement to the current interval
+ */
+void MeasurementConflator::update(const struct measurement_record &record) {
+    auto &s = this->current;
+
+    auto add = [first = !s.count](Channel &channel, const float value) {
+        channel.last = value;
+        channel.min = first ? value : std::min(channel.min, value);
+        channel.max = first ? value : std::max(channel.max, value);
+        channel.sum += value;
+    };
+
+    if(!s.count) {
+        s.firstTimestamp = record.timestamp;
+    }
+    s.lastTimestamp = record.timestamp;
+    s.count++;
+
+    add(s.voltage, record.voltage);
+    add(s.current, record.current);
+    add(s.temperature, record.temperature);
+}
+
+/**
+ * @brief Get the summary of the current interval, and begin a new one
+ */
+MeasurementConflator::Summary MeasurementConflator::take() {
+    const auto summary = this->current;
+    this->current = {};
+    return summary;
+}
+
+/**
+ * @brief Serialize a summary as a CBOR payload
+ *
+ * The payload is a map with the keys `n` (number of measurements), `t0` and `t1` (timestamps of
+ * the first and last measurement) and `v`, `i` and `t` (voltage, current and temperature); each
+ * of the latter is a map with the keys `last`, `min`, `max` and `mean`.
+ *
+ * @param summary Summary to serialize
+ * @param out Buffer to receive the payload
+ *
+ * @return Number of bytes written, or 0 if the buffer is too small
+ */
+size_t MeasurementConflator::Serialize(const Summary &summary, std::span<std::byte> out) {
+    auto buildChannel = [count = summary.count](const Channel &channel) {
+        auto map = cbor_new_definite_map(4);
+        cbor_map_add(map, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("last")),
+            .value = cbor_move(cbor_build_float4(channel.last)),
+        });
+        cbor_map_add(map, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("min")),
+            .value = cbor_move(cbor_build_float4(channel.min)),
+        });
+        cbor_map_add(map, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("max")),
+            .value = cbor_move(cbor_build_float4(channel.max)),
+        });
+        cbor_map_add(map, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("mean")),
+            .value = cbor_move(cbor_build_float4(channel.getMean(count))),
+        });
+        return map;
+    };
+
+    auto root = cbor_new_definite_map(6);
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("n")),
+        .value = cbor_move(cbor_build_uint32(summary.count)),
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("t0")),
+        .value = cbor_move(cbor_build_uint64(summary.firstTimestamp)),
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("t1")),
+        .value = cbor_move(cbor_build_uint64(summary.lastTimestamp)),
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("v")),
+        .value = cbor_move(buildChannel(summary.voltage)),
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("i")),
+        .value = cbor_move(buildChannel(summary.current)),
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("t")),
+        .value = cbor_move(buildChannel(summary.temperature)),
+    });
+
+    const auto written = cbor_serialize(root, reinterpret_cast<unsigned char *>(out.data()),
+            out.size());
+    cbor_decref(&root);
+
+    return written;
+}
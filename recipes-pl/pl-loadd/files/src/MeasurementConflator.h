@@ -0,0 +1,65 @@
+#ifndef MEASUREMENTCONFLATOR_H
+#define MEASUREMENTCONFLATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+#include "MeasurementRingTypes.h"
+
+/**
+ * @brief Aggregates measurements over a delivery interval
+ *
+ * Rather than sending every measurement to a client, the measurements received between two
+ * deliveries are conflated into a single summary: the latest value, plus the minimum, maximum
+ * and mean over the interval, for each channel.
+ */
+class MeasurementConflator {
+    public:
+        /**
+         * @brief Summary of a single channel over an interval
+         */
+        struct Channel {
+            /// Most recent value
+            float last{0};
+            /// Smallest value
+            float min{0};
+            /// Largest value
+            float max{0};
+            /// Sum of all values (to compute the mean)
+            double sum{0};
+
+            /// Get the mean of all values
+            constexpr inline float getMean(const size_t count) const {
+                return count ? static_cast<float>(this->sum / count) : this->last;
+            }
+        };
+
+        /**
+         * @brief Summary of all measurements over an interval
+         */
+        struct Summary {
+            /// Number of measurements aggregated
+            size_t count{0};
+            /// Timestamp of the first and last measurement (nanoseconds, CLOCK_MONOTONIC)
+            uint64_t firstTimestamp{0}, lastTimestamp{0};
+
+            Channel voltage, current, temperature;
+        };
+
+        void update(const struct measurement_record &record);
+        Summary take();
+
+        /// Whether any measurements were aggregated since the last summary was taken
+        constexpr inline bool isEmpty() const {
+            return !this->current.count;
+        }
+
+        static size_t Serialize(const Summary &summary, std::span<std::byte> out);
+
+    private:
+        /// Summary of the current interval
+        Summary current;
+};
+
+#endif
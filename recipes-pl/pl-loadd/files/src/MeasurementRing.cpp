@@ -0,0 +1,123 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <plog/Log.h>
+
+#include "MeasurementRing.h"
+
+/**
+ * @brief Create the measurement ring
+ *
+ * Allocate a memfd large enough for the ring header and all records, map it, and initialize the
+ * header. The memfd is then sealed, so that clients can neither resize it nor map it writable.
+ *
+ * @param capacity Number of records in the ring; must be a power of two
+ */
+MeasurementRing::MeasurementRing(const size_t capacity) {
+    int err;
+
+    if(!std::has_single_bit(capacity)) {
+        throw std::invalid_argument("ring capacity must be a power of two");
+    }
+
+    // create the memfd and size it
+    this->size = sizeof(struct measurement_ring_header) +
+        (capacity * sizeof(struct measurement_record));
+
+    this->fd = memfd_create("loadd-measurements", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(this->fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "memfd_create");
+    }
+
+    err = ftruncate(this->fd, this->size);
+    if(err == -1) {
+        close(this->fd);
+        throw std::system_error(errno, std::generic_category(), "ftruncate measurement ring");
+    }
+
+    // map it and initialize the header
+    auto base = mmap(nullptr, this->size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+    if(base == MAP_FAILED) {
+        close(this->fd);
+        throw std::system_error(errno, std::generic_category(), "mmap measurement ring");
+    }
+
+    this->header = reinterpret_cast<struct measurement_ring_header *>(base);
+    this->records = reinterpret_cast<struct measurement_record *>(
+            reinterpret_cast<std::byte *>(base) + sizeof(struct measurement_ring_header));
+
+    memset(base, 0, this->size);
+
+    this->header->magic = kMeasurementRingMagic;
+    this->header->version = kMeasurementRingVersion;
+    this->header->headerSize = sizeof(struct measurement_ring_header);
+    this->header->recordSize = sizeof(struct measurement_record);
+    this->header->capacity = capacity;
+
+    // prevent clients from resizing or writing to the ring
+    int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+#ifdef F_SEAL_FUTURE_WRITE
+    seals |= F_SEAL_FUTURE_WRITE;
+#endif
+
+    err = fcntl(this->fd, F_ADD_SEALS, seals);
+    if(err == -1) {
+        PLOG_WARNING << "failed to seal measurement ring: " << strerror(errno);
+    }
+
+    PLOG_VERBOSE << "measurement ring: " << capacity << " records (" << this->size << " bytes)";
+}
+
+/**
+ * @brief Release the ring's resources
+ *
+ * Unmap the ring and close our handle to the memfd. Clients that have it mapped will keep their
+ * mapping, but won't receive any new records.
+ */
+MeasurementRing::~MeasurementRing() {
+    if(this->header) {
+        munmap(this->header, this->size);
+    }
+    if(this->fd != -1) {
+        close(this->fd);
+    }
+}
+
+/**
+ * @brief Publish a measurement into the ring
+ *
+ * Write the record into the next slot (overwriting the oldest record, if the ring is full) then
+ * advance the write index.
+ *
+ * @param record Measurement to publish; its sequence field is ignored
+ */
+void MeasurementRing::publish(const struct measurement_record &record) {
+    const auto index = this->writeIndex;
+    auto &slot = this->records[index & (this->header->capacity - 1)];
+
+    // invalidate the slot while it's being written
+    std::atomic_ref<uint64_t> sequence(slot.sequence);
+    sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.timestamp = record.timestamp;
+    slot.voltage = record.voltage;
+    slot.current = record.current;
+    slot.temperature = record.temperature;
+    slot.status = record.status;
+
+    // then mark it as valid, and make it visible to readers
+    sequence.store(index + 1, std::memory_order_release);
+
+    this->writeIndex = index + 1;
+    std::atomic_ref<uint64_t>(this->header->writeIndex).store(this->writeIndex,
+            std::memory_order_release);
+}
@@ -0,0 +1,51 @@
+#ifndef MEASUREMENTRING_H
+#define MEASUREMENTRING_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "MeasurementRingTypes.h"
+
+/**
+ * @brief Shared memory measurement ring
+ *
+ * A lock-free, single producer/multiple consumer ring buffer of fixed layout measurement records,
+ * backed by a memfd. Local clients receive the file descriptor over the RPC socket and map it to
+ * read measurements without any per-sample syscalls.
+ *
+ * @seeAlso MeasurementRingTypes.h
+ */
+class MeasurementRing {
+    public:
+        MeasurementRing(const size_t capacity = kDefaultCapacity);
+        ~MeasurementRing();
+
+        void publish(const struct measurement_record &record);
+
+        /**
+         * @brief Get the file descriptor of the ring's memfd
+         *
+         * @remark The ring retains ownership of the descriptor.
+         */
+        constexpr inline auto getFd() const {
+            return this->fd;
+        }
+
+    private:
+        /// Default number of records in the ring (~8 seconds of data at 500 Hz)
+        constexpr static const size_t kDefaultCapacity{4096};
+
+        /// memfd backing the ring
+        int fd{-1};
+        /// Total size of the shared memory region
+        size_t size{0};
+
+        /// Ring header (at the start of the mapping)
+        struct measurement_ring_header *header{nullptr};
+        /// Records (immediately following the header)
+        struct measurement_record *records{nullptr};
+        /// Index of the next record to write
+        uint64_t writeIndex{0};
+};
+
+#endif
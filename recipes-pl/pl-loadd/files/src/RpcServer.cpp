@@ -1,12 +1,18 @@
 #include <fcntl.h>
+#include <grp.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <cbor.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cerrno>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <filesystem>
 #include <system_error>
 
 #include <event2/event.h>
@@ -14,15 +20,53 @@
 #include <event2/bufferevent.h>
 #include <fmt/format.h>
 #include <plog/Log.h>
+#include <load-common/Utils/Cbor.h>
 
+#include "Capture.h"
 #include "Config.h"
+#include "MeasurementCodec.h"
+#include "MeasurementRing.h"
 #include "RpcServer.h"
 #include "RpcTypes.h"
+#include "Stats.h"
 #include "Watchdog.h"
 
+namespace Mmsg = PlCommon::Util::Mmsg;
+
 // declared in main.cpp
 extern std::atomic_bool gRun;
 
+const std::array<RpcServer::EndpointInfo, 256> RpcServer::kEndpoints = []{
+    std::array<EndpointInfo, 256> table{};
+
+    table[kRpcEndpointNoOp] = {
+        .format = PayloadFormat::Raw,
+        .rawHandler = &RpcServer::handleNoOp,
+    };
+    table[kRpcEndpointMeasurementRing] = {
+        .format = PayloadFormat::Raw,
+        .rawHandler = &RpcServer::handleMeasurementRing,
+    };
+    table[kRpcEndpointRetrieveChannel] = {
+        .format = PayloadFormat::Cbor,
+        .cborHandler = &RpcServer::handleRetrieveChannel,
+    };
+    table[kRpcEndpointStats] = {
+        .format = PayloadFormat::Cbor,
+        .cborHandler = &RpcServer::handleStats,
+    };
+    table[kRpcEndpointCapture] = {
+        .format = PayloadFormat::Cbor,
+        .cborHandler = &RpcServer::handleCapture,
+    };
+    table[kRpcEndpointMeasurementSubscribe] = {
+        .format = PayloadFormat::Cbor,
+        .cborHandler = &RpcServer::handleMeasurementSubscribe,
+    };
+
+    return table;
+}();
+
 /**
  * @brief Initialize the listening socket
  *
@@ -92,13 +136,18 @@ void RpcServer::initEventLoop() {
     this->initWatchdogEvent();
     this->initSignalEvents();
     this->initSocketEvent();
+
+    if(Config::GetRpcBatchedIo()) {
+        this->initBatchedIo();
+    }
 }
 
 /**
  * @brief Create watchdog event
  *
  * Create a timer event with half of the period of the watchdog timer. Every time the event fires,
- * it will kick the watchdog to ensure we don't get killed.
+ * it will kick the watchdog to ensure we don't get killed, as long as all other event loops have
+ * checked in as well.
  */
 void RpcServer::initWatchdogEvent() {
     // bail if watchdog is disabled
@@ -110,9 +159,12 @@ void RpcServer::initWatchdogEvent() {
     // get interval
     const auto usec = Watchdog::GetInterval().count() / 2;
 
-    // create and add event
+    // create and add event; the event firing indicates the RPC loop is alive
+    this->watchdogCheckin = Watchdog::AddCheckin();
+
     this->watchdogEvent = event_new(this->evbase, -1, EV_PERSIST, [](auto, auto, auto ctx) {
-        Watchdog::Kick();
+        Watchdog::Checkin(reinterpret_cast<RpcServer *>(ctx)->watchdogCheckin);
+        Watchdog::KickIfAlive();
     }, this);
     if(!this->watchdogEvent) {
         throw std::runtime_error("failed to allocate watchdog event");
@@ -169,6 +221,35 @@ void RpcServer::initSocketEvent() {
     event_add(this->listenEvent, nullptr);
 }
 
+/**
+ * @brief Set up batched client IO
+ *
+ * Allocate the receive buffer for recvmmsg, and the event used to flush all queued client
+ * messages at the end of an event loop iteration.
+ */
+void RpcServer::initBatchedIo() {
+    PLOG_INFO << "using batched rpc io";
+
+    this->batchRxBuf.resize(Mmsg::kBatchSize * Mmsg::kMaxMessageSize);
+
+    this->batchFlushEvent = event_new(this->evbase, -1, 0, [](auto, auto, auto ctx) {
+        reinterpret_cast<RpcServer *>(ctx)->flushBatchedClients();
+    }, this);
+    if(!this->batchFlushEvent) {
+        throw std::runtime_error("failed to allocate batch flush event");
+    }
+}
+
+/**
+ * @brief Create the shared memory measurement ring
+ *
+ * Measurements received from the coprocessor are published into this ring, which clients can
+ * retrieve with the measurement ring endpoint.
+ */
+void RpcServer::initMeasurementRing() {
+    this->measurementRing = std::make_unique<MeasurementRing>();
+}
+
 /**
  * @brief Shut down the RPC server
  *
@@ -204,6 +285,9 @@ RpcServer::~RpcServer() {
     if(this->watchdogEvent) {
         event_free(this->watchdogEvent);
     }
+    if(this->batchFlushEvent) {
+        event_free(this->batchFlushEvent);
+    }
 
     // shut down event loop
     event_base_free(this->evbase);
@@ -249,76 +333,246 @@ void RpcServer::acceptClient() {
     PLOG_DEBUG << "Accepted client " << fd << " (" << this->clients.size() << " total)";
 }
 
+/**
+ * @brief Validate a message header received from a client
+ *
+ * Ensure the version is supported, and that the length is at least large enough to cover the
+ * header itself.
+ */
+static void ValidateHeader(const struct rpc_header *hdr) {
+    if(hdr->version != kRpcVersionLatest) {
+        throw std::runtime_error(fmt::format("unsupported rpc version ${:04x}", hdr->version));
+    } else if(hdr->length < sizeof(struct rpc_header)) {
+        throw std::runtime_error(fmt::format("invalid header length ({}, too short)",
+                    hdr->length));
+    }
+}
+
 /**
  * @brief A client connection is ready to read
  *
- * Reads data from the given client connection.
+ * Walk the client's input buffer and dispatch every complete message in it. Messages are handed
+ * to the endpoint handlers directly out of the input buffer; any trailing partial message is left
+ * in the buffer, and the read watermark raised so we're not invoked again until it's complete.
  */
 void RpcServer::handleClientRead(struct bufferevent *ev) {
     // get client struct
-    auto &client = this->clients.at(ev);
-
-    // read client data
-    /**
-     * TODO: rework this so data is buffered over time in the client receive buffer, rather than
-     * being overwritten each time, in case clients decide to do partial writes down the line!
-     */
+    auto client = this->clients.at(ev);
     auto buf = bufferevent_get_input(ev);
-    const size_t pending = evbuffer_get_length(buf);
 
-    client->receiveBuf.resize(pending);
-    int read = evbuffer_remove(buf, static_cast<void *>(client->receiveBuf.data()), pending);
+    size_t pending;
+    while((pending = evbuffer_get_length(buf)) >= sizeof(struct rpc_header)) {
+        // read the header
+        auto hdr = reinterpret_cast<const struct rpc_header *>(
+                evbuffer_pullup(buf, sizeof(struct rpc_header)));
+        if(!hdr) {
+            throw std::runtime_error("failed to pull up client message header");
+        }
 
-    if(read == -1) {
-        throw std::runtime_error("failed to drain client read buffer");
-    }
+        ValidateHeader(hdr);
+
+        // wait for the remainder of the message to arrive
+        const size_t msgLen = hdr->length;
+        if(pending < msgLen) {
+            bufferevent_setwatermark(ev, EV_READ, msgLen, EV_RATE_LIMIT_MAX);
+            return;
+        }
 
-    // read the header
-    if(read < sizeof(struct rpc_header)) {
-        // we haven't yet read enough bytes; this should never happen, so abort
-        throw std::runtime_error(fmt::format("read too few bytes ({}) from client", read));
+        /*
+         * Ensure the entire message is contiguous. This is almost always already the case, in
+         * which case the pullup is free; otherwise account for the bytes it copied.
+         */
+        struct evbuffer_iovec vec;
+        if(evbuffer_peek(buf, msgLen, nullptr, &vec, 1) != 1) {
+            client->rxBytesCopied += msgLen;
+        }
+
+        hdr = reinterpret_cast<const struct rpc_header *>(evbuffer_pullup(buf, msgLen));
+        if(!hdr) {
+            throw std::runtime_error("failed to pull up client message");
+        }
+
+        client->rxMessages++;
+
+        // dispatch, then discard the message
+        this->handleClientMessage(client, hdr, {reinterpret_cast<const std::byte *>(hdr->payload),
+                msgLen - sizeof(struct rpc_header)});
+
+        if(evbuffer_drain(buf, msgLen) == -1) {
+            throw std::runtime_error("failed to drain client read buffer");
+        }
     }
 
-    const auto hdr = reinterpret_cast<const struct rpc_header *>(client->receiveBuf.data());
+    // reset watermark so we get invoked for the next header
+    bufferevent_setwatermark(ev, EV_READ, sizeof(struct rpc_header), EV_RATE_LIMIT_MAX);
+}
 
-    if(hdr->version != kRpcVersionLatest) {
-        throw std::runtime_error(fmt::format("unsupported rpc version ${:04x}", hdr->version));
-    } else if(hdr->length < sizeof(struct rpc_header)) {
-        throw std::runtime_error(fmt::format("invalid header length ({}, too short)",
-                    hdr->length));
+/**
+ * @brief A client connection is ready to read (batched IO)
+ *
+ * Read up to a batch worth of datagrams from the client's socket, and process the messages in
+ * each of them.
+ */
+void RpcServer::handleClientBatchRead(struct bufferevent *ev) {
+    auto client = this->clients.at(ev);
+
+    const auto result = Mmsg::Receive(client->socket, this->batchRxBuf,
+            client->batchRxStats, [&](auto datagram) {
+        this->handleClientDatagram(client, datagram);
+    });
+
+    if(result == Mmsg::RecvResult::Closed) {
+        this->handleClientEvent(ev, BEV_EVENT_EOF);
     }
+}
 
-    const auto payloadLen = hdr->length - sizeof(struct rpc_header);
-    if(payloadLen > client->receiveBuf.size()) {
-        throw std::runtime_error(fmt::format("invalid header length ({}, too long)",
-                    hdr->length));
+/**
+ * @brief Process all messages in a received datagram
+ *
+ * Datagrams usually contain exactly one message, but a client may have written several messages
+ * at once. Messages may not span multiple datagrams.
+ *
+ * @param client Client that sent the datagram
+ * @param datagram Contents of the datagram
+ */
+void RpcServer::handleClientDatagram(const std::shared_ptr<Client> &client,
+        std::span<const std::byte> datagram) {
+    while(!datagram.empty()) {
+        if(datagram.size() < sizeof(struct rpc_header)) {
+            throw std::runtime_error(fmt::format("read too few bytes ({}) from client",
+                        datagram.size()));
+        }
+
+        auto hdr = reinterpret_cast<const struct rpc_header *>(datagram.data());
+        ValidateHeader(hdr);
+
+        if(hdr->length > datagram.size()) {
+            throw std::runtime_error(fmt::format("invalid header length ({}, too long)",
+                        hdr->length));
+        }
+
+        client->rxMessages++;
+
+        this->handleClientMessage(client, hdr, datagram.subspan(sizeof(struct rpc_header),
+                    hdr->length - sizeof(struct rpc_header)));
+        datagram = datagram.subspan(hdr->length);
     }
+}
+
+/**
+ * @brief Mark a client as having messages to send (batched IO)
+ *
+ * The client's output buffer will be flushed at the end of the current event loop iteration.
+ */
+void RpcServer::scheduleBatchFlush(struct bufferevent *ev) {
+    this->batchDirtyClients.insert(ev);
+    event_active(this->batchFlushEvent, EV_TIMEOUT, 0);
+}
 
-    // decode as CBOR, if desired
-    struct cbor_load_result result{};
+/**
+ * @brief Send messages queued for all clients (batched IO)
+ */
+void RpcServer::flushBatchedClients() {
+    auto dirty = std::move(this->batchDirtyClients);
+    this->batchDirtyClients.clear();
 
-    auto item = cbor_load(reinterpret_cast<const cbor_data>(hdr->payload), payloadLen,
-            &result);
-    if(result.error.code != CBOR_ERR_NONE) {
-        throw std::runtime_error(fmt::format("cbor_load failed: {} (at ${:x})", result.error.code,
-                    result.error.position));
+    for(auto ev : dirty) {
+        this->flushClient(ev);
+    }
+}
+
+/**
+ * @brief Send all messages queued for a client
+ *
+ * The client's output buffer is sent with as few `sendmmsg` calls as possible, one datagram per
+ * message. If the socket would block, we'll wait for it to become writable before continuing.
+ */
+void RpcServer::flushClient(struct bufferevent *ev) {
+    auto it = this->clients.find(ev);
+    if(it == this->clients.end()) {
+        return;
     }
 
-    // invoke endpoint handler
+    auto client = it->second;
+    auto output = bufferevent_get_output(ev);
+
     try {
-        switch(hdr->endpoint) {
-            // TODO: implement
+        if(!client->transmit()) {
+            event_add(client->writeEvent, nullptr);
+        }
 
-            default:
-                throw std::runtime_error(fmt::format("unknown rpc endpoint ${:02x}", hdr->endpoint));
+        // bufferevent won't invoke the write callback, since it doesn't do the writing
+        if(evbuffer_get_length(output) <= Config::GetBroadcastLowWatermark()) {
+            client->drainBroadcasts();
         }
     } catch(const std::exception &e) {
-        cbor_decref(&item);
-        throw;
+        PLOG_ERROR << "Failed to send to client " << client->socket << ": " << e.what();
+        this->abortClient(ev);
     }
+}
 
-    // clean up
-    cbor_decref(&item);
+/**
+ * @brief Process a single message received from a client
+ *
+ * Look up the endpoint's handler, and invoke it with the payload in the format it requested. Only
+ * endpoints that want a decoded item will have the payload parsed into a CBOR item tree.
+ *
+ * @param client Client that sent the message
+ * @param hdr Message header (pointing into the client's input buffer)
+ * @param payload Message payload following the header
+ */
+void RpcServer::handleClientMessage(const std::shared_ptr<Client> &client,
+        const struct rpc_header *hdr, std::span<const std::byte> payload) {
+    const auto &ep = kEndpoints[hdr->endpoint];
+    const auto start = Stats::Now();
+
+    switch(ep.format) {
+        case PayloadFormat::Raw:
+            (this->*ep.rawHandler)(client, *hdr, payload);
+            break;
+
+        case PayloadFormat::CborStream: {
+            CborStreamReader reader(payload);
+            (this->*ep.streamHandler)(client, *hdr, reader);
+            break;
+        }
+
+        case PayloadFormat::Cbor: {
+            struct cbor_load_result result{};
+            cbor_item_t *item{nullptr};
+
+            // decode as CBOR, if there's a payload
+            if(!payload.empty()) {
+                item = cbor_load(reinterpret_cast<const cbor_data>(payload.data()),
+                        payload.size(), &result);
+                if(result.error.code != CBOR_ERR_NONE) {
+                    throw std::runtime_error(fmt::format("cbor_load failed: {} (at ${:x})",
+                                result.error.code, result.error.position));
+                }
+            }
+
+            // invoke endpoint handler
+            try {
+                (this->*ep.cborHandler)(client, *hdr, item);
+            } catch(const std::exception &) {
+                if(item) {
+                    cbor_decref(&item);
+                }
+                throw;
+            }
+
+            // clean up
+            if(item) {
+                cbor_decref(&item);
+            }
+            break;
+        }
+
+        case PayloadFormat::Invalid:
+            throw std::runtime_error(fmt::format("unknown rpc endpoint ${:02x}", hdr->endpoint));
+    }
+
+    Stats::RecordSince(Stats::Source::RpcRequest, hdr->endpoint, start, hdr->length);
 }
 
 /**
@@ -339,8 +593,21 @@ void RpcServer::handleClientEvent(struct bufferevent *ev, const size_t flags) {
         PLOG_DEBUG << "Client " << client->socket << " error: flags=" << flags;
     }
 
+    PLOG_DEBUG << "Client " << client->socket << " received " << client->rxMessages
+        << " messages (" << client->rxBytesCopied << " bytes copied)";
+    PLOG_DEBUG << "Client " << client->socket << " dropped " << client->droppedBroadcasts
+        << " broadcasts (max queue depth " << client->maxQueueDepth << " bytes)";
+    PLOG_DEBUG << "Client " << client->socket << " sent " << client->txStats.messages
+        << " messages in " << client->txStats.syscalls << " syscalls";
+    PLOG_DEBUG_IF(Config::GetRpcBatchedIo()) << "Client " << client->socket << " received "
+        << client->batchRxStats.messages << " messages in " << client->batchRxStats.syscalls
+        << " syscalls";
+    PLOG_DEBUG_IF(client->conflator) << "Client " << client->socket << " received "
+        << client->summariesSent << " measurement summaries (of "
+        << client->summarizedMeasurements << " measurements)";
+
     // in either case, remove the client struct
-    this->clients.erase(ev);
+    this->abortClient(ev);
 }
 
 /**
@@ -350,6 +617,7 @@ void RpcServer::handleClientEvent(struct bufferevent *ev, const size_t flags) {
  * response to an error of some sort.
  */
 void RpcServer::abortClient(struct bufferevent *ev) {
+    this->releaseChannelLeases(ev);
     this->clients.erase(ev);
 }
 
@@ -366,25 +634,509 @@ void RpcServer::handleTermination() {
 
 
 
+/**
+ * @brief Handle a no-op message
+ *
+ * These are used by clients to check the connection is alive; they are simply ignored.
+ */
+void RpcServer::handleNoOp(const std::shared_ptr<Client> &, const struct rpc_header &,
+        std::span<const std::byte>) {
+    // nothing to do
+}
+
+
+
+/**
+ * @brief Hand the measurement ring to a client
+ *
+ * Reply with the ring's memfd, and an eventfd (unique to this client) that's signalled whenever
+ * new measurements are published.
+ */
+void RpcServer::handleMeasurementRing(const std::shared_ptr<Client> &client,
+        const struct rpc_header &hdr, std::span<const std::byte>) {
+    if(client->measurementEventFd == -1) {
+        client->measurementEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(client->measurementEventFd == -1) {
+            throw std::system_error(errno, std::generic_category(), "create measurement eventfd");
+        }
+    }
+
+    const std::array<int, 2> fds{{this->measurementRing->getFd(), client->measurementEventFd}};
+    client->replyTo(hdr, {}, fds);
+}
+
+/**
+ * @brief Broadcast a measurement as a CBOR message
+ *
+ * Used for measurements that the coprocessor sent as binary frames, which aren't part of the
+ * local RPC protocol. The message is only encoded if there are any clients to send it to, that
+ * is, those not subscribed to summaries.
+ *
+ * @param record Measurement to broadcast
+ *
+ * @return Size of the broadcast message (0 if none was sent)
+ */
+size_t RpcServer::broadcastMeasurement(const struct measurement_record &record) {
+    if(std::none_of(this->clients.begin(), this->clients.end(),
+                [](const auto &it) { return !it.second->conflator; })) {
+        return 0;
+    }
+
+    std::array<std::byte, 64> buf;
+    const auto payloadLen = MeasurementCodec::EncodeCbor(record,
+            std::span(buf).subspan(sizeof(struct rpc_header)));
+    if(!payloadLen) {
+        throw std::runtime_error("failed to encode measurement");
+    }
+
+    const struct rpc_header hdr{
+        .version = kRpcVersionLatest,
+        .length = static_cast<uint16_t>(sizeof(struct rpc_header) + payloadLen),
+        .endpoint = kRpcEndpointMeasurement,
+        .tag = 0,
+        .flags = kRpcFlagBroadcast,
+    };
+    memcpy(buf.data(), &hdr, sizeof(hdr));
+
+    this->broadcastPacket(std::span<const std::byte>(buf.data(), hdr.length));
+    return hdr.length;
+}
+
+/**
+ * @brief Publish a measurement
+ *
+ * Write the measurement into the shared memory ring, and then wake up all clients that have
+ * subscribed to it. It's also added to the summaries of all clients subscribed to them; those
+ * subscribed at full rate are sent their summary right away.
+ *
+ * @param record Measurement to publish
+ */
+void RpcServer::publishMeasurement(const struct measurement_record &record) {
+    std::vector<struct bufferevent *> slowClients;
+
+    this->measurementRing->publish(record);
+
+    for(const auto &[bev, client] : this->clients) {
+        if(client->measurementEventFd != -1) {
+            // this only fails if the counter would overflow, which is fine to ignore
+            eventfd_write(client->measurementEventFd, 1);
+        }
+
+        if(client->conflator) {
+            client->conflator->update(record);
+
+            try {
+                if(!client->summaryTimer && !client->sendSummary()) {
+                    PLOG_WARNING << "Disconnecting client " << client->socket
+                        << ": broadcast queue overflow";
+                    slowClients.push_back(bev);
+                }
+            } catch(const std::exception &e) {
+                PLOG_WARNING << "Disconnecting client " << client->socket
+                    << ": failed to send measurement summary: " << e.what();
+                slowClients.push_back(bev);
+            }
+        }
+    }
+
+    // disconnect clients that overflowed their queue (or failed)
+    for(auto bev : slowClients) {
+        this->abortClient(bev);
+    }
+}
+
+/**
+ * @brief Subscribe to (or unsubscribe from) measurement summaries
+ *
+ * The payload is a map with either the key `rate` (the delivery rate, in Hz; 0 for full rate)
+ * or `unsubscribe`. We reply with the effective delivery rate.
+ */
+void RpcServer::handleMeasurementSubscribe(const std::shared_ptr<Client> &client,
+        const struct rpc_header &hdr, const struct cbor_item_t *item) {
+    if(!item || !cbor_isa_map(item)) {
+        throw std::invalid_argument("invalid payload: expected map");
+    }
+
+    double rate{0};
+
+    if(auto unsubItem = PlCommon::Util::CborMapGet(item, "unsubscribe"); unsubItem &&
+            cbor_is_bool(unsubItem) && cbor_get_bool(unsubItem)) {
+        client->unsubscribeSummaries();
+    } else {
+        auto rateItem = PlCommon::Util::CborMapGet(item, "rate");
+        if(!rateItem) {
+            throw std::invalid_argument("missing rate");
+        } else if(cbor_isa_uint(rateItem)) {
+            rate = static_cast<double>(PlCommon::Util::CborReadUint(rateItem));
+        } else if(cbor_isa_float_ctrl(rateItem) && cbor_is_float(rateItem)) {
+            rate = cbor_float_get_float(rateItem);
+        } else {
+            throw std::invalid_argument("invalid rate: expected number");
+        }
+
+        // full rate is cheaper than a timer that fires (nearly) as often as measurements arrive
+        if(rate < 0. || rate >= Config::GetMeasurementSummaryMaxRate()) {
+            rate = 0.;
+        }
+
+        client->subscribeSummaries(rate);
+    }
+
+    // build the reply
+    std::array<std::byte, 16> buf;
+
+    auto root = cbor_new_definite_map(1);
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("rate")),
+        .value = cbor_move(cbor_build_float4(static_cast<float>(rate))),
+    });
+
+    const auto serializedBytes = cbor_serialize(root, reinterpret_cast<unsigned char *>(
+                buf.data()), buf.size());
+    cbor_decref(&root);
+
+    if(!serializedBytes) {
+        throw std::runtime_error("failed to serialize subscription reply");
+    }
+
+    client->replyTo(hdr, {buf.data(), serializedBytes});
+}
+
+
+
+/**
+ * @brief Register a coprocessor channel that clients may retrieve
+ *
+ * @param name Endpoint name of the channel (used by clients to identify it)
+ * @param fd File descriptor of the channel's rpmsg chrdev (ownership is not transferred)
+ * @param revoke Callback invoked to revoke the channel when its lease is released
+ */
+void RpcServer::registerChannel(const std::string_view &name, const int fd,
+        const ChannelRevokeCallback &revoke) {
+    const auto [it, inserted] = this->channels.emplace(name, RetrievableChannel{
+        .fd = fd,
+        .revoke = revoke,
+    });
+
+    if(!inserted) {
+        throw std::invalid_argument(fmt::format("channel '{}' already registered", name));
+    }
+}
+
+/**
+ * @brief Remove a previously registered retrievable channel
+ *
+ * @remark The channel isn't revoked; the caller is responsible for destroying it.
+ */
+void RpcServer::unregisterChannel(const std::string_view &name) {
+    this->channels.erase(std::string(name));
+}
+
+/**
+ * @brief Lease a coprocessor channel to a client
+ *
+ * The payload is a map, with the key `name` containing the endpoint name of the channel to
+ * retrieve. If the channel isn't already leased, we reply with its file descriptor attached as
+ * SCM_RIGHTS ancillary data.
+ *
+ * The lease is held until the client disconnects, at which point the channel is revoked; any
+ * file descriptors the client still holds for it are then invalid.
+ */
+void RpcServer::handleRetrieveChannel(const std::shared_ptr<Client> &client,
+        const struct rpc_header &hdr, const struct cbor_item_t *item) {
+    // figure out what channel is requested
+    if(!item || !cbor_isa_map(item)) {
+        throw std::invalid_argument("invalid payload: expected map");
+    }
+
+    auto nameItem = PlCommon::Util::CborMapGet(item, "name");
+    if(!nameItem || !cbor_isa_string(nameItem) || !cbor_string_is_definite(nameItem)) {
+        throw std::invalid_argument("invalid or missing channel name");
+    }
+
+    const std::string name(reinterpret_cast<const char *>(cbor_string_handle(nameItem)),
+            cbor_string_length(nameItem));
+
+    // ensure the client may retrieve it and that it's available
+    if(!this->isClientAuthorized(client)) {
+        throw std::runtime_error(fmt::format("client {} not authorized to retrieve channels",
+                    client->socket));
+    }
+
+    auto it = this->channels.find(name);
+    if(it == this->channels.end()) {
+        throw std::invalid_argument(fmt::format("unknown channel '{}'", name));
+    }
+
+    auto &channel = it->second;
+    if(channel.lessee && channel.lessee != client->event) {
+        throw std::runtime_error(fmt::format("channel '{}' already leased", name));
+    } else if(channel.fd == -1) {
+        throw std::runtime_error(fmt::format("channel '{}' unavailable", name));
+    }
+
+    // hand it out
+    channel.lessee = client->event;
+    PLOG_INFO << "Leased channel '" << name << "' to client " << client->socket;
+
+    const std::array<int, 1> fds{{channel.fd}};
+    client->replyTo(hdr, {}, fds);
+}
+
+/**
+ * @brief Return message statistics
+ *
+ * Reply with a snapshot of all message statistics; if the request payload is a map with the key
+ * `reset` set to true, they're cleared afterwards.
+ *
+ * @seeAlso Stats::Snapshot
+ */
+void RpcServer::handleStats(const std::shared_ptr<Client> &client, const struct rpc_header &hdr,
+        const struct cbor_item_t *item) {
+    bool reset{false};
+    if(item && cbor_isa_map(item)) {
+        if(auto resetItem = PlCommon::Util::CborMapGet(item, "reset")) {
+            reset = cbor_is_bool(resetItem) && cbor_get_bool(resetItem);
+        }
+    }
+
+    // serialize the snapshot
+    auto root = Stats::Snapshot();
+
+    size_t rootBufLen;
+    unsigned char *rootBuf{nullptr};
+    const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
+    cbor_decref(&root);
+
+    if(!serializedBytes) {
+        free(rootBuf);
+        throw std::runtime_error("failed to serialize stats");
+    }
+
+    if(reset) {
+        Stats::Reset();
+    }
+
+    // then reply with it
+    try {
+        client->replyTo(hdr, {reinterpret_cast<std::byte *>(rootBuf), serializedBytes});
+        free(rootBuf);
+    } catch(const std::exception &) {
+        free(rootBuf);
+        throw;
+    }
+}
+
+/**
+ * @brief Control rpmsg message capture
+ *
+ * Apply the requested changes (enable/disable, clear, write to file) then reply with the current
+ * capture state. Only clients that may retrieve channels may control capturing.
+ *
+ * @seeAlso Capture
+ */
+void RpcServer::handleCapture(const std::shared_ptr<Client> &client, const struct rpc_header &hdr,
+        const struct cbor_item_t *item) {
+    if(!this->isClientAuthorized(client)) {
+        throw std::runtime_error(fmt::format("client {} not authorized to control capture",
+                    client->socket));
+    }
+
+    std::filesystem::path path;
+
+    if(item && cbor_isa_map(item)) {
+        if(auto enableItem = PlCommon::Util::CborMapGet(item, "enable"); enableItem &&
+                cbor_is_bool(enableItem)) {
+            Capture::SetEnabled(cbor_get_bool(enableItem));
+        }
+        if(auto clearItem = PlCommon::Util::CborMapGet(item, "clear"); clearItem &&
+                cbor_is_bool(clearItem) && cbor_get_bool(clearItem)) {
+            Capture::Clear();
+        }
+        if(auto writeItem = PlCommon::Util::CborMapGet(item, "write"); writeItem &&
+                cbor_is_bool(writeItem) && cbor_get_bool(writeItem)) {
+            path = Config::GetCaptureDirectory();
+            path /= fmt::format("rpmsg-{}.cap", time(nullptr));
+
+            Capture::WriteTo(path);
+        }
+    }
+
+    // build the reply
+    auto root = cbor_new_definite_map(path.empty() ? 2 : 3);
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("enabled")),
+        .value = cbor_move(cbor_build_bool(Capture::IsEnabled())),
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("records")),
+        .value = cbor_move(cbor_build_uint32(Capture::GetNumRecords())),
+    });
+    if(!path.empty()) {
+        cbor_map_add(root, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("path")),
+            .value = cbor_move(cbor_build_string(path.c_str())),
+        });
+    }
+
+    size_t rootBufLen;
+    unsigned char *rootBuf{nullptr};
+    const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
+    cbor_decref(&root);
+
+    if(!serializedBytes) {
+        free(rootBuf);
+        throw std::runtime_error("failed to serialize capture state");
+    }
+
+    try {
+        client->replyTo(hdr, {reinterpret_cast<std::byte *>(rootBuf), serializedBytes});
+        free(rootBuf);
+    } catch(const std::exception &) {
+        free(rootBuf);
+        throw;
+    }
+}
+
+
+
+/**
+ * @brief Determine whether a client may retrieve coprocessor channels
+ *
+ * Clients running as root, as the same user as we are, or whose primary group is the configured
+ * channel lease group are authorized.
+ */
+bool RpcServer::isClientAuthorized(const std::shared_ptr<Client> &client) {
+    struct ucred cred{};
+    socklen_t credLen{sizeof(cred)};
+
+    int err = getsockopt(client->socket, SOL_SOCKET, SO_PEERCRED, &cred, &credLen);
+    if(err == -1) {
+        throw std::system_error(errno, std::generic_category(), "get peer credentials");
+    }
+
+    if(!cred.uid || cred.uid == geteuid()) {
+        return true;
+    }
+
+    const auto group = getgrnam(Config::GetChannelLeaseGroup().c_str());
+    return group && cred.gid == group->gr_gid;
+}
+
+/**
+ * @brief Release all channel leases held by a client
+ *
+ * Each channel leased by the client is revoked, and the new file descriptor for it stored for the
+ * next client to lease it.
+ */
+void RpcServer::releaseChannelLeases(struct bufferevent *ev) {
+    for(auto &[name, channel] : this->channels) {
+        if(channel.lessee != ev) {
+            continue;
+        }
+
+        PLOG_INFO << "Revoking channel '" << name << "'";
+        channel.lessee = nullptr;
+
+        try {
+            channel.fd = channel.revoke();
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "failed to revoke channel '" << name << "': " << e.what();
+            channel.fd = -1;
+        }
+    }
+}
+
+
+
+/**
+ * @brief Decode the payload with the streaming CBOR decoder
+ *
+ * Invokes the given callbacks for each data item in the payload, until it has been consumed in
+ * its entirety.
+ *
+ * @param callbacks libcbor streaming decoder callbacks
+ * @param ctx Context passed to each callback
+ */
+void RpcServer::CborStreamReader::decode(const struct cbor_callbacks &callbacks, void *ctx) {
+    size_t offset{0};
+
+    while(offset < this->payload.size()) {
+        const auto result = cbor_stream_decode(
+                reinterpret_cast<cbor_data>(this->payload.data() + offset),
+                this->payload.size() - offset, &callbacks, ctx);
+
+        switch(result.status) {
+            case CBOR_DECODER_FINISHED:
+                offset += result.read;
+                break;
+            case CBOR_DECODER_NEDATA:
+                throw std::runtime_error(fmt::format("truncated cbor payload (at ${:x})", offset));
+            case CBOR_DECODER_ERROR:
+                throw std::runtime_error(fmt::format("malformed cbor payload (at ${:x})", offset));
+        }
+    }
+}
+
+
+
 /**
  * @brief Broadcast a packet to all connected clients
  *
  * Send the specified packet (which should have an rpc_header prepended, followed immediately by
  * the packet payload) to all connected clients.
  *
+ * The packet is copied exactly once, into a shared buffer that is then referenced by each of the
+ * clients' output buffers.
+ *
  * @param packet Packet data to broadcast
  */
 void RpcServer::broadcastPacket(std::span<const std::byte> packet) {
-    int err;
+    if(this->clients.empty()) {
+        return;
+    }
+
+    this->broadcastPacket(std::make_shared<const std::vector<std::byte>>(packet.begin(),
+                packet.end()));
+}
+
+/**
+ * @brief Broadcast a shared packet to all connected clients
+ *
+ * Clients that can't keep up are handled according to the configured broadcast overflow policy;
+ * this may involve disconnecting them.
+ *
+ * @param packet Packet data to broadcast
+ */
+void RpcServer::broadcastPacket(const SharedPacket &packet) {
+    std::vector<struct bufferevent *> slowClients;
+
+    // clients subscribed to summaries don't get individual measurements
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(packet->data());
+    const bool isMeasurement = (hdr->endpoint == kRpcEndpointMeasurement);
 
     for(const auto &[bev, client] : this->clients) {
-        err = bufferevent_write(bev, packet.data(), packet.size());
+        if(isMeasurement && client->conflator) {
+            continue;
+        }
 
-        if(err != 0) {
-            PLOG_WARNING << "failed to broadcast packet to client " << client->socket << ": "
-                << err;
+        try {
+            if(!client->broadcast(packet)) {
+                PLOG_WARNING << "Disconnecting client " << client->socket
+                    << ": broadcast queue overflow";
+                slowClients.push_back(bev);
+            }
+        } catch(const std::exception &e) {
+            PLOG_WARNING << "Disconnecting client " << client->socket
+                << ": failed to broadcast packet: " << e.what();
+            slowClients.push_back(bev);
         }
     }
+
+    // disconnect clients that overflowed their queue (or failed)
+    for(auto bev : slowClients) {
+        this->abortClient(bev);
+    }
 }
 
 
@@ -395,10 +1147,14 @@ void RpcServer::broadcastPacket(std::span<const std::byte> packet) {
  * Initialize a buffer event (used for event notifications, like the connection being closed; as
  * well as when buffered data is available) for the client.
  *
+ * The bufferevent never writes to the socket itself: it would write its entire output buffer at
+ * once, which on a SOCK_SEQPACKET socket coalesces several messages into one datagram. Instead,
+ * the output buffer is sent by flushClient(), one datagram per message.
+ *
  * @param server RPC server to which the client connected
  * @param fd File descriptor for client (we take ownership of this)
  */
-RpcServer::Client::Client(RpcServer *server, const int fd) : socket(fd) {
+RpcServer::Client::Client(RpcServer *server, const int fd) : server(server), socket(fd) {
     // create the event
     this->event = bufferevent_socket_new(server->evbase, this->socket, 0);
     if(!this->event) {
@@ -426,6 +1182,25 @@ RpcServer::Client::Client(RpcServer *server, const int fd) : socket(fd) {
         }
     }, server);
 
+    // we always do the writing, so the output buffer mustn't stay frozen for the bufferevent
+    bufferevent_disable(this->event, EV_WRITE);
+    evbuffer_unfreeze(bufferevent_get_output(this->event), 1);
+
+    this->writeEvent = event_new(this->server->evbase, this->socket, EV_WRITE,
+            [](auto, auto, auto ctx) {
+        auto client = reinterpret_cast<Client *>(ctx);
+        client->server->flushClient(client->event);
+    }, this);
+    if(!this->writeEvent) {
+        throw std::runtime_error("failed to allocate client write event");
+    }
+
+    // with batched IO, we do the reading as well
+    if(Config::GetRpcBatchedIo()) {
+        this->initBatchedIo();
+        return;
+    }
+
     // enable event for "client data available to read" events
     int err = bufferevent_enable(this->event, EV_READ);
     if(err == -1) {
@@ -433,16 +1208,67 @@ RpcServer::Client::Client(RpcServer *server, const int fd) : socket(fd) {
     }
 }
 
+/**
+ * @brief Set up batched IO for the client
+ *
+ * Disable the bufferevent's own socket reading, and instead install an event to read from the
+ * socket with `recvmmsg`.
+ */
+void RpcServer::Client::initBatchedIo() {
+    bufferevent_disable(this->event, EV_READ);
+
+    this->batchReadEvent = event_new(this->server->evbase, this->socket, EV_READ | EV_PERSIST,
+            [](auto, auto, auto ctx) {
+        auto client = reinterpret_cast<Client *>(ctx);
+        auto bev = client->event;
+        auto server = client->server;
+
+        try {
+            server->handleClientBatchRead(bev);
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "Failed to handle client read: " << e.what();
+            server->abortClient(bev);
+        }
+    }, this);
+
+    if(!this->batchReadEvent) {
+        throw std::runtime_error("failed to allocate batched io events");
+    }
+
+    event_add(this->batchReadEvent, nullptr);
+}
+
 /**
  * @brief Ensure all client resources are released.
  *
  * This closes the client socket, as well as releasing the libevent resources.
  */
 RpcServer::Client::~Client() {
+    if(this->summaryTimer) {
+        event_free(this->summaryTimer);
+    }
+
+    if(this->batchReadEvent) {
+        event_free(this->batchReadEvent);
+    }
+    if(this->writeEvent) {
+        event_free(this->writeEvent);
+    }
+
     if(this->event) {
         bufferevent_free(this->event);
     }
 
+    if(this->measurementEventFd != -1) {
+        close(this->measurementEventFd);
+    }
+
+    for(const auto &message : this->pendingFdMessages) {
+        for(const auto fd : message.fds) {
+            close(fd);
+        }
+    }
+
     if(this->socket != -1) {
         close(this->socket);
     }
@@ -456,8 +1282,10 @@ RpcServer::Client::~Client() {
  *
  * @param req Message header of the request we're replying to
  * @param payload Optional payload to add to the reply
+ * @param fds Optional file descriptors to pass to the client with the reply
  */
-void RpcServer::Client::replyTo(const struct rpc_header &req, std::span<const std::byte> payload) {
+void RpcServer::Client::replyTo(const struct rpc_header &req, std::span<const std::byte> payload,
+        std::span<const int> fds) {
     // calculate total size required and reserve space
     const size_t msgSize = sizeof(struct rpc_header) + payload.size();
     this->transmitBuf.resize(msgSize, std::byte(0));
@@ -479,7 +1307,11 @@ void RpcServer::Client::replyTo(const struct rpc_header &req, std::span<const st
     }
 
     // transmit the message
-    this->send(this->transmitBuf);
+    if(fds.empty()) {
+        this->send(this->transmitBuf);
+    } else {
+        this->sendWithFds(this->transmitBuf, fds);
+    }
 }
 
 /**
@@ -496,5 +1328,394 @@ void RpcServer::Client::send(std::span<const std::byte> buf) {
     if(err == -1) {
         throw std::system_error(errno, std::generic_category(), "write rpc reply");
     }
+
+    this->flush();
+}
+
+/**
+ * @brief Transmit the given packet, along with file descriptors
+ *
+ * The file descriptors are passed as SCM_RIGHTS ancillary data, which can't go through the output
+ * buffer. Instead, the packet is queued separately, to be sent once everything already in the
+ * output buffer has been; the descriptors are duplicated, so they stay valid until then.
+ *
+ * @param buf Packet (including header) to send
+ * @param fds File descriptors to send with the packet
+ */
+void RpcServer::Client::sendWithFds(std::span<const std::byte> buf, std::span<const int> fds) {
+    FdMessage message{
+        .bytesAhead = evbuffer_get_length(bufferevent_get_output(this->event)),
+        .packet = {buf.begin(), buf.end()},
+    };
+
+    for(const auto fd : fds) {
+        const auto dup = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+        if(dup == -1) {
+            const auto error = errno;
+            for(const auto dupFd : message.fds) {
+                close(dupFd);
+            }
+            throw std::system_error(error, std::generic_category(), "duplicate rpc reply fd");
+        }
+
+        message.fds.push_back(dup);
+    }
+
+    this->pendingFdMessages.emplace_back(std::move(message));
+    this->flush();
+}
+
+/**
+ * @brief Transmit the given shared packet
+ *
+ * Rather than copying the packet into the output buffer, add a reference to the shared packet's
+ * storage; we hold a reference to the packet until libevent is done with it.
+ */
+void RpcServer::Client::send(const SharedPacket &packet) {
+    int err;
+    auto ref = new SharedPacket(packet);
+
+    err = evbuffer_add_reference(bufferevent_get_output(this->event), packet->data(),
+            packet->size(), [](auto, auto, auto ctx) {
+        delete reinterpret_cast<SharedPacket *>(ctx);
+    }, ref);
+
+    if(err == -1) {
+        delete ref;
+        throw std::runtime_error("failed to add reference to rpc broadcast");
+    }
+
+    this->flush();
+}
+
+/**
+ * @brief Send the client's output buffer
+ *
+ * With batched IO, the buffer is sent at the end of the current event loop iteration, along with
+ * any other messages queued until then. Otherwise, it's sent right away; unless we're already
+ * waiting for the socket to become writable.
+ */
+void RpcServer::Client::flush() {
+    if(Config::GetRpcBatchedIo()) {
+        this->server->scheduleBatchFlush(this->event);
+        return;
+    } else if(event_pending(this->writeEvent, EV_WRITE, nullptr)) {
+        return;
+    }
+
+    if(!this->transmit()) {
+        event_add(this->writeEvent, nullptr);
+    }
+}
+
+/**
+ * @brief Send as many queued messages as the socket will take
+ *
+ * The output buffer is sent one datagram per message; messages with file descriptors are sent
+ * in between, once the data queued ahead of them has been sent.
+ *
+ * @return Whether all messages were sent; if not, the socket would block.
+ */
+bool RpcServer::Client::transmit() {
+    auto output = bufferevent_get_output(this->event);
+
+    while(!this->pendingFdMessages.empty()) {
+        auto &message = this->pendingFdMessages.front();
+
+        if(message.bytesAhead) {
+            const auto before = evbuffer_get_length(output);
+            const bool done = Mmsg::SendBuffer<struct rpc_header>(this->socket, output,
+                    this->txStats, message.bytesAhead);
+            const auto sent = before - evbuffer_get_length(output);
+
+            for(auto &pending : this->pendingFdMessages) {
+                pending.bytesAhead -= sent;
+            }
+
+            if(!done) {
+                return false;
+            }
+        }
+
+        if(!this->transmitFdMessage(message)) {
+            return false;
+        }
+
+        for(const auto fd : message.fds) {
+            close(fd);
+        }
+        this->pendingFdMessages.pop_front();
+    }
+
+    return Mmsg::SendBuffer<struct rpc_header>(this->socket, output, this->txStats);
+}
+
+/**
+ * @brief Send a message with file descriptors attached
+ *
+ * @return Whether the message was sent; if not, the socket would block.
+ */
+bool RpcServer::Client::transmitFdMessage(const FdMessage &message) {
+    int err;
+
+    struct iovec iov{
+        .iov_base = const_cast<std::byte *>(message.packet.data()),
+        .iov_len  = message.packet.size(),
+    };
+
+    const auto fdBytes = message.fds.size() * sizeof(int);
+    std::vector<std::byte> control(CMSG_SPACE(fdBytes));
+
+    struct msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(fdBytes);
+    memcpy(CMSG_DATA(cmsg), message.fds.data(), fdBytes);
+
+    do {
+        err = sendmsg(this->socket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    } while(err == -1 && errno == EINTR);
+
+    this->txStats.syscalls++;
+
+    if(err == -1) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        }
+        throw std::system_error(errno, std::generic_category(), "send rpc reply with fds");
+    }
+
+    this->txStats.messages++;
+    return true;
+}
+
+/**
+ * @brief Determine whether a broadcast may be discarded for a congested client
+ *
+ * Only measurements (and summaries thereof) are superseded by the next one to arrive; all other
+ * broadcasts, such as link state changes, are always delivered.
+ */
+static bool IsDroppableBroadcast(const RpcServer::SharedPacket &packet) {
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(packet->data());
+    return hdr->endpoint == kRpcEndpointMeasurement ||
+        hdr->endpoint == kRpcEndpointMeasurementSummary;
 }
 
+/**
+ * @brief Send a broadcast packet to the client
+ *
+ * If the client's output buffer is below the high watermark, the packet is written immediately.
+ * Otherwise, it's queued until the buffer drains, and the overflow policy applied to it if it's
+ * a measurement. Other broadcasts are always queued.
+ *
+ * @param packet Full packet (including RPC header) to broadcast
+ *
+ * @return Whether the client should stay connected
+ */
+bool RpcServer::Client::broadcast(const SharedPacket &packet) {
+    const auto outputLen = evbuffer_get_length(bufferevent_get_output(this->event));
+
+    // fast path: write it straight to the socket
+    if(!this->isCongested && outputLen < Config::GetBroadcastHighWatermark()) {
+        this->send(packet);
+        this->maxQueueDepth = std::max(this->maxQueueDepth, this->getQueuedBytes());
+        return true;
+    }
+
+    this->isCongested = true;
+
+    // apply the overflow policy
+    const bool isDroppable = IsDroppableBroadcast(packet);
+    auto &queue = this->pendingBroadcasts;
+
+    auto discard = [&](auto it) {
+        this->pendingBytes -= (*it)->size();
+        this->pendingDroppable--;
+        this->droppedBroadcasts++;
+        return queue.erase(it);
+    };
+
+    if(isDroppable) {
+        switch(Config::GetBroadcastOverflowPolicy()) {
+            case Config::BroadcastOverflowPolicy::DropOldest:
+                if(this->pendingDroppable >= Config::GetBroadcastQueueDepth()) {
+                    auto oldest = std::find_if(queue.begin(), queue.end(), IsDroppableBroadcast);
+                    if(oldest != queue.end()) {
+                        discard(oldest);
+                    }
+                }
+                break;
+
+            // keep only the most recent broadcast per endpoint
+            case Config::BroadcastOverflowPolicy::Conflate: {
+                const auto endpoint = reinterpret_cast<const struct rpc_header *>(
+                        packet->data())->endpoint;
+
+                for(auto it = queue.begin(); it != queue.end();) {
+                    const auto hdr = reinterpret_cast<const struct rpc_header *>((*it)->data());
+                    it = (hdr->endpoint == endpoint) ? discard(it) : std::next(it);
+                }
+                break;
+            }
+
+            case Config::BroadcastOverflowPolicy::Disconnect:
+                this->droppedBroadcasts++;
+                return false;
+        }
+
+        this->pendingDroppable++;
+    }
+
+    queue.push_back(packet);
+    this->pendingBytes += packet->size();
+
+    this->maxQueueDepth = std::max(this->maxQueueDepth, this->getQueuedBytes());
+    return true;
+}
+
+/**
+ * @brief Write queued broadcasts to the client
+ *
+ * Invoked once the output buffer drained to the low watermark; this will move as many queued
+ * broadcasts as fit under the high watermark to the output buffer.
+ */
+void RpcServer::Client::drainBroadcasts() {
+    auto output = bufferevent_get_output(this->event);
+
+    while(!this->pendingBroadcasts.empty() &&
+            evbuffer_get_length(output) < Config::GetBroadcastHighWatermark()) {
+        const auto packet = std::move(this->pendingBroadcasts.front());
+        this->pendingBroadcasts.pop_front();
+
+        this->pendingBytes -= packet->size();
+        if(IsDroppableBroadcast(packet)) {
+            this->pendingDroppable--;
+        }
+
+        this->send(packet);
+    }
+
+    if(this->pendingBroadcasts.empty()) {
+        this->isCongested = false;
+    }
+}
+
+/**
+ * @brief Get the total number of bytes waiting to be sent to the client
+ *
+ * This includes both the socket output buffer, and any broadcasts held back.
+ */
+size_t RpcServer::Client::getQueuedBytes() const {
+    return evbuffer_get_length(bufferevent_get_output(this->event)) + this->pendingBytes;
+}
+
+
+
+/**
+ * @brief Subscribe the client to measurement summaries
+ *
+ * Replaces any existing subscription; measurements aggregated so far are kept.
+ *
+ * @param rate Rate at which summaries are delivered (in Hz) or 0 to deliver one per measurement
+ */
+void RpcServer::Client::subscribeSummaries(const double rate) {
+    if(!this->conflator) {
+        this->conflator = std::make_unique<MeasurementConflator>();
+    }
+
+    if(this->summaryTimer) {
+        event_free(this->summaryTimer);
+        this->summaryTimer = nullptr;
+    }
+
+    if(rate > 0.) {
+        this->summaryTimer = event_new(this->server->evbase, -1, EV_PERSIST,
+                [](auto, auto, auto ctx) {
+            auto client = reinterpret_cast<Client *>(ctx);
+            auto bev = client->event;
+            auto server = client->server;
+
+            try {
+                if(!client->sendSummary()) {
+                    PLOG_WARNING << "Disconnecting client " << client->socket
+                        << ": broadcast queue overflow";
+                    server->abortClient(bev);
+                }
+            } catch(const std::exception &e) {
+                PLOG_ERROR << "Failed to send measurement summary: " << e.what();
+                server->abortClient(bev);
+            }
+        }, this);
+        if(!this->summaryTimer) {
+            throw std::runtime_error("failed to allocate summary timer");
+        }
+
+        const auto usec = static_cast<uint64_t>(1'000'000. / rate);
+        const struct timeval tv{
+            .tv_sec  = static_cast<time_t>(usec / 1'000'000U),
+            .tv_usec = static_cast<suseconds_t>(usec % 1'000'000U),
+        };
+        evtimer_add(this->summaryTimer, &tv);
+    }
+
+    PLOG_DEBUG << "Client " << this->socket << " subscribed to measurement summaries ("
+        << rate << " Hz)";
+}
+
+/**
+ * @brief Cancel the client's measurement summary subscription
+ *
+ * The client receives individual measurement broadcasts again.
+ */
+void RpcServer::Client::unsubscribeSummaries() {
+    if(this->summaryTimer) {
+        event_free(this->summaryTimer);
+        this->summaryTimer = nullptr;
+    }
+
+    this->conflator.reset();
+}
+
+/**
+ * @brief Send the client a summary of the measurements aggregated since the last one
+ *
+ * Nothing is sent if no measurements arrived in the meantime. Summaries are sent like any other
+ * broadcast, so they're subject to the overflow policy.
+ *
+ * @return Whether the client should stay connected
+ */
+bool RpcServer::Client::sendSummary() {
+    if(!this->conflator || this->conflator->isEmpty()) {
+        return true;
+    }
+
+    const auto summary = this->conflator->take();
+
+    std::array<std::byte, 256> buf;
+    const auto payloadLen = MeasurementConflator::Serialize(summary,
+            std::span(buf).subspan(sizeof(struct rpc_header)));
+    if(!payloadLen) {
+        throw std::runtime_error("failed to serialize measurement summary");
+    }
+
+    const struct rpc_header hdr{
+        .version = kRpcVersionLatest,
+        .length = static_cast<uint16_t>(sizeof(struct rpc_header) + payloadLen),
+        .endpoint = kRpcEndpointMeasurementSummary,
+        .tag = 0,
+        .flags = kRpcFlagBroadcast,
+    };
+    memcpy(buf.data(), &hdr, sizeof(hdr));
+
+    this->summariesSent++;
+    this->summarizedMeasurements += summary.count;
+
+    return this->broadcast(std::make_shared<const std::vector<std::byte>>(buf.begin(),
+                buf.begin() + hdr.length));
+}
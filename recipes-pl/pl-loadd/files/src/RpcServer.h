@@ -5,10 +5,24 @@
 
 #include <array>
 #include <cstddef>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <load-common/Utils/Mmsg.h>
+
+#include "MeasurementConflator.h"
+#include "MeasurementRing.h"
+
+struct cbor_callbacks;
+struct cbor_item_t;
+struct rpc_header;
 
 /**
  * @brief Local RPC server
@@ -27,6 +41,7 @@ class RpcServer {
         RpcServer() {
             this->initSocket();
             this->initEventLoop();
+            this->initMeasurementRing();
         }
 
         ~RpcServer();
@@ -43,7 +58,31 @@ class RpcServer {
             return this->evbase;
         }
 
+        /**
+         * @brief An immutable, serialized packet shared between multiple clients
+         *
+         * Broadcasts are copied into one of these exactly once; each client's output buffer
+         * then references the same memory, which is released once the last client has sent it.
+         */
+        using SharedPacket = std::shared_ptr<const std::vector<std::byte>>;
+
         void broadcastPacket(std::span<const std::byte> packet);
+        void broadcastPacket(const SharedPacket &packet);
+
+        size_t broadcastMeasurement(const struct measurement_record &record);
+        void publishMeasurement(const struct measurement_record &record);
+
+        /**
+         * @brief Callback to revoke a leased channel
+         *
+         * Invoked when the client holding a lease on the channel disconnects. It should invalidate
+         * all existing file descriptors for the channel, and return a new file descriptor for it.
+         */
+        using ChannelRevokeCallback = std::function<int()>;
+
+        void registerChannel(const std::string_view &name, const int fd,
+                const ChannelRevokeCallback &revoke);
+        void unregisterChannel(const std::string_view &name);
 
     private:
         /**
@@ -53,20 +92,175 @@ class RpcServer {
          * used to wait for activity on the connection.
          */
         struct Client {
+            /**
+             * @brief A message with file descriptors attached, waiting to be sent
+             *
+             * These can't be sent out of the output buffer, so they're held separately, until
+             * all data that was queued before them has been sent.
+             */
+            struct FdMessage {
+                /// Number of bytes in the output buffer to send before this message
+                size_t bytesAhead{0};
+                /// Packet (including header) to send
+                std::vector<std::byte> packet;
+                /// Duplicates of the file descriptors to pass (closed once sent)
+                std::vector<int> fds;
+            };
+
+            /// Server the client is connected to
+            RpcServer *server{nullptr};
             /// Underlying client file descriptor
             int socket{-1};
-            /// Socket buffer event (used for data ready to read + events)
+            /// Socket buffer event (holds the output buffer; used for data ready to read + events)
             struct bufferevent *event{nullptr};
-            /// message receive buffer
-            std::vector<std::byte> receiveBuf;
+
+            /// Socket writable event (to resume sending after it would block)
+            struct event *writeEvent{nullptr};
+            /// Transmit counters
+            PlCommon::Util::Mmsg::Stats txStats;
+            /// Batched IO: socket readable event (replaces the bufferevent's reading)
+            struct event *batchReadEvent{nullptr};
+            /// Batched IO: receive counters
+            PlCommon::Util::Mmsg::Stats batchRxStats;
             /// message transmit buffer
             std::vector<std::byte> transmitBuf;
+            /// Messages with file descriptors, in the order they're to be sent
+            std::deque<FdMessage> pendingFdMessages;
+
+            /// Total number of messages received from this client
+            size_t rxMessages{0};
+            /**
+             * @brief Bytes copied to linearize received messages
+             *
+             * Messages are dispatched directly out of the input buffer; this only increments if
+             * a message happened to straddle two buffer chains and had to be pulled up.
+             */
+            size_t rxBytesCopied{0};
+
+            /**
+             * @brief Broadcasts waiting to be written to the client
+             *
+             * Once the client's output buffer reaches the high watermark, broadcasts are held
+             * here (subject to the overflow policy) until it drains to the low watermark again.
+             */
+            std::deque<SharedPacket> pendingBroadcasts;
+            /// Total size of all pending broadcasts, in bytes
+            size_t pendingBytes{0};
+            /// Number of pending broadcasts that the overflow policy may discard
+            size_t pendingDroppable{0};
+            /// Set while the output buffer is above the low watermark after hitting the high mark
+            bool isCongested{false};
+
+            /// Number of broadcasts discarded due to the client being too slow
+            size_t droppedBroadcasts{0};
+            /// Largest number of bytes ever queued for the client
+            size_t maxQueueDepth{0};
+
+            /// eventfd signalled when measurements are published (if subscribed to the ring)
+            int measurementEventFd{-1};
+
+            /// Aggregates measurements between summaries (if subscribed to summaries)
+            std::unique_ptr<MeasurementConflator> conflator;
+            /// Timer to deliver measurement summaries (nullptr if delivered at full rate)
+            struct event *summaryTimer{nullptr};
+            /// Number of measurement summaries sent, and measurements aggregated into them
+            size_t summariesSent{0}, summarizedMeasurements{0};
 
             Client(RpcServer *, const int);
             ~Client();
 
-            void replyTo(const struct rpc_header &, std::span<const std::byte>);
+            void initBatchedIo();
+
+            void replyTo(const struct rpc_header &, std::span<const std::byte>,
+                    std::span<const int> fds = {});
             void send(std::span<const std::byte>);
+            void sendWithFds(std::span<const std::byte>, std::span<const int>);
+            void send(const SharedPacket &);
+            void flush();
+            bool transmit();
+            bool transmitFdMessage(const FdMessage &);
+
+            bool broadcast(const SharedPacket &);
+            void drainBroadcasts();
+
+            size_t getQueuedBytes() const;
+
+            void subscribeSummaries(const double rate);
+            void unsubscribeSummaries();
+            bool sendSummary();
+        };
+
+        /**
+         * @brief Incremental reader for a CBOR message payload
+         *
+         * Handed to endpoints that process their payload with libcbor's streaming decoder, rather
+         * than building an item tree.
+         */
+        class CborStreamReader {
+            public:
+                CborStreamReader(std::span<const std::byte> payload) : payload(payload) {}
+
+                void decode(const struct cbor_callbacks &callbacks, void *ctx);
+
+                /// Get the raw payload being decoded
+                constexpr inline auto getPayload() const {
+                    return this->payload;
+                }
+
+            private:
+                /// Payload data to decode
+                std::span<const std::byte> payload;
+        };
+
+        /**
+         * @brief A coprocessor channel that may be retrieved by clients
+         *
+         * Clients can lease the channel, at which point they receive its file descriptor and may
+         * communicate with the coprocessor directly. Only one client may hold a lease at a time.
+         */
+        struct RetrievableChannel {
+            /// File descriptor of the channel's rpmsg chrdev
+            int fd{-1};
+            /// Callback to revoke the channel when its lease is released
+            ChannelRevokeCallback revoke;
+
+            /// Client currently holding the lease (if any)
+            struct bufferevent *lessee{nullptr};
+        };
+
+        /**
+         * @brief Payload formats an endpoint handler may request
+         */
+        enum class PayloadFormat: uint8_t {
+            /// Endpoint is not defined
+            Invalid,
+            /// Raw payload bytes are passed to the handler
+            Raw,
+            /// Payload is decoded into a CBOR item tree
+            Cbor,
+            /// Payload is read with the streaming CBOR decoder
+            CborStream,
+        };
+
+        /**
+         * @brief Description of a single RPC endpoint
+         *
+         * An entry exists for every possible endpoint value, in the `kEndpoints` table. Exactly one
+         * of the handler methods (according to the payload format) should be specified.
+         */
+        struct EndpointInfo {
+            /// How the message payload is passed to the handler
+            PayloadFormat format{PayloadFormat::Invalid};
+
+            /// Handler for endpoints that take the raw payload
+            void (RpcServer::*rawHandler)(const std::shared_ptr<Client> &,
+                    const struct rpc_header &, std::span<const std::byte>){nullptr};
+            /// Handler for endpoints that take a decoded CBOR item (nullptr if no payload)
+            void (RpcServer::*cborHandler)(const std::shared_ptr<Client> &,
+                    const struct rpc_header &, const struct cbor_item_t *){nullptr};
+            /// Handler for endpoints that decode their payload with a streaming reader
+            void (RpcServer::*streamHandler)(const std::shared_ptr<Client> &,
+                    const struct rpc_header &, CborStreamReader &){nullptr};
         };
 
     private:
@@ -76,15 +270,44 @@ class RpcServer {
         void initWatchdogEvent();
         void initSignalEvents();
         void initSocketEvent();
+        void initMeasurementRing();
 
         void acceptClient();
         void handleClientRead(struct bufferevent *);
+        void handleClientMessage(const std::shared_ptr<Client> &, const struct rpc_header *,
+                std::span<const std::byte>);
         void handleClientEvent(struct bufferevent *, const size_t);
         void abortClient(struct bufferevent *);
 
+        void initBatchedIo();
+        void scheduleBatchFlush(struct bufferevent *);
+        void flushBatchedClients();
+        void flushClient(struct bufferevent *);
+        void handleClientBatchRead(struct bufferevent *);
+        void handleClientDatagram(const std::shared_ptr<Client> &, std::span<const std::byte>);
+
         void handleTermination();
 
+        void handleNoOp(const std::shared_ptr<Client> &, const struct rpc_header &,
+                std::span<const std::byte>);
+        void handleMeasurementRing(const std::shared_ptr<Client> &, const struct rpc_header &,
+                std::span<const std::byte>);
+        void handleRetrieveChannel(const std::shared_ptr<Client> &, const struct rpc_header &,
+                const struct cbor_item_t *);
+        void handleStats(const std::shared_ptr<Client> &, const struct rpc_header &,
+                const struct cbor_item_t *);
+        void handleCapture(const std::shared_ptr<Client> &, const struct rpc_header &,
+                const struct cbor_item_t *);
+        void handleMeasurementSubscribe(const std::shared_ptr<Client> &,
+                const struct rpc_header &, const struct cbor_item_t *);
+
+        bool isClientAuthorized(const std::shared_ptr<Client> &);
+        void releaseChannelLeases(struct bufferevent *);
+
     private:
+        /// Handlers for all RPC endpoints, indexed by endpoint number
+        static const std::array<EndpointInfo, 256> kEndpoints;
+
         /// Maximum amount of clients that may be waiting to be accepted at once
         constexpr static const size_t kListenBacklog{5};
 
@@ -100,6 +323,8 @@ class RpcServer {
 
         /// watchdog kicking timer event (if watchdog is active)
         struct event *watchdogEvent{nullptr};
+        /// watchdog check-in source id for the RPC loop
+        size_t watchdogCheckin{0};
 
         /// libevent main loop
         struct event_base *evbase{nullptr};
@@ -107,6 +332,19 @@ class RpcServer {
         /// connected clients
         std::unordered_map<struct bufferevent *, std::shared_ptr<Client>> clients;
 
+        /// Batched IO: event fired at the end of a loop iteration to send queued messages
+        struct event *batchFlushEvent{nullptr};
+        /// Batched IO: clients with messages queued since the last flush
+        std::unordered_set<struct bufferevent *> batchDirtyClients;
+        /// Batched IO: receive buffer for recvmmsg
+        std::vector<std::byte> batchRxBuf;
+
+        /// coprocessor channels that clients may retrieve, keyed by endpoint name
+        std::unordered_map<std::string, RetrievableChannel> channels;
+
+        /// shared memory ring that measurements are published into
+        std::unique_ptr<MeasurementRing> measurementRing;
+
 };
 
 #endif
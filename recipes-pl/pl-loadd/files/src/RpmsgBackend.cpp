@@ -0,0 +1,606 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+#include <linux/rpmsg.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <system_error>
+
+#include <event2/event.h>
+#include <fmt/format.h>
+#include <plog/Log.h>
+
+#include "RpmsgBackend.h"
+
+/**
+ * @brief Initialize the backend
+ *
+ * Subscribe to kernel uevents, which are sent as rpmsg devices come and go; these are used as a
+ * hint to check the coprocessor's state. If this fails, the state is only polled.
+ */
+RpmsgBackend::RpmsgBackend() {
+    this->ueventFd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+            NETLINK_KOBJECT_UEVENT);
+    if(this->ueventFd == -1) {
+        PLOG_WARNING << "failed to create uevent socket: " << strerror(errno);
+        return;
+    }
+
+    const struct sockaddr_nl addr{
+        .nl_family = AF_NETLINK,
+        .nl_groups = 1,
+    };
+    if(bind(this->ueventFd, reinterpret_cast<const struct sockaddr *>(&addr),
+                sizeof(addr)) == -1) {
+        PLOG_WARNING << "failed to bind uevent socket: " << strerror(errno);
+        close(this->ueventFd);
+        this->ueventFd = -1;
+    }
+}
+
+/**
+ * @brief Release backend resources
+ */
+RpmsgBackend::~RpmsgBackend() {
+    this->cancelCreateEndpoints();
+
+    if(this->rpmsgCtrlFd != -1) {
+        close(this->rpmsgCtrlFd);
+    }
+    if(this->ueventFd != -1) {
+        close(this->ueventFd);
+    }
+}
+
+/**
+ * @brief Load coprocessor firmware
+ *
+ * Load the coprocessor's firmware from an ELF file at the specified path.
+ */
+void RpmsgBackend::loadFirmware(const std::filesystem::path &fwPath) {
+    this->setFirmwareDirectory(fwPath.parent_path().native());
+    this->setFirmwareFilename(fwPath.filename().native());
+}
+
+/**
+ * @brief Start the coprocessor
+ *
+ * Kernel recovery is disabled first: we handle crashes ourselves (reloading the firmware and
+ * re-creating all endpoints) so the core should stay down until we get to it.
+ */
+void RpmsgBackend::start() {
+    try {
+        this->writeFile(kRprocSysfsBase, "recovery", "disabled");
+    } catch(const std::exception &e) {
+        PLOG_WARNING << "failed to disable remoteproc recovery: " << e.what();
+    }
+
+    this->writeFile(kRprocSysfsBase, "state", "start");
+}
+
+/**
+ * @brief Stop the coprocessor
+ *
+ * The rpmsg control device goes away with the coprocessor, so it's closed as well.
+ */
+void RpmsgBackend::stop() {
+    if(this->rpmsgCtrlFd != -1) {
+        close(this->rpmsgCtrlFd);
+        this->rpmsgCtrlFd = -1;
+    }
+
+    this->writeFile(kRprocSysfsBase, "state", "stop");
+}
+
+/**
+ * @brief Determine whether the coprocessor is running
+ *
+ * Read the remoteproc state; it's considered running if it's either running, or attached to
+ * (if it was started by the bootloader.)
+ */
+bool RpmsgBackend::isRunning() {
+    std::filesystem::path path{kRprocSysfsBase};
+    path /= "state";
+
+    std::ifstream file(path);
+    std::string state;
+
+    if(!file || !std::getline(file, state)) {
+        throw std::runtime_error("failed to read coproc state");
+    }
+
+    return (state == "running" || state == "attached");
+}
+
+/**
+ * @brief Discard all pending uevents
+ *
+ * We only care that something happened, not what it was; the state is re-read anyways.
+ */
+void RpmsgBackend::drainStateEvents() {
+    std::array<std::byte, 4096> buf;
+
+    while(recv(this->ueventFd, buf.data(), buf.size(), MSG_DONTWAIT) > 0) {}
+}
+
+/**
+ * @brief Write a coprocessor management file
+ *
+ * Write the specified string into a coprocessor management file.
+ *
+ * @param base Base directory to (or full path of) the management file
+ * @param name Name of the management file (or empty if full path is specified)
+ * @param value String to write to the file
+ */
+void RpmsgBackend::writeFile(const std::string_view &base, const std::string_view &name,
+        const std::string_view &value) {
+    int fd, err;
+
+    // figure out full path
+    std::filesystem::path path(base);
+
+    if(!name.empty()) {
+        path /= name;
+    }
+
+    PLOG_VERBOSE << "writing coproc file " << path.native() << " = '" << value << "'";
+
+    // open file
+    fd = open(path.native().c_str(), O_RDWR);
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "open coproc file");
+    }
+
+    // write the value
+    try {
+        err = write(fd, value.data(), value.length());
+        if(err == -1) {
+            throw std::system_error(errno, std::generic_category(), "write coproc file");
+        }
+    } catch(const std::exception &) {
+        // ensure file is closed
+        close(fd);
+        throw;
+    }
+
+    // clean up
+    close(fd);
+}
+
+
+
+/**
+ * @brief Create and open endpoints
+ *
+ * All endpoints are created up front, then we wait for all of their device nodes to appear at
+ * once, rather than waiting for each in turn.
+ *
+ * @param addresses Endpoints to create
+ *
+ * @return Opened endpoints
+ */
+std::vector<CoprocessorBackend::Endpoint> RpmsgBackend::createEndpoints(
+        std::span<const EndpointAddress> addresses) {
+    this->openControlDevice();
+
+    const auto paths = this->requestEndpoints(addresses);
+    WaitForDevices(paths, kChrdevTimeout);
+
+    return OpenEndpoints(paths);
+}
+
+/**
+ * @brief Create and open endpoints, without blocking
+ *
+ * Instead of waiting for the control device and the endpoints' device nodes to appear, watch the
+ * device directory from the given event loop; each time it changes, we check whether we can
+ * proceed.
+ *
+ * @param evbase Event loop to wait on
+ * @param addresses Endpoints to create
+ * @param callback Invoked once done; if the devices already exist, this happens right away
+ */
+void RpmsgBackend::createEndpointsAsync(struct event_base *evbase,
+        std::span<const EndpointAddress> addresses, CreateEndpointsCallback &&callback) {
+    this->cancelCreateEndpoints();
+
+    auto pending = std::make_unique<PendingCreate>();
+    pending->addresses.assign(addresses.begin(), addresses.end());
+    pending->callback = std::move(callback);
+    pending->deadline = std::chrono::steady_clock::now() + kCtrlDevTimeout;
+
+    pending->inotifyFd = WatchDevDirectory();
+    pending->event = event_new(evbase, pending->inotifyFd, EV_READ, [](auto, auto, auto ctx) {
+        reinterpret_cast<RpmsgBackend *>(ctx)->advancePendingCreate();
+    }, this);
+    if(!pending->event) {
+        close(pending->inotifyFd);
+        throw std::runtime_error("failed to allocate rpmsg device event");
+    }
+
+    this->pendingCreate = std::move(pending);
+    this->advancePendingCreate();
+}
+
+/**
+ * @brief Cancel an asynchronous endpoint creation
+ *
+ * Endpoints that were already created are left for the caller's next cleanup of leftovers.
+ */
+void RpmsgBackend::cancelCreateEndpoints() {
+    if(!this->pendingCreate) {
+        return;
+    }
+
+    event_free(this->pendingCreate->event);
+    close(this->pendingCreate->inotifyFd);
+    this->pendingCreate.reset();
+}
+
+/**
+ * @brief Make progress on an asynchronous endpoint creation
+ *
+ * Once the control device exists, create the endpoints; once all of their device nodes exist,
+ * open them and invoke the callback. Until then, wait for the device directory to change again.
+ */
+void RpmsgBackend::advancePendingCreate() {
+    auto &pending = *this->pendingCreate;
+
+    std::vector<Endpoint> endpoints;
+    std::exception_ptr error;
+
+    try {
+        DrainWatch(pending.inotifyFd);
+
+        if(!pending.endpointsRequested) {
+            const std::filesystem::path ctrlPath{kRpmsgCtrlDev};
+            if(this->rpmsgCtrlFd == -1 && !DevicesExist({&ctrlPath, 1})) {
+                this->waitPendingCreate();
+                return;
+            }
+
+            this->openControlDevice();
+            pending.paths = this->requestEndpoints(pending.addresses);
+            pending.endpointsRequested = true;
+            pending.deadline = std::chrono::steady_clock::now() + kChrdevTimeout;
+        }
+
+        if(!DevicesExist(pending.paths)) {
+            this->waitPendingCreate();
+            return;
+        }
+
+        endpoints = OpenEndpoints(pending.paths);
+    } catch(const std::exception &) {
+        error = std::current_exception();
+    }
+
+    // the callback may well start another request
+    auto callback = std::move(pending.callback);
+    this->cancelCreateEndpoints();
+
+    callback(std::move(endpoints), error);
+}
+
+/**
+ * @brief Wait for the device directory to change, up to the pending request's deadline
+ */
+void RpmsgBackend::waitPendingCreate() {
+    auto &pending = *this->pendingCreate;
+
+    const auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+            pending.deadline - std::chrono::steady_clock::now()).count();
+    if(remaining <= 0) {
+        throw std::runtime_error("timed out waiting for rpmsg devices");
+    }
+
+    const struct timeval tv{
+        .tv_sec  = static_cast<time_t>(remaining / 1'000'000),
+        .tv_usec = static_cast<suseconds_t>(remaining % 1'000'000),
+    };
+    event_add(pending.event, &tv);
+}
+
+/**
+ * @brief Open the rpmsg control device, if not already done
+ *
+ * Since the coprocessor needs to do some setup during boot to start exposing the virtio rings
+ * and notify the host, we wait for the device to appear first.
+ */
+void RpmsgBackend::openControlDevice() {
+    if(this->rpmsgCtrlFd != -1) {
+        return;
+    }
+
+    PLOG_DEBUG << "opening rpmsg_ctrl at " << kRpmsgCtrlDev;
+
+    const std::filesystem::path ctrlPath{kRpmsgCtrlDev};
+    WaitForDevices({&ctrlPath, 1}, kCtrlDevTimeout);
+
+    this->rpmsgCtrlFd = open(kRpmsgCtrlDev.data(), O_RDWR);
+    if(this->rpmsgCtrlFd == -1) {
+        throw std::system_error(errno, std::generic_category(), "open rpmsg_ctrl");
+    }
+}
+
+/**
+ * @brief Create endpoints via the control device
+ *
+ * @param addresses Endpoints to create
+ *
+ * @return Paths of the endpoints' device nodes (which may not exist yet)
+ */
+std::vector<std::filesystem::path> RpmsgBackend::requestEndpoints(
+        std::span<const EndpointAddress> addresses) {
+    const auto existing = ListEndpointDevices();
+    std::vector<std::filesystem::path> paths(addresses.size());
+
+    for(size_t i = 0; i < addresses.size(); i++) {
+        this->createRpcEndpoint(addresses[i].name, addresses[i].address);
+        paths[i] = ResolveEndpointDevice(addresses[i].name, addresses[i].address, existing);
+    }
+
+    return paths;
+}
+
+/**
+ * @brief Create an endpoint
+ *
+ * Invoke an ioctl on the rpmsg_ctrl device to create a new character device corresponding to an
+ * RPC endpoint with the given name and address.
+ *
+ * @param name ns name the service shall be advertised under
+ * @param address Numeric endpoint address of the service on the M4 side
+ */
+void RpmsgBackend::createRpcEndpoint(const std::string_view &name, const uint32_t address) {
+    struct rpmsg_endpoint_info ept{};
+
+    ept.src = -1;
+    ept.dst = address;
+    strncpy(ept.name, name.data(), std::min(name.size(), sizeof(ept.name) - 1));
+
+    int err = ioctl(this->rpmsgCtrlFd, RPMSG_CREATE_EPT_IOCTL, &ept);
+    if(err < 0) {
+        throw std::system_error(errno, std::generic_category(), "RPMSG_CREATE_EPT_IOCTL");
+    }
+}
+
+/**
+ * @brief Get all rpmsg endpoint devices
+ *
+ * Read the endpoint attributes of each device in the rpmsg sysfs class; devices without them
+ * (such as the control device) are skipped.
+ */
+std::vector<RpmsgBackend::EndpointDevice> RpmsgBackend::ListEndpointDevices() {
+    std::vector<EndpointDevice> devices;
+
+    for(const auto &dent : std::filesystem::directory_iterator{kRpmsgSysfsClass}) {
+        std::ifstream nameFile(dent.path() / "name"), dstFile(dent.path() / "dst");
+        if(!nameFile || !dstFile) {
+            continue;
+        }
+
+        EndpointDevice device{
+            .devName = dent.path().filename().native(),
+        };
+
+        int64_t dst{-1};
+        if(!std::getline(nameFile, device.name) || !(dstFile >> dst) || dst < 0) {
+            continue;
+        }
+        device.address = static_cast<uint32_t>(dst);
+
+        devices.emplace_back(std::move(device));
+    }
+
+    return devices;
+}
+
+/**
+ * @brief Find the device created for an endpoint
+ *
+ * Look for an endpoint device with the given name and address, that didn't exist before the
+ * endpoint was created.
+ *
+ * @param name Endpoint name
+ * @param address Remote endpoint address
+ * @param existing Endpoint devices that existed before the endpoint was created
+ *
+ * @return Path of the device node
+ */
+std::filesystem::path RpmsgBackend::ResolveEndpointDevice(const std::string_view &name,
+        const uint32_t address, std::span<const EndpointDevice> existing) {
+    for(const auto &device : ListEndpointDevices()) {
+        if(device.name != name || device.address != address) {
+            continue;
+        } else if(std::any_of(existing.begin(), existing.end(),
+                    [&](const auto &old) { return old.devName == device.devName; })) {
+            continue;
+        }
+
+        std::filesystem::path path{kDevDirectory};
+        path /= device.devName;
+        return path;
+    }
+
+    throw std::runtime_error(fmt::format("no rpmsg device for endpoint {}:{:x}", name, address));
+}
+
+/**
+ * @brief Wait for device nodes to appear
+ *
+ * An inotify watch on the device directory wakes us whenever a node is created (or its
+ * attributes change, as udev adjusts permissions) so we can check again.
+ *
+ * @param paths Device nodes to wait for
+ * @param timeout Maximum time to wait for all of them
+ */
+void RpmsgBackend::WaitForDevices(std::span<const std::filesystem::path> paths,
+        const std::chrono::milliseconds timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    // watch before checking, so a node appearing in between isn't missed
+    const int fd = WatchDevDirectory();
+
+    try {
+        while(!DevicesExist(paths)) {
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now());
+            if(remaining.count() <= 0) {
+                throw std::runtime_error("timed out waiting for rpmsg devices");
+            }
+
+            struct pollfd pfd{
+                .fd = fd,
+                .events = POLLIN,
+            };
+            if(poll(&pfd, 1, remaining.count()) == -1 && errno != EINTR) {
+                throw std::system_error(errno, std::generic_category(), "poll inotify");
+            }
+
+            DrainWatch(fd);
+        }
+    } catch(const std::exception &) {
+        close(fd);
+        throw;
+    }
+
+    close(fd);
+}
+
+/**
+ * @brief Check whether all of the given device nodes exist
+ */
+bool RpmsgBackend::DevicesExist(std::span<const std::filesystem::path> paths) {
+    return std::all_of(paths.begin(), paths.end(), [](const auto &path) {
+        return std::filesystem::is_character_file(path);
+    });
+}
+
+/**
+ * @brief Set up an inotify watch for nodes appearing in (or changing in) the device directory
+ *
+ * @return Non-blocking inotify file descriptor; the caller is responsible for closing it
+ */
+int RpmsgBackend::WatchDevDirectory() {
+    int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "inotify_init1");
+    }
+
+    if(inotify_add_watch(fd, kDevDirectory.data(), IN_CREATE | IN_ATTRIB) == -1) {
+        const auto error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "inotify_add_watch");
+    }
+
+    return fd;
+}
+
+/**
+ * @brief Discard all pending events of an inotify watch
+ *
+ * We only care that something changed, not what it was.
+ */
+void RpmsgBackend::DrainWatch(const int fd) {
+    alignas(struct inotify_event) std::array<std::byte, 1024> events;
+    while(read(fd, events.data(), events.size()) > 0) {}
+}
+
+/**
+ * @brief Open the device nodes of endpoints
+ *
+ * @param paths Device nodes to open
+ *
+ * @return Opened endpoints, in the same order as the paths
+ */
+std::vector<CoprocessorBackend::Endpoint> RpmsgBackend::OpenEndpoints(
+        std::span<const std::filesystem::path> paths) {
+    std::vector<Endpoint> endpoints(paths.size());
+
+    for(size_t i = 0; i < paths.size(); i++) {
+        const int fd = open(paths[i].native().c_str(), O_RDWR);
+        if(fd == -1) {
+            const auto error = errno;
+            for(size_t j = 0; j < i; j++) {
+                close(endpoints[j].fd);
+            }
+            throw std::system_error(error, std::generic_category(), "open rpmsg_chrdev");
+        }
+
+        endpoints[i] = {
+            .path = paths[i],
+            .fd = fd,
+        };
+    }
+
+    return endpoints;
+}
+
+
+
+/**
+ * @brief Destroy endpoints left over in the rpmsg sysfs class
+ *
+ * @return Number of endpoints destroyed
+ */
+size_t RpmsgBackend::destroyLeftoverEndpoints() {
+    size_t count{0};
+
+    for(const auto &device : ListEndpointDevices()) {
+        std::filesystem::path path{kDevDirectory};
+        path /= device.devName;
+
+        // try to open the file; then destroy the endpoint
+        try {
+            PLOG_VERBOSE << "destroying leftover ep " << device.name << " (" << path.native()
+                << ")";
+
+            this->destroyRpcEndpoint(path);
+            count++;
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "failed to destroy ep '" << path << "': " << e.what();
+        }
+    }
+
+    return count;
+}
+
+/**
+ * @brief Destroy an RPC endpoint, given its path
+ *
+ * @param path Path to the rpmsg_chrdev device to destroy
+ */
+void RpmsgBackend::destroyRpcEndpoint(const std::filesystem::path &path) {
+    int fd = open(path.native().c_str(), O_RDWR);
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "open rpmsg_chrdev");
+    }
+
+    this->destroyEndpoint(fd);
+
+    close(fd);
+}
+
+/**
+ * @brief Destroy an RPC endpoint, given an open file descriptor
+ *
+ * This invokes the `RPMSG_DESTROY_EPT_IOCTL` ioctl which will remove this device.
+ *
+ * @param fd File descriptor to invoke the destroy ioctl on
+ */
+void RpmsgBackend::destroyEndpoint(const int fd) {
+    int err = ioctl(fd, RPMSG_DESTROY_EPT_IOCTL, nullptr);
+    if(err < 0) {
+        throw std::system_error(errno, std::generic_category(), "RPMSG_DESTROY_EPT_IOCTL");
+    }
+}
@@ -0,0 +1,146 @@
+#ifndef RPMSGBACKEND_H
+#define RPMSGBACKEND_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "CoprocessorBackend.h"
+
+/**
+ * @brief Coprocessor backend for the real hardware
+ *
+ * The coprocessor is controlled through the remoteproc sysfs interface, and its endpoints are
+ * exposed through `rpmsg_chrdev` devices, created via the rpmsg control device.
+ *
+ * Device nodes appear some time after the coprocessor starts (or an endpoint is created); when
+ * creating endpoints asynchronously, an inotify watch on the device directory drives the process
+ * from the caller's event loop, rather than blocking it.
+ */
+class RpmsgBackend: public CoprocessorBackend {
+    public:
+        RpmsgBackend();
+        ~RpmsgBackend() override;
+
+        void loadFirmware(const std::filesystem::path &fwPath) override;
+        void start() override;
+        void stop() override;
+        bool isRunning() override;
+
+        /// Get the uevent socket; any uevent may indicate a state change
+        int getStateEventFd() override {
+            return this->ueventFd;
+        }
+        void drainStateEvents() override;
+
+        std::vector<Endpoint> createEndpoints(std::span<const EndpointAddress> addresses) override;
+        void createEndpointsAsync(struct event_base *evbase,
+                std::span<const EndpointAddress> addresses,
+                CreateEndpointsCallback &&callback) override;
+        void cancelCreateEndpoints() override;
+        void destroyEndpoint(const int fd) override;
+        size_t destroyLeftoverEndpoints() override;
+
+    private:
+        /**
+         * @brief An rpmsg endpoint device, as listed in sysfs
+         */
+        struct EndpointDevice {
+            /// Device name (the name of its node in /dev)
+            std::string devName;
+            /// Endpoint name
+            std::string name;
+            /// Remote endpoint address
+            uint32_t address;
+        };
+
+        /**
+         * @brief State of an asynchronous endpoint creation
+         *
+         * First, we wait for the control device to appear; then the endpoints are created, and we
+         * wait for all of their device nodes.
+         */
+        struct PendingCreate {
+            /// Endpoints to create
+            std::vector<EndpointAddress> addresses;
+            /// Invoked once done
+            CreateEndpointsCallback callback;
+
+            /// Set once the endpoints were created (and we're waiting for their nodes)
+            bool endpointsRequested{false};
+            /// Device nodes of the created endpoints
+            std::vector<std::filesystem::path> paths;
+
+            /// inotify instance watching the device directory
+            int inotifyFd{-1};
+            /// Read event for the inotify instance
+            struct event *event{nullptr};
+            /// Time by which the device nodes currently waited for must have appeared
+            std::chrono::steady_clock::time_point deadline;
+        };
+
+        /// Set the directory to search for firmware in
+        void setFirmwareDirectory(const std::string_view &directory) {
+            this->writeFile(kFirmwareSysfsBase, "path", directory);
+        }
+        /// Set the firmware file name to load
+        void setFirmwareFilename(const std::string_view &filename) {
+            this->writeFile(kRprocSysfsBase, "firmware", filename);
+        }
+
+        void writeFile(const std::string_view &, const std::string_view &,
+                const std::string_view &);
+
+        void openControlDevice();
+        std::vector<std::filesystem::path> requestEndpoints(
+                std::span<const EndpointAddress> addresses);
+        void createRpcEndpoint(const std::string_view &name, const uint32_t address);
+        void destroyRpcEndpoint(const std::filesystem::path &chrdevPath);
+
+        void advancePendingCreate();
+        void waitPendingCreate();
+
+        static std::vector<EndpointDevice> ListEndpointDevices();
+        static std::filesystem::path ResolveEndpointDevice(const std::string_view &name,
+                const uint32_t address, std::span<const EndpointDevice> existing);
+        static void WaitForDevices(std::span<const std::filesystem::path> paths,
+                const std::chrono::milliseconds timeout);
+        static bool DevicesExist(std::span<const std::filesystem::path> paths);
+        static int WatchDevDirectory();
+        static void DrainWatch(const int fd);
+        static std::vector<Endpoint> OpenEndpoints(std::span<const std::filesystem::path> paths);
+
+    private:
+        /// Path of the "firmware base path" sysfs variable
+        constexpr static const std::string_view kFirmwareSysfsBase{"/sys/module/firmware_class/parameters/"};
+        /// Remoteproc base path
+        constexpr static const std::string_view kRprocSysfsBase{"/dev/remoteproc/m4/"};
+
+        /// rpmsg control device file
+        constexpr static const std::string_view kRpmsgCtrlDev{"/dev/rpmsg_ctrl0"};
+        /// directory containing the rpmsg device nodes
+        constexpr static const std::string_view kDevDirectory{"/dev/"};
+        /// sysfs class directory listing all rpmsg devices (and their endpoint attributes)
+        constexpr static const std::string_view kRpmsgSysfsClass{"/sys/class/rpmsg/"};
+
+        /// How long to wait for the rpmsg control device to appear after the coprocessor starts
+        constexpr static const std::chrono::milliseconds kCtrlDevTimeout{5000};
+        /// How long to wait for the device node of a newly created endpoint to appear
+        constexpr static const std::chrono::milliseconds kChrdevTimeout{1000};
+
+        /// file descriptor to the rpmsg control interface
+        int rpmsgCtrlFd{-1};
+        /// netlink socket receiving kernel uevents (-1 if unavailable)
+        int ueventFd{-1};
+
+        /// Asynchronous endpoint creation in progress (if any)
+        std::unique_ptr<PendingCreate> pendingCreate;
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <cerrno>
+#include <system_error>
+
+#include <event2/event.h>
+#include <plog/Log.h>
+
+#include "RpmsgLoop.h"
+#include "Watchdog.h"
+
+/**
+ * @brief Initialize the rpmsg loop
+ *
+ * Create the event base for the rpmsg thread, and the mailboxes used to pass work to and from it.
+ * The thread isn't started until `start()` is called, so endpoint handlers can be set up first.
+ *
+ * @param rpcEvBase Event loop of the RPC server
+ */
+RpmsgLoop::RpmsgLoop(struct event_base *rpcEvBase) {
+    this->evbase = event_base_new();
+    if(!this->evbase) {
+        throw std::runtime_error("failed to allocate event_base");
+    }
+
+    this->toRpc.init(rpcEvBase);
+    this->toRpmsg.init(this->evbase, [this]() {
+        if(!this->shouldRun) {
+            event_base_loopbreak(this->evbase);
+        }
+    });
+
+    this->initWatchdogEvent();
+}
+
+/**
+ * @brief Create watchdog check-in event
+ *
+ * Check in with the watchdog periodically, to indicate that the rpmsg loop is alive. This fires
+ * at twice the rate the RPC loop kicks the watchdog, so we'll always have checked in between two
+ * kicks.
+ */
+void RpmsgLoop::initWatchdogEvent() {
+    if(!Watchdog::IsActive()) {
+        return;
+    }
+
+    const auto usec = Watchdog::GetInterval().count() / 4;
+
+    this->watchdogCheckin = Watchdog::AddCheckin();
+
+    this->watchdogEvent = event_new(this->evbase, -1, EV_PERSIST, [](auto, auto, auto ctx) {
+        Watchdog::Checkin(reinterpret_cast<RpmsgLoop *>(ctx)->watchdogCheckin);
+    }, this);
+    if(!this->watchdogEvent) {
+        throw std::runtime_error("failed to allocate watchdog event");
+    }
+
+    struct timeval tv{
+        .tv_sec  = static_cast<time_t>(usec / 1'000'000U),
+        .tv_usec = static_cast<suseconds_t>(usec % 1'000'000U),
+    };
+
+    evtimer_add(this->watchdogEvent, &tv);
+}
+
+/**
+ * @brief Stop the rpmsg thread and release all resources
+ *
+ * @remark Any endpoint handlers using this loop should be destroyed before the loop.
+ */
+RpmsgLoop::~RpmsgLoop() {
+    this->stop();
+
+    if(this->watchdogEvent) {
+        event_free(this->watchdogEvent);
+        Watchdog::RemoveCheckin(this->watchdogCheckin);
+    }
+
+    // release the mailbox before the event base its event belongs to
+    this->toRpmsg.release();
+
+    event_base_free(this->evbase);
+}
+
+/**
+ * @brief Start the rpmsg thread
+ */
+void RpmsgLoop::start() {
+    this->shouldRun = true;
+    this->thread = std::thread(&RpmsgLoop::run, this);
+}
+
+/**
+ * @brief Stop the rpmsg thread
+ *
+ * Request the rpmsg loop to exit, then wait for the thread to terminate.
+ */
+void RpmsgLoop::stop() {
+    if(!this->thread.joinable()) {
+        return;
+    }
+
+    this->shouldRun = false;
+    eventfd_write(this->toRpmsg.eventFd, 1);
+
+    this->thread.join();
+}
+
+/**
+ * @brief Entry point for the rpmsg thread
+ */
+void RpmsgLoop::run() {
+    pthread_setname_np(pthread_self(), "rpmsg");
+    PLOG_DEBUG << "rpmsg loop starting";
+
+    while(this->shouldRun) {
+        event_base_dispatch(this->evbase);
+    }
+
+    PLOG_DEBUG << "rpmsg loop exiting";
+}
+
+
+
+/**
+ * @brief Set up a mailbox
+ *
+ * Create its eventfd, and an event on the receiving loop to drain the queue when signalled.
+ *
+ * @param receiver Event loop that executes the mailbox's work items
+ * @param drained Optional callback to invoke each time the queue has been drained
+ */
+void RpmsgLoop::Mailbox::init(struct event_base *receiver, std::function<void()> &&drained) {
+    this->drainedCallback = std::move(drained);
+
+    this->eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(this->eventFd == -1) {
+        throw std::system_error(errno, std::generic_category(), "create mailbox eventfd");
+    }
+
+    this->event = event_new(receiver, this->eventFd, EV_READ | EV_PERSIST,
+            [](auto, auto, auto ctx) {
+        reinterpret_cast<Mailbox *>(ctx)->drain();
+    }, this);
+    if(!this->event) {
+        throw std::runtime_error("failed to allocate mailbox event");
+    }
+
+    event_add(this->event, nullptr);
+}
+
+/**
+ * @brief Release mailbox resources
+ *
+ * @remark Any work items remaining in the queue are discarded.
+ */
+void RpmsgLoop::Mailbox::release() {
+    if(this->event) {
+        event_free(this->event);
+        this->event = nullptr;
+    }
+    if(this->eventFd != -1) {
+        close(this->eventFd);
+        this->eventFd = -1;
+    }
+}
+
+/**
+ * @brief Queue a work item
+ *
+ * The receiver is woken up only if it's not already been signalled since it last drained the
+ * queue, so a burst of work costs only a single eventfd write.
+ *
+ * @return Whether the item was queued
+ */
+bool RpmsgLoop::Mailbox::post(Work &&work) {
+    if(!this->queue.push(std::move(work))) {
+        return false;
+    }
+
+    if(!this->isSignalled.exchange(true)) {
+        eventfd_write(this->eventFd, 1);
+    }
+
+    return true;
+}
+
+/**
+ * @brief Execute all queued work items
+ *
+ * The signalled flag is cleared before the queue is drained, so that any work queued while
+ * draining signals the eventfd again.
+ */
+void RpmsgLoop::Mailbox::drain() {
+    eventfd_t value;
+    eventfd_read(this->eventFd, &value);
+
+    this->isSignalled = false;
+
+    while(auto work = this->queue.pop()) {
+        try {
+            (*work)();
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "Failed to execute mailbox work: " << e.what();
+        }
+    }
+
+    if(this->drainedCallback) {
+        this->drainedCallback();
+    }
+}
@@ -0,0 +1,120 @@
+#ifndef RPMSGLOOP_H
+#define RPMSGLOOP_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <thread>
+
+#include "Utils/SpscQueue.h"
+
+struct event;
+struct event_base;
+
+/**
+ * @brief Event loop for coprocessor (rpmsg) endpoints
+ *
+ * The coprocessor endpoint handlers run on their own libevent loop, on a dedicated thread; this
+ * way, work done for local RPC clients can't add latency to messages to and from the M4, and vice
+ * versa.
+ *
+ * Work is passed between this thread and the RPC server's thread through a pair of lock-free
+ * single producer/single consumer queues; the receiving side is woken up with an eventfd.
+ */
+class RpmsgLoop {
+    public:
+        /// Work item to be executed on another loop
+        using Work = std::function<void()>;
+
+        RpmsgLoop(struct event_base *rpcEvBase);
+        ~RpmsgLoop();
+
+        void start();
+        void stop();
+
+        /**
+         * @brief Get the libevent loop for the rpmsg thread
+         */
+        constexpr inline auto getEvBase() {
+            return this->evbase;
+        }
+
+        /**
+         * @brief Run work on the RPC server's loop
+         *
+         * @remark Call only from the rpmsg thread.
+         *
+         * @return Whether the work was queued; if not, the queue is full.
+         */
+        inline bool postToRpc(Work &&work) {
+            return this->toRpc.post(std::move(work));
+        }
+
+        /**
+         * @brief Run work on the rpmsg loop
+         *
+         * @remark Call only from the RPC server's thread.
+         *
+         * @return Whether the work was queued; if not, the queue is full.
+         */
+        inline bool postToRpmsg(Work &&work) {
+            return this->toRpmsg.post(std::move(work));
+        }
+
+    private:
+        /**
+         * @brief One direction of work passing between the loops
+         *
+         * Work items are queued, then the eventfd is signalled to wake the receiving loop (only
+         * if it hasn't been signalled since it last drained the queue.)
+         */
+        struct Mailbox {
+            /// Number of work items that can be queued
+            constexpr static const size_t kCapacity{512};
+
+            /// Pending work items
+            Util::SpscQueue<Work, kCapacity> queue;
+            /// eventfd used to wake the receiver
+            int eventFd{-1};
+            /// Set once the eventfd has been signalled, until the receiver drains the queue
+            std::atomic_bool isSignalled{false};
+            /// Receive event (on the receiving loop)
+            struct event *event{nullptr};
+
+            void init(struct event_base *receiver, std::function<void()> &&drained = {});
+            void release();
+            ~Mailbox() {
+                this->release();
+            }
+
+            bool post(Work &&);
+            void drain();
+
+            /// Invoked after the queue has been drained
+            std::function<void()> drainedCallback;
+        };
+
+        void initWatchdogEvent();
+
+        void run();
+
+    private:
+        /// libevent loop for the rpmsg thread
+        struct event_base *evbase{nullptr};
+        /// Thread running the rpmsg loop
+        std::thread thread;
+        /// Cleared to request the rpmsg thread to exit
+        std::atomic_bool shouldRun{true};
+
+        /// Work to run on the RPC server's loop
+        Mailbox toRpc;
+        /// Work to run on the rpmsg loop
+        Mailbox toRpmsg;
+
+        /// watchdog check-in timer event (if watchdog is active)
+        struct event *watchdogEvent{nullptr};
+        /// watchdog check-in source id
+        size_t watchdogCheckin{0};
+};
+
+#endif
@@ -0,0 +1,479 @@
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <cbor.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <system_error>
+
+#include <fmt/format.h>
+#include <plog/Log.h>
+
+#include "Config.h"
+#include "ControlFrameTypes.h"
+#include "MeasurementCodec.h"
+#include "RpcTypes.h"
+#include "SimulatedBackend.h"
+
+/**
+ * @brief Initialize the simulator
+ *
+ * @param params Simulation parameters
+ */
+SimulatedBackend::SimulatedBackend(const Params &params) : params(params) {
+    this->wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(this->wakeFd == -1) {
+        throw std::system_error(errno, std::generic_category(), "create simulator eventfd");
+    }
+
+    PLOG_WARNING << "using simulated coprocessor (" << params.measurementRate << " Hz)";
+}
+
+/**
+ * @brief Stop the simulator and close all endpoints
+ */
+SimulatedBackend::~SimulatedBackend() {
+    this->stop();
+    this->closeEndpoints();
+
+    close(this->wakeFd);
+}
+
+/**
+ * @brief Firmware can't be loaded into the simulator; this is ignored
+ */
+void SimulatedBackend::loadFirmware(const std::filesystem::path &fwPath) {
+    PLOG_VERBOSE << "simulator: ignoring firmware " << fwPath.native();
+}
+
+/**
+ * @brief Start the simulated coprocessor
+ *
+ * This spawns the simulator thread, which services all endpoints.
+ */
+void SimulatedBackend::start() {
+    if(this->thread.joinable()) {
+        return;
+    }
+
+    this->isCrashed = false;
+    this->shouldRun = true;
+    this->thread = std::thread(&SimulatedBackend::run, this);
+}
+
+/**
+ * @brief Stop the simulated coprocessor
+ *
+ * Wait for the simulator thread to exit; all endpoints are closed, like the rpmsg devices are
+ * removed when the real coprocessor stops.
+ */
+void SimulatedBackend::stop() {
+    if(!this->thread.joinable()) {
+        return;
+    }
+
+    this->shouldRun = false;
+    this->wake();
+    this->thread.join();
+
+    this->closeEndpoints();
+
+    PLOG_INFO << "simulator stopped: sent " << this->measurementsSent << " measurements ("
+        << this->measurementsDropped << " dropped)";
+}
+
+/**
+ * @brief Create endpoints
+ *
+ * For each endpoint, create a socket pair: one end is returned, while the other is serviced by
+ * the simulator thread.
+ */
+std::vector<CoprocessorBackend::Endpoint> SimulatedBackend::createEndpoints(
+        std::span<const EndpointAddress> addresses) {
+    std::vector<Endpoint> out;
+    std::lock_guard lg(this->lock);
+
+    for(const auto &address : addresses) {
+        std::array<int, 2> fds;
+        if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds.data()) == -1) {
+            const auto error = errno;
+            for(const auto &endpoint : out) {
+                close(endpoint.fd);
+            }
+            throw std::system_error(error, std::generic_category(), "create simulator endpoint");
+        }
+
+        auto &ep = this->endpoints.emplace_back(SimEndpoint{
+            .name = std::string(address.name),
+            .type = EndpointType::Other,
+            .fd = fds[1],
+            .peerFd = fds[0],
+        });
+
+        if(address.name == "pl.control") {
+            ep.type = EndpointType::Control;
+        } else if(address.name == "confd") {
+            ep.type = EndpointType::Confd;
+        } else if(address.name == "pl.direct") {
+            ep.type = EndpointType::Direct;
+        }
+
+        out.emplace_back(Endpoint{
+            .path = fmt::format("sim:{}:{:x}", address.name, address.address),
+            .fd = fds[0],
+        });
+    }
+
+    this->wake();
+    return out;
+}
+
+/**
+ * @brief Destroy an endpoint
+ *
+ * The endpoint is marked as destroyed; the simulator thread closes its end of the socket pair.
+ */
+void SimulatedBackend::destroyEndpoint(const int fd) {
+    std::lock_guard lg(this->lock);
+
+    auto it = std::find_if(this->endpoints.begin(), this->endpoints.end(),
+            [&](const auto &ep) { return ep.peerFd == fd && !ep.isDestroyed; });
+    if(it == this->endpoints.end()) {
+        throw std::invalid_argument(fmt::format("unknown simulator endpoint (fd {})", fd));
+    }
+
+    it->isDestroyed = true;
+    this->wake();
+}
+
+/**
+ * @brief Close the simulator's end of all endpoints
+ *
+ * @remark The simulator thread must not be running.
+ */
+void SimulatedBackend::closeEndpoints() {
+    std::lock_guard lg(this->lock);
+
+    for(const auto &ep : this->endpoints) {
+        if(ep.fd != -1) {
+            close(ep.fd);
+        }
+    }
+    this->endpoints.clear();
+}
+
+/**
+ * @brief Wake the simulator thread
+ */
+void SimulatedBackend::wake() {
+    eventfd_write(this->wakeFd, 1);
+}
+
+
+
+/**
+ * @brief Simulator thread entry point
+ *
+ * Wait for messages from loadd on all endpoints, or for the next measurement, stall or crash to
+ * be due, whichever comes first.
+ */
+void SimulatedBackend::run() {
+    pthread_setname_np(pthread_self(), "m4-sim");
+    PLOG_DEBUG << "simulator starting";
+
+    const auto &p = this->params;
+    const auto startedAt = Clock::now();
+    const auto kNever = Clock::time_point::max();
+
+    const auto measurementPeriod = (p.measurementRate > 0.) ?
+        std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+                    1. / p.measurementRate)) : Clock::duration::zero();
+
+    auto nextMeasurement = (p.measurementRate > 0.) ? startedAt : kNever;
+    auto nextStall = p.stallInterval.count() ? (startedAt + p.stallInterval) : kNever;
+    auto stallEnd = Clock::time_point::min();
+    auto crashAt = p.crashAfter.count() ? (startedAt + p.crashAfter) : kNever;
+
+    std::vector<struct pollfd> pfds;
+    std::array<std::byte, 512> buf;
+
+    while(this->shouldRun) {
+        const auto now = Clock::now();
+
+        // inject faults
+        if(now >= crashAt) {
+            this->crash();
+            crashAt = kNever;
+        }
+        if(now >= nextStall) {
+            PLOG_INFO << "simulator: stalling for " << p.stallDuration.count() << " ms";
+            stallEnd = now + p.stallDuration;
+            nextStall = now + p.stallInterval;
+        }
+
+        const bool isStalled = (now < stallEnd);
+
+        // broadcast measurements (without bursting to catch up after a stall)
+        if(!isStalled && !this->isCrashed && now >= nextMeasurement) {
+            this->sendMeasurement();
+
+            nextMeasurement += measurementPeriod;
+            if(nextMeasurement < now) {
+                nextMeasurement = now + measurementPeriod;
+            }
+        }
+
+        // wait for messages (unless stalled), or until the next thing is due
+        pfds.clear();
+        pfds.push_back({.fd = this->wakeFd, .events = POLLIN});
+
+        if(!isStalled) {
+            std::lock_guard lg(this->lock);
+            for(const auto &ep : this->endpoints) {
+                if(ep.fd != -1 && !ep.isDestroyed) {
+                    pfds.push_back({.fd = ep.fd, .events = POLLIN});
+                }
+            }
+        }
+
+        auto deadline = std::min({crashAt, nextStall, isStalled ? stallEnd : kNever});
+        if(!isStalled && !this->isCrashed) {
+            deadline = std::min(deadline, nextMeasurement);
+        }
+
+        struct timespec ts{}, *timeout{nullptr};
+        if(deadline != kNever) {
+            const auto nsec = std::max<int64_t>(0,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(deadline -
+                        Clock::now()).count());
+            ts.tv_sec = nsec / 1'000'000'000;
+            ts.tv_nsec = nsec % 1'000'000'000;
+            timeout = &ts;
+        }
+
+        if(ppoll(pfds.data(), pfds.size(), timeout, nullptr) == -1) {
+            if(errno == EINTR) {
+                continue;
+            }
+            PLOG_ERROR << "simulator: ppoll failed: " << strerror(errno);
+            break;
+        }
+
+        if(pfds[0].revents & POLLIN) {
+            eventfd_t value;
+            eventfd_read(this->wakeFd, &value);
+        }
+
+        // close destroyed endpoints, and read messages from the others
+        std::lock_guard lg(this->lock);
+
+        for(auto it = this->endpoints.begin(); it != this->endpoints.end();) {
+            if(it->isDestroyed) {
+                if(it->fd != -1) {
+                    close(it->fd);
+                }
+                it = this->endpoints.erase(it);
+                continue;
+            }
+
+            auto &ep = *it++;
+            if(ep.fd == -1 || isStalled) {
+                continue;
+            }
+
+            ssize_t read;
+            while((read = recv(ep.fd, buf.data(), buf.size(), MSG_DONTWAIT)) > 0) {
+                this->handleMessage(ep, {buf.data(), static_cast<size_t>(read)});
+            }
+        }
+    }
+
+    PLOG_DEBUG << "simulator exiting";
+}
+
+/**
+ * @brief Handle a message from loadd
+ */
+void SimulatedBackend::handleMessage(SimEndpoint &ep, std::span<const std::byte> message) {
+    if(message.size() < sizeof(struct rpc_header)) {
+        PLOG_WARNING << "simulator: runt message on " << ep.name;
+        return;
+    }
+
+    struct rpc_header hdr;
+    memcpy(&hdr, message.data(), sizeof(hdr));
+
+    // the first message is the wake-up message
+    if(!ep.isConnected) {
+        PLOG_DEBUG << "simulator: endpoint " << ep.name << " connected";
+        ep.isConnected = true;
+
+        if(ep.type == EndpointType::Confd) {
+            this->sendBootQueries(ep);
+        }
+        return;
+    }
+
+    if(ep.type == EndpointType::Direct) {
+        this->send(ep, message);
+    } else if(ep.type == EndpointType::Confd && (hdr.flags & kRpcFlagReply) &&
+            this->bootQueriesPending) {
+        if(!--this->bootQueriesPending) {
+            PLOG_INFO << "simulator: boot queries answered in "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() -
+                        this->bootQueriesSent).count() << " ms";
+        }
+    }
+}
+
+/**
+ * @brief Broadcast a measurement on the control endpoint
+ *
+ * The values follow a slow sine wave (with some noise) so they look somewhat plausible. They're
+ * sent either as a binary frame or as CBOR, as configured.
+ */
+void SimulatedBackend::sendMeasurement() {
+    static std::minstd_rand gRandom;
+    std::uniform_real_distribution<float> noise(-.01f, .01f);
+
+    const auto phase = static_cast<float>(this->measurementsSent) / 1000.f;
+
+    const struct measurement_record record{
+        .voltage = 12.f + std::sin(phase) + noise(gRandom),
+        .current = 1.5f + std::cos(phase) + noise(gRandom),
+        .temperature = 35.f + noise(gRandom),
+        .status = kControlStatusEnabled,
+    };
+
+    // encode the payload
+    std::array<std::byte, 128> buf;
+    const auto payload = std::span(buf).subspan(sizeof(struct rpc_header));
+    size_t payloadLen;
+
+    if(this->params.binaryFrames) {
+        const struct control_measurement_frame frame{
+            .version = kControlFrameVersion,
+            .status = static_cast<uint16_t>(record.status),
+            .sequence = this->frameSequence++,
+            .voltage = record.voltage,
+            .current = record.current,
+            .temperature = record.temperature,
+        };
+        memcpy(payload.data(), &frame, sizeof(frame));
+        payloadLen = sizeof(frame);
+    } else {
+        payloadLen = MeasurementCodec::EncodeCbor(record, payload);
+    }
+
+    if(!payloadLen) {
+        throw std::runtime_error("failed to serialize simulated measurement");
+    }
+
+    const struct rpc_header hdr{
+        .version = kRpcVersionLatest,
+        .length = static_cast<uint16_t>(sizeof(struct rpc_header) + payloadLen),
+        .endpoint = kRpcEndpointMeasurement,
+        .tag = 0,
+        .flags = static_cast<uint8_t>(kRpcFlagBroadcast |
+                (this->params.binaryFrames ? kRpcFlagBinary : 0)),
+    };
+    memcpy(buf.data(), &hdr, sizeof(hdr));
+
+    std::lock_guard lg(this->lock);
+    for(auto &ep : this->endpoints) {
+        if(ep.type != EndpointType::Control || !ep.isConnected || ep.fd == -1) {
+            continue;
+        }
+
+        if(this->send(ep, {buf.data(), hdr.length})) {
+            this->measurementsSent++;
+        } else {
+            this->measurementsDropped++;
+        }
+    }
+}
+
+/**
+ * @brief Issue the config queries the firmware makes during boot
+ *
+ * Queries are for a handful of keys (so some are repeated), each with its own tag.
+ */
+void SimulatedBackend::sendBootQueries(SimEndpoint &ep) {
+    constexpr static const size_t kNumKeys{8};
+
+    this->bootQueriesSent = Clock::now();
+    this->bootQueriesPending = 0;
+
+    for(size_t i = 0; i < this->params.numBootQueries; i++) {
+        const auto key = fmt::format("sim.key{}", i % kNumKeys);
+
+        auto map = cbor_new_definite_map(1);
+        cbor_map_add(map, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("key")),
+            .value = cbor_move(cbor_build_stringn(key.data(), key.size())),
+        });
+
+        std::array<std::byte, 128> buf;
+        const auto payloadLen = cbor_serialize(map, reinterpret_cast<unsigned char *>(
+                    buf.data()) + sizeof(struct rpc_header),
+                buf.size() - sizeof(struct rpc_header));
+        cbor_decref(&map);
+
+        const struct rpc_header hdr{
+            .version = kRpcVersionLatest,
+            .length = static_cast<uint16_t>(sizeof(struct rpc_header) + payloadLen),
+            .endpoint = Config::GetConfdQueryEndpoint(),
+            .tag = static_cast<uint8_t>(i),
+        };
+        memcpy(buf.data(), &hdr, sizeof(hdr));
+
+        if(this->send(ep, {buf.data(), hdr.length})) {
+            this->bootQueriesPending++;
+        }
+    }
+}
+
+/**
+ * @brief Send a message to loadd
+ *
+ * @return Whether the message was sent; if not, loadd isn't keeping up
+ */
+bool SimulatedBackend::send(SimEndpoint &ep, std::span<const std::byte> message) {
+    const auto err = ::send(ep.fd, message.data(), message.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    if(err == -1) {
+        if(errno != EAGAIN && errno != EWOULDBLOCK) {
+            PLOG_WARNING << "simulator: send on " << ep.name << " failed: " << strerror(errno);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Inject a crash
+ *
+ * Close our end of all endpoints, so loadd sees them hang up; nothing is sent or received until
+ * the coprocessor is restarted.
+ */
+void SimulatedBackend::crash() {
+    PLOG_WARNING << "simulator: injecting crash";
+
+    std::lock_guard lg(this->lock);
+    for(auto &ep : this->endpoints) {
+        if(ep.fd != -1) {
+            close(ep.fd);
+            ep.fd = -1;
+        }
+    }
+
+    this->isCrashed = true;
+}
@@ -0,0 +1,141 @@
+#ifndef SIMULATEDBACKEND_H
+#define SIMULATEDBACKEND_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CoprocessorBackend.h"
+
+/**
+ * @brief Simulated coprocessor backend
+ *
+ * Stands in for the M4 and its rpmsg endpoints, so loadd can be run (and load tested) on any
+ * machine. Each endpoint is a sequenced packet socket pair, of which loadd gets one end; the
+ * other is serviced by a simulator thread, which implements the load control and confd
+ * endpoints:
+ *
+ * - pl.control: Broadcasts measurements at a configurable rate, once loadd has sent its wake-up
+ *   message.
+ * - confd: Issues a burst of config queries once loadd has sent its wake-up message, as the
+ *   firmware does during boot.
+ * - pl.direct: Echoes every message after the wake-up message back to its sender (a client that
+ *   leased the channel.)
+ *
+ * Faults can be injected as well: the simulator can periodically stall (stop reading and sending
+ * messages for a while) or crash (all endpoints are closed, until the coprocessor is restarted.)
+ */
+class SimulatedBackend: public CoprocessorBackend {
+    public:
+        /**
+         * @brief Simulation parameters
+         */
+        struct Params {
+            /// Rate at which measurements are broadcast, in Hz (0 to disable)
+            double measurementRate{100.};
+            /// Send measurements as binary frames (rather than CBOR)
+            bool binaryFrames{true};
+            /// Number of config queries issued when the confd endpoint is opened
+            size_t numBootQueries{32};
+            /// Interval between stalls (0 to disable)
+            std::chrono::milliseconds stallInterval{0};
+            /// Duration of each stall
+            std::chrono::milliseconds stallDuration{0};
+            /// Time after the coprocessor is started at which it crashes (0 to disable)
+            std::chrono::milliseconds crashAfter{0};
+        };
+
+        SimulatedBackend(const Params &params);
+        ~SimulatedBackend() override;
+
+        void loadFirmware(const std::filesystem::path &fwPath) override;
+        void start() override;
+        void stop() override;
+        /// The simulator is running until it's stopped, or crashes
+        bool isRunning() override {
+            return this->thread.joinable() && !this->isCrashed;
+        }
+
+        std::vector<Endpoint> createEndpoints(std::span<const EndpointAddress> addresses) override;
+        void destroyEndpoint(const int fd) override;
+        /// There are never any leftover endpoints
+        size_t destroyLeftoverEndpoints() override {
+            return 0;
+        }
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        /// Endpoints implemented by the simulator
+        enum class EndpointType {
+            Control,
+            Confd,
+            Direct,
+            /// Any other endpoint; messages to it are discarded
+            Other,
+        };
+
+        /**
+         * @brief Simulator side of an endpoint
+         */
+        struct SimEndpoint {
+            /// Endpoint name
+            std::string name;
+            EndpointType type;
+            /// Our end of the socket pair
+            int fd{-1};
+            /// loadd's end of the socket pair (to identify the endpoint when it's destroyed)
+            int peerFd{-1};
+
+            /// Set once loadd sent its wake-up message
+            bool isConnected{false};
+            /// Set when loadd destroyed the endpoint; it's closed by the simulator thread
+            bool isDestroyed{false};
+        };
+
+        void wake();
+        void run();
+
+        void handleMessage(SimEndpoint &ep, std::span<const std::byte> message);
+        void sendMeasurement();
+        void sendBootQueries(SimEndpoint &ep);
+        bool send(SimEndpoint &ep, std::span<const std::byte> message);
+        void crash();
+        void closeEndpoints();
+
+    private:
+        /// Simulation parameters
+        Params params;
+
+        /// Simulator thread (while the coprocessor is running)
+        std::thread thread;
+        /// Cleared to request the simulator thread to exit
+        std::atomic_bool shouldRun{false};
+        /// eventfd used to wake the simulator thread (when endpoints change, or to exit)
+        int wakeFd{-1};
+
+        /// Protects the endpoints
+        std::mutex lock;
+        /// All endpoints
+        std::vector<SimEndpoint> endpoints;
+
+        /// Set when a crash was injected; the coprocessor must be restarted
+        std::atomic_bool isCrashed{false};
+        /// Timestamp at which the boot queries were sent
+        Clock::time_point bootQueriesSent;
+        /// Number of replies to boot queries still outstanding
+        size_t bootQueriesPending{0};
+
+        /// Number of measurements sent, and dropped because loadd wasn't reading
+        size_t measurementsSent{0}, measurementsDropped{0};
+        /// Sequence number of the next binary measurement frame
+        uint32_t frameSequence{0};
+};
+
+#endif
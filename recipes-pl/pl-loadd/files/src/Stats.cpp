@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <ctime>
+#include <string_view>
+
+#include <cbor.h>
+
+#include "Stats.h"
+
+std::array<Stats::Counters, Stats::kNumSources << 8> Stats::gSeries;
+
+/**
+ * @brief Get the current time for latency measurements
+ *
+ * @return Monotonic timestamp, in nanoseconds
+ */
+uint64_t Stats::Now() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000ULL) + ts.tv_nsec;
+}
+
+/**
+ * @brief Record a sample
+ *
+ * @param source Message path
+ * @param endpoint Endpoint of the message (from its header)
+ * @param nsec Time taken to handle the message, in nanoseconds
+ * @param size Total size of the message, in bytes
+ * @param now Current timestamp (from `Now()`)
+ */
+void Stats::Record(const Source source, const uint8_t endpoint, const uint64_t nsec,
+        const size_t size, const uint64_t now) {
+    const auto key = MakeKey(source, endpoint);
+    if(key >= gSeries.size()) {
+        return;
+    }
+
+    gSeries[key].record(nsec, size, now);
+}
+
+/**
+ * @brief Discard all statistics collected so far
+ *
+ * Samples recorded concurrently may be partially retained.
+ */
+void Stats::Reset() {
+    for(auto &counters : gSeries) {
+        counters.clear();
+    }
+}
+
+/**
+ * @brief Serialize all statistics
+ *
+ * Create a CBOR map, keyed by message path name. Each value is in turn a map, keyed by endpoint
+ * number, whose values are maps with the following keys:
+ *
+ * - n: Number of messages
+ * - b: Total bytes
+ * - s: Largest message size, in bytes
+ * - r: Average message rate, in messages per second
+ * - p50, p99, max: Latency percentiles and maximum, in nanoseconds
+ *
+ * @return CBOR item, which the caller is responsible for releasing
+ */
+struct cbor_item_t *Stats::Snapshot() {
+    // names for each of the sources
+    constexpr static const std::array<std::string_view, kNumSources> kSourceNames{{
+        "rpc", "control", "broadcast", "confd", "confdReply", "confdRtt", "confdCacheHit",
+        "confdCacheMiss", "ready", "endpoints", "recovery",
+    }};
+
+    std::array<cbor_item_t *, kSourceNames.size()> sources{};
+
+    for(size_t key = 0; key < gSeries.size(); key++) {
+        // skip series without any samples without reading all of their counters
+        if(!gSeries[key].lastSample.load(std::memory_order_relaxed)) {
+            continue;
+        }
+
+        const auto series = gSeries[key].load();
+        if(!series.latency.count) {
+            continue;
+        }
+
+        auto &source = sources[key >> 8];
+        if(!source) {
+            source = cbor_new_indefinite_map();
+        }
+
+        // calculate the rate over the period during which we've seen messages
+        const auto &hist = series.latency;
+        double rate{0.};
+
+        if(series.lastSample > series.firstSample) {
+            rate = static_cast<double>(hist.count - 1) /
+                (static_cast<double>(series.lastSample - series.firstSample) / 1'000'000'000.);
+        }
+
+        auto entry = cbor_new_definite_map(7);
+        cbor_map_add(entry, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("n")),
+            .value = cbor_move(cbor_build_uint64(hist.count)),
+        });
+        cbor_map_add(entry, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("b")),
+            .value = cbor_move(cbor_build_uint64(series.bytes)),
+        });
+        cbor_map_add(entry, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("s")),
+            .value = cbor_move(cbor_build_uint32(series.maxSize)),
+        });
+        cbor_map_add(entry, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("r")),
+            .value = cbor_move(cbor_build_float4(rate)),
+        });
+        cbor_map_add(entry, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("p50")),
+            .value = cbor_move(cbor_build_uint64(hist.percentile(.5))),
+        });
+        cbor_map_add(entry, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("p99")),
+            .value = cbor_move(cbor_build_uint64(hist.percentile(.99))),
+        });
+        cbor_map_add(entry, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("max")),
+            .value = cbor_move(cbor_build_uint64(hist.max)),
+        });
+
+        cbor_map_add(source, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_uint8(key & 0xFF)),
+            .value = cbor_move(entry),
+        });
+    }
+
+    // then assemble the root map from all sources that have any samples
+    auto root = cbor_new_indefinite_map();
+
+    for(size_t i = 0; i < sources.size(); i++) {
+        if(!sources[i]) {
+            continue;
+        }
+
+        cbor_map_add(root, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_stringn(kSourceNames[i].data(), kSourceNames[i].size())),
+            .value = cbor_move(sources[i]),
+        });
+    }
+
+    return root;
+}
+
+
+
+/**
+ * @brief Record a sample into a series' counters
+ *
+ * @param nsec Latency, in nanoseconds
+ * @param size Message size, in bytes
+ * @param now Current timestamp
+ */
+void Stats::Counters::record(const uint64_t nsec, const size_t size, const uint64_t now) {
+    // raise an atomic to at least the given value
+    auto raise = [](std::atomic_uint64_t &value, const uint64_t to) {
+        auto current = value.load(std::memory_order_relaxed);
+        while(current < to && !value.compare_exchange_weak(current, to,
+                    std::memory_order_relaxed)) {}
+    };
+
+    const auto bucket = std::min<size_t>(std::bit_width(nsec), Histogram::kNumBuckets - 1);
+    this->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    raise(this->max, nsec);
+
+    this->bytes.fetch_add(size, std::memory_order_relaxed);
+    raise(this->maxSize, size);
+
+    uint64_t first{0};
+    this->firstSample.compare_exchange_strong(first, now, std::memory_order_relaxed);
+    raise(this->lastSample, now);
+}
+
+/**
+ * @brief Read the current value of a series' counters
+ */
+Stats::Series Stats::Counters::load() const {
+    Series series;
+
+    for(size_t i = 0; i < Histogram::kNumBuckets; i++) {
+        series.latency.buckets[i] = this->buckets[i].load(std::memory_order_relaxed);
+        series.latency.count += series.latency.buckets[i];
+    }
+    series.latency.max = this->max.load(std::memory_order_relaxed);
+
+    series.bytes = this->bytes.load(std::memory_order_relaxed);
+    series.maxSize = this->maxSize.load(std::memory_order_relaxed);
+    series.firstSample = this->firstSample.load(std::memory_order_relaxed);
+    series.lastSample = this->lastSample.load(std::memory_order_relaxed);
+
+    return series;
+}
+
+/**
+ * @brief Reset a series' counters
+ */
+void Stats::Counters::clear() {
+    for(auto &bucket : this->buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    this->max.store(0, std::memory_order_relaxed);
+
+    this->bytes.store(0, std::memory_order_relaxed);
+    this->maxSize.store(0, std::memory_order_relaxed);
+    this->firstSample.store(0, std::memory_order_relaxed);
+    this->lastSample.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Approximate a percentile
+ *
+ * @param p Percentile to calculate, in [0, 1]
+ *
+ * @return Upper bound of the bucket containing the percentile, in nanoseconds (limited to the
+ *         largest sample)
+ */
+uint64_t Stats::Histogram::percentile(const double p) const {
+    if(!this->count) {
+        return 0;
+    }
+
+    const auto target = static_cast<uint64_t>(std::ceil(p * static_cast<double>(this->count)));
+    uint64_t seen{0};
+
+    for(size_t i = 0; i < kNumBuckets; i++) {
+        seen += this->buckets[i];
+        if(seen >= target) {
+            return std::min<uint64_t>(this->max, (i ? (1ULL << i) - 1 : 0));
+        }
+    }
+
+    return this->max;
+}
@@ -0,0 +1,151 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+struct cbor_item_t;
+
+/**
+ * @brief Message latency and throughput statistics
+ *
+ * Collects per-endpoint statistics for each of the message paths through loadd: the time taken
+ * to handle a message, its size, and the rate at which messages arrive. Latencies are recorded
+ * into log2-bucketed histograms, so recording a sample is just a few increments.
+ *
+ * A snapshot of all statistics can be retrieved by clients through the stats RPC endpoint.
+ *
+ * @remark Samples are recorded from both the RPC and rpmsg threads. Rather than taking a lock,
+ *         each sample updates the relaxed atomic counters of its series, which live in a fixed
+ *         table indexed by source and endpoint; snapshots read them back into `Series`. A
+ *         snapshot taken while samples are recorded may thus be slightly inconsistent.
+ */
+class Stats {
+    public:
+        /**
+         * @brief Message paths that are instrumented
+         */
+        enum class Source: uint8_t {
+            /// Local RPC requests, from receipt to the handler returning
+            RpcRequest                  = 0,
+            /// Messages read from the rpmsg control endpoint
+            ControlRpmsg                = 1,
+            /// Broadcasts sent to local RPC clients
+            Broadcast                   = 2,
+            /// Messages read from the rpmsg confd endpoint, and forwarded to confd
+            ConfdRpmsg                  = 3,
+            /// Messages read from confd, and forwarded to the rpmsg confd endpoint
+            ConfdReply                  = 4,
+            /// Time between a confd request from the M4 and confd's reply to it
+            ConfdRoundTrip              = 5,
+            /// confd queries from the M4 answered from the cache
+            ConfdCacheHit               = 6,
+            /// confd queries from the M4 not in the cache (round trip, once the reply arrives)
+            ConfdCacheMiss              = 7,
+            /// Time from the coprocessor endpoints appearing to its first measurement
+            CoprocessorReady            = 8,
+            /// Time from starting the coprocessor to all rpmsg endpoints being opened
+            EndpointsReady              = 9,
+            /// Time from detecting a coprocessor crash to all of its endpoints being re-opened
+            CoprocessorRecovery         = 10,
+        };
+        /// Number of message paths
+        constexpr static const size_t kNumSources{11};
+
+        /**
+         * @brief Latency histogram
+         *
+         * Bucket n counts samples in [2^(n-1), 2^n) nanoseconds; bucket 0 only holds zero length
+         * samples. Percentiles are thus approximated by a bucket's upper bound.
+         */
+        struct Histogram {
+            /// Number of buckets (the last bucket covers ~4.5 minutes and up)
+            constexpr static const size_t kNumBuckets{40};
+
+            std::array<uint32_t, kNumBuckets> buckets{};
+            /// Total number of samples
+            uint64_t count{0};
+            /// Largest sample ever recorded, in nanoseconds
+            uint64_t max{0};
+
+            uint64_t percentile(const double p) const;
+        };
+
+        /**
+         * @brief All statistics for a single endpoint of a message path
+         */
+        struct Series {
+            /// Handling latency
+            Histogram latency;
+            /// Total bytes of messages
+            uint64_t bytes{0};
+            /// Largest message size
+            size_t maxSize{0};
+            /// Timestamp of the first and most recent sample
+            uint64_t firstSample{0}, lastSample{0};
+        };
+
+        static uint64_t Now();
+
+        /**
+         * @brief Record the time since a previously taken timestamp
+         *
+         * @param source Message path
+         * @param endpoint Endpoint of the message (from its header)
+         * @param start Timestamp (from `Now()`) at which handling of the message began
+         * @param size Total size of the message, in bytes
+         */
+        static inline void RecordSince(const Source source, const uint8_t endpoint,
+                const uint64_t start, const size_t size) {
+            const auto now = Now();
+            Record(source, endpoint, now - start, size, now);
+        }
+        /**
+         * @brief Record a sample, taken now
+         *
+         * @param source Message path
+         * @param endpoint Endpoint of the message (from its header)
+         * @param nsec Time taken to handle the message, in nanoseconds
+         * @param size Total size of the message, in bytes
+         */
+        static inline void Record(const Source source, const uint8_t endpoint,
+                const uint64_t nsec, const size_t size) {
+            Record(source, endpoint, nsec, size, Now());
+        }
+        static void Record(const Source source, const uint8_t endpoint, const uint64_t nsec,
+                const size_t size, const uint64_t now);
+
+        static struct cbor_item_t *Snapshot();
+        static void Reset();
+
+    private:
+        /**
+         * @brief Counters backing a series
+         *
+         * These are updated (with relaxed ordering) by any thread recording a sample; the total
+         * sample count is the sum of the histogram buckets.
+         */
+        struct Counters {
+            std::array<std::atomic_uint32_t, Histogram::kNumBuckets> buckets{};
+            std::atomic_uint64_t max{0};
+            std::atomic_uint64_t bytes{0};
+            std::atomic_uint64_t maxSize{0};
+            std::atomic_uint64_t firstSample{0}, lastSample{0};
+
+            void record(const uint64_t nsec, const size_t size, const uint64_t now);
+            Series load() const;
+            void clear();
+        };
+
+        /// Create the lookup key for a particular source and endpoint
+        constexpr static inline uint16_t MakeKey(const Source source, const uint8_t endpoint) {
+            return (static_cast<uint16_t>(source) << 8) | endpoint;
+        }
+
+        /// Counters for all series, indexed by their key
+        static std::array<Counters, kNumSources << 8> gSeries;
+};
+
+#endif
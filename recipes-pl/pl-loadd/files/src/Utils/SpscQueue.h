@@ -0,0 +1,78 @@
+#ifndef UTIL_SPSCQUEUE_H
+#define UTIL_SPSCQUEUE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <optional>
+#include <utility>
+
+namespace Util {
+/**
+ * @brief Lock-free single producer/single consumer queue
+ *
+ * A bounded ring buffer, which may be pushed to by exactly one thread and popped from by exactly
+ * one (other) thread, without any locking.
+ *
+ * @tparam T Type of element in the queue
+ * @tparam Capacity Number of elements the queue can hold; must be a power of two
+ */
+template<typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity && !(Capacity & (Capacity - 1)), "capacity must be a power of two");
+
+    public:
+        /**
+         * @brief Append an element to the queue
+         *
+         * @remark Call only from the producer thread.
+         *
+         * @return Whether the element was added; if not, the queue is full.
+         */
+        bool push(T &&value) {
+            const auto tail = this->tail.load(std::memory_order_relaxed);
+            if(tail - this->head.load(std::memory_order_acquire) == Capacity) {
+                return false;
+            }
+
+            this->storage[tail & (Capacity - 1)] = std::move(value);
+            this->tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Remove the oldest element from the queue
+         *
+         * @remark Call only from the consumer thread.
+         *
+         * @return The element, or nothing if the queue is empty.
+         */
+        std::optional<T> pop() {
+            const auto head = this->head.load(std::memory_order_relaxed);
+            if(head == this->tail.load(std::memory_order_acquire)) {
+                return std::nullopt;
+            }
+
+            auto &slot = this->storage[head & (Capacity - 1)];
+            std::optional<T> value{std::move(slot)};
+            slot = T{};
+
+            this->head.store(head + 1, std::memory_order_release);
+            return value;
+        }
+
+    private:
+        /// Size of a cache line (to keep the indices from sharing one)
+        constexpr static const size_t kCacheLineSize{64};
+
+        /// Index of the next element to pop (written by consumer)
+        alignas(kCacheLineSize) std::atomic_size_t head{0};
+        /// Index of the next element to push (written by producer)
+        alignas(kCacheLineSize) std::atomic_size_t tail{0};
+
+        /// Element storage
+        alignas(kCacheLineSize) std::array<T, Capacity> storage{};
+};
+}
+
+#endif
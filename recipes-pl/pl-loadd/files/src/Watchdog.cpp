@@ -1,5 +1,6 @@
 #include <cerrno>
 #include <cstdint>
+#include <stdexcept>
 #include <system_error>
 
 #include <plog/Log.h>
@@ -8,6 +9,69 @@
 
 bool Watchdog::gIsActive{false};
 std::chrono::microseconds Watchdog::gInterval;
+std::array<std::atomic_bool, Watchdog::kMaxCheckins> Watchdog::gCheckinsUsed{};
+std::array<std::atomic_bool, Watchdog::kMaxCheckins> Watchdog::gCheckins{};
+
+/**
+ * @brief Register a check-in source
+ *
+ * Each event loop that must be alive for the process to be considered healthy registers a check-in
+ * source, and then periodically checks in. The watchdog is only kicked once all sources have
+ * checked in since it was last kicked.
+ *
+ * @return Check-in source id, to pass to `Checkin()`
+ */
+size_t Watchdog::AddCheckin() {
+    for(size_t i = 0; i < kMaxCheckins; i++) {
+        bool used{false};
+        if(gCheckinsUsed[i].compare_exchange_strong(used, true)) {
+            // start out alive, so we don't miss a kick right after registering
+            gCheckins[i] = true;
+            return i;
+        }
+    }
+
+    throw std::runtime_error("too many watchdog check-in sources");
+}
+
+/**
+ * @brief Remove a check-in source
+ *
+ * The watchdog will no longer wait for the source to check in before being kicked.
+ */
+void Watchdog::RemoveCheckin(const size_t id) {
+    gCheckinsUsed[id] = false;
+}
+
+/**
+ * @brief Indicate that a check-in source is alive
+ *
+ * @remark This may be called from any thread.
+ */
+void Watchdog::Checkin(const size_t id) {
+    gCheckins[id].store(true, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Kick the watchdog, if all check-in sources are alive
+ *
+ * If any source hasn't checked in since the last kick, the watchdog isn't kicked; if it stays
+ * silent, we'll eventually be restarted.
+ */
+void Watchdog::KickIfAlive() {
+    for(size_t i = 0; i < kMaxCheckins; i++) {
+        if(gCheckinsUsed[i] && !gCheckins[i].load(std::memory_order_relaxed)) {
+            PLOG_WARNING << "watchdog check-in " << i << " missed, not kicking";
+            return;
+        }
+    }
+
+    for(size_t i = 0; i < kMaxCheckins; i++) {
+        gCheckins[i].store(false, std::memory_order_relaxed);
+    }
+
+    Kick();
+}
 
 #ifdef __linux__
 /*
@@ -1,7 +1,10 @@
 #ifndef WATCHDOG_H
 #define WATCHDOG_H
 
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cstddef>
 
 /**
  * @brief Interface to system process supervidsor watchdog
@@ -17,6 +20,11 @@ class Watchdog {
         static void Stop();
         static void Kick();
 
+        static size_t AddCheckin();
+        static void RemoveCheckin(const size_t id);
+        static void Checkin(const size_t id);
+        static void KickIfAlive();
+
         /// Is the watchdog enabled?
         static const bool IsActive() {
             return gIsActive;
@@ -31,6 +39,13 @@ class Watchdog {
         static bool gIsActive;
         /// Interval at which the watchdog should be kicked
         static std::chrono::microseconds gInterval;
+
+        /// Maximum number of check-in sources
+        constexpr static const size_t kMaxCheckins{4};
+        /// Whether each check-in source slot is in use
+        static std::array<std::atomic_bool, kMaxCheckins> gCheckinsUsed;
+        /// Set by each check-in source when it checks in; cleared when the watchdog is kicked
+        static std::array<std::atomic_bool, kMaxCheckins> gCheckins;
 };
 
 #endif
@@ -1,4 +1,5 @@
 #include <getopt.h>
+#include <signal.h>
 #include <unistd.h>
 #include <event2/event.h>
 
@@ -10,7 +11,7 @@
 #include <iostream>
 #include <memory>
 #include <string>
-#include <thread>
+#include <utility>
 
 #include <plog/Log.h>
 #include <plog/Appenders/ColorConsoleAppender.h>
@@ -19,7 +20,10 @@
 #include <plog/Formatters/TxtFormatter.h>
 #include <plog/Init.h>
 
+#include "Config.h"
 #include "Coprocessor.h"
+#include "RpmsgBackend.h"
+#include "SimulatedBackend.h"
 #include "Watchdog.h"
 #include "RpcServer.h"
 #include "version.h"
@@ -91,6 +95,27 @@ static void InitLibevent() {
 
 
 
+/**
+ * @brief Print usage information
+ */
+static void PrintUsage(const char *name) {
+    std::cerr << "usage: " << name << " [options]" << std::endl
+        << "  -s, --socket path             path for the RPC socket" << std::endl
+        << "      --rpc-batch               batch RPC client IO (sendmmsg/recvmmsg)" << std::endl
+        << "      --no-confd-cache          forward all config queries from the M4 to confd"
+        << std::endl
+        << "      --simulate                use a simulated coprocessor" << std::endl
+        << "      --sim-rate hz             simulated measurement rate (default 100)" << std::endl
+        << "      --sim-cbor                send CBOR measurements rather than binary frames"
+        << std::endl
+        << "      --sim-stall-interval ms   stall the simulator periodically" << std::endl
+        << "      --sim-stall-duration ms   duration of each simulator stall" << std::endl
+        << "      --sim-crash-after ms      crash the simulator after it runs this long"
+        << std::endl;
+}
+
+
+
 /**
  * Entry point for config daemon
  *
@@ -102,22 +127,92 @@ int main(const int argc, char * const * argv) {
     plog::Severity logLevel{plog::Severity::verbose};
     bool logSimple{false};
     std::filesystem::path fwPath{"/tmp/balls.elf"};
+    bool simulate{false};
+    SimulatedBackend::Params simParams;
 
     std::unique_ptr<Coprocessor> cop;
     std::shared_ptr<RpcServer> lrpc;
 
     // parse command line
-    // TODO: do this
+    enum {
+        kOptRpcBatch = 0x100,
+        kOptNoConfdCache,
+        kOptSimulate,
+        kOptSimRate,
+        kOptSimCbor,
+        kOptSimStallInterval,
+        kOptSimStallDuration,
+        kOptSimCrashAfter,
+    };
+
+    const struct option kOptions[]{
+        {"socket",              required_argument,  nullptr, 's'},
+        {"rpc-batch",           no_argument,        nullptr, kOptRpcBatch},
+        {"no-confd-cache",      no_argument,        nullptr, kOptNoConfdCache},
+        {"simulate",            no_argument,        nullptr, kOptSimulate},
+        {"sim-rate",            required_argument,  nullptr, kOptSimRate},
+        {"sim-cbor",            no_argument,        nullptr, kOptSimCbor},
+        {"sim-stall-interval",  required_argument,  nullptr, kOptSimStallInterval},
+        {"sim-stall-duration",  required_argument,  nullptr, kOptSimStallDuration},
+        {"sim-crash-after",     required_argument,  nullptr, kOptSimCrashAfter},
+        {nullptr,               0,                  nullptr, 0},
+    };
+
+    int c;
+    while((c = getopt_long(argc, argv, "s:", kOptions, nullptr)) != -1) {
+        switch(c) {
+            case 's':
+                Config::SetRpcSocketPath(optarg);
+                break;
+            case kOptRpcBatch:
+                Config::SetRpcBatchedIo(true);
+                break;
+            case kOptNoConfdCache:
+                Config::SetConfdCacheEnabled(false);
+                break;
+            case kOptSimulate:
+                simulate = true;
+                break;
+            case kOptSimRate:
+                simParams.measurementRate = strtod(optarg, nullptr);
+                break;
+            case kOptSimCbor:
+                simParams.binaryFrames = false;
+                break;
+            case kOptSimStallInterval:
+                simParams.stallInterval = std::chrono::milliseconds(strtoul(optarg, nullptr, 0));
+                break;
+            case kOptSimStallDuration:
+                simParams.stallDuration = std::chrono::milliseconds(strtoul(optarg, nullptr, 0));
+                break;
+            case kOptSimCrashAfter:
+                simParams.crashAfter = std::chrono::milliseconds(strtoul(optarg, nullptr, 0));
+                break;
+            default:
+                PrintUsage(argv[0]);
+                return 1;
+        }
+    }
 
     // perform initialization
     InitLog(logLevel, logSimple);
 
+    // writes to a hung up channel should fail (and be handled) rather than kill us
+    signal(SIGPIPE, SIG_IGN);
+
     Watchdog::Init();
     Watchdog::Start();
 
     try {
         // boot coprocessor
-        cop = std::make_unique<Coprocessor>();
+        std::unique_ptr<CoprocessorBackend> backend;
+        if(simulate) {
+            backend = std::make_unique<SimulatedBackend>(simParams);
+        } else {
+            backend = std::make_unique<RpmsgBackend>();
+        }
+
+        cop = std::make_unique<Coprocessor>(std::move(backend));
 
         cop->loadFirmware(fwPath);
         cop->start();
@@ -127,14 +222,10 @@ int main(const int argc, char * const * argv) {
         lrpc = std::make_shared<RpcServer>();
 
         /*
-         * Insert a short wait before we try to enable the RPC interface. This is required because
-         * the M4 firmware needs to do some setup during boot to start exposing the virtio rings
-         * and then notify the host.
-         *
-         * If we don't have this wait, the rpmsg subsystem won't have initialized, and we'll fail
-         * to open the control device.
+         * Set up the RPC interface. This waits for the rpmsg control device to appear, since the
+         * M4 firmware needs to do some setup during boot to start exposing the virtio rings and
+         * then notify the host.
          */
-        std::this_thread::sleep_for(std::chrono::milliseconds(420));
         cop->initRpc(lrpc);
     } catch(const std::exception &e) {
         PLOG_FATAL << "failed to start loadd: " << e.what();
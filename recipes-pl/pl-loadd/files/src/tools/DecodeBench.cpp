@@ -0,0 +1,139 @@
+/**
+ * @file
+ *
+ * @brief Measurement decode benchmark
+ *
+ * Compares the throughput of decoding measurement messages from the coprocessor in both formats
+ * it may send them in: fixed layout binary frames, and CBOR maps. Run it on the target to see
+ * what the per-sample cost on the Cortex-A7 is.
+ */
+#include <getopt.h>
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "ControlFrameTypes.h"
+#include "MeasurementCodec.h"
+#include "MeasurementRingTypes.h"
+
+namespace {
+/// Number of distinct messages to cycle through (so we're not just decoding one over and over)
+constexpr static const size_t kNumMessages{256};
+
+/**
+ * @brief An encoded measurement message payload
+ */
+struct Message {
+    std::array<std::byte, 64> data;
+    size_t length{0};
+
+    auto getPayload() const {
+        return std::span<const std::byte>(this->data.data(), this->length);
+    }
+};
+
+/**
+ * @brief Generate a set of measurement payloads in both formats
+ */
+void MakeMessages(std::vector<Message> &outFrames, std::vector<Message> &outCbor) {
+    for(size_t i = 0; i < kNumMessages; i++) {
+        const struct measurement_record record{
+            .voltage = 12.f + static_cast<float>(i) / 100.f,
+            .current = 1.5f - static_cast<float>(i) / 1000.f,
+            .temperature = 35.f + static_cast<float>(i % 10),
+            .status = kControlStatusEnabled,
+        };
+
+        // binary frame
+        const struct control_measurement_frame frame{
+            .version = kControlFrameVersion,
+            .status = static_cast<uint16_t>(record.status),
+            .sequence = static_cast<uint32_t>(i),
+            .voltage = record.voltage,
+            .current = record.current,
+            .temperature = record.temperature,
+        };
+
+        auto &binary = outFrames.emplace_back();
+        memcpy(binary.data.data(), &frame, sizeof(frame));
+        binary.length = sizeof(frame);
+
+        // CBOR
+        auto &cbor = outCbor.emplace_back();
+        cbor.length = MeasurementCodec::EncodeCbor(record, cbor.data);
+        if(!cbor.length) {
+            throw std::runtime_error("failed to encode measurement");
+        }
+    }
+}
+
+/**
+ * @brief Decode all messages repeatedly, and print the throughput
+ *
+ * @param name Name of the format (for output)
+ * @param messages Messages to decode
+ * @param iterations Total number of messages to decode
+ * @param decoder Function to decode a single message
+ */
+void Run(const std::string_view &name, const std::vector<Message> &messages,
+        const size_t iterations,
+        const std::function<struct measurement_record(std::span<const std::byte>)> &decoder) {
+    float sum{0};
+
+    const auto start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < iterations; i++) {
+        const auto record = decoder(messages[i % messages.size()].getPayload());
+        sum += record.voltage;
+    }
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+    // print the sum so the decoding can't be optimized out
+    std::cout << name << ": " << iterations << " messages in " << elapsed.count() << " s ("
+        << (elapsed.count() * 1e9 / iterations) << " ns/msg, "
+        << static_cast<double>(iterations) / elapsed.count() << " msg/s) [" << sum << "]"
+        << std::endl;
+}
+}
+
+
+
+/**
+ * @brief Benchmark entry point
+ *
+ * Takes an optional argument, the number of messages to decode in each format.
+ */
+int main(const int argc, char * const * argv) {
+    size_t iterations{1'000'000};
+
+    if(argc > 2) {
+        std::cerr << "usage: " << argv[0] << " [iterations]" << std::endl;
+        return 1;
+    } else if(argc == 2) {
+        iterations = strtoul(argv[1], nullptr, 0);
+    }
+
+    try {
+        std::vector<Message> frames, cbor;
+        MakeMessages(frames, cbor);
+
+        std::cout << "frame: " << frames.front().length << " bytes, cbor: "
+            << cbor.front().length << " bytes" << std::endl;
+
+        Run("binary", frames, iterations, [](auto payload) {
+            return MeasurementCodec::DecodeFrame(payload);
+        });
+        Run("cbor", cbor, iterations, MeasurementCodec::DecodeCbor);
+    } catch(const std::exception &e) {
+        std::cerr << "benchmark failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
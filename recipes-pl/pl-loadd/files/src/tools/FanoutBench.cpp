@@ -0,0 +1,222 @@
+/**
+ * @file
+ *
+ * @brief Broadcast fan-out benchmark
+ *
+ * Measures the cost of broadcasting a packet to 1, 8 and 64 connected clients, for a few payload
+ * sizes. Clients are sequenced packet sockets connected to a real RPC server, in this process;
+ * they're drained between broadcasts (outside of the timed section) so that they never congest.
+ *
+ * Each broadcast is timed from the call to `RpcServer::broadcastPacket` until the server's loop
+ * has had a chance to flush it, so batched IO is accounted for as well.
+ */
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <event2/event.h>
+#include <plog/Log.h>
+#include <plog/Appenders/ColorConsoleAppender.h>
+#include <plog/Formatters/TxtFormatter.h>
+#include <plog/Init.h>
+
+#include "Config.h"
+#include "RpcServer.h"
+#include "RpcTypes.h"
+
+/// Referenced by the RPC server
+std::atomic_bool gRun{true};
+
+namespace {
+/// Numbers of clients to broadcast to
+constexpr static const std::array<size_t, 3> kClientCounts{{1, 8, 64}};
+/// Payload sizes to broadcast (bytes)
+constexpr static const std::array<size_t, 3> kPayloadSizes{{64, 1024, 16384}};
+
+/**
+ * @brief Connect a client to the RPC server
+ *
+ * The server's loop is run once afterwards, so that it accepts the connection.
+ *
+ * @return Client socket (non-blocking)
+ */
+int ConnectClient(RpcServer &server, const std::string &path) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "create client socket");
+    }
+
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    if(connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1) {
+        close(fd);
+        throw std::system_error(errno, std::generic_category(), "connect client socket");
+    }
+
+    event_base_loop(server.getEvBase(), EVLOOP_NONBLOCK);
+    return fd;
+}
+
+/**
+ * @brief Read all pending messages from the clients
+ *
+ * @return Number of messages received
+ */
+size_t DrainClients(const std::vector<int> &clients) {
+    static std::array<std::byte, 0x10000> buf;
+    size_t received{0};
+
+    for(const auto fd : clients) {
+        while(recv(fd, buf.data(), buf.size(), MSG_DONTWAIT) > 0) {
+            received++;
+        }
+    }
+
+    return received;
+}
+
+/**
+ * @brief Broadcast a packet repeatedly, and print the time per broadcast
+ *
+ * @param server RPC server to broadcast with
+ * @param clients All connected clients
+ * @param payloadSize Size of the broadcast payload (bytes)
+ * @param iterations Number of broadcasts to send
+ */
+void Run(RpcServer &server, const std::vector<int> &clients, const size_t payloadSize,
+        const size_t iterations) {
+    std::vector<std::byte> packet(sizeof(struct rpc_header) + payloadSize);
+
+    const struct rpc_header hdr{
+        .version = kRpcVersionLatest,
+        .length = static_cast<uint16_t>(packet.size()),
+        .endpoint = kRpcEndpointMeasurement,
+        .tag = 0,
+        .flags = kRpcFlagBroadcast,
+    };
+    memcpy(packet.data(), &hdr, sizeof(hdr));
+
+    std::chrono::nanoseconds elapsed{0};
+    size_t delivered{0};
+
+    for(size_t i = 0; i < iterations; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        server.broadcastPacket(packet);
+        event_base_loop(server.getEvBase(), EVLOOP_NONBLOCK);
+        elapsed += std::chrono::steady_clock::now() - start;
+
+        delivered += DrainClients(clients);
+    }
+
+    const auto perBroadcast = static_cast<double>(elapsed.count()) / iterations;
+    std::cout << std::setw(8) << clients.size() << std::setw(10) << payloadSize
+        << std::setw(14) << std::fixed << std::setprecision(0) << perBroadcast
+        << std::setw(14) << perBroadcast / clients.size()
+        << std::setw(12) << delivered << std::endl;
+}
+
+/**
+ * @brief Print usage information
+ */
+void PrintUsage(const char *name) {
+    std::cerr << "usage: " << name << " [-n iterations] [-s socket path]" << std::endl
+        << "  -n, --iterations  broadcasts per measurement (default 10000)" << std::endl
+        << "  -s, --socket      path for the RPC socket (default /tmp/loadd-fanout.sock)"
+        << std::endl;
+}
+}
+
+
+
+/**
+ * @brief Benchmark entry point
+ *
+ * Set up an RPC server, then connect clients to it in steps, and broadcast packets of each size
+ * to all of them.
+ */
+int main(const int argc, char * const * argv) {
+    size_t iterations{10'000};
+    std::string socketPath{"/tmp/loadd-fanout.sock"};
+
+    const struct option kOptions[]{
+        {"iterations",  required_argument,  nullptr, 'n'},
+        {"socket",      required_argument,  nullptr, 's'},
+        {nullptr,       0,                  nullptr, 0},
+    };
+
+    int c;
+    while((c = getopt_long(argc, argv, "n:s:", kOptions, nullptr)) != -1) {
+        switch(c) {
+            case 'n':
+                iterations = strtoul(optarg, nullptr, 0);
+                break;
+            case 's':
+                socketPath = optarg;
+                break;
+            default:
+                PrintUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind != argc || !iterations) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    static plog::ColorConsoleAppender<plog::TxtFormatter> appender;
+    plog::init(plog::Severity::error, &appender);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<int> clients;
+
+    try {
+        Config::SetRpcSocketPath(socketPath);
+        auto server = std::make_shared<RpcServer>();
+
+        std::cout << std::setw(8) << "clients" << std::setw(10) << "payload"
+            << std::setw(14) << "ns/broadcast" << std::setw(14) << "ns/client"
+            << std::setw(12) << "delivered" << std::endl;
+
+        for(const auto numClients : kClientCounts) {
+            while(clients.size() < numClients) {
+                clients.push_back(ConnectClient(*server, socketPath));
+            }
+
+            for(const auto payloadSize : kPayloadSizes) {
+                Run(*server, clients, payloadSize, iterations);
+            }
+        }
+
+        for(const auto fd : clients) {
+            close(fd);
+        }
+    } catch(const std::exception &e) {
+        std::cerr << "benchmark failed: " << e.what() << std::endl;
+
+        for(const auto fd : clients) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    return 0;
+}
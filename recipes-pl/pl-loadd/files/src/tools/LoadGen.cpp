@@ -0,0 +1,298 @@
+/**
+ * @file
+ *
+ * @brief RPC load generator
+ *
+ * Connects a number of clients to a running daemon, and has each of them keep a fixed number of
+ * requests in flight. Requests are measurement unsubscribe requests, which are cheap to handle
+ * and always replied to; broadcasts received in the meantime are ignored.
+ *
+ * The round trip latency of each request is recorded, and summarized once all clients finished.
+ * Together with the server's IO statistics (logged when a client disconnects) this is used to
+ * compare batched and unbatched client IO.
+ */
+#include <getopt.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "RpcTypes.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+/// CBOR encoded request payload: `{"unsubscribe": true}`
+constexpr static const std::array<uint8_t, 14> kRequestPayload{{
+    0xa1, 0x6b, 'u', 'n', 's', 'u', 'b', 's', 'c', 'r', 'i', 'b', 'e', 0xf5,
+}};
+
+/**
+ * @brief State of a single load generating client
+ */
+struct Client {
+    /// Socket connected to the daemon
+    int fd{-1};
+    /// Number of requests sent so far
+    size_t sent{0};
+    /// Number of replies received so far
+    size_t received{0};
+    /// Send timestamp of each in flight request, indexed by tag
+    std::array<Clock::time_point, 256> sentAt;
+};
+
+/**
+ * @brief Connect a client to the daemon
+ *
+ * @return Client socket (non-blocking)
+ */
+int ConnectClient(const std::string &path) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "create client socket");
+    }
+
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    if(connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1) {
+        close(fd);
+        throw std::system_error(errno, std::generic_category(), "connect client socket");
+    }
+
+    return fd;
+}
+
+/**
+ * @brief Send the next request of a client
+ *
+ * @return Whether the request was sent; false if the socket is full
+ */
+bool SendRequest(Client &client) {
+    std::array<std::byte, sizeof(struct rpc_header) + kRequestPayload.size()> packet;
+
+    const struct rpc_header hdr{
+        .version = kRpcVersionLatest,
+        .length = static_cast<uint16_t>(packet.size()),
+        .endpoint = kRpcEndpointMeasurementSubscribe,
+        .tag = static_cast<uint8_t>(client.sent & 0xff),
+        .flags = 0,
+    };
+    memcpy(packet.data(), &hdr, sizeof(hdr));
+    memcpy(packet.data() + sizeof(hdr), kRequestPayload.data(), kRequestPayload.size());
+
+    client.sentAt[hdr.tag] = Clock::now();
+
+    if(send(client.fd, packet.data(), packet.size(), MSG_DONTWAIT) == -1) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        }
+        throw std::system_error(errno, std::generic_category(), "send request");
+    }
+
+    client.sent++;
+    return true;
+}
+
+/**
+ * @brief Read all pending messages of a client
+ *
+ * Replies to our requests are matched by their tag, and their latency recorded.
+ */
+void ReadReplies(Client &client, std::vector<std::chrono::nanoseconds> &latencies) {
+    static std::array<std::byte, 0x10000> buf;
+
+    while(true) {
+        const auto len = recv(client.fd, buf.data(), buf.size(), MSG_DONTWAIT);
+        if(len == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            throw std::system_error(errno, std::generic_category(), "receive reply");
+        } else if(!len) {
+            throw std::runtime_error("daemon closed connection");
+        } else if(static_cast<size_t>(len) < sizeof(struct rpc_header)) {
+            continue;
+        }
+
+        struct rpc_header hdr;
+        memcpy(&hdr, buf.data(), sizeof(hdr));
+
+        // each datagram must hold exactly one message
+        if(hdr.length != static_cast<size_t>(len)) {
+            throw std::runtime_error("datagram length doesn't match message length");
+        }
+
+        if(!(hdr.flags & kRpcFlagReply) || hdr.endpoint != kRpcEndpointMeasurementSubscribe) {
+            continue;
+        }
+
+        latencies.emplace_back(Clock::now() - client.sentAt[hdr.tag]);
+        client.received++;
+    }
+}
+
+/**
+ * @brief Print usage information
+ */
+void PrintUsage(const char *name) {
+    std::cerr << "usage: " << name << " [options]" << std::endl
+        << "  -c, --clients n   number of clients (default 8)" << std::endl
+        << "  -w, --window n    requests in flight per client (default 4)" << std::endl
+        << "  -n, --requests n  requests per client (default 10000)" << std::endl
+        << "  -s, --socket path RPC socket of the daemon (default /var/run/loadd/rpc.sock)"
+        << std::endl;
+}
+}
+
+
+
+/**
+ * @brief Load generator entry point
+ *
+ * Connect all clients, then keep each client's window of requests full until it sent all of its
+ * requests, and received all replies. Finally, print the latency distribution.
+ */
+int main(const int argc, char * const * argv) {
+    size_t numClients{8}, window{4}, numRequests{10'000};
+    std::string socketPath{"/var/run/loadd/rpc.sock"};
+
+    const struct option kOptions[]{
+        {"clients",     required_argument,  nullptr, 'c'},
+        {"window",      required_argument,  nullptr, 'w'},
+        {"requests",    required_argument,  nullptr, 'n'},
+        {"socket",      required_argument,  nullptr, 's'},
+        {nullptr,       0,                  nullptr, 0},
+    };
+
+    int c;
+    while((c = getopt_long(argc, argv, "c:w:n:s:", kOptions, nullptr)) != -1) {
+        switch(c) {
+            case 'c':
+                numClients = strtoul(optarg, nullptr, 0);
+                break;
+            case 'w':
+                window = strtoul(optarg, nullptr, 0);
+                break;
+            case 'n':
+                numRequests = strtoul(optarg, nullptr, 0);
+                break;
+            case 's':
+                socketPath = optarg;
+                break;
+            default:
+                PrintUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    // tags identify in flight requests, so there may be no more of them than there are tags
+    if(optind != argc || !numClients || !window || window > 256 || !numRequests) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Client> clients(numClients);
+    std::vector<std::chrono::nanoseconds> latencies;
+    latencies.reserve(numClients * numRequests);
+
+    Clock::duration elapsed{};
+
+    try {
+        for(auto &client : clients) {
+            client.fd = ConnectClient(socketPath);
+        }
+
+        std::vector<struct pollfd> pfds(clients.size());
+        for(size_t i = 0; i < clients.size(); i++) {
+            pfds[i] = {.fd = clients[i].fd, .events = POLLIN, .revents = 0};
+        }
+
+        const auto start = Clock::now();
+        size_t remaining{clients.size()};
+
+        while(remaining) {
+            for(auto &client : clients) {
+                while(client.sent < numRequests && client.sent - client.received < window) {
+                    if(!SendRequest(client)) {
+                        break;
+                    }
+                }
+            }
+
+            if(poll(pfds.data(), pfds.size(), 1000) == -1) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "poll");
+            }
+
+            for(size_t i = 0; i < clients.size(); i++) {
+                if(!pfds[i].revents) {
+                    continue;
+                }
+
+                auto &client = clients[i];
+                const bool wasDone = (client.received == numRequests);
+                ReadReplies(client, latencies);
+
+                if(!wasDone && client.received == numRequests) {
+                    remaining--;
+                }
+            }
+        }
+
+        elapsed = Clock::now() - start;
+    } catch(const std::exception &e) {
+        std::cerr << "load generator failed: " << e.what() << std::endl;
+
+        for(const auto &client : clients) {
+            if(client.fd != -1) {
+                close(client.fd);
+            }
+        }
+        return 1;
+    }
+
+    for(const auto &client : clients) {
+        close(client.fd);
+    }
+
+    // summarize
+    std::sort(latencies.begin(), latencies.end());
+
+    auto percentile = [&latencies](const double p) -> double {
+        const auto idx = static_cast<size_t>(p * static_cast<double>(latencies.size() - 1));
+        return static_cast<double>(latencies[idx].count()) / 1e3;
+    };
+
+    double total{0};
+    for(const auto &latency : latencies) {
+        total += static_cast<double>(latency.count());
+    }
+
+    const auto seconds = std::chrono::duration<double>(elapsed).count();
+
+    std::cout << std::fixed << std::setprecision(1)
+        << "requests:   " << latencies.size() << " in " << seconds << " s ("
+        << static_cast<double>(latencies.size()) / seconds << " req/s)" << std::endl
+        << "latency us: mean " << total / static_cast<double>(latencies.size()) / 1e3
+        << ", p50 " << percentile(.5) << ", p99 " << percentile(.99)
+        << ", max " << percentile(1.) << std::endl;
+
+    return 0;
+}
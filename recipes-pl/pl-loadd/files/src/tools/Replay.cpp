@@ -0,0 +1,530 @@
+/**
+ * @file
+ *
+ * @brief rpmsg capture replay tool
+ *
+ * Feeds the messages from a capture file (written by loadd's capture endpoint) back through the
+ * coprocessor endpoint handlers, in place of the rpmsg channels; either at the speed they were
+ * recorded, or as fast as the handlers will accept them. This allows benchmarking the handlers'
+ * throughput on a workstation.
+ *
+ * Each channel is emulated with a sequenced packet socket pair, so message boundaries are kept
+ * just like with the rpmsg chrdev. Messages the handlers send to the coprocessor are read and
+ * discarded.
+ *
+ * confd is emulated too, so the replay doesn't depend on (or disturb) a running instance: the
+ * confd handler is given one end of a stream socket pair, and every request it forwards is
+ * answered right away with an empty reply.
+ */
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <cbor.h>
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <span>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <event2/event.h>
+#include <plog/Log.h>
+#include <plog/Appenders/ColorConsoleAppender.h>
+#include <plog/Formatters/TxtFormatter.h>
+#include <plog/Init.h>
+
+#include "CaptureTypes.h"
+#include "ConfdEpHandler.h"
+#include "Config.h"
+#include "ControlEpHandler.h"
+#include "RpcServer.h"
+#include "RpcTypes.h"
+#include "RpmsgLoop.h"
+#include "Stats.h"
+
+/// Referenced by the RPC server
+std::atomic_bool gRun{true};
+
+namespace {
+/**
+ * @brief A single message to replay
+ */
+struct Record {
+    /// Capture timestamp (nanoseconds)
+    uint64_t timestamp;
+    /// Channel to send it on
+    uint8_t channel;
+    /// Message data
+    std::span<const std::byte> data;
+};
+
+/**
+ * @brief State of a replay
+ *
+ * Messages are written from a timer on the RPC server's loop; if a channel's socket is full, we
+ * wait for it to become writable again.
+ */
+struct Replay {
+    /// Number of emulated channels
+    constexpr static const size_t kNumChannels{2};
+
+    /// Should messages be sent at the recorded rate, rather than as fast as possible?
+    bool isRealtime{true};
+
+    /// All messages to send (to the handlers)
+    std::vector<Record> records;
+    /// Index of the next message to send
+    size_t next{0};
+
+    /// Our end of each channel's socket pair
+    std::array<int, kNumChannels> peers{-1, -1};
+    /// Read events for each channel (to discard messages to the coprocessor)
+    std::array<struct event *, kNumChannels> readEvents{};
+    /// Write events for each channel (used when its socket is full)
+    std::array<struct event *, kNumChannels> writeEvents{};
+    /// Timer to send the next message (or to finish the replay)
+    struct event *timer{nullptr};
+
+    /// Our end of the emulated confd connection
+    int confdPeer{-1};
+    /// Read event for the emulated confd connection
+    struct event *confdEvent{nullptr};
+    /// Write event for the emulated confd connection (used when its socket is full)
+    struct event *confdWriteEvent{nullptr};
+    /// Partially received messages from the confd handler
+    std::vector<std::byte> confdRxBuf;
+    /// Replies waiting to be written to the confd handler
+    std::vector<std::byte> confdTxBuf;
+    /// Number of requests answered by the emulated confd
+    size_t numConfdRequests{0};
+
+    /// Timestamp at which the replay started
+    uint64_t startedAt{0};
+    /// Timestamp at which the last message was sent
+    uint64_t finishedAt{0};
+    /// Number of messages received from the handlers
+    size_t numReplies{0};
+
+    struct event_base *evbase{nullptr};
+
+    void feed();
+    void drain(const size_t channel);
+    void serveConfd();
+    void flushConfd();
+};
+
+/**
+ * @brief Send as many messages as possible
+ *
+ * In real time mode, stop at the first message that isn't due yet, and arm the timer for it.
+ */
+void Replay::feed() {
+    // give the handlers a moment to process the last messages before stopping
+    constexpr static const struct timeval kFinishDelay{
+        .tv_sec = 0,
+        .tv_usec = 250'000,
+    };
+
+    while(this->next < this->records.size()) {
+        const auto &record = this->records[this->next];
+
+        if(this->isRealtime) {
+            const auto due = this->startedAt + (record.timestamp - this->records[0].timestamp);
+            const auto now = Stats::Now();
+
+            if(due > now) {
+                const auto usec = (due - now) / 1'000U;
+                struct timeval tv{
+                    .tv_sec  = static_cast<time_t>(usec / 1'000'000U),
+                    .tv_usec = static_cast<suseconds_t>(usec % 1'000'000U),
+                };
+                evtimer_add(this->timer, &tv);
+                return;
+            }
+        }
+
+        const auto fd = this->peers[record.channel];
+        const auto err = write(fd, record.data.data(), record.data.size());
+        if(err == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                event_add(this->writeEvents[record.channel], nullptr);
+                return;
+            } else if(errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "write replay message");
+        }
+
+        this->next++;
+    }
+
+    // all messages were sent; stop the loop after a short delay
+    if(!this->finishedAt) {
+        this->finishedAt = Stats::Now();
+        event_base_loopexit(this->evbase, &kFinishDelay);
+    }
+}
+
+/**
+ * @brief Discard all messages the handler sent to the coprocessor
+ */
+void Replay::drain(const size_t channel) {
+    std::array<std::byte, 512> buf;
+
+    while(recv(this->peers[channel], buf.data(), buf.size(), MSG_DONTWAIT) > 0) {
+        this->numReplies++;
+    }
+}
+
+/**
+ * @brief Answer all requests the confd handler sent to the emulated confd
+ *
+ * The connection is a stream, so messages are reassembled from the receive buffer first. Each
+ * request gets a reply that's just the request's header, with the reply flag set.
+ */
+void Replay::serveConfd() {
+    std::array<std::byte, 4096> buf;
+
+    while(true) {
+        const auto len = recv(this->confdPeer, buf.data(), buf.size(), MSG_DONTWAIT);
+        if(len == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            } else if(errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "read emulated confd");
+        } else if(!len) {
+            event_del(this->confdEvent);
+            break;
+        }
+
+        this->confdRxBuf.insert(this->confdRxBuf.end(), buf.begin(), buf.begin() + len);
+    }
+
+    size_t offset{0};
+    struct rpc_header hdr;
+
+    while(this->confdRxBuf.size() - offset >= sizeof(hdr)) {
+        memcpy(&hdr, this->confdRxBuf.data() + offset, sizeof(hdr));
+        if(hdr.length < sizeof(hdr)) {
+            throw std::runtime_error("invalid message length from confd handler");
+        } else if(this->confdRxBuf.size() - offset < hdr.length) {
+            break;
+        }
+        offset += hdr.length;
+
+        if(hdr.endpoint == kRpcEndpointNoOp || (hdr.flags & kRpcFlagReply)) {
+            continue;
+        }
+
+        const struct rpc_header reply{
+            .version = kRpcVersionLatest,
+            .length = sizeof(reply),
+            .endpoint = hdr.endpoint,
+            .tag = hdr.tag,
+            .flags = kRpcFlagReply,
+        };
+        const auto bytes = reinterpret_cast<const std::byte *>(&reply);
+        this->confdTxBuf.insert(this->confdTxBuf.end(), bytes, bytes + sizeof(reply));
+
+        this->numConfdRequests++;
+    }
+
+    this->confdRxBuf.erase(this->confdRxBuf.begin(), this->confdRxBuf.begin() + offset);
+    this->flushConfd();
+}
+
+/**
+ * @brief Write as many pending replies to the confd handler as possible
+ *
+ * If the socket is full (the handler stops reading while the coprocessor is behind) wait for it
+ * to become writable again.
+ */
+void Replay::flushConfd() {
+    size_t written{0};
+
+    while(written < this->confdTxBuf.size()) {
+        const auto len = send(this->confdPeer, this->confdTxBuf.data() + written,
+                this->confdTxBuf.size() - written, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(len == -1) {
+            if(errno == EAGAIN || errno == EWOULDBLOCK) {
+                event_add(this->confdWriteEvent, nullptr);
+                break;
+            } else if(errno == EINTR) {
+                continue;
+            }
+            throw std::system_error(errno, std::generic_category(), "write emulated confd");
+        }
+
+        written += len;
+    }
+
+    this->confdTxBuf.erase(this->confdTxBuf.begin(), this->confdTxBuf.begin() + written);
+}
+
+/**
+ * @brief Read all records from a capture file
+ *
+ * Only messages received from the coprocessor are replayed; those it was sent are skipped.
+ *
+ * @param file Capture file contents
+ * @param outRecords Vector to receive the records to replay
+ */
+void ParseCapture(std::span<const std::byte> file, std::vector<Record> &outRecords) {
+    struct capture_file_header hdr;
+
+    if(file.size() < sizeof(hdr)) {
+        throw std::runtime_error("capture file too small");
+    }
+    memcpy(&hdr, file.data(), sizeof(hdr));
+
+    if(hdr.magic != kCaptureFileMagic) {
+        throw std::runtime_error("invalid capture file magic");
+    } else if(hdr.version != kCaptureFileVersion) {
+        throw std::runtime_error("unsupported capture file version");
+    } else if(hdr.headerSize > file.size()) {
+        throw std::runtime_error("invalid capture file header size");
+    }
+
+    auto data = file.subspan(hdr.headerSize);
+
+    for(size_t i = 0; i < hdr.numRecords; i++) {
+        struct capture_record_header recordHdr;
+        if(data.size() < sizeof(recordHdr)) {
+            throw std::runtime_error("truncated capture record header");
+        }
+        memcpy(&recordHdr, data.data(), sizeof(recordHdr));
+
+        if(data.size() < sizeof(recordHdr) + recordHdr.length) {
+            throw std::runtime_error("truncated capture record");
+        }
+
+        if(recordHdr.direction == kCaptureFromRemote &&
+                recordHdr.channel < Replay::kNumChannels) {
+            outRecords.emplace_back(Record{
+                .timestamp = recordHdr.timestamp,
+                .channel = recordHdr.channel,
+                .data = data.subspan(sizeof(recordHdr), recordHdr.length),
+            });
+        }
+
+        data = data.subspan(sizeof(recordHdr) + recordHdr.length);
+    }
+}
+
+/**
+ * @brief Print usage information
+ */
+void PrintUsage(const char *name) {
+    std::cerr << "usage: " << name << " [-f] [-v] [-s socket path] capture-file" << std::endl
+        << "  -f, --fast      replay as fast as possible, rather than at the recorded rate"
+        << std::endl
+        << "  -v, --verbose   log handler messages" << std::endl
+        << "  -s, --socket    path for the RPC socket (default /tmp/loadd-replay.sock)"
+        << std::endl;
+}
+}
+
+
+
+/**
+ * @brief Replay tool entry point
+ *
+ * Load the capture file, set up an RPC server and the endpoint handlers, and then replay all
+ * messages. Once done, print the elapsed time and message statistics.
+ */
+int main(const int argc, char * const * argv) {
+    bool isRealtime{true}, isVerbose{false};
+    std::string socketPath{"/tmp/loadd-replay.sock"};
+
+    const struct option kOptions[]{
+        {"fast",    no_argument,        nullptr, 'f'},
+        {"verbose", no_argument,        nullptr, 'v'},
+        {"socket",  required_argument,  nullptr, 's'},
+        {nullptr,   0,                  nullptr, 0},
+    };
+
+    int c;
+    while((c = getopt_long(argc, argv, "fvs:", kOptions, nullptr)) != -1) {
+        switch(c) {
+            case 'f':
+                isRealtime = false;
+                break;
+            case 'v':
+                isVerbose = true;
+                break;
+            case 's':
+                socketPath = optarg;
+                break;
+            default:
+                PrintUsage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind != argc - 1) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    static plog::ColorConsoleAppender<plog::TxtFormatter> appender;
+    plog::init(isVerbose ? plog::Severity::verbose : plog::Severity::error, &appender);
+
+    try {
+        // read the capture
+        std::ifstream file(argv[optind], std::ios::binary);
+        if(!file) {
+            throw std::runtime_error("failed to open capture file");
+        }
+
+        std::vector<char> contents{std::istreambuf_iterator<char>(file),
+            std::istreambuf_iterator<char>()};
+
+        Replay replay;
+        replay.isRealtime = isRealtime;
+        ParseCapture(std::as_bytes(std::span{contents}), replay.records);
+
+        if(replay.records.empty()) {
+            std::cerr << "nothing to replay" << std::endl;
+            return 0;
+        }
+
+        // set up the RPC server and the handlers' loop
+        Config::SetRpcSocketPath(socketPath);
+
+        auto lrpc = std::make_shared<RpcServer>();
+        auto loop = std::make_unique<RpmsgLoop>(lrpc->getEvBase());
+        replay.evbase = lrpc->getEvBase();
+
+        // create a socket pair in place of each channel
+        std::array<std::shared_ptr<Coprocessor::EndpointHandler>, Replay::kNumChannels> handlers;
+        std::array<int, Replay::kNumChannels> handlerFds{-1, -1};
+
+        for(size_t i = 0; i < Replay::kNumChannels; i++) {
+            std::array<int, 2> fds;
+            if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0,
+                        fds.data()) == -1) {
+                throw std::system_error(errno, std::generic_category(), "socketpair");
+            }
+
+            handlerFds[i] = fds[0];
+            replay.peers[i] = fds[1];
+
+            replay.readEvents[i] = event_new(replay.evbase, fds[1], EV_READ | EV_PERSIST,
+                    [](auto, auto, auto ctx) {
+                auto replay = reinterpret_cast<Replay *>(ctx);
+                for(size_t i = 0; i < Replay::kNumChannels; i++) {
+                    replay->drain(i);
+                }
+            }, &replay);
+            replay.writeEvents[i] = event_new(replay.evbase, fds[1], EV_WRITE,
+                    [](auto, auto, auto ctx) {
+                reinterpret_cast<Replay *>(ctx)->feed();
+            }, &replay);
+
+            if(!replay.readEvents[i] || !replay.writeEvents[i]) {
+                throw std::runtime_error("failed to allocate channel events");
+            }
+            event_add(replay.readEvents[i], nullptr);
+        }
+
+        // and a stream socket pair in place of confd (the handler's end is owned by it)
+        std::array<int, 2> confdFds;
+        if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0,
+                    confdFds.data()) == -1) {
+            throw std::system_error(errno, std::generic_category(), "socketpair (confd)");
+        }
+        replay.confdPeer = confdFds[1];
+
+        replay.confdEvent = event_new(replay.evbase, replay.confdPeer, EV_READ | EV_PERSIST,
+                [](auto, auto, auto ctx) {
+            try {
+                reinterpret_cast<Replay *>(ctx)->serveConfd();
+            } catch(const std::exception &e) {
+                std::cerr << "emulated confd failed: " << e.what() << std::endl;
+            }
+        }, &replay);
+        replay.confdWriteEvent = event_new(replay.evbase, replay.confdPeer, EV_WRITE,
+                [](auto, auto, auto ctx) {
+            try {
+                reinterpret_cast<Replay *>(ctx)->flushConfd();
+            } catch(const std::exception &e) {
+                std::cerr << "emulated confd failed: " << e.what() << std::endl;
+            }
+        }, &replay);
+        if(!replay.confdEvent || !replay.confdWriteEvent) {
+            close(confdFds[0]);
+            throw std::runtime_error("failed to allocate confd events");
+        }
+        event_add(replay.confdEvent, nullptr);
+
+        handlers[kCaptureChannelControl] = std::make_shared<ControlEpHandler>(
+                handlerFds[kCaptureChannelControl], *loop, lrpc);
+        handlers[kCaptureChannelConfd] = std::make_shared<ConfdEpHandler>(
+                handlerFds[kCaptureChannelConfd], *loop, lrpc, confdFds[0]);
+
+        replay.timer = evtimer_new(replay.evbase, [](auto, auto, auto ctx) {
+            reinterpret_cast<Replay *>(ctx)->feed();
+        }, &replay);
+        if(!replay.timer) {
+            throw std::runtime_error("failed to allocate replay timer");
+        }
+
+        // replay the messages
+        std::cerr << "replaying " << replay.records.size() << " messages ("
+            << (isRealtime ? "recorded rate" : "fast") << ")" << std::endl;
+
+        loop->start();
+
+        replay.startedAt = Stats::Now();
+        replay.feed();
+        lrpc->run();
+
+        loop->stop();
+
+        // print results
+        const auto elapsed = static_cast<double>(replay.finishedAt - replay.startedAt) / 1e9;
+        std::cerr << "sent " << replay.records.size() << " messages in " << elapsed << " s ("
+            << static_cast<double>(replay.records.size()) / elapsed << " msg/s), "
+            << replay.numReplies << " replies, " << replay.numConfdRequests
+            << " confd requests" << std::endl;
+
+        auto stats = Stats::Snapshot();
+        cbor_describe(stats, stdout);
+        cbor_decref(&stats);
+
+        // clean up
+        for(auto &handler : handlers) {
+            handler.reset();
+        }
+        loop.reset();
+
+        event_free(replay.timer);
+        event_free(replay.confdEvent);
+        event_free(replay.confdWriteEvent);
+        close(replay.confdPeer);
+        for(size_t i = 0; i < Replay::kNumChannels; i++) {
+            event_free(replay.readEvents[i]);
+            event_free(replay.writeEvents[i]);
+            close(replay.peers[i]);
+            close(handlerFds[i]);
+        }
+    } catch(const std::exception &e) {
+        std::cerr << "replay failed: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,252 @@
+/**
+ * @file
+ *
+ * @brief Tests for RPC server client output
+ *
+ * A client is connected to an in-process RPC server, and sends it requests while the server also
+ * broadcasts to it; the client doesn't read anything until the server's output buffers backed up.
+ * Replies are copied into the output buffer, so several of them share a buffer chain. The client
+ * is then drained, and each received datagram must be exactly one message, in order.
+ *
+ * This is run with both unbatched and batched IO.
+ */
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <event2/event.h>
+#include <plog/Log.h>
+#include <plog/Appenders/ColorConsoleAppender.h>
+#include <plog/Formatters/TxtFormatter.h>
+#include <plog/Init.h>
+
+#include "Config.h"
+#include "RpcServer.h"
+#include "RpcTypes.h"
+
+/// Referenced by the RPC server
+std::atomic_bool gRun{true};
+
+namespace {
+/// Socket path for the server under test
+constexpr static const char *kSocketPath{"/tmp/loadd-rpcserver-test.sock"};
+/// Number of messages to broadcast (and requests to send); enough to fill the socket
+constexpr static const size_t kNumMessages{4000};
+
+/// CBOR encoded request payload: `{"unsubscribe": true}`
+constexpr static const std::array<uint8_t, 14> kRequestPayload{{
+    0xa1, 0x6b, 'u', 'n', 's', 'u', 'b', 's', 'c', 'r', 'i', 'b', 'e', 0xf5,
+}};
+
+/**
+ * @brief Messages received by the client so far
+ */
+struct Received {
+    /// Index of the next expected broadcast
+    size_t broadcasts{0};
+    /// Number of replies received
+    size_t replies{0};
+};
+
+/// Number of failed checks
+int gFailures{0};
+
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        gFailures++; \
+    } \
+} while(0)
+
+/**
+ * @brief Connect a client to the RPC server
+ *
+ * The server's loop is run once afterwards, so that it accepts the connection.
+ *
+ * @return Client socket (non-blocking)
+ */
+int ConnectClient(RpcServer &server) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if(fd == -1) {
+        throw std::system_error(errno, std::generic_category(), "create client socket");
+    }
+
+    struct sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, kSocketPath, sizeof(addr.sun_path) - 1);
+
+    if(connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1) {
+        close(fd);
+        throw std::system_error(errno, std::generic_category(), "connect client socket");
+    }
+
+    event_base_loop(server.getEvBase(), EVLOOP_NONBLOCK);
+    return fd;
+}
+
+/**
+ * @brief Build the broadcast with the given index
+ *
+ * Sizes vary between messages, and the payload is filled with the (truncated) index, so that
+ * any data from a neighbouring message is detected.
+ */
+std::vector<std::byte> MakeMessage(const size_t index) {
+    std::vector<std::byte> packet(sizeof(struct rpc_header) + 64 + (index % 251),
+            static_cast<std::byte>(index));
+
+    const struct rpc_header hdr{
+        .version = kRpcVersionLatest,
+        .length = static_cast<uint16_t>(packet.size()),
+        .endpoint = kRpcEndpointLinkState,
+        .tag = static_cast<uint8_t>(index),
+        .flags = kRpcFlagBroadcast,
+    };
+    memcpy(packet.data(), &hdr, sizeof(hdr));
+
+    return packet;
+}
+
+/**
+ * @brief Send the request with the given index
+ *
+ * @return Whether the request was sent; false if the socket is full
+ */
+bool SendRequest(const int fd, const size_t index) {
+    std::array<std::byte, sizeof(struct rpc_header) + kRequestPayload.size()> packet;
+
+    const struct rpc_header hdr{
+        .version = kRpcVersionLatest,
+        .length = static_cast<uint16_t>(packet.size()),
+        .endpoint = kRpcEndpointMeasurementSubscribe,
+        .tag = static_cast<uint8_t>(index),
+        .flags = 0,
+    };
+    memcpy(packet.data(), &hdr, sizeof(hdr));
+    memcpy(packet.data() + sizeof(hdr), kRequestPayload.data(), kRequestPayload.size());
+
+    if(send(fd, packet.data(), packet.size(), MSG_DONTWAIT) == -1) {
+        if(errno == EAGAIN || errno == EWOULDBLOCK) {
+            return false;
+        }
+        throw std::system_error(errno, std::generic_category(), "send request");
+    }
+    return true;
+}
+
+/**
+ * @brief Read all datagrams waiting on the client socket, and verify each
+ *
+ * Every datagram must hold exactly one message. Broadcasts must arrive in order and intact, and
+ * replies in the order of their requests.
+ *
+ * @param fd Client socket
+ * @param received Messages received so far; updated
+ */
+void DrainClient(const int fd, Received &received) {
+    static std::vector<std::byte> buf(0x10000);
+
+    while(true) {
+        const auto len = recv(fd, buf.data(), buf.size(), MSG_DONTWAIT);
+        if(len == -1) {
+            CHECK(errno == EAGAIN || errno == EWOULDBLOCK);
+            return;
+        }
+
+        CHECK(static_cast<size_t>(len) >= sizeof(struct rpc_header));
+        if(static_cast<size_t>(len) < sizeof(struct rpc_header)) {
+            continue;
+        }
+
+        struct rpc_header hdr;
+        memcpy(&hdr, buf.data(), sizeof(hdr));
+        CHECK(hdr.length == len);
+
+        if(hdr.flags & kRpcFlagReply) {
+            CHECK(hdr.tag == static_cast<uint8_t>(received.replies));
+            received.replies++;
+        } else {
+            const auto expected = MakeMessage(received.broadcasts);
+            CHECK(static_cast<size_t>(len) == expected.size());
+            CHECK(!memcmp(buf.data(), expected.data(), std::min<size_t>(len, expected.size())));
+            received.broadcasts++;
+        }
+    }
+}
+
+/**
+ * @brief Back up a client's socket, then drain it
+ *
+ * @param batched Whether to use batched IO
+ */
+void TestBackedUpClient(const bool batched) {
+    Config::SetRpcBatchedIo(batched);
+    auto server = std::make_shared<RpcServer>();
+    const int fd = ConnectClient(*server);
+
+    // interleave requests and broadcasts, without reading anything
+    for(size_t i = 0; i < kNumMessages; i++) {
+        server->broadcastPacket(MakeMessage(i));
+
+        while(!SendRequest(fd, i)) {
+            event_base_loop(server->getEvBase(), EVLOOP_NONBLOCK);
+        }
+        event_base_loop(server->getEvBase(), EVLOOP_NONBLOCK);
+    }
+
+    // the socket can't have taken all of it
+    Received received;
+    DrainClient(fd, received);
+    CHECK(received.broadcasts + received.replies < 2 * kNumMessages);
+
+    // then alternate between draining and letting the server send more
+    for(size_t tries = 0; tries < 10'000; tries++) {
+        if(received.broadcasts == kNumMessages && received.replies == kNumMessages) {
+            break;
+        }
+
+        event_base_loop(server->getEvBase(), EVLOOP_NONBLOCK);
+        DrainClient(fd, received);
+    }
+    CHECK(received.broadcasts == kNumMessages);
+    CHECK(received.replies == kNumMessages);
+
+    close(fd);
+}
+}
+
+
+
+int main() {
+    static plog::ColorConsoleAppender<plog::TxtFormatter> appender;
+    plog::init(plog::Severity::error, &appender);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    try {
+        Config::SetRpcSocketPath(kSocketPath);
+
+        TestBackedUpClient(false);
+        TestBackedUpClient(true);
+    } catch(const std::exception &e) {
+        fprintf(stderr, "test failed: %s\n", e.what());
+        return 1;
+    }
+
+    if(gFailures) {
+        fprintf(stderr, "%d check(s) failed\n", gFailures);
+        return 1;
+    }
+    return 0;
+}
@@ -78,6 +78,10 @@ enum rpc_endpoint {
     kRpcEndpointUiEvent                 = 0x02,
     /// Indicator state update
     kRpcEndpointIndicator               = 0x03,
+    /// Request I²C bus statistics (utilization and queueing latency)
+    kRpcEndpointBusStats                = 0x04,
+    /// Indicator animation update
+    kRpcEndpointIndicatorAnimation      = 0x05,
 };
 
 #endif
@@ -24,8 +24,9 @@ thread_local std::weak_ptr<EventLoop> EventLoop::gCurrentEventLoop;
  * @brief Initialize the event loop
  *
  * @param rpcSocketPath Path to the RPC socket on the filesystem
+ * @param rpcBatchedIo Whether the RPC server uses batched socket IO
  */
-EventLoop::EventLoop(const std::filesystem::path &rpcSocketPath) {
+EventLoop::EventLoop(const std::filesystem::path &rpcSocketPath, const bool rpcBatchedIo) {
     // create the event base
     this->evbase = event_base_new();
     if(!this->evbase) {
@@ -38,7 +39,7 @@ EventLoop::EventLoop(const std::filesystem::path &rpcSocketPath) {
 
     // set up RPC boi
     if(!rpcSocketPath.empty()) {
-        this->rpc = std::make_shared<Rpc::Server>(this, rpcSocketPath);
+        this->rpc = std::make_shared<Rpc::Server>(this, rpcSocketPath, rpcBatchedIo);
     }
 }
 
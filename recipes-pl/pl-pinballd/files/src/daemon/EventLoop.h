@@ -23,7 +23,7 @@ class Server;
  */
 class EventLoop: public std::enable_shared_from_this<EventLoop> {
     public:
-        EventLoop(const std::filesystem::path &rpcSocketPath);
+        EventLoop(const std::filesystem::path &rpcSocketPath, const bool rpcBatchedIo = false);
         ~EventLoop();
 
         /**
@@ -0,0 +1,521 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <exception>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+
+#include <cbor.h>
+#include <event2/event.h>
+#include <fmt/format.h>
+#include <plog/Log.h>
+
+#include "EventLoop.h"
+#include "I2cBus.h"
+
+/**
+ * @brief Open the I²C bus
+ *
+ * Open the bus device, then start the worker thread that performs all transfers on it.
+ * Completions of asynchronous transfers are delivered on the calling thread's event loop.
+ *
+ * @param path Path to the I²C bus device (such as /dev/i2c-1)
+ */
+I2cBus::I2cBus(const std::filesystem::path &path) {
+    this->fd = open(path.native().c_str(), O_RDWR | O_CLOEXEC);
+    if(this->fd == -1) {
+        throw std::system_error(errno, std::generic_category(),
+                fmt::format("failed to open i2c bus ('{}')", path.native()));
+    }
+
+    this->openedAt = Now();
+
+    try {
+        this->initCompletionEvent();
+    } catch(const std::exception &) {
+        close(this->fd);
+        throw;
+    }
+
+    this->worker = std::thread(&I2cBus::workerMain, this);
+}
+
+/**
+ * @brief Shut down the bus
+ *
+ * Any transactions that are still queued will be performed before the worker exits; but the
+ * callbacks of asynchronous transfers that haven't been delivered yet are discarded.
+ */
+I2cBus::~I2cBus() {
+    {
+        std::lock_guard lg(this->lock);
+        this->shutdown = true;
+    }
+    this->queueCond.notify_one();
+
+    if(this->worker.joinable()) {
+        this->worker.join();
+    }
+
+    event_free(this->completionEvent);
+    close(this->completionFd);
+
+    close(this->fd);
+}
+
+/**
+ * @brief Set up the event used to deliver asynchronous completions
+ *
+ * The worker signals an eventfd whenever it completed asynchronous requests; the event loop then
+ * invokes their callbacks.
+ */
+void I2cBus::initCompletionEvent() {
+    this->completionFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(this->completionFd == -1) {
+        throw std::system_error(errno, std::generic_category(), "create i2c completion eventfd");
+    }
+
+    this->completionEvent = event_new(EventLoop::Current()->getEvBase(), this->completionFd,
+            EV_READ | EV_PERSIST, [](auto, auto, auto ctx) {
+        reinterpret_cast<I2cBus *>(ctx)->deliverCompletions();
+    }, this);
+    if(!this->completionEvent) {
+        close(this->completionFd);
+        throw std::runtime_error("failed to allocate i2c completion event");
+    }
+
+    event_add(this->completionEvent, nullptr);
+}
+
+
+
+/**
+ * @brief Perform a transaction, and wait for it to complete
+ *
+ * @param priority Transfer priority
+ * @param txn Messages to transfer; on return, read messages contain the data that was read
+ *
+ * @throws std::system_error The transfer failed
+ *
+ * @remark This blocks the calling thread until the transfer completed, including any time spent
+ *         queued behind other transfers. It's meant for startup and shutdown (probing and device
+ *         configuration) only; use transferAsync() from the event loop.
+ *
+ * @remark This must not be called from the bus worker thread.
+ */
+void I2cBus::transfer(const Priority priority, Transaction &txn) {
+    if(txn.empty() || txn.size() > kMaxMessagesPerTransfer) {
+        throw std::invalid_argument(fmt::format("invalid transaction size ({})", txn.size()));
+    }
+
+    auto request = std::make_unique<Request>();
+    request->txn = std::move(txn);
+    request->priority = priority;
+    request->queuedAt = Now();
+    request->completion.emplace();
+
+    auto future = request->completion->get_future();
+    this->enqueue(std::move(request));
+
+    txn = future.get();
+}
+
+/**
+ * @brief Queue a transaction, and invoke a callback once it completed
+ *
+ * The callback is invoked on the event loop, never from within this call.
+ *
+ * @param priority Transfer priority
+ * @param txn Messages to transfer
+ * @param callback Invoked with the transferred messages, and the error if the transfer failed
+ */
+void I2cBus::transferAsync(const Priority priority, Transaction &&txn, Completion &&callback) {
+    if(txn.empty() || txn.size() > kMaxMessagesPerTransfer) {
+        throw std::invalid_argument(fmt::format("invalid transaction size ({})", txn.size()));
+    }
+
+    auto request = std::make_unique<Request>();
+    request->txn = std::move(txn);
+    request->priority = priority;
+    request->queuedAt = Now();
+    request->callback = std::move(callback);
+
+    this->enqueue(std::move(request));
+}
+
+/**
+ * @brief Queue a transaction, without waiting for it to complete
+ *
+ * This is intended for writes, whose completion the caller doesn't care about. If the transfer
+ * fails, the error is logged.
+ *
+ * @param priority Transfer priority
+ * @param txn Messages to transfer
+ */
+void I2cBus::submit(const Priority priority, Transaction &&txn) {
+    if(txn.empty() || txn.size() > kMaxMessagesPerTransfer) {
+        throw std::invalid_argument(fmt::format("invalid transaction size ({})", txn.size()));
+    }
+
+    auto request = std::make_unique<Request>();
+    request->txn = std::move(txn);
+    request->priority = priority;
+    request->queuedAt = Now();
+
+    this->enqueue(std::move(request));
+}
+
+/**
+ * @brief Add a request to the queue for its priority, and wake up the worker
+ */
+void I2cBus::enqueue(std::unique_ptr<Request> &&request) {
+    {
+        std::lock_guard lg(this->lock);
+        this->queues[static_cast<size_t>(request->priority)].emplace_back(std::move(request));
+    }
+    this->queueCond.notify_one();
+}
+
+/**
+ * @brief Write to a device, then read back from it
+ *
+ * This is the usual way to read device registers: write the register address, then read the
+ * register data, with a repeated start in between.
+ *
+ * @param priority Transfer priority
+ * @param address Device address
+ * @param writeData Data to write (usually, the register address)
+ * @param readData Buffer to receive the read data
+ *
+ * @throws std::system_error The transfer failed
+ */
+void I2cBus::writeRead(const Priority priority, const uint16_t address,
+        std::span<const uint8_t> writeData, std::span<uint8_t> readData) {
+    Transaction txn{
+        Message::Write(address, writeData),
+        Message::Read(address, readData.size()),
+    };
+    this->transfer(priority, txn);
+
+    std::copy(txn[1].data.begin(), txn[1].data.end(), readData.begin());
+}
+
+
+
+/**
+ * @brief Bus worker thread entry point
+ *
+ * Wait for transactions to be queued; then take as many of them as fit into a single transfer
+ * (in priority order) and perform them. Shortly after a merged transfer failed, only a single
+ * transaction is taken at a time instead.
+ */
+void I2cBus::workerMain() {
+    pthread_setname_np(pthread_self(), "i2c-bus");
+
+    std::vector<std::unique_ptr<Request>> batch;
+
+    while(true) {
+        {
+            std::unique_lock lg(this->lock);
+
+            auto hasWork = [this] {
+                return std::any_of(this->queues.begin(), this->queues.end(),
+                        [](const auto &queue) { return !queue.empty(); });
+            };
+            this->queueCond.wait(lg, [&] {
+                return this->shutdown || hasWork();
+            });
+
+            if(!hasWork()) {
+                return;
+            }
+
+            /*
+             * Take requests from the highest priority queue first. Stop as soon as a request
+             * doesn't fit, rather than skipping ahead, so lower priority requests can never
+             * overtake it.
+             */
+            size_t numMessages{0};
+            bool full{false};
+
+            for(auto &queue : this->queues) {
+                while(!queue.empty() && !full) {
+                    const auto size = queue.front()->txn.size();
+                    if(numMessages + size > kMaxMessagesPerTransfer ||
+                            (this->unmergedBatches && !batch.empty())) {
+                        full = true;
+                        break;
+                    }
+
+                    numMessages += size;
+                    batch.emplace_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+            }
+
+            if(this->unmergedBatches) {
+                this->unmergedBatches--;
+            }
+        }
+
+        this->perform(batch);
+        batch.clear();
+    }
+}
+
+/**
+ * @brief Perform a batch of transactions
+ *
+ * All transactions are performed as a single transfer. If it fails, all of them fail: some of
+ * their messages may already have been performed on the bus, so replaying them (for example,
+ * applying register writes twice, or reads after their writes went through) isn't safe.
+ *
+ * To keep a misbehaving device from failing other devices' transactions over and over, the next
+ * few batches after a failed merged transfer are performed one transaction at a time.
+ */
+void I2cBus::perform(std::span<std::unique_ptr<Request>> batch) {
+    // record queueing time
+    const auto now = Now();
+
+    {
+        std::lock_guard lg(this->lock);
+
+        for(const auto &request : batch) {
+            auto &stats = this->queueStats[static_cast<size_t>(request->priority)];
+            const auto wait = now - request->queuedAt;
+
+            stats.requests++;
+            stats.totalWait += wait;
+            stats.maxWait = std::max(stats.maxWait, wait);
+        }
+    }
+
+    // perform them all at once
+    std::exception_ptr error;
+
+    try {
+        this->doTransfer(batch);
+    } catch(const std::exception &e) {
+        error = std::current_exception();
+
+        if(batch.size() > 1) {
+            PLOG_WARNING << fmt::format("merged i2c transfer ({} transactions) failed: {}",
+                    batch.size(), e.what());
+            this->unmergedBatches = kUnmergedBatchesAfterError;
+        }
+    }
+
+    for(auto &request : batch) {
+        this->complete(request, error);
+    }
+}
+
+/**
+ * @brief Perform the messages of one or more transactions in a single `I2C_RDWR` call
+ *
+ * @throws std::system_error The transfer failed
+ */
+void I2cBus::doTransfer(std::span<const std::unique_ptr<Request>> requests) {
+    std::array<struct i2c_msg, kMaxMessagesPerTransfer> msgs;
+    size_t numMsgs{0};
+
+    for(const auto &request : requests) {
+        for(auto &message : request->txn) {
+            auto &msg = msgs[numMsgs++];
+            memset(&msg, 0, sizeof(msg));
+
+            msg.addr = message.address;
+            msg.flags = message.isRead ? I2C_M_RD : 0;
+            msg.len = message.data.size();
+            msg.buf = message.data.data();
+        }
+    }
+
+    struct i2c_rdwr_ioctl_data txns;
+    txns.msgs = msgs.data();
+    txns.nmsgs = numMsgs;
+
+    const auto start = Now();
+    const int err = ioctl(this->fd, I2C_RDWR, &txns);
+    const auto elapsed = Now() - start;
+
+    {
+        std::lock_guard lg(this->lock);
+        this->busyTime += elapsed;
+        this->numTransfers++;
+        this->numMessages += numMsgs;
+    }
+
+    if(err < 0) {
+        throw std::system_error(errno, std::generic_category(), "I2C_RDWR");
+    }
+}
+
+/**
+ * @brief Complete a transaction
+ *
+ * Hand asynchronous transactions to the event loop, to invoke their callback; wake up the caller
+ * waiting for it (if any) and hand back the messages; otherwise, just log the error if the
+ * transaction failed.
+ *
+ * @param request Transaction that was performed; asynchronous requests are moved out of it
+ * @param error Exception describing why the transfer failed, or `nullptr` if it succeeded
+ */
+void I2cBus::complete(std::unique_ptr<Request> &request, std::exception_ptr error) {
+    if(error) {
+        std::lock_guard lg(this->lock);
+        this->numErrors++;
+    }
+
+    if(request->callback) {
+        request->error = error;
+
+        {
+            std::lock_guard lg(this->lock);
+            this->completed.emplace_back(std::move(request));
+        }
+
+        const uint64_t value{1};
+        if(::write(this->completionFd, &value, sizeof(value)) == -1) {
+            PLOG_ERROR << "failed to signal i2c completion: " << strerror(errno);
+        }
+    } else if(request->completion) {
+        if(error) {
+            request->completion->set_exception(error);
+        } else {
+            request->completion->set_value(std::move(request->txn));
+        }
+    } else if(error) {
+        try {
+            std::rethrow_exception(error);
+        } catch(const std::exception &e) {
+            PLOG_WARNING << fmt::format("i2c write to ${:02x} failed: {}",
+                    request->txn.front().address, e.what());
+        }
+    }
+}
+
+/**
+ * @brief Invoke the callbacks of completed asynchronous transactions
+ *
+ * Runs on the event loop, whenever the worker signalled the completion eventfd.
+ */
+void I2cBus::deliverCompletions() {
+    uint64_t value;
+    if(::read(this->completionFd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        PLOG_ERROR << "failed to read i2c completion eventfd: " << strerror(errno);
+    }
+
+    decltype(this->completed) done;
+    {
+        std::lock_guard lg(this->lock);
+        done.swap(this->completed);
+    }
+
+    for(auto &request : done) {
+        try {
+            request->callback(std::move(request->txn), request->error);
+        } catch(const std::exception &e) {
+            PLOG_WARNING << "failed to handle i2c completion: " << e.what();
+        }
+    }
+}
+
+
+
+/**
+ * @brief Serialize bus statistics
+ *
+ * Create a CBOR map with the following keys:
+ *
+ * - util: Bus utilization (fraction of time spent in transfers) since the bus was opened
+ * - transfers: Number of `I2C_RDWR` calls made
+ * - messages: Number of messages transferred
+ * - errors: Number of transactions that failed
+ * - queue: Map keyed by priority name (input, indicator, housekeeping) whose values are maps with
+ *   the keys `n` (number of transactions), `avg` and `max` (time spent queued, in nanoseconds)
+ *
+ * @return CBOR item, which the caller is responsible for releasing
+ */
+struct cbor_item_t *I2cBus::serializeStats() {
+    constexpr static const std::array<std::string_view, kNumPriorities> kPriorityNames{{
+        "input", "indicator", "housekeeping",
+    }};
+
+    std::lock_guard lg(this->lock);
+
+    const auto elapsed = Now() - this->openedAt;
+    const double util = elapsed ? static_cast<double>(this->busyTime) / elapsed : 0.;
+
+    auto queues = cbor_new_definite_map(kNumPriorities);
+    for(size_t i = 0; i < kNumPriorities; i++) {
+        const auto &stats = this->queueStats[i];
+
+        auto entry = cbor_new_definite_map(3);
+        cbor_map_add(entry, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("n")),
+            .value = cbor_move(cbor_build_uint64(stats.requests)),
+        });
+        cbor_map_add(entry, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("avg")),
+            .value = cbor_move(cbor_build_uint64(stats.requests ?
+                        (stats.totalWait / stats.requests) : 0)),
+        });
+        cbor_map_add(entry, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_string("max")),
+            .value = cbor_move(cbor_build_uint64(stats.maxWait)),
+        });
+
+        cbor_map_add(queues, (struct cbor_pair) {
+            .key = cbor_move(cbor_build_stringn(kPriorityNames[i].data(),
+                        kPriorityNames[i].size())),
+            .value = cbor_move(entry),
+        });
+    }
+
+    auto root = cbor_new_definite_map(5);
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("util")),
+        .value = cbor_move(cbor_build_float4(util)),
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("transfers")),
+        .value = cbor_move(cbor_build_uint64(this->numTransfers)),
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("messages")),
+        .value = cbor_move(cbor_build_uint64(this->numMessages)),
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("errors")),
+        .value = cbor_move(cbor_build_uint64(this->numErrors)),
+    });
+    cbor_map_add(root, (struct cbor_pair) {
+        .key = cbor_move(cbor_build_string("queue")),
+        .value = cbor_move(queues),
+    });
+
+    return root;
+}
+
+/**
+ * @brief Get the current time for bus statistics
+ *
+ * @return Monotonic timestamp, in nanoseconds
+ */
+uint64_t I2cBus::Now() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000ULL) + ts.tv_nsec;
+}
@@ -0,0 +1,219 @@
+#ifndef I2CBUS_H
+#define I2CBUS_H
+
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+struct cbor_item_t;
+struct event;
+
+/**
+ * @brief Shared I²C bus
+ *
+ * Owns the I²C bus that all front panel devices are on, and performs transfers on behalf of their
+ * drivers on a dedicated worker thread.
+ *
+ * Transfers are queued by priority, so that (for example) reading touch data doesn't have to
+ * wait behind a burst of LED updates. All transactions waiting when the bus becomes free are
+ * merged into as few `I2C_RDWR` calls as possible.
+ *
+ * Completions of asynchronous transfers are delivered on the event loop that was current when
+ * the bus was opened.
+ *
+ * @remark Because merged transactions are separated by a repeated start (rather than a stop
+ *         condition) devices should not depend on seeing a stop between transactions.
+ */
+class I2cBus {
+    public:
+        /**
+         * @brief Transfer priorities
+         *
+         * Transactions of a higher priority are always performed before those of a lower one;
+         * transactions with the same priority are performed in the order they were queued.
+         */
+        enum class Priority: uint8_t {
+            /// User input (touch, buttons)
+            Input                       = 0,
+            /// Indicator updates
+            Indicator                   = 1,
+            /// Everything else (probing, configuration)
+            Housekeeping                = 2,
+        };
+        /// Total number of priority levels
+        constexpr static const size_t kNumPriorities{3};
+
+        /**
+         * @brief A single message on the bus
+         *
+         * For writes, the data buffer holds the bytes to write; for reads, it's sized to the
+         * number of bytes to read, and receives the read data.
+         */
+        struct Message {
+            /// Device address
+            uint16_t address{0};
+            /// Is this a read?
+            bool isRead{false};
+            /// Data to write, or read data
+            std::vector<uint8_t> data;
+
+            /**
+             * @brief Create a write message
+             */
+            static inline Message Write(const uint16_t address, std::span<const uint8_t> data) {
+                return {address, false, {data.begin(), data.end()}};
+            }
+
+            /**
+             * @brief Create a read message
+             */
+            static inline Message Read(const uint16_t address, const size_t length) {
+                return {address, true, std::vector<uint8_t>(length, 0)};
+            }
+        };
+
+        /**
+         * @brief A sequence of messages that's performed as one bus transaction
+         *
+         * Messages are separated by a repeated start.
+         */
+        using Transaction = std::vector<Message>;
+
+        /**
+         * @brief Completion callback for asynchronous transfers
+         *
+         * Invoked with the transferred messages (read messages contain the data that was read)
+         * and, if the transfer failed, the exception describing why.
+         */
+        using Completion = std::function<void(Transaction &&, std::exception_ptr)>;
+
+    public:
+        I2cBus(const std::filesystem::path &path);
+        ~I2cBus();
+
+        void transfer(const Priority priority, Transaction &txn);
+        void transferAsync(const Priority priority, Transaction &&txn, Completion &&callback);
+        void submit(const Priority priority, Transaction &&txn);
+
+        /**
+         * @brief Write to a device register (or sequence of registers) and wait for completion
+         *
+         * @param priority Transfer priority
+         * @param address Device address
+         * @param data Register address, followed by the data to write
+         */
+        inline void write(const Priority priority, const uint16_t address,
+                std::span<const uint8_t> data) {
+            Transaction txn{Message::Write(address, data)};
+            this->transfer(priority, txn);
+        }
+
+        void writeRead(const Priority priority, const uint16_t address,
+                std::span<const uint8_t> writeData, std::span<uint8_t> readData);
+
+        struct cbor_item_t *serializeStats();
+
+    private:
+        /**
+         * @brief A queued transaction
+         */
+        struct Request {
+            /// Messages to transfer
+            Transaction txn;
+            /// Priority the request was queued with
+            Priority priority{Priority::Housekeeping};
+            /// Time at which the request was queued (nanoseconds, monotonic)
+            uint64_t queuedAt{0};
+            /// Caller waiting for completion, if any
+            std::optional<std::promise<Transaction>> completion;
+            /// Callback to invoke on the event loop once completed, if any
+            Completion callback;
+            /// Error that the transfer failed with (for callbacks)
+            std::exception_ptr error;
+        };
+
+        /**
+         * @brief Queueing statistics for a priority level
+         */
+        struct QueueStats {
+            /// Number of transactions performed
+            uint64_t requests{0};
+            /// Total time transactions spent queued (nanoseconds)
+            uint64_t totalWait{0};
+            /// Longest time a transaction was queued (nanoseconds)
+            uint64_t maxWait{0};
+        };
+
+        void initCompletionEvent();
+        void enqueue(std::unique_ptr<Request> &&request);
+        void workerMain();
+        void perform(std::span<std::unique_ptr<Request>> batch);
+        void doTransfer(std::span<const std::unique_ptr<Request>> requests);
+        void complete(std::unique_ptr<Request> &request, std::exception_ptr error);
+        void deliverCompletions();
+
+        static uint64_t Now();
+
+    private:
+        /// Maximum number of messages in a single `I2C_RDWR` call (I2C_RDWR_IOCTL_MAX_MSGS)
+        constexpr static const size_t kMaxMessagesPerTransfer{42};
+        /**
+         * @brief Number of batches to perform without merging after a merged transfer failed
+         *
+         * This isolates the device that caused the failure, so it doesn't keep failing the
+         * transactions of other devices merged with it.
+         */
+        constexpr static const size_t kUnmergedBatchesAfterError{16};
+
+        /// File descriptor for the bus
+        int fd{-1};
+
+        /// Protects the queues and statistics
+        std::mutex lock;
+        /// Signalled when a request is queued, or the worker should shut down
+        std::condition_variable queueCond;
+        /// Pending requests, per priority
+        std::array<std::deque<std::unique_ptr<Request>>, kNumPriorities> queues;
+        /// Set to shut down the worker
+        bool shutdown{false};
+        /// Asynchronous requests that completed, and whose callbacks are yet to be invoked
+        std::vector<std::unique_ptr<Request>> completed;
+
+        /// Remaining batches to be performed one transaction at a time (worker only)
+        size_t unmergedBatches{0};
+
+        /// eventfd signalled by the worker when asynchronous requests completed
+        int completionFd{-1};
+        /// Event loop event for the completion eventfd
+        struct event *completionEvent{nullptr};
+
+        /// Time the bus was opened (nanoseconds, monotonic)
+        uint64_t openedAt{0};
+        /// Total time spent in `I2C_RDWR` calls (nanoseconds)
+        uint64_t busyTime{0};
+        /// Number of `I2C_RDWR` calls made
+        uint64_t numTransfers{0};
+        /// Number of messages transferred
+        uint64_t numMessages{0};
+        /// Number of transactions that failed
+        uint64_t numErrors{0};
+        /// Per priority queueing statistics
+        std::array<QueueStats, kNumPriorities> queueStats;
+
+        /// Worker thread that performs all transfers
+        std::thread worker;
+};
+
+#endif
@@ -1,9 +1,45 @@
+#include <time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <stdexcept>
+
+#include <event2/event.h>
 #include <fmt/format.h>
 #include <plog/Log.h>
 
 #include "EventLoop.h"
 #include "LedManager.h"
 
+/**
+ * @brief Initialize the LED manager
+ *
+ * Allocate the timer used to render software animations; it's only armed while there are any.
+ */
+LedManager::LedManager() {
+    this->frameTimer = event_new(EventLoop::Current()->getEvBase(), -1, EV_PERSIST,
+            [](auto, auto, auto ctx) {
+        try {
+            reinterpret_cast<LedManager *>(ctx)->renderFrame();
+        } catch(const std::exception &e) {
+            PLOG_WARNING << "failed to render indicator animation: " << e.what();
+        }
+    }, this);
+    if(!this->frameTimer) {
+        throw std::runtime_error("failed to allocate animation timer");
+    }
+}
+
+/**
+ * @brief Clean up the LED manager
+ */
+LedManager::~LedManager() {
+    if(this->frameTimer) {
+        event_free(this->frameTimer);
+    }
+}
+
 /**
  * @brief Register a LED driver
  *
@@ -17,37 +53,300 @@ void LedManager::registerDriver(const std::shared_ptr<DriverInterface> &driver)
  * @brief Set the brightness of an indicator
  */
 void LedManager::setBrightness(const Indicator which, const double brightness) {
+    Transaction txn;
+    txn.setBrightness(which, brightness);
+    this->apply(txn);
+}
+
+/**
+ * @brief Set the color of an indicator
+ */
+void LedManager::setColor(const Indicator which, const Color &color) {
+    Transaction txn;
+    txn.setColor(which, color);
+    this->apply(txn);
+}
+
+/**
+ * @brief Apply a set of indicator changes
+ *
+ * Changed indicators stop any animation they're playing, and remember the new state as the one
+ * to return to after future animations. Then, the changes are applied by the drivers.
+ */
+void LedManager::apply(Transaction &txn) {
+    for(size_t i = 0; i < txn.changes.size(); i++) {
+        if(!txn.changes[i]) {
+            continue;
+        }
+
+        this->stopAnimation(static_cast<Indicator>(i));
+        this->baseColors[i] = *txn.changes[i];
+    }
+
+    this->applyToDrivers(txn);
+    this->updateFrameTimer();
+}
+
+/**
+ * @brief Hand a set of indicator changes to the drivers
+ *
+ * The transaction is handed to each registered driver in turn; each applies (and removes) the
+ * changes for the indicators it handles. Any changes left over afterwards have no driver.
+ */
+void LedManager::applyToDrivers(Transaction &txn) {
     for(const auto &ptr : this->drivers) {
+        if(txn.empty()) {
+            return;
+        }
+
         auto driver = ptr.lock();
         if(!driver) {
             continue;
         }
 
-        if(driver->setIndicatorBrightness(which, brightness)) {
-            return;
+        driver->applyIndicatorTransaction(txn);
+    }
+
+    for(size_t i = 0; i < txn.changes.size(); i++) {
+        if(!txn.changes[i]) {
+            continue;
+        }
+
+        const auto [cR, cG, cB] = *txn.changes[i];
+        PLOG_WARNING << fmt::format("failed to set indicator {}=({}, {}, {}): no driver", i, cR,
+                cG, cB);
+    }
+}
+
+
+
+/**
+ * @brief Start playing an animation on an indicator
+ *
+ * Any animation the indicator is already playing is replaced. Blinks that repeat indefinitely,
+ * and alternate with off, are offered to the drivers to perform in hardware first; all other
+ * animations are rendered by us, at a fixed frame rate.
+ *
+ * @param which Indicator to animate
+ * @param animation Animation to play back
+ */
+void LedManager::setAnimation(const Indicator which, const Animation &animation) {
+    if(animation.colors.empty()) {
+        throw std::invalid_argument("animation requires at least one color");
+    } else if(!(animation.period > 0.)) {
+        throw std::invalid_argument(fmt::format("invalid animation period ({})",
+                    animation.period));
+    }
+
+    this->stopAnimation(which);
+
+    auto &anim = this->animations[static_cast<size_t>(which)];
+    anim.emplace(ActiveAnimation{animation, Now()});
+    anim->animation.duty = std::clamp(animation.duty, 0., 1.);
+
+    // try to offload plain blinks to hardware
+    if(animation.type == Animation::Type::Blink && !animation.repeat &&
+            (animation.colors.size() == 1 || animation.colors[1] == Color{})) {
+        for(const auto &ptr : this->drivers) {
+            auto driver = ptr.lock();
+            if(driver && driver->startIndicatorBlink(which, animation.colors[0],
+                        animation.period, anim->animation.duty)) {
+                anim->isHardware = true;
+                anim->driver = driver;
+                break;
+            }
         }
     }
 
-    PLOG_WARNING << fmt::format("failed to set indicator {}={}: no driver",
-            static_cast<size_t>(which), brightness);
+    if(kLogAnimations) {
+        PLOG_VERBOSE << fmt::format("indicator {}: start animation type {} ({})",
+                static_cast<size_t>(which), static_cast<size_t>(animation.type),
+                anim->isHardware ? "hardware" : "software");
+    }
+
+    // show the first frame right away
+    if(!anim->isHardware) {
+        this->renderFrame();
+    } else {
+        this->updateFrameTimer();
+    }
 }
 
 /**
- * @brief Set the color of an indicator
+ * @brief Stop an indicator's animation
+ *
+ * The indicator returns to the state it was last set to.
  */
-void LedManager::setColor(const Indicator which, const Color &color) {
-    for(const auto &ptr : this->drivers) {
-        auto driver = ptr.lock();
-        if(!driver) {
+void LedManager::clearAnimation(const Indicator which) {
+    const auto idx = static_cast<size_t>(which);
+    if(!this->animations[idx]) {
+        return;
+    }
+
+    this->stopAnimation(which);
+
+    Transaction txn;
+    txn.setColor(which, this->baseColors[idx]);
+    this->applyToDrivers(txn);
+
+    this->updateFrameTimer();
+}
+
+/**
+ * @brief Discard an indicator's animation
+ *
+ * If the animation was performed in hardware, the driver is asked to stop it. The indicator's
+ * state is not updated.
+ */
+void LedManager::stopAnimation(const Indicator which) {
+    auto &anim = this->animations[static_cast<size_t>(which)];
+    if(!anim) {
+        return;
+    }
+
+    if(anim->isHardware) {
+        if(auto driver = anim->driver.lock()) {
+            driver->stopIndicatorBlink(which);
+        }
+    }
+
+    if(kLogAnimations) {
+        PLOG_VERBOSE << fmt::format("indicator {}: stop animation", static_cast<size_t>(which));
+    }
+
+    anim.reset();
+}
+
+/**
+ * @brief Render a frame of all software animations
+ *
+ * Evaluate each animation at the current time, and apply the resulting colors as a single
+ * transaction. Drivers drop writes that don't change an output, so frames in which nothing
+ * visibly changes (most of a blink, for example) don't cause any bus traffic.
+ *
+ * Animations that have finished are removed, and their indicator restored.
+ */
+void LedManager::renderFrame() {
+    const auto now = Now();
+    Transaction txn;
+
+    for(size_t i = 0; i < this->animations.size(); i++) {
+        auto &anim = this->animations[i];
+        if(!anim || anim->isHardware) {
             continue;
         }
 
-        if(driver->setIndicatorColor(which, color)) {
-            return;
+        if(const auto color = Evaluate(*anim, now - anim->start, this->baseColors[i])) {
+            txn.changes[i] = *color;
+        } else {
+            if(anim->animation.type == Animation::Type::Fade) {
+                this->baseColors[i] = anim->animation.colors.back();
+            }
+
+            txn.changes[i] = this->baseColors[i];
+            anim.reset();
         }
     }
 
-    const auto [cR, cG, cB] = color;
-    PLOG_WARNING << fmt::format("failed to set indicator {}=({}, {}, {}): no driver",
-            static_cast<size_t>(which), cR, cG, cB);
+    if(!txn.empty()) {
+        this->applyToDrivers(txn);
+    }
+
+    this->updateFrameTimer();
+}
+
+/**
+ * @brief Arm or disarm the frame timer
+ *
+ * The timer runs only while at least one animation is rendered in software.
+ */
+void LedManager::updateFrameTimer() {
+    const bool needed = std::any_of(this->animations.begin(), this->animations.end(),
+            [](const auto &anim) { return anim && !anim->isHardware; });
+    const bool pending = event_pending(this->frameTimer, EV_TIMEOUT, nullptr);
+
+    if(needed && !pending) {
+        struct timeval tv{
+            .tv_sec  = 0,
+            .tv_usec = static_cast<suseconds_t>(kFrameInterval),
+        };
+        event_add(this->frameTimer, &tv);
+    } else if(!needed && pending) {
+        event_del(this->frameTimer);
+    }
+}
+
+/**
+ * @brief Evaluate an animation at a point in time
+ *
+ * @param anim Animation to evaluate
+ * @param t Time since the animation started (seconds)
+ * @param base State of the indicator before the animation started
+ *
+ * @return Color of the indicator, or no value if the animation has finished
+ */
+std::optional<LedManager::Color> LedManager::Evaluate(const ActiveAnimation &anim,
+        const double t, const Color &base) {
+    const auto &info = anim.animation;
+    const auto &colors = info.colors;
+
+    // linear interpolation between two colors
+    auto lerp = [](const Color &from, const Color &to, const double f) -> Color {
+        const auto [fR, fG, fB] = from;
+        const auto [tR, tG, tB] = to;
+        return {fR + (tR - fR) * f, fG + (tG - fG) * f, fB + (tB - fB) * f};
+    };
+
+    const auto cycle = t / info.period;
+    const auto phase = cycle - std::floor(cycle);
+    const auto &alternate = (colors.size() > 1) ? colors[1] : Color{};
+
+    switch(info.type) {
+        case Animation::Type::Blink:
+            if(info.repeat && cycle >= info.repeat) {
+                return std::nullopt;
+            }
+            return (phase < info.duty) ? colors[0] : alternate;
+
+        case Animation::Type::Fade:
+            if(cycle >= 1.) {
+                return std::nullopt;
+            }
+            return lerp((colors.size() > 1) ? colors[0] : base, colors.back(), cycle);
+
+        case Animation::Type::Breathe:
+            if(info.repeat && cycle >= info.repeat) {
+                return std::nullopt;
+            }
+            return lerp(alternate, colors[0],
+                    (1. - std::cos(2. * std::numbers::pi * phase)) / 2.);
+
+        case Animation::Type::Sequence: {
+            const auto step = static_cast<size_t>(cycle);
+            if(info.repeat && step >= info.repeat * colors.size()) {
+                return std::nullopt;
+            }
+            return colors[step % colors.size()];
+        }
+
+        case Animation::Type::Flash:
+            if(cycle >= 1.) {
+                return std::nullopt;
+            }
+            return colors[0];
+    }
+
+    return std::nullopt;
+}
+
+/**
+ * @brief Get the current time for animations
+ *
+ * @return Monotonic timestamp, in seconds
+ */
+double LedManager::Now() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return static_cast<double>(ts.tv_sec) + (static_cast<double>(ts.tv_nsec) / 1e9);
 }
@@ -1,12 +1,16 @@
 #ifndef LEDMANAGER_H
 #define LEDMANAGER_H
 
+#include <array>
 #include <cstddef>
 #include <cstdint>
 #include <tuple>
 #include <memory>
+#include <optional>
 #include <vector>
 
+struct event;
+
 /**
  * @brief Interface to front panel LED indicators
  *
@@ -47,6 +51,8 @@ class LedManager {
             /// Menu button
             BtnMenu                     = 11,
         };
+        /// Largest indicator enum value
+        constexpr static const size_t kMaxIndicatorValue{11};
 
         /**
          * @brief Validate an indicator value
@@ -73,6 +79,85 @@ class LedManager {
             }
         }
 
+        /**
+         * @brief A set of indicator changes to apply at once
+         *
+         * Changes are collected into a transaction, which is then handed to each LED driver in
+         * turn. Drivers apply all changes for indicators they handle together (so all of them
+         * become visible at the same time) and remove them from the transaction.
+         *
+         * Brightness changes are stored as a color whose components are all equal. If the same
+         * indicator is changed more than once, only the last change is applied.
+         */
+        struct Transaction {
+            /// Pending changes, indexed by indicator value
+            std::array<std::optional<Color>, kMaxIndicatorValue + 1> changes;
+
+            /**
+             * @brief Set the brightness of an indicator
+             */
+            inline void setBrightness(const Indicator which, const double brightness) {
+                this->changes[static_cast<size_t>(which)] = Color{brightness, brightness,
+                    brightness};
+            }
+
+            /**
+             * @brief Set the color of an indicator
+             */
+            inline void setColor(const Indicator which, const Color &color) {
+                this->changes[static_cast<size_t>(which)] = color;
+            }
+
+            /**
+             * @brief Determine whether there are any changes left to apply
+             */
+            inline bool empty() const {
+                for(const auto &change : this->changes) {
+                    if(change) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+        };
+
+        /**
+         * @brief Indicator animation
+         *
+         * Describes an effect that the LED manager plays back on an indicator by itself, so that
+         * clients only send a single message per effect, rather than one for every frame.
+         *
+         * When an animation ends, the indicator returns to the state it was last set to (except
+         * for fades, whose final color becomes the indicator's new state.)
+         */
+        struct Animation {
+            /// Types of animation
+            enum class Type: uint8_t {
+                /// Alternate between the first color, and the second color (or off)
+                Blink,
+                /// Fade from the first color to the last, once; with one color, from the
+                /// indicator's current state to that color
+                Fade,
+                /// Smoothly ramp between the first color, and the second color (or off)
+                Breathe,
+                /// Show each of the colors in turn
+                Sequence,
+                /// Show the first color once
+                Flash,
+            };
+
+            /// Type of animation
+            Type type{Type::Blink};
+            /// Colors used by the animation (at least one is required)
+            std::vector<Color> colors;
+            /// Blink/breathe period, fade/flash duration, or time per sequence step (seconds)
+            double period{1.};
+            /// Fraction of the blink period for which the indicator shows the first color
+            double duty{.5};
+            /// Number of blink/breathe cycles or sequence loops; 0 repeats until cancelled
+            size_t repeat{0};
+        };
+
         /**
          * @brief Abstract base class for LED drivers
          *
@@ -103,6 +188,23 @@ class LedManager {
                  */
                 virtual bool setIndicatorColor(const Indicator which, const Color &color) = 0;
 
+                /**
+                 * @brief Apply the changes in a transaction
+                 *
+                 * Apply all changes for indicators handled by this driver, and remove them from
+                 * the transaction. Drivers should override this to write all changes to the
+                 * hardware at once; the default implementation sets each indicator's color in
+                 * turn.
+                 */
+                virtual void applyIndicatorTransaction(Transaction &txn) {
+                    for(size_t i = 0; i < txn.changes.size(); i++) {
+                        auto &change = txn.changes[i];
+                        if(change && this->setIndicatorColor(static_cast<Indicator>(i), *change)) {
+                            change.reset();
+                        }
+                    }
+                }
+
                 /**
                  * @brief Get whether the driver supports global brightness control
                  *
@@ -123,16 +225,88 @@ class LedManager {
                 virtual void setIndicatorGlobalBrightness(const double brightness) {
                     // default implementation: do nothing
                 }
+
+                /**
+                 * @brief Blink an indicator in hardware
+                 *
+                 * Drivers for controllers that can blink outputs by themselves may implement
+                 * this, so that a blinking indicator doesn't need any bus traffic after it's
+                 * started. The indicator alternates between the given color and off.
+                 *
+                 * @param period Blink period, in seconds
+                 * @param duty Fraction of the period for which the indicator is on
+                 *
+                 * @return Whether the indicator is now blinking; if not, the LED manager will
+                 *         animate it in software instead.
+                 */
+                virtual bool startIndicatorBlink(const Indicator which, const Color &color,
+                        const double period, const double duty) {
+                    return false;
+                }
+
+                /**
+                 * @brief Stop a hardware blink started previously
+                 *
+                 * The indicator's color is left as is; the LED manager updates it afterwards.
+                 */
+                virtual void stopIndicatorBlink(const Indicator which) {
+                    // default implementation: do nothing
+                }
         };
 
+        LedManager();
+        ~LedManager();
+
         void registerDriver(const std::shared_ptr<DriverInterface> &driver);
 
         void setBrightness(const Indicator which, const double brightness);
         void setColor(const Indicator which, const Color &color);
+        void apply(Transaction &txn);
+
+        void setAnimation(const Indicator which, const Animation &animation);
+        void clearAnimation(const Indicator which);
+
+    private:
+        /**
+         * @brief State of an animation that's being played back
+         */
+        struct ActiveAnimation {
+            /// Animation description
+            Animation animation;
+            /// Time at which the animation was started (seconds, monotonic)
+            double start{0};
+            /// Whether a driver is performing the animation in hardware
+            bool isHardware{false};
+            /// Driver performing the animation in hardware
+            std::weak_ptr<DriverInterface> driver;
+        };
+
+        void applyToDrivers(Transaction &txn);
+
+        void stopAnimation(const Indicator which);
+        void renderFrame();
+        void updateFrameTimer();
+
+        static std::optional<Color> Evaluate(const ActiveAnimation &anim, const double t,
+                const Color &base);
+        static double Now();
 
     public:
         /// LED controller drivers
         std::vector<std::weak_ptr<DriverInterface>> drivers;
+
+    private:
+        /// Output debug logs about animations starting and stopping
+        constexpr static const bool kLogAnimations{false};
+        /// Interval between software animation frames (µs)
+        constexpr static const size_t kFrameInterval{20'000};
+
+        /// Last state each indicator was explicitly set to (restored when an animation ends)
+        std::array<Color, kMaxIndicatorValue + 1> baseColors{};
+        /// Animations currently playing, by indicator
+        std::array<std::optional<ActiveAnimation>, kMaxIndicatorValue + 1> animations;
+        /// Timer to render animation frames; only pending while software animations are playing
+        struct event *frameTimer{nullptr};
 };
 
 #endif
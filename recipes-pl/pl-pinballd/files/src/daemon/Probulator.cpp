@@ -1,9 +1,3 @@
-#include <fcntl.h>
-#include <unistd.h>
-#include <linux/i2c.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
-
 #include <algorithm>
 #include <array>
 #include <cerrno>
@@ -22,6 +16,7 @@
 #include "Utils/Base32.h"
 #include "Utils/Cbor.h"
 
+#include "I2cBus.h"
 #include "LedManager.h"
 #include "Probulator.h"
 #include "drivers/DriverList.h"
@@ -34,11 +29,7 @@
  */
 Probulator::Probulator(const std::filesystem::path &i2cPath) {
     // open the bus
-    this->busFd = open(i2cPath.native().c_str(), O_RDWR);
-    if(this->busFd == -1) {
-        throw std::system_error(errno, std::generic_category(), 
-                fmt::format("failed to open i2c bus ('{}')", i2cPath.native()));
-    }
+    this->bus = std::make_shared<I2cBus>(i2cPath);
 
     // figure out where the EEPROM is chilling
     for(size_t i = 0; i < 8; i++) {
@@ -89,7 +80,7 @@ Probulator::~Probulator() {
     this->drivers.clear();
 
     // close hardware resources
-    close(this->busFd);
+    this->bus.reset();
 }
 
 /**
@@ -378,29 +369,11 @@ void Probulator::registerDriver(const std::shared_ptr<DriverBase> &driver) {
  */
 void Probulator::readIdprom(const uint8_t deviceAddress, const uint16_t startAddress,
         std::span<std::byte> outBuffer) {
-    std::array<struct i2c_msg, 2> msgs;
-    for(auto &msg : msgs) {
-        memset(&msg, 0, sizeof(msg));
-        msg.addr = deviceAddress;
-    }
-
     std::array<uint8_t, 2> readAddr{{static_cast<uint8_t>(startAddress >> 8),
         static_cast<uint8_t>(startAddress & 0xff)}};
-    msgs[0].len = readAddr.size();
-    msgs[0].buf = readAddr.data();
-
-    msgs[1].flags = I2C_M_RD;
-    msgs[1].len = outBuffer.size();
-    msgs[1].buf = reinterpret_cast<uint8_t *>(outBuffer.data());
-
-    struct i2c_rdwr_ioctl_data txns;
-    txns.msgs = msgs.data();
-    txns.nmsgs = msgs.size();
 
-    int err = ioctl(this->busFd, I2C_RDWR, &txns);
-    if(err < 0) {
-        throw std::system_error(errno, std::generic_category(), "read IDPROM");
-    }
+    this->bus->writeRead(I2cBus::Priority::Housekeeping, deviceAddress, readAddr,
+            {reinterpret_cast<uint8_t *>(outBuffer.data()), outBuffer.size()});
 }
 
 /**
@@ -445,8 +418,6 @@ void Probulator::writeIdprom(const uint8_t deviceAddress, const uint16_t base,
  */
 void Probulator::writeIdpromPage(const uint8_t deviceAddress, const uint16_t base,
         std::span<const std::byte> data) {
-    int err;
-
     using namespace std::chrono_literals;
     PLOG_VERBOSE << "IDPROM write: " << fmt::format("{} bytes to ${:04x}", data.size(), base);
 
@@ -469,15 +440,8 @@ void Probulator::writeIdpromPage(const uint8_t deviceAddress, const uint16_t bas
     memcpy(msg.data() + 2, data.data(), data.size());
     DumpPacket("write txn", msg);
 
-    err = ioctl(this->busFd, I2C_SLAVE, deviceAddress);
-    if(err < 0) {
-        throw std::system_error(errno, std::generic_category(), "write IDPROM payload");
-    }
-
-    err = write(this->busFd, msg.data(), msg.size());
-    if(err < 0) {
-        throw std::system_error(errno, std::generic_category(), "write IDPROM payload");
-    }
+    this->bus->write(I2cBus::Priority::Housekeeping, deviceAddress,
+            {reinterpret_cast<const uint8_t *>(msg.data()), msg.size()});
 
     // wait for write to complete
     std::this_thread::sleep_for(10ms);
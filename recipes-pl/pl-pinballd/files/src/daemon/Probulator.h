@@ -13,6 +13,7 @@
 #include <arpa/inet.h>
 
 class DriverBase;
+class I2cBus;
 class LedManager;
 
 /**
@@ -137,10 +138,10 @@ class Probulator {
         void registerDriver(const std::shared_ptr<DriverBase> &driver);
 
         /**
-         * @brief Get the file descriptor for I²C access
+         * @brief Get the I²C bus the front panel devices are on
          */
-        constexpr inline auto getBusFd() const {
-            return this->busFd;
+        constexpr inline auto &getBus() const {
+            return this->bus;
         }
 
         /**
@@ -165,8 +166,8 @@ class Probulator {
         // IDPROM page write size
         constexpr static const size_t kPageSize{32};
 
-        /// file descriptor to the I2C bus the device is on
-        int busFd{-1};
+        /// I2C bus the device is on
+        std::shared_ptr<I2cBus> bus;
 
         /// Header read from the IDPROM
         IdpromHeader idpromHeader;
@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <array>
 #include <cstring>
+#include <optional>
 #include <string_view>
 #include <system_error>
-#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <cbor.h>
 #include <event2/event.h>
@@ -12,6 +15,8 @@
 #include <plog/Log.h>
 
 #include "Utils/Cbor.h"
+#include "Utils/PerfectHash.h"
+#include "I2cBus.h"
 #include "LedManager.h"
 #include "EventLoop.h"
 #include "RpcTypes.h"
@@ -19,6 +24,89 @@
 #include "Client.h"
 
 using namespace Rpc;
+namespace Mmsg = PlCommon::Util::Mmsg;
+
+namespace {
+using Indicator = LedManager::Indicator;
+
+/// Mapping from key names to their associated indicator IDs
+constexpr static const Util::PerfectHashMap<Indicator, 11> kIndicators{{{
+    {"status",      Indicator::Status},
+    {"trigger",     Indicator::Trigger},
+    {"overheat",    Indicator::Overheat},
+    {"overcurrent", Indicator::Overcurrent},
+    {"error",       Indicator::Error},
+    {"modeCc",      Indicator::BtnModeCc},
+    {"modeCv",      Indicator::BtnModeCv},
+    {"modeCw",      Indicator::BtnModeCw},
+    {"modeExt",     Indicator::BtnModeExt},
+    {"loadOn",      Indicator::BtnLoadOn},
+    {"menu",        Indicator::BtnMenu},
+}}};
+
+/**
+ * @brief Look up the indicator named by a map key
+ *
+ * @return Indicator, or `nullptr` if the key isn't a string naming a known indicator
+ */
+const Indicator *FindIndicator(const struct cbor_item_t *key) {
+    if(!cbor_isa_string(key) || !cbor_string_is_definite(key)) {
+        return nullptr;
+    }
+
+    return kIndicators.find({reinterpret_cast<const char *>(cbor_string_handle(key)),
+            cbor_string_length(key)});
+}
+
+/**
+ * @brief Decode an indicator state
+ *
+ * This is either a boolean (fully on/off,) a floating point value (brightness of all color
+ * components) or an array of up to three floating point values (color components.)
+ *
+ * @return Decoded color, or no value if the item isn't of a supported type
+ */
+std::optional<LedManager::Color> ReadColor(const struct cbor_item_t *value) {
+    if(cbor_isa_float_ctrl(value)) {
+        double brightness{0.};
+
+        if(cbor_float_get_width(value) == CBOR_FLOAT_0 && cbor_is_bool(value)) {
+            brightness = cbor_get_bool(value) ? 1. : 0.;
+        }
+        else if(cbor_is_float(value)) {
+            brightness = std::clamp(cbor_float_get_float(value), 0., 1.);
+        } else {
+            throw std::runtime_error("unsupported float-type value");
+        }
+
+        return LedManager::Color{brightness, brightness, brightness};
+    } else if(cbor_isa_array(value)) {
+        const auto numEntries = cbor_array_size(value);
+        if(!numEntries || numEntries > 3) {
+            throw std::runtime_error(fmt::format("invalid color ({} entries)", numEntries));
+        }
+
+        // cbor_array_get() returns a new reference to each entry
+        std::array<double, 3> components{};
+        for(size_t i = 0; i < numEntries; i++) {
+            auto entry = cbor_array_get(value, i);
+            const bool valid = cbor_isa_float_ctrl(entry) && cbor_is_float(entry);
+            if(valid) {
+                components[i] = cbor_float_get_float(entry);
+            }
+            cbor_decref(&entry);
+
+            if(!valid) {
+                throw std::runtime_error(fmt::format("invalid color component {}", i));
+            }
+        }
+
+        return LedManager::Color{components[0], components[1], components[2]};
+    }
+
+    return std::nullopt;
+}
+}
 
 /**
  * @brief Create a new client data structure
@@ -57,6 +145,12 @@ Client::Client(const std::shared_ptr<Server> &server, const int fd) : socket(fd)
         }
     }, this);
 
+    // with batched IO, we do the reading and writing; the bufferevent only holds the output
+    if(server->batchedIo) {
+        this->initBatchedIo();
+        return;
+    }
+
     // enable event for "client data available to read" events
     int err = bufferevent_enable(this->event, EV_READ);
     if(err == -1) {
@@ -64,12 +158,69 @@ Client::Client(const std::shared_ptr<Server> &server, const int fd) : socket(fd)
     }
 }
 
+/**
+ * @brief Set up batched IO for the client
+ *
+ * Disable the bufferevent's own socket IO, and instead install events to read from and write to
+ * the socket. Any data added to the output buffer schedules a flush at the end of the current
+ * event loop iteration.
+ */
+void Client::initBatchedIo() {
+    auto evbase = EventLoop::Current()->getEvBase();
+
+    // the bufferevent freezes its output buffer while it's not writing; we need to drain it
+    bufferevent_disable(this->event, EV_READ | EV_WRITE);
+    evbuffer_unfreeze(bufferevent_get_output(this->event), 1);
+
+    this->batchReadEvent = event_new(evbase, this->socket, EV_READ | EV_PERSIST,
+            [](auto, auto, auto ctx) {
+        try {
+            reinterpret_cast<Client *>(ctx)->batchRead();
+        } catch(const std::exception &e) {
+            PLOG_ERROR << "Failed to handle client read: " << e.what();
+            throw;
+        }
+    }, this);
+    this->batchWriteEvent = event_new(evbase, this->socket, EV_WRITE, [](auto, auto, auto ctx) {
+        reinterpret_cast<Client *>(ctx)->flushBatched();
+    }, this);
+
+    if(!this->batchReadEvent || !this->batchWriteEvent) {
+        throw std::runtime_error("failed to allocate batched io events");
+    }
+
+    evbuffer_add_cb(bufferevent_get_output(this->event), [](auto, auto info, auto ctx) {
+        if(!info->n_added) {
+            return;
+        }
+
+        auto client = reinterpret_cast<Client *>(ctx);
+        if(auto server = client->server.lock()) {
+            server->scheduleBatchFlush(client->getId());
+        }
+    }, this);
+
+    event_add(this->batchReadEvent, nullptr);
+}
+
 /**
  * @brief Ensure all client resources are released.
  *
  * This closes the client socket, as well as releasing the libevent resources.
  */
 Client::~Client() {
+    if(this->batchReadEvent) {
+        PLOG_DEBUG << "Client " << this->socket << " sent " << this->batchTxStats.messages
+            << " messages in " << this->batchTxStats.syscalls << " syscalls, received "
+            << this->batchRxStats.messages << " messages in " << this->batchRxStats.syscalls
+            << " syscalls";
+
+        event_free(this->batchReadEvent);
+    }
+    if(this->batchWriteEvent) {
+        event_free(this->batchWriteEvent);
+    }
+
     if(this->event) {
         bufferevent_free(this->event);
     }
@@ -102,13 +253,48 @@ void Client::bevRead(struct bufferevent *ev) {
         throw std::runtime_error("failed to drain client read buffer");
     }
 
+    this->receiveBuf.resize(read);
+    this->handleMessage(this->receiveBuf);
+}
+
+/**
+ * @brief A client connection is ready to read (batched IO)
+ *
+ * Read up to a batch worth of datagrams from the client's socket with a single syscall, and
+ * process each of them.
+ */
+void Client::batchRead() {
+    auto server = this->server.lock();
+    if(!server) {
+        return;
+    }
+
+    const auto result = Mmsg::Receive(this->socket, server->batchRxBuf, this->batchRxStats,
+            [&](auto datagram) {
+        this->handleMessage(datagram);
+    });
+
+    if(result == Mmsg::RecvResult::Closed) {
+        this->bevEvent(this->event, BEV_EVENT_EOF);
+    }
+}
+
+/**
+ * @brief Process a message received from the client
+ *
+ * Validate the message header, decode its payload and invoke the appropriate handler.
+ *
+ * @param message Received message, including its header
+ */
+void Client::handleMessage(std::span<const std::byte> message) {
     // read the header
-    if(read < sizeof(struct rpc_header)) {
+    if(message.size() < sizeof(struct rpc_header)) {
         // we haven't yet read enough bytes; this should never happen, so abort
-        throw std::runtime_error(fmt::format("read too few bytes ({}) from client", read));
+        throw std::runtime_error(fmt::format("read too few bytes ({}) from client",
+                    message.size()));
     }
 
-    const auto hdr = reinterpret_cast<const struct rpc_header *>(this->receiveBuf.data());
+    const auto hdr = reinterpret_cast<const struct rpc_header *>(message.data());
 
     if(hdr->version != kRpcVersionLatest) {
         throw std::runtime_error(fmt::format("unsupported rpc version ${:04x}", hdr->version));
@@ -118,7 +304,7 @@ void Client::bevRead(struct bufferevent *ev) {
     }
 
     const auto payloadLen = hdr->length - sizeof(struct rpc_header);
-    if(payloadLen > this->receiveBuf.size()) {
+    if(payloadLen > message.size()) {
         throw std::runtime_error(fmt::format("invalid header length ({}, too long)",
                     hdr->length));
     }
@@ -221,6 +407,52 @@ void Client::send(std::span<const std::byte> buf) {
 
 
 
+/**
+ * @brief Transmit the given shared packet
+ *
+ * Rather than copying the packet into the output buffer, add a reference to the shared packet's
+ * storage; we hold a reference to the packet until libevent is done with it.
+ */
+void Client::send(const SharedPacket &packet) {
+    int err;
+    auto ref = new SharedPacket(packet);
+
+    err = evbuffer_add_reference(bufferevent_get_output(this->event), packet->data(),
+            packet->size(), [](auto, auto, auto ctx) {
+        delete reinterpret_cast<SharedPacket *>(ctx);
+    }, ref);
+
+    if(err == -1) {
+        delete ref;
+        throw std::runtime_error("failed to add reference to rpc broadcast");
+    }
+}
+
+
+
+/**
+ * @brief Send all queued messages (batched IO)
+ *
+ * The output buffer is sent with as few `sendmmsg` calls as possible. If the socket would block,
+ * wait for it to become writable before continuing.
+ */
+void Client::flushBatched() {
+    try {
+        if(!Mmsg::SendBuffer<struct rpc_header>(this->socket,
+                    bufferevent_get_output(this->event), this->batchTxStats)) {
+            event_add(this->batchWriteEvent, nullptr);
+        }
+    } catch(const std::exception &e) {
+        PLOG_WARNING << "Client " << this->socket << " send failed: " << e.what();
+
+        if(auto server = this->server.lock()) {
+            server->releaseClient(this->getId());
+        }
+    }
+}
+
+
+
 /**
  * @brief Invoke the handler for a received packet
  *
@@ -241,6 +473,14 @@ void Client::dispatchPacket(const struct rpc_header &hdr, const struct cbor_item
         case kRpcEndpointIndicator:
             this->updateIndicators(payload);
             break;
+        // start or stop indicator animations
+        case kRpcEndpointIndicatorAnimation:
+            this->updateIndicatorAnimations(payload);
+            break;
+        // get bus statistics
+        case kRpcEndpointBusStats:
+            this->sendBusStats(hdr);
+            break;
         // ignore nops
         case kRpcEndpointNoOp:
             break;
@@ -261,6 +501,9 @@ void Client::dispatchPacket(const struct rpc_header &hdr, const struct cbor_item
  * - button: Physical button presses (up/down events)
  * - encoder: Encoder rotation events (deltas)
  *
+ * The server's per type subscriber lists are updated to match, so broadcasts are only ever
+ * delivered to clients that asked for them.
+ *
  * @remark If a key is absent from the payload, its current value is _not_ changed.
  */
 void Client::updateBroadcastConfig(const struct cbor_item_t *item) {
@@ -280,6 +523,14 @@ void Client::updateBroadcastConfig(const struct cbor_item_t *item) {
         }
     }
 
+    // update the server's subscriber lists
+    if(auto server = this->server.lock()) {
+        for(size_t i = 0; i < kNumBroadcastTypes; i++) {
+            const auto type = static_cast<BroadcastType>(i);
+            server->setSubscribed(type, this->getId(), this->wantsBroadcastOfType(type));
+        }
+    }
+
     PLOG_VERBOSE << "client " << this->socket << " enabled broadcasts: " <<
         (this->wantsTouchEvents ? "touch " : "") << (this->wantsButtonEvents ? "button " : "")
         << (this->wantsEncoderEvents ? "encoder " : "");
@@ -292,71 +543,191 @@ void Client::updateBroadcastConfig(const struct cbor_item_t *item) {
  * indicators. Each key's value can be either a boolean (to set the indicator fully on/off,) a
  * floating point value (to set the brightness) or an array (to set the color of a multicolor
  * indicator.)
+ *
+ * All changes in the message are collected into a single transaction, which is only applied once
+ * the entire payload was decoded successfully; so all indicators update at the same time.
  */
 void Client::updateIndicators(const struct cbor_item_t *item) {
-    using Indicator = LedManager::Indicator;
+    if(!cbor_isa_map(item)) {
+        throw std::runtime_error("invalid indicator payload (expected map)");
+    }
+
+    LedManager::Transaction txn;
+
+    auto pairs = cbor_map_handle(item);
+    for(size_t i = 0; i < cbor_map_size(item); i++) {
+        const auto &pair = pairs[i];
 
+        // look up the indicator (ignoring keys we don't know)
+        const auto indicator = FindIndicator(pair.key);
+        if(!indicator) {
+            continue;
+        }
+
+        // record the change
+        const auto color = ReadColor(pair.value);
+        if(!color) {
+            const std::string_view key{reinterpret_cast<const char *>(cbor_string_handle(pair.key)),
+                cbor_string_length(pair.key)};
+            throw std::runtime_error(fmt::format("invalid value for key '{}'", key));
+        }
+
+        txn.setColor(*indicator, *color);
+    }
+
+    // then apply all changes at once
     auto led = this->server.lock()->ledManager.lock();
+    led->apply(txn);
+}
+
+/**
+ * @brief Start or stop indicator animations
+ *
+ * The payload is a CBOR map keyed by indicator name (as for updateIndicators.) A value of `null`
+ * or `false` stops the indicator's animation, returning it to its last set state; otherwise, the
+ * value is a map describing the animation to play, with the following keys:
+ *
+ * - type: One of "blink", "fade", "breathe", "sequence" or "flash" (required)
+ * - colors: Array of indicator states (bool, float or color array) used by the animation
+ *   (required)
+ * - period: Blink/breathe period, fade/flash duration, or time per sequence step, in seconds
+ * - duty: Fraction of the blink period for which the first color is shown
+ * - repeat: Number of cycles to play (blink, breathe, sequence); 0 repeats until stopped
+ *
+ * The entire payload is decoded before any animations are changed.
+ *
+ * @seeAlso LedManager::Animation
+ */
+void Client::updateIndicatorAnimations(const struct cbor_item_t *item) {
+    using Type = LedManager::Animation::Type;
+
+    // Mapping from animation type names to types
+    constexpr static const Util::PerfectHashMap<Type, 5> kTypes{{{
+        {"blink",       Type::Blink},
+        {"fade",        Type::Fade},
+        {"breathe",     Type::Breathe},
+        {"sequence",    Type::Sequence},
+        {"flash",       Type::Flash},
+    }}};
+
+    if(!cbor_isa_map(item)) {
+        throw std::runtime_error("invalid animation payload (expected map)");
+    }
 
-    // Mapping from key names to their associated indicator IDs
-    static const std::unordered_map<std::string_view, Indicator> kIndicators{{
-        {"status",      Indicator::Status},
-        {"trigger",     Indicator::Trigger},
-        {"overheat",    Indicator::Overheat},
-        {"overcurrent", Indicator::Overcurrent},
-        {"error",       Indicator::Error},
-        {"modeCc",      Indicator::BtnModeCc},
-        {"modeCv",      Indicator::BtnModeCv},
-        {"modeCw",      Indicator::BtnModeCw},
-        {"modeExt",     Indicator::BtnModeExt},
-        {"loadOn",      Indicator::BtnLoadOn},
-        {"menu",        Indicator::BtnMenu},
-    }};
-
-    for(const auto &[key, indicator] : kIndicators) {
-        // retrieve the associated key
-        auto value = Util::CborMapGet(item, key);
-        if(!value) {
+    std::vector<std::pair<Indicator, std::optional<LedManager::Animation>>> changes;
+
+    auto pairs = cbor_map_handle(item);
+    for(size_t i = 0; i < cbor_map_size(item); i++) {
+        const auto &pair = pairs[i];
+
+        const auto indicator = FindIndicator(pair.key);
+        if(!indicator) {
             continue;
         }
 
-        // apply it appropriately
-        if(cbor_isa_float_ctrl(value)) {
-            double brightness{0.};
+        // null or false: stop animation
+        const auto value = pair.value;
+        if(cbor_isa_float_ctrl(value) && (cbor_is_null(value) ||
+                    (cbor_is_bool(value) && !cbor_get_bool(value)))) {
+            changes.emplace_back(*indicator, std::nullopt);
+            continue;
+        } else if(!cbor_isa_map(value)) {
+            throw std::runtime_error("invalid animation (expected map, null or false)");
+        }
 
-            if(cbor_float_get_width(value) == CBOR_FLOAT_0 && cbor_is_bool(value)) {
-                brightness = cbor_get_bool(value) ? 1. : 0.;
-            }
-            else if(cbor_is_float(value)) {
-                brightness = std::clamp(cbor_float_get_float(value), 0., 1.);
-            } else {
-                throw std::runtime_error("unsupported float-type value");
+        LedManager::Animation anim;
+
+        // type
+        const auto typeItem = Util::CborMapGet(value, "type");
+        if(!typeItem || !cbor_isa_string(typeItem) || !cbor_string_is_definite(typeItem)) {
+            throw std::runtime_error("missing or invalid animation type");
+        }
+
+        const std::string_view typeName{
+            reinterpret_cast<const char *>(cbor_string_handle(typeItem)),
+            cbor_string_length(typeItem)};
+        if(auto type = kTypes.find(typeName)) {
+            anim.type = *type;
+        } else {
+            throw std::runtime_error(fmt::format("unknown animation type '{}'", typeName));
+        }
+
+        // colors
+        const auto colors = Util::CborMapGet(value, "colors");
+        if(!colors || !cbor_isa_array(colors) || !cbor_array_size(colors)) {
+            throw std::runtime_error("missing or invalid animation colors");
+        }
+
+        for(size_t j = 0; j < cbor_array_size(colors); j++) {
+            auto entry = cbor_array_get(colors, j);
+            std::optional<LedManager::Color> color;
+            try {
+                color = ReadColor(entry);
+            } catch(const std::exception &) {
+                cbor_decref(&entry);
+                throw;
             }
+            cbor_decref(&entry);
 
-            led->setBrightness(indicator, brightness);
-        } else if(cbor_isa_array(value)) {
-            LedManager::Color color{};
-            const auto numEntries = cbor_array_size(value);
-
-            switch(numEntries) {
-                case 3:
-                    std::get<2>(color) = cbor_float_get_float(cbor_array_get(value, 2));
-                    [[fallthrough]];
-                case 2:
-                    std::get<1>(color) = cbor_float_get_float(cbor_array_get(value, 1));
-                    [[fallthrough]];
-                case 1:
-                    std::get<0>(color) = cbor_float_get_float(cbor_array_get(value, 0));
-                    break;
-
-                default:
-                    throw std::runtime_error(fmt::format("invalid color ({} entries)", numEntries));
+            if(!color) {
+                throw std::runtime_error("invalid animation color");
             }
+            anim.colors.emplace_back(*color);
+        }
 
-            led->setColor(indicator, color);
+        // timing
+        if(auto period = Util::CborMapGet(value, "period"); period &&
+                cbor_isa_float_ctrl(period) && cbor_is_float(period)) {
+            anim.period = cbor_float_get_float(period);
+        }
+        if(auto duty = Util::CborMapGet(value, "duty"); duty &&
+                cbor_isa_float_ctrl(duty) && cbor_is_float(duty)) {
+            anim.duty = cbor_float_get_float(duty);
+        }
+        if(auto repeat = Util::CborMapGet(value, "repeat")) {
+            anim.repeat = Util::CborReadUint(repeat);
+        }
+
+        changes.emplace_back(*indicator, std::move(anim));
+    }
+
+    // then apply them
+    auto led = this->server.lock()->ledManager.lock();
+
+    for(const auto &[indicator, anim] : changes) {
+        if(anim) {
+            led->setAnimation(indicator, *anim);
         } else {
-            throw std::runtime_error(fmt::format("invalid value for key '{}', "
-                        "expected bool, float, or array", key));
+            led->clearAnimation(indicator);
         }
     }
 }
+
+/**
+ * @brief Reply with the front panel I²C bus statistics
+ *
+ * @seeAlso I2cBus::serializeStats
+ */
+void Client::sendBusStats(const struct rpc_header &hdr) {
+    auto bus = this->server.lock()->bus.lock();
+    if(!bus) {
+        throw std::runtime_error("no i2c bus available");
+    }
+
+    // serialize the statistics
+    auto root = bus->serializeStats();
+
+    size_t rootBufLen;
+    unsigned char *rootBuf{nullptr};
+    const size_t serializedBytes = cbor_serialize_alloc(root, &rootBuf, &rootBufLen);
+    cbor_decref(&root);
+
+    // then send the reply
+    try {
+        this->replyTo(hdr, {reinterpret_cast<std::byte *>(rootBuf), serializedBytes});
+        free(rootBuf);
+    } catch(const std::exception &) {
+        free(rootBuf);
+        throw;
+    }
+}
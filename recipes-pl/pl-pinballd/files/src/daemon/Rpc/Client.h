@@ -3,9 +3,12 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <span>
 #include <vector>
 
+#include <load-common/Utils/Mmsg.h>
+
 #include "Types.h"
 
 struct cbor_item_t;
@@ -26,13 +29,16 @@ class Client {
 
         void replyTo(const struct rpc_header &, std::span<const std::byte>);
         void send(std::span<const std::byte>);
+        void send(const SharedPacket &);
+
+        void flushBatched();
 
         /**
          * @brief Determine if the client wants to receive broadcasts of the given type
          *
          * @param type Broadcast packet type
          */
-        constexpr inline bool wantsBroadcastOfType(const BroadcastType type) {
+        constexpr inline bool wantsBroadcastOfType(const BroadcastType type) const {
             switch(type) {
                 case BroadcastType::TouchEvent:
                     return this->wantsTouchEvents;
@@ -43,20 +49,6 @@ class Client {
             }
         }
 
-        /**
-         * @brief Broadcast a packet, if the client desires this type
-         *
-         * @param type Packet type
-         * @param packet Full packet (including RPC header) to send
-         */
-        inline void maybeBroadcast(const BroadcastType type, std::span<const std::byte> packet) {
-            if(!this->wantsBroadcastOfType(type)) {
-                return;
-            }
-
-            this->send(packet);
-        }
-
         /**
          * @brief Return the client's connection id
          *
@@ -67,12 +59,19 @@ class Client {
         }
 
     private:
+        void initBatchedIo();
+
         void bevRead(struct bufferevent *);
         void bevEvent(struct bufferevent *, const size_t);
+        void batchRead();
+
+        void handleMessage(std::span<const std::byte>);
 
         void dispatchPacket(const struct rpc_header &, const struct cbor_item_t *);
         void updateBroadcastConfig(const struct cbor_item_t *);
         void updateIndicators(const struct cbor_item_t *);
+        void updateIndicatorAnimations(const struct cbor_item_t *);
+        void sendBusStats(const struct rpc_header &);
 
     private:
         /// Log received packets
@@ -87,6 +86,15 @@ class Client {
         /// message transmit buffer
         std::vector<std::byte> transmitBuf;
 
+        /// Batched IO: socket readable event (replaces the bufferevent's reading)
+        struct event *batchReadEvent{nullptr};
+        /// Batched IO: socket writable event (to resume sending after it would block)
+        struct event *batchWriteEvent{nullptr};
+        /// Batched IO: transmit counters
+        PlCommon::Util::Mmsg::Stats batchTxStats;
+        /// Batched IO: receive counters
+        PlCommon::Util::Mmsg::Stats batchRxStats;
+
         /// Owning server instance
         std::weak_ptr<Server> server;
 
@@ -4,6 +4,7 @@
 #include <sys/un.h>
 #include <cbor.h>
 
+#include <algorithm>
 #include <cerrno>
 #include <cstring>
 #include <system_error>
@@ -13,6 +14,7 @@
 #include <event2/bufferevent.h>
 #include <fmt/format.h>
 #include <plog/Log.h>
+#include <load-common/Utils/Mmsg.h>
 
 #include "EventLoop.h"
 #include "Probulator.h"
@@ -21,6 +23,7 @@
 #include "Server.h"
 
 using namespace Rpc;
+namespace Mmsg = PlCommon::Util::Mmsg;
 
 /**
  * @brief Initialize the listening socket
@@ -100,6 +103,25 @@ void Server::initSocketEvent(EventLoop *ev) {
     event_add(this->listenEvent, nullptr);
 }
 
+/**
+ * @brief Set up batched client IO
+ *
+ * Allocate the receive buffer for recvmmsg, and the event used to flush all queued client
+ * messages at the end of an event loop iteration.
+ */
+void Server::initBatchedIo(EventLoop *ev) {
+    PLOG_INFO << "using batched rpc io";
+
+    this->batchRxBuf.resize(Mmsg::kBatchSize * Mmsg::kMaxMessageSize);
+
+    this->batchFlushEvent = event_new(ev->getEvBase(), -1, 0, [](auto, auto, auto ctx) {
+        reinterpret_cast<Server *>(ctx)->flushBatchedClients();
+    }, this);
+    if(!this->batchFlushEvent) {
+        throw std::runtime_error("failed to allocate batch flush event");
+    }
+}
+
 /**
  * @brief Shut down the RPC server
  *
@@ -123,6 +145,10 @@ Server::~Server() {
     // close all clients
     PLOG_DEBUG << "Closing client connections";
     this->clients.clear();
+
+    if(this->batchFlushEvent) {
+        event_free(this->batchFlushEvent);
+    }
 }
 
 
@@ -132,6 +158,7 @@ Server::~Server() {
  */
 void Server::setProbulator(const std::shared_ptr<Probulator> &probulator) {
     this->ledManager = probulator->getLedManager();
+    this->bus = probulator->getBus();
 }
 
 
@@ -168,53 +195,101 @@ void Server::acceptClient() {
  * All of its associated resources will be released as well.
  */
 void Server::releaseClient(const int clientId) {
+    for(auto &list : this->subscribers) {
+        std::erase_if(list, [clientId](const auto &client) {
+            return client->getId() == clientId;
+        });
+    }
+
     const auto removed = this->clients.erase(clientId);
     if(!removed) {
         throw std::invalid_argument(fmt::format("cannot remove nonexistent client {}", clientId));
     }
 }
 
+/**
+ * @brief Update a client's subscription to a broadcast type
+ *
+ * Adds the client to (or removes it from) the list of subscribers for the given broadcast type.
+ * Invoked by clients when their broadcast config changes.
+ *
+ * @param type Broadcast packet type
+ * @param clientId Client whose subscription changed
+ * @param subscribed Whether the client should receive broadcasts of this type
+ */
+void Server::setSubscribed(const BroadcastType type, const int clientId, const bool subscribed) {
+    auto &list = this->subscribers[static_cast<size_t>(type)];
+    auto it = std::find_if(list.begin(), list.end(), [clientId](const auto &client) {
+        return client->getId() == clientId;
+    });
+
+    if(subscribed && it == list.end()) {
+        const auto client = this->clients.find(clientId);
+        if(client == this->clients.end()) {
+            throw std::invalid_argument(fmt::format("cannot subscribe nonexistent client {}",
+                        clientId));
+        }
+
+        list.push_back(client->second);
+    } else if(!subscribed && it != list.end()) {
+        list.erase(it);
+    }
+}
 
+/**
+ * @brief Mark a client as having messages to send (batched IO)
+ *
+ * The client's output buffer will be flushed at the end of the current event loop iteration.
+ */
+void Server::scheduleBatchFlush(const int clientId) {
+    this->batchDirtyClients.insert(clientId);
+    event_active(this->batchFlushEvent, EV_TIMEOUT, 0);
+}
 
-#if 0
-    int err;
+/**
+ * @brief Send messages queued for all clients (batched IO)
+ */
+void Server::flushBatchedClients() {
+    auto dirty = std::move(this->batchDirtyClients);
+    this->batchDirtyClients.clear();
 
-    for(const auto &[bev, client] : this->clients) {
-        // skip if client doesn't want this broadcast
-        if(!client->wantsBroadcastOfType(type)) {
+    for(const auto id : dirty) {
+        auto it = this->clients.find(id);
+        if(it == this->clients.end()) {
             continue;
         }
 
-        err = bufferevent_write(bev, packet.data(), packet.size());
-
-        if(err != 0) {
-            PLOG_WARNING << "failed to broadcast packet to client " << client->socket << ": "
-                << err;
-        }
+        // hold a reference, since a failed flush releases the client
+        auto client = it->second;
+        client->flushBatched();
     }
-#endif
+}
+
+
 
 /**
  * @brief Broadcast a packet given a raw payload
  *
  * Format the packet by prepending a `struct rpc_header` to it, filling it out appropriately and
  * then copying the payload in before sending it to be broadcast.
+ *
+ * The packet is built exactly once; all clients that receive it share the same buffer.
  */
 void Server::broadcastRaw(const BroadcastType type, const uint8_t endpoint,
         std::span<const std::byte> payload) {
     // set up buffer and copy the payload in
-    std::vector<std::byte> buffer;
-    buffer.resize(sizeof(struct rpc_header) + payload.size());
-    std::fill(buffer.begin(), buffer.begin() + sizeof(struct rpc_header), std::byte{0});
+    auto buffer = std::make_shared<std::vector<std::byte>>();
+    buffer->resize(sizeof(struct rpc_header) + payload.size());
+    std::fill(buffer->begin(), buffer->begin() + sizeof(struct rpc_header), std::byte{0});
 
-    std::copy(payload.begin(), payload.end(), buffer.begin() + sizeof(struct rpc_header));
+    std::copy(payload.begin(), payload.end(), buffer->begin() + sizeof(struct rpc_header));
 
     // initialize the header
-    auto hdr = reinterpret_cast<struct rpc_header *>(buffer.data());
+    auto hdr = reinterpret_cast<struct rpc_header *>(buffer->data());
     hdr->version = kRpcVersionLatest;
     hdr->endpoint = endpoint;
-    hdr->length = buffer.size();
+    hdr->length = buffer->size();
 
     // send it
-    this->broadcastPacket(type, buffer);
+    this->broadcastPacket(type, std::move(buffer));
 }
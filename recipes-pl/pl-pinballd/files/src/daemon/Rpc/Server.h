@@ -1,16 +1,20 @@
 #ifndef RPC_SERVER_H
 #define RPC_SERVER_H
 
+#include <array>
 #include <cstddef>
 #include <filesystem>
 #include <memory>
 #include <span>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "Client.h"
 #include "Types.h"
 
 class EventLoop;
+class I2cBus;
 class Probulator;
 class LedManager;
 
@@ -30,31 +34,53 @@ class Server: public std::enable_shared_from_this<Server> {
          * @brief Initialize the RPC server
          *
          * Open the local RPC listening socket and the associated event loop.
+         *
+         * @param ev Event loop to run the server on
+         * @param socketPath Path to create the listening socket at
+         * @param batchedIo Move multiple messages per syscall (with sendmmsg/recvmmsg)
          */
-        Server(EventLoop *ev, const std::filesystem::path &socketPath) {
+        Server(EventLoop *ev, const std::filesystem::path &socketPath,
+                const bool batchedIo = false) : batchedIo(batchedIo) {
             this->initSocket(socketPath);
             this->initSocketEvent(ev);
+
+            if(batchedIo) {
+                this->initBatchedIo(ev);
+            }
         }
 
         ~Server();
 
         /**
-         * @brief Broadcast a packet to all connected clients
+         * @brief Broadcast a packet to all subscribed clients
          *
          * Send the specified packet (which should have an rpc_header prepended, followed
-         * immediately by the packet payload) to all connected clients.
+         * immediately by the packet payload) to all clients that subscribed to broadcasts of
+         * this type.
          *
          * @param type Type of broadcast packet
          * @param packet Packet data to broadcast
          */
-        inline void broadcastPacket(const BroadcastType type, std::span<const std::byte> packet) {
-            for(const auto &[id, client] : this->clients) {
-                client->maybeBroadcast(type, packet);
+        inline void broadcastPacket(const BroadcastType type, const SharedPacket &packet) {
+            for(const auto &client : this->subscribers[static_cast<size_t>(type)]) {
+                client->send(packet);
             }
         }
         void broadcastRaw(const BroadcastType type, const uint8_t endpoint,
                 std::span<const std::byte> payload);
 
+        /**
+         * @brief Determine whether any clients want broadcasts of the given type
+         *
+         * Producers should check this before serializing a broadcast, so that no work is done for
+         * events nobody is listening to.
+         *
+         * @param type Broadcast packet type
+         */
+        inline bool hasSubscribers(const BroadcastType type) const {
+            return !this->subscribers[static_cast<size_t>(type)].empty();
+        }
+
         void setProbulator(const std::shared_ptr<Probulator> &probulator);
 
     private:
@@ -63,9 +89,14 @@ class Server: public std::enable_shared_from_this<Server> {
     private:
         void initSocket(const std::filesystem::path &);
         void initSocketEvent(EventLoop *);
+        void initBatchedIo(EventLoop *);
 
         void acceptClient();
         void releaseClient(const int clientId);
+        void setSubscribed(const BroadcastType type, const int clientId, const bool subscribed);
+
+        void scheduleBatchFlush(const int clientId);
+        void flushBatchedClients();
 
     private:
         /// Maximum amount of clients that may be waiting to be accepted at once
@@ -80,9 +111,22 @@ class Server: public std::enable_shared_from_this<Server> {
 
         /// connected clients
         std::unordered_map<int, std::shared_ptr<Client>> clients;
+        /// clients subscribed to each type of broadcast (indexed by `BroadcastType`)
+        std::array<std::vector<std::shared_ptr<Client>>, kNumBroadcastTypes> subscribers;
+
+        /// Whether client IO is batched
+        bool batchedIo{false};
+        /// Batched IO: event to flush client output at the end of an event loop iteration
+        struct event *batchFlushEvent{nullptr};
+        /// Batched IO: clients with messages waiting to be flushed
+        std::unordered_set<int> batchDirtyClients;
+        /// Batched IO: receive buffer shared by all clients
+        std::vector<std::byte> batchRxBuf;
 
         /// LED manager (for controlling indicators)
         std::weak_ptr<LedManager> ledManager;
+        /// Front panel I²C bus (for statistics)
+        std::weak_ptr<I2cBus> bus;
 };
 }
 
@@ -1,13 +1,27 @@
 #ifndef RPC_TYPES_H
 #define RPC_TYPES_H
 
+#include <cstddef>
+#include <memory>
+#include <vector>
+
 namespace Rpc {
+/**
+ * @brief An immutable, serialized packet shared between multiple clients
+ *
+ * Broadcasts are serialized into one of these once, and then referenced by the output buffers
+ * of all clients that receive it.
+ */
+using SharedPacket = std::shared_ptr<const std::vector<std::byte>>;
+
 /// Types of broadcastable packets
 enum class BroadcastType {
     TouchEvent,
     ButtonEvent,
     EncoderEvent,
 };
+/// Total number of broadcast types
+constexpr static const size_t kNumBroadcastTypes{3};
 }
 
 #endif
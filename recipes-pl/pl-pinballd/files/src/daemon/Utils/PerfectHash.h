@@ -0,0 +1,114 @@
+#ifndef UTIL_PERFECTHASH_H
+#define UTIL_PERFECTHASH_H
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+namespace Util {
+/**
+ * @brief Compile time perfect hash map with string keys
+ *
+ * Maps a fixed set of string keys to values. At compile time, a seed is found for which the hash
+ * of every key lands in a distinct slot of the table, so a lookup is a single hash of the key,
+ * followed by one string comparison to reject keys not in the map.
+ *
+ * @tparam Value Type of the values
+ * @tparam N Number of keys
+ * @tparam TableSize Number of slots in the hash table; must be a power of two
+ */
+template<typename Value, size_t N, size_t TableSize = std::bit_ceil(N * 2)>
+class PerfectHashMap {
+    static_assert(N > 0 && N < 0xff, "invalid number of keys");
+    static_assert(std::has_single_bit(TableSize) && TableSize >= N, "invalid table size");
+
+    public:
+        using Entry = std::pair<std::string_view, Value>;
+
+        /**
+         * @brief Build the hash table
+         *
+         * @param entries Keys and their associated values; keys must be unique
+         *
+         * @remark This fails to compile if no seed can be found that hashes all keys into
+         *         distinct slots; increase the table size if that happens.
+         */
+        consteval PerfectHashMap(const std::array<Entry, N> &entries) : entries(entries) {
+            for(uint32_t seed = 0; seed < kMaxSeed; seed++) {
+                if(this->tryBuild(seed)) {
+                    this->seed = seed;
+                    return;
+                }
+            }
+
+            throw std::logic_error("failed to find perfect hash seed");
+        }
+
+        /**
+         * @brief Look up the value for a key
+         *
+         * @return Pointer to the value, or `nullptr` if the key isn't in the map
+         */
+        constexpr const Value *find(const std::string_view &key) const {
+            const auto idx = this->slots[Hash(key, this->seed) & (TableSize - 1)];
+            if(idx == kEmptySlot || this->entries[idx].first != key) {
+                return nullptr;
+            }
+
+            return &this->entries[idx].second;
+        }
+
+    private:
+        /**
+         * @brief Attempt to fill the table with the given seed
+         *
+         * @return Whether all keys hashed into distinct slots
+         */
+        constexpr bool tryBuild(const uint32_t seed) {
+            this->slots.fill(kEmptySlot);
+
+            for(size_t i = 0; i < N; i++) {
+                auto &slot = this->slots[Hash(this->entries[i].first, seed) & (TableSize - 1)];
+                if(slot != kEmptySlot) {
+                    return false;
+                }
+                slot = static_cast<uint8_t>(i);
+            }
+
+            return true;
+        }
+
+        /**
+         * @brief Hash a key (FNV-1a, with the seed mixed into the offset basis)
+         */
+        constexpr static uint32_t Hash(const std::string_view &key, const uint32_t seed) {
+            uint32_t hash{0x811c9dc5 ^ (seed * 0x9e3779b9)};
+
+            for(const auto c : key) {
+                hash ^= static_cast<uint8_t>(c);
+                hash *= 0x01000193;
+            }
+
+            return hash ^ (hash >> 16);
+        }
+
+    private:
+        /// Number of seeds to try before giving up
+        constexpr static const uint32_t kMaxSeed{0x10000};
+        /// Marker for a slot that doesn't have a key
+        constexpr static const uint8_t kEmptySlot{0xff};
+
+        /// All keys and values
+        std::array<Entry, N> entries;
+        /// Hash table: index into the entries array for each slot
+        std::array<uint8_t, TableSize> slots{};
+        /// Seed for which all keys hash into distinct slots
+        uint32_t seed{0};
+};
+}
+
+#endif
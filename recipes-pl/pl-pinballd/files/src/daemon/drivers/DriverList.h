@@ -61,7 +61,7 @@ static const std::array<DriverInfo, 3> gSupportedDrivers{{
         .id = drivers::touch::Ft6336::kDriverId,
         .name = "FocalTech FT6336 Touch Controller",
         .constructor = [](auto probulator, auto id, auto args) {
-            auto driver = std::make_shared<drivers::touch::Ft6336>(probulator->getBusFd(), args);
+            auto driver = std::make_shared<drivers::touch::Ft6336>(probulator->getBus(), args);
             probulator->registerDriver(driver);
         }
     },
@@ -81,7 +81,7 @@ static const std::array<DriverInfo, 3> gSupportedDrivers{{
         .name = "NT35510 Display Controller",
         .constructor = [](auto probulator, auto id, auto args) {
             if(!gFrontIoExpander) {
-                gFrontIoExpander = std::make_shared<drivers::gpio::Pca9535>(probulator->getBusFd(), 0x20);
+                gFrontIoExpander = std::make_shared<drivers::gpio::Pca9535>(probulator->getBus(), 0x20);
             }
 
             drivers::lcd::Nt35510("/dev/spidev0.1", gFrontIoExpander, 8);
@@ -108,7 +108,7 @@ static const std::array<DriverInfo, 3> gSupportedDrivers{{
             gFrontIoExpander->setPinState(7, false);
 
             // create the driver
-            auto driver = std::make_shared<drivers::led::Pca9955>(probulator->getBusFd(), args);
+            auto driver = std::make_shared<drivers::led::Pca9955>(probulator->getBus(), args);
             probulator->registerDriver(driver);
         },
     },
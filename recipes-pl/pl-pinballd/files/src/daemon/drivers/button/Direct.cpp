@@ -74,13 +74,46 @@ void Direct::initGpio() {
 
 /**
  * @brief Read out the state of the IO expander
+ *
+ * The read is asynchronous, so the event loop isn't held up by the bus; if the previous read is
+ * still in flight when the timer fires again, this poll is skipped.
  */
 void Direct::updateButtonState() {
-    std::bitset<32> current;
+    if(this->isReadPending) {
+        return;
+    }
+    this->isReadPending = true;
+
+    this->gpio->getPinStateAsync([weak = this->weak_from_this()](auto state, auto error) {
+        auto self = weak.lock();
+        if(!self) {
+            return;
+        }
+
+        self->isReadPending = false;
+
+        try {
+            if(error) {
+                std::rethrow_exception(error);
+            }
+
+            self->handleButtonState(state & self->buttonBits.to_ulong());
+        } catch(const std::exception &e) {
+            PLOG_WARNING << "failed to update button state: " << e.what();
+        }
+    });
+}
+
+/**
+ * @brief Process the state of the IO expander
+ *
+ * Determine which buttons changed since the last read, and broadcast those changes.
+ *
+ * @param current State of all button inputs
+ */
+void Direct::handleButtonState(const std::bitset<32> &current) {
     std::unordered_map<Button, bool> changes;
 
-    // read current state
-    current = this->gpio->getPinState() & this->buttonBits.to_ulong();
     if(current == this->buttonLastState) {
         return;
     }
@@ -130,6 +163,12 @@ void Direct::sendUpdate(const std::unordered_map<Button, bool> &changes) {
         throw std::runtime_error("no button updates to send!");
     }
 
+    // skip serializing entirely if nobody is listening
+    auto &rpc = EventLoop::Current()->getRpcServer();
+    if(!rpc->hasSubscribers(Rpc::BroadcastType::ButtonEvent)) {
+        return;
+    }
+
     // set up the root of the message
     auto root = cbor_new_definite_map(2);
     cbor_map_add(root, (struct cbor_pair) {
@@ -162,8 +201,8 @@ void Direct::sendUpdate(const std::unordered_map<Button, bool> &changes) {
 
     // now broadcast this packet
     try {
-        EventLoop::Current()->getRpcServer()->broadcastRaw(Rpc::BroadcastType::ButtonEvent,
-                kRpcEndpointUiEvent, {reinterpret_cast<std::byte *>(rootBuf), serializedBytes});
+        rpc->broadcastRaw(Rpc::BroadcastType::ButtonEvent, kRpcEndpointUiEvent,
+                {reinterpret_cast<std::byte *>(rootBuf), serializedBytes});
         free(rootBuf);
     } catch(const std::exception &) {
         free(rootBuf);
@@ -42,6 +42,7 @@ class Direct: public DriverBase, public std::enable_shared_from_this<Direct> {
 
         void initGpio();
         void updateButtonState();
+        void handleButtonState(const std::bitset<32> &current);
 
         void sendUpdate(const std::unordered_map<Button, bool> &);
 
@@ -63,6 +64,8 @@ class Direct: public DriverBase, public std::enable_shared_from_this<Direct> {
         std::bitset<32> buttonPolarity;
         /// Last button state
         std::bitset<32> buttonLastState;
+        /// Is a read of the button state in flight?
+        bool isReadPending{false};
 
         /// Mapping from IO lines to button
         std::unordered_map<size_t, Button> buttonMap;
@@ -3,6 +3,8 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <exception>
+#include <functional>
 
 namespace drivers::gpio {
 /**
@@ -58,6 +60,29 @@ class GpioChip {
          * be the actual physical value of the pin.
          */
         virtual uint32_t getPinState() = 0;
+
+        /**
+         * @brief Callback for asynchronous pin state reads
+         *
+         * Invoked with the state of all pins (as getPinState() returns it) or, if the read
+         * failed, the exception describing why.
+         */
+        using PinStateCallback = std::function<void(uint32_t, std::exception_ptr)>;
+
+        /**
+         * @brief Get the state of all pins, without blocking the event loop
+         *
+         * Chips whose reads block (such as IO expanders on a bus) should override this; by
+         * default, the state is read synchronously and the callback invoked right away.
+         */
+        virtual void getPinStateAsync(PinStateCallback &&callback) {
+            try {
+                const auto state = this->getPinState();
+                callback(state, nullptr);
+            } catch(const std::exception &) {
+                callback(0, std::current_exception());
+            }
+        }
 };
 };
 
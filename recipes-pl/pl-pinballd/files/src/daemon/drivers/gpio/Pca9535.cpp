@@ -1,20 +1,9 @@
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/ioctl.h>
-
-#ifdef __linux__
-#include <linux/i2c-dev.h>
-#include <i2c/smbus.h>
-#endif
-
 #include <array>
-#include <cerrno>
-#include <cstring>
-#include <system_error>
 
 #include <fmt/format.h>
 #include <plog/Log.h>
 
+#include "I2cBus.h"
 #include "Pca9535.h"
 
 using namespace drivers::gpio;
@@ -24,8 +13,11 @@ using namespace drivers::gpio;
  *
  * Given an already opened I2C bus, set up the IO expander. This will configure all pins as
  * inputs and disable interrupts.
+ *
+ * The expander mostly serves button inputs, so all of its transfers use the input priority.
  */
-Pca9535::Pca9535(int fd, const uint8_t address) : bus(fd), busAddress(address) {
+Pca9535::Pca9535(const std::shared_ptr<I2cBus> &bus, const uint8_t address) : bus(bus),
+    busAddress(address) {
     // configure all pins as inputs
     this->cfgPort.value = 0xffff;
     this->inversionPort.value = 0;
@@ -78,28 +70,48 @@ void Pca9535::setPinState(const size_t pin, bool asserted) {
 
 
 
+/**
+ * @brief Read the state of all pins asynchronously
+ *
+ * Both input registers are read in a single bus transaction; the callback is invoked on the
+ * event loop once it completed.
+ */
+void Pca9535::getPinStateAsync(PinStateCallback &&callback) {
+    constexpr static const std::array<uint8_t, 1> kInput0{{
+        static_cast<uint8_t>(Register::Input0)}};
+    constexpr static const std::array<uint8_t, 1> kInput1{{
+        static_cast<uint8_t>(Register::Input1)}};
+
+    I2cBus::Transaction txn{
+        I2cBus::Message::Write(this->busAddress, kInput0),
+        I2cBus::Message::Read(this->busAddress, 1),
+        I2cBus::Message::Write(this->busAddress, kInput1),
+        I2cBus::Message::Read(this->busAddress, 1),
+    };
+
+    this->bus->transferAsync(I2cBus::Priority::Input, std::move(txn),
+            [callback = std::move(callback)](auto &&txn, auto error) {
+        if(error) {
+            callback(0, error);
+            return;
+        }
+
+        callback(txn[1].data[0] | (static_cast<uint32_t>(txn[3].data[0]) << 8), nullptr);
+    });
+}
+
+
+
 /**
  * @brief Write a single 8-bit register
  */
 void Pca9535::writeReg(const Register reg, const uint8_t value) {
-    int err;
-
     if(kLogRegWrite) {
         PLOG_DEBUG << fmt::format("<< wr {:02x} = {:02x}", static_cast<uint8_t>(reg), value);
     }
 
-    // select slave
-    err = ioctl(this->bus, I2C_SLAVE, this->busAddress);
-    if(err == -1) {
-        throw std::system_error(errno, std::generic_category(), "Pca9535: set slave address");
-    }
-
-    // perform the transaction
     std::array<uint8_t, 2> txd{{static_cast<uint8_t>(reg), value}};
-    err = write(this->bus, txd.data(), txd.size());
-    if(err != txd.size()) {
-        throw std::system_error(errno, std::generic_category(), "Pca9535: write register");
-    }
+    this->bus->write(I2cBus::Priority::Input, this->busAddress, txd);
 }
 
 /**
@@ -116,28 +128,7 @@ uint8_t Pca9535::readReg(const Register reg) {
     std::array<uint8_t, 1> addrBuffer{{static_cast<uint8_t>(reg)}};
     std::array<uint8_t, 1> readBuffer;
 
-    // prepare the read messages
-    std::array<struct i2c_msg, 2> msgs;
-    for(auto &msg : msgs) {
-        memset(&msg, 0, sizeof(msg));
-        msg.addr = this->busAddress;
-    }
-
-    msgs[0].len = addrBuffer.size();
-    msgs[0].buf = addrBuffer.data();
-
-    msgs[1].flags = I2C_M_RD;
-    msgs[1].len = readBuffer.size();
-    msgs[1].buf = readBuffer.data();
-
-    struct i2c_rdwr_ioctl_data txns;
-    txns.msgs = msgs.data();
-    txns.nmsgs = msgs.size();
-
-    int err = ioctl(this->bus, I2C_RDWR, &txns);
-    if(err < 0) {
-        throw std::system_error(errno, std::generic_category(), "read register");
-    }
+    this->bus->writeRead(I2cBus::Priority::Input, this->busAddress, addrBuffer, readBuffer);
 
     // return the read data
     return *readBuffer.begin();
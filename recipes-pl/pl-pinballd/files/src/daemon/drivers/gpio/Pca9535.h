@@ -4,10 +4,13 @@
 #include <cstddef>
 #include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <optional>
 
 #include "GpioChip.h"
 
+class I2cBus;
+
 namespace drivers::gpio {
 /**
  * @brief NXP PCA9535 16-bit I²C GPIO expander
@@ -17,7 +20,7 @@ namespace drivers::gpio {
  */
 class Pca9535: public GpioChip {
     public:
-        Pca9535(int busFd, const uint8_t address);
+        Pca9535(const std::shared_ptr<I2cBus> &bus, const uint8_t address);
         virtual ~Pca9535() = default;
 
         void configurePin(const size_t pin, const PinMode mode) override;
@@ -28,6 +31,7 @@ class Pca9535: public GpioChip {
             temp |= static_cast<uint32_t>(this->readReg(Register::Input1)) << 8;
             return temp;
         }
+        void getPinStateAsync(PinStateCallback &&callback) override;
 
     private:
         /// Are register reads dumped to the terminal?
@@ -129,8 +133,8 @@ class Pca9535: public GpioChip {
         }
 
     private:
-        /// File descriptor to the I2C bus
-        int bus;
+        /// I2C bus the expander is on
+        std::shared_ptr<I2cBus> bus;
         /// Device address on the bus
         uint8_t busAddress;
 
@@ -1,18 +1,15 @@
-#include <linux/i2c.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
-
 #include <algorithm>
-#include <cerrno>
-#include <cstring>
+#include <cmath>
 #include <stdexcept>
-#include <system_error>
 #include <utility>
 
 #include <cbor.h>
+#include <event2/event.h>
 #include <fmt/format.h>
 #include <plog/Log.h>
 
+#include "EventLoop.h"
+#include "I2cBus.h"
 #include "LedManager.h"
 #include "Probulator.h"
 #include "Utils/Cbor.h"
@@ -25,10 +22,10 @@ using namespace drivers::led;
  *
  * This parses the specified configuration data to set up the controller.
  *
- * @param busFd Opened file descriptor for the I²C bus
+ * @param bus I²C bus the controller is on
  * @param config Driver configuration payload (should be a map)
  */
-Pca9955::Pca9955(const int busFd, const cbor_item_t *config) : busFd(busFd) {
+Pca9955::Pca9955(const std::shared_ptr<I2cBus> &bus, const cbor_item_t *config) : bus(bus) {
     // validate the config entry as being a map and then read the config
     if(!cbor_isa_map(config)) {
         throw std::runtime_error("invalid config (expected map)");
@@ -41,33 +38,38 @@ Pca9955::Pca9955(const int busFd, const cbor_item_t *config) : busFd(busFd) {
     /*
      * Set up the chip's mode registers: clear errors, use exponential gradation control;
      * disable sub-addresses and all-call addresses and enable auto-increment in the normal mode.
-     * Also upload the calculated current reference values.
      */
     // MODE1: disable all auxiliary addresses; use address autoincrement
     this->writeRegister(Register::Mode1, 0b1'00'0'000'0);
-    // MODE2: group dimming, exponential gradation
-    this->writeRegister(Register::Mode2, 0b00'0'1'0'1'01);
     // 1.5µS between pwm edges
     this->writeRegister(Register::PwmEdgeOffset, 12);
-    // set global dimming control to full
-    this->setGlobalBrightness(1.);
-
-    // set the current values
-    this->writeRegister(Register::IREF0, this->iref);
 
     /*
-     * Ensure each channel's output is disabled. We do this first by setting all channels' PWM
-     * duty cycle to zero, then enabling the drivers in individual/group dimming mode.
+     * Then initialize the shadow registers and write all of them in one go: group dimming mode
+     * (MODE2), and all channels enabled in individual/group dimming mode, but with a PWM duty
+     * cycle of zero (so they're off) and global dimming at full brightness. This also uploads
+     * the calculated current reference values.
      */
-    this->writeRegister(Register::PWMAll, 0x00);
-
-    std::array<uint8_t, 4> ledoutData{{
-        0b11'11'11'11,
-        0b11'11'11'11,
-        0b11'11'11'11,
-        0b11'11'11'11,
-    }};
-    this->writeRegister(Register::LEDOUT0, ledoutData);
+    this->shadow[Register::Mode2 - kShadowFirst] = kMode2;
+    std::fill_n(this->shadow.begin() + (Register::LEDOUT0 - kShadowFirst), 4, 0b11'11'11'11);
+    this->shadow[Register::GroupDutyCycle - kShadowFirst] = 0xff;
+    std::copy(this->iref.begin(), this->iref.end(),
+            this->shadow.begin() + (Register::IREF0 - kShadowFirst));
+
+    this->writeRegister(kShadowFirst, this->shadow);
+
+    // set up the event used to flush register changes
+    this->flushEvent = event_new(EventLoop::Current()->getEvBase(), -1, 0,
+            [](auto, auto, auto ctx) {
+        try {
+            reinterpret_cast<Pca9955 *>(ctx)->flush();
+        } catch(const std::exception &e) {
+            PLOG_WARNING << "failed to flush Pca9955 registers: " << e.what();
+        }
+    }, this);
+    if(!this->flushEvent) {
+        throw std::runtime_error("failed to allocate register flush event");
+    }
 }
 
 /**
@@ -76,6 +78,10 @@ Pca9955::Pca9955(const int busFd, const cbor_item_t *config) : busFd(busFd) {
  * This will turn off all LEDs.
  */
 Pca9955::~Pca9955() {
+    if(this->flushEvent) {
+        event_free(this->flushEvent);
+    }
+
     this->writeRegister(Register::PWMAll, 0x00);
 }
 
@@ -252,8 +258,98 @@ void Pca9955::setBrightness(const size_t channel, const double brightness) {
         throw std::invalid_argument("invalid channel number");
     }
 
-    const auto temp = std::clamp(brightness, 0., 1.) * 0xff;
-    this->writeRegister(Register::PWM0 + channel, static_cast<uint8_t>(temp));
+    this->setRegister(Register::PWM0 + channel, BrightnessToPwm(brightness));
+}
+
+
+
+/**
+ * @brief Update a register's value
+ *
+ * The new value is stored in the shadow copy, and the register marked as dirty; it's written to
+ * the device when the shadow registers are flushed at the end of the current event loop
+ * iteration. Writes that don't change the register's value are dropped.
+ *
+ * @param reg Register address (must be a shadowed register)
+ * @param value New register value
+ */
+void Pca9955::setRegister(const uint8_t reg, const uint8_t value) {
+    if(reg < kShadowFirst || reg >= kShadowFirst + kShadowSize) {
+        throw std::invalid_argument(fmt::format("register ${:02x} is not shadowed", reg));
+    }
+
+    const size_t idx = reg - kShadowFirst;
+    if(this->shadow[idx] == value) {
+        return;
+    }
+
+    this->shadow[idx] = value;
+    this->dirty.set(idx);
+
+    event_active(this->flushEvent, EV_TIMEOUT, 0);
+}
+
+/**
+ * @brief Select which channels are controlled by the group registers
+ *
+ * Channels in the group are driven by their PWM register and the group dimming/blinking; all
+ * others only by their PWM register.
+ */
+void Pca9955::setGroupChannels(const std::bitset<kNumChannels> &group) {
+    for(size_t reg = 0; reg < 4; reg++) {
+        uint8_t value{0};
+
+        for(size_t i = 0; i < 4; i++) {
+            value |= (group[(reg * 4) + i] ? 0b11 : 0b10) << (i * 2);
+        }
+
+        this->setRegister(Register::LEDOUT0 + reg, value);
+    }
+}
+
+/**
+ * @brief Write all dirty shadow registers to the device
+ *
+ * Each contiguous range of dirty registers is written as one auto-incrementing burst; all of the
+ * bursts are queued on the bus as a single transaction, without waiting for it to complete. (If
+ * it fails, the error is logged by the bus.)
+ */
+void Pca9955::flush() {
+    if(this->dirty.none()) {
+        return;
+    }
+
+    I2cBus::Transaction txn;
+
+    for(size_t i = 0; i < kShadowSize; i++) {
+        if(!this->dirty.test(i)) {
+            continue;
+        }
+
+        // find the end of this range
+        size_t end{i + 1};
+        while(end < kShadowSize && this->dirty.test(end)) {
+            end++;
+        }
+
+        // build the burst: register address (with autoincrement bit) followed by data
+        std::vector<uint8_t> msg;
+        msg.reserve(1 + (end - i));
+        msg.push_back(((kShadowFirst + i) & 0x7f) | (((end - i) > 1) ? 0x80 : 0x00));
+        msg.insert(msg.end(), this->shadow.begin() + i, this->shadow.begin() + end);
+
+        txn.push_back({this->address, false, std::move(msg)});
+
+        i = end;
+    }
+
+    this->dirty.reset();
+
+    if(kLogFlushes) {
+        PLOG_VERBOSE << fmt::format("Pca9955: flushing {} register range(s)", txn.size());
+    }
+
+    this->bus->submit(I2cBus::Priority::Indicator, std::move(txn));
 }
 
 
@@ -261,12 +357,13 @@ void Pca9955::setBrightness(const size_t channel, const double brightness) {
 /**
  * @brief Write device registers
  *
+ * Perform a write immediately, and wait for it to complete. This bypasses the shadow registers,
+ * and should only be used for registers that aren't shadowed, or during initialization.
+ *
  * @param start Starting register address
  * @param data One or more bytes of data to write to the device
  */
 void Pca9955::writeRegister(const uint8_t start, std::span<const uint8_t> data) {
-    int err;
-
     if(data.empty()) {
         throw std::invalid_argument("data must be at least 1 byte");
     }
@@ -280,15 +377,7 @@ void Pca9955::writeRegister(const uint8_t start, std::span<const uint8_t> data)
     std::copy(data.begin(), data.end(), msg.begin() + 1);
 
     // send it
-    err = ioctl(this->busFd, I2C_SLAVE, this->address);
-    if(err < 0) {
-        throw std::system_error(errno, std::generic_category(), "select device");
-    }
-
-    err = write(this->busFd, msg.data(), msg.size());
-    if(err < 0) {
-        throw std::system_error(errno, std::generic_category(), "write register");
-    }
+    this->bus->write(I2cBus::Priority::Indicator, this->address, msg);
 }
 
 
@@ -302,23 +391,13 @@ void Pca9955::writeRegister(const uint8_t start, std::span<const uint8_t> data)
  * @seeAlso setIndicatorColor
  */
 bool Pca9955::setIndicatorBrightness(const LedManager::Indicator which, const double brightness) {
-    using namespace std::placeholders;
-
-    const double temp = std::clamp(brightness, 0., 1.);
-
-    if(kLogChanges) {
-        PLOG_INFO << fmt::format("set led {} to {}", static_cast<size_t>(which), temp);
-    }
-
-    // ensure we have this channel
     if(!this->channels.contains(which)) {
         return false;
     }
-    const auto &info = this->channels.at(which);
 
-    // set each channel's brightness
-    std::for_each(info.indices.begin(), info.indices.end(),
-            std::bind(std::mem_fn(&Pca9955::setBrightness), this, _1, brightness));
+    LedManager::Transaction txn;
+    txn.setBrightness(which, brightness);
+    this->applyIndicatorTransaction(txn);
 
     return true;
 }
@@ -329,46 +408,137 @@ bool Pca9955::setIndicatorBrightness(const LedManager::Indicator which, const do
  * Any color components beyond what we have are ignored.
  */
 bool Pca9955::setIndicatorColor(const LedManager::Indicator which, const LedManager::Color &color) {
-    const auto [cR, cG, cB] = color;
+    if(!this->channels.contains(which)) {
+        return false;
+    }
 
-    if(kLogChanges) {
-        PLOG_VERBOSE << fmt::format("set led {} to ({}, {}, {})", static_cast<size_t>(which), cR,
-                cG, cB);
+    LedManager::Transaction txn;
+    txn.setColor(which, color);
+    this->applyIndicatorTransaction(txn);
+
+    return true;
+}
+
+/**
+ * @brief Apply a set of indicator changes
+ *
+ * The duty cycle of every channel belonging to one of our indicators is updated in the shadow
+ * registers; they're all written to the device at once when the registers are flushed, so all
+ * indicators change at the same time.
+ */
+void Pca9955::applyIndicatorTransaction(LedManager::Transaction &txn) {
+    for(size_t i = 0; i < txn.changes.size(); i++) {
+        auto &change = txn.changes[i];
+        const auto which = static_cast<LedManager::Indicator>(i);
+
+        // ensure we have this indicator
+        if(!change || !this->channels.contains(which)) {
+            continue;
+        }
+        const auto &info = this->channels.at(which);
+        const auto [cR, cG, cB] = *change;
+
+        if(kLogChanges) {
+            PLOG_VERBOSE << fmt::format("set led {} to ({}, {}, {})", i, cR, cG, cB);
+        }
+
+        switch(info.indices.size()) {
+            case 3:
+                this->setBrightness(info.indices[2], cB);
+                [[fallthrough]];
+            case 2:
+                this->setBrightness(info.indices[1], cG);
+                [[fallthrough]];
+            case 1:
+                this->setBrightness(info.indices[0], cR);
+                break;
+
+            default:
+                throw std::runtime_error(fmt::format("invalid channel info (has {} indices)",
+                            info.indices.size()));
+        }
+
+        change.reset();
     }
+}
 
-    // ensure we have this channel
+/**
+ * @brief Set the global brightness
+ *
+ * This sets the group duty cycle register.
+ */
+void Pca9955::setIndicatorGlobalBrightness(const double brightness) {
+    this->setGlobalBrightness(brightness);
+}
+
+/**
+ * @brief Blink an indicator using the group blink registers
+ *
+ * Only the indicator's channels are put under group control, and the group registers switched
+ * from dimming to blinking; once set up, the chip blinks the indicator by itself.
+ *
+ * There's only one set of group registers, so only one indicator can blink at a time; and since
+ * the other channels then lose group dimming, only while global brightness is at its maximum.
+ * Changes to the global brightness made while blinking take effect once it stops.
+ *
+ * @return Whether the blink could be performed in hardware
+ */
+bool Pca9955::startIndicatorBlink(const LedManager::Indicator which,
+        const LedManager::Color &color, const double period, const double duty) {
     if(!this->channels.contains(which)) {
         return false;
+    } else if(this->blinkIndicator && *this->blinkIndicator != which) {
+        return false;
+    } else if(this->globalBrightness != 0xff) {
+        return false;
     }
-    const auto &info = this->channels.at(which);
-
-    switch(info.indices.size()) {
-        case 3:
-            this->setBrightness(info.indices[2], cB);
-            [[fallthrough]];
-        case 2:
-            this->setBrightness(info.indices[1], cG);
-            [[fallthrough]];
-        case 1:
-            this->setBrightness(info.indices[0], cR);
-            break;
-
-        default:
-            throw std::runtime_error(fmt::format("invalid channel info (has {} indices)",
-                        info.indices.size()));
+
+    // the period must be representable
+    const auto periodSteps = std::lround(period * kGroupBlinkClock) - 1;
+    if(periodSteps < 0 || periodSteps > 0xff) {
+        return false;
+    }
+
+    // set the color, then put only this indicator's channels into the group
+    LedManager::Transaction txn;
+    txn.setColor(which, color);
+    this->applyIndicatorTransaction(txn);
+
+    std::bitset<kNumChannels> group;
+    for(const auto idx : this->channels.at(which).indices) {
+        group.set(idx);
+    }
+    this->setGroupChannels(group);
+
+    // configure the group for blinking
+    this->setRegister(Register::GroupBlinkPeriod, static_cast<uint8_t>(periodSteps));
+    this->setRegister(Register::GroupDutyCycle, BrightnessToPwm(duty));
+    this->setRegister(Register::Mode2, kMode2 | kMode2GroupBlink);
+
+    this->blinkIndicator = which;
+
+    if(kLogChanges) {
+        PLOG_VERBOSE << fmt::format("blink led {}: period ${:02x}, duty {}",
+                static_cast<size_t>(which), periodSteps, duty);
     }
 
     return true;
 }
 
 /**
- * @brief Set the global brightness
+ * @brief Stop a hardware blink
  *
- * This sets the group duty cycle register.
+ * Restore group dimming (with the current global brightness) for all channels.
  */
-void Pca9955::setIndicatorGlobalBrightness(const double brightness) {
-    const double temp = std::clamp(brightness, 0., 1.);
-    const uint8_t duty = static_cast<double>(0xff) * temp;
+void Pca9955::stopIndicatorBlink(const LedManager::Indicator which) {
+    if(this->blinkIndicator != which) {
+        return;
+    }
+
+    this->setGroupChannels(std::bitset<kNumChannels>{}.set());
+    this->setRegister(Register::Mode2, kMode2);
+    this->setRegister(Register::GroupBlinkPeriod, 0);
+    this->setRegister(Register::GroupDutyCycle, this->globalBrightness);
 
-    this->writeRegister(Register::GroupDutyCycle, duty);
+    this->blinkIndicator.reset();
 }
@@ -6,14 +6,20 @@
 #include <bitset>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
 #include <unordered_map>
+#include <vector>
 
 #include <uuid.h>
 
 #include "LedManager.h"
 #include "drivers/Driver.h"
 
+class I2cBus;
 struct cbor_item_t;
+struct event;
 
 namespace drivers::led {
 /**
@@ -52,15 +58,16 @@ class Pca9955: public DriverBase, public LedManager::DriverInterface,
             /**
              * @brief Group brightness control
              *
-             * Duty cycle for group dimming.
+             * Duty cycle for group dimming; or the fraction of the blink period for which the
+             * outputs are on, if group blinking is enabled in MODE2.
              */
             GroupDutyCycle              = 0x06,
             /**
              * @brief Group blinking control
              *
-             * Duty cycle of the blinking period; in steps of 67ms.
+             * Period of group blinking: (value + 1) / 15.26 Hz, so in steps of about 67ms.
              */
-            GroupBlinkDutyCycle         = 0x07,
+            GroupBlinkPeriod            = 0x07,
 
             /**
              * @brief Output PWM duty cycle
@@ -105,7 +112,7 @@ class Pca9955: public DriverBase, public LedManager::DriverInterface,
         constexpr static const uint8_t kDefaultCurrent{0x20};
 
     public:
-        Pca9955(const int busFd, const cbor_item_t *config);
+        Pca9955(const std::shared_ptr<I2cBus> &bus, const cbor_item_t *config);
         ~Pca9955();
 
         void driverDidRegister(Probulator *) override;
@@ -116,8 +123,12 @@ class Pca9955: public DriverBase, public LedManager::DriverInterface,
          * This brightness value affects all output channels.
          */
         inline void setGlobalBrightness(const double brightness) {
-            const auto temp = std::clamp(brightness, 0., 1.) * 0xff;
-            this->writeRegister(Register::GroupDutyCycle, temp);
+            this->globalBrightness = BrightnessToPwm(brightness);
+
+            // while an indicator blinks, the group registers control blinking instead
+            if(!this->blinkIndicator) {
+                this->setRegister(Register::GroupDutyCycle, this->globalBrightness);
+            }
         }
 
         void setBrightness(const size_t channel, const double brightness);
@@ -127,6 +138,7 @@ class Pca9955: public DriverBase, public LedManager::DriverInterface,
                 const double brightness) override;
         bool setIndicatorColor(const LedManager::Indicator which,
                 const LedManager::Color &color) override;
+        void applyIndicatorTransaction(LedManager::Transaction &txn) override;
 
         /// Global brightness support is implemented.
         bool supportsIndicatorGlobalBrightness() const override {
@@ -134,6 +146,11 @@ class Pca9955: public DriverBase, public LedManager::DriverInterface,
         }
         void setIndicatorGlobalBrightness(const double brightness) override;
 
+        bool startIndicatorBlink(const LedManager::Indicator which,
+                const LedManager::Color &color, const double period,
+                const double duty) override;
+        void stopIndicatorBlink(const LedManager::Indicator which) override;
+
     private:
         void readConfig(const struct cbor_item_t *);
         void readLedMap(const struct cbor_item_t *);
@@ -175,11 +192,37 @@ class Pca9955: public DriverBase, public LedManager::DriverInterface,
         }
         void writeRegister(const uint8_t reg, std::span<const uint8_t> data);
 
+        void setRegister(const uint8_t reg, const uint8_t value);
+        void flush();
+
+        void setGroupChannels(const std::bitset<kNumChannels> &group);
+
+        /**
+         * @brief Convert a brightness value to a PWM duty cycle
+         */
+        constexpr static inline uint8_t BrightnessToPwm(const double brightness) {
+            return static_cast<uint8_t>(std::clamp(brightness, 0., 1.) * 0xff);
+        }
+
     private:
         /// Output debug logs about the per channel current settings
         constexpr static const bool kLogChannelCurrent{false};
         /// Output debug logs about indicators being set
         constexpr static const bool kLogChanges{false};
+        /// Output debug logs about register flushes
+        constexpr static const bool kLogFlushes{false};
+
+        /// MODE2 value: clear errors, exponential gradation
+        constexpr static const uint8_t kMode2{0b00'0'1'0'1'01};
+        /// MODE2 bit to use the group registers for blinking, rather than dimming
+        constexpr static const uint8_t kMode2GroupBlink{(1 << 5)};
+        /// Rate of the group blink clock (Hz)
+        constexpr static const double kGroupBlinkClock{15.26};
+
+        /// First register in the shadow copy
+        constexpr static const uint8_t kShadowFirst{Register::Mode2};
+        /// Number of registers in the shadow copy (MODE2 through IREF15)
+        constexpr static const size_t kShadowSize{Register::IREF0 + kNumChannels - kShadowFirst};
 
         /**
          * @brief Information to drive an indicator
@@ -192,8 +235,8 @@ class Pca9955: public DriverBase, public LedManager::DriverInterface,
             std::vector<size_t> indices;
         };
 
-        /// File descriptor for the I2C bus
-        int busFd{-1};
+        /// I2C bus the controller is on
+        std::shared_ptr<I2cBus> bus;
 
         /// Resistance value of the current set resistor (much above 3kΩ is not really useful)
         uint16_t rext{0};
@@ -207,6 +250,23 @@ class Pca9955: public DriverBase, public LedManager::DriverInterface,
          */
         std::array<uint8_t, kNumChannels> iref;
 
+        /**
+         * @brief Shadow copy of device registers
+         *
+         * Mirrors the MODE2, LEDOUTx, group control, PWMx and IREFx registers. Changes are made
+         * here first, and only registers that actually changed are written to the device.
+         */
+        std::array<uint8_t, kShadowSize> shadow{};
+        /// Shadow registers that have changed since they were last written to the device
+        std::bitset<kShadowSize> dirty;
+        /// Event to flush dirty registers at the end of the current event loop iteration
+        struct event *flushEvent{nullptr};
+
+        /// Group duty cycle for global brightness (applied once no indicator is blinking)
+        uint8_t globalBrightness{0xff};
+        /// Indicator that is blinking using the group blink registers, if any
+        std::optional<LedManager::Indicator> blinkIndicator;
+
         /// Mapping from indicator id -> LED info
         std::unordered_map<LedManager::Indicator, LedInfo> channels;
 };
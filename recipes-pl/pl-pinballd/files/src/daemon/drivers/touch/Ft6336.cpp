@@ -1,7 +1,3 @@
-#include <linux/i2c.h>
-#include <linux/i2c-dev.h>
-#include <sys/ioctl.h>
-
 #include <algorithm>
 #include <array>
 #include <cerrno>
@@ -13,10 +9,12 @@
 
 #include <cbor.h>
 #include <event2/event.h>
+#include <gpiod.h>
 #include <fmt/format.h>
 #include <plog/Log.h>
 
 #include "EventLoop.h"
+#include "I2cBus.h"
 #include "RpcTypes.h"
 #include "Rpc/Server.h"
 #include "Utils/Cbor.h"
@@ -29,10 +27,10 @@ using namespace drivers::touch;
  *
  * This parses the specified configuration data to set up the controller.
  *
- * @param busFd Opened file descriptor for the I²C bus
+ * @param bus I²C bus the controller is on
  * @param config Driver configuration payload (should be a map)
  */
-Ft6336::Ft6336(const int busFd, const cbor_item_t *config) : busFd(busFd) {
+Ft6336::Ft6336(const std::shared_ptr<I2cBus> &bus, const cbor_item_t *config) : bus(bus) {
     // validate the config entry as being a map and then read the config
     if(!cbor_isa_map(config)) {
         throw std::runtime_error("invalid config (expected map)");
@@ -55,8 +53,7 @@ Ft6336::Ft6336(const int busFd, const cbor_item_t *config) : busFd(busFd) {
     if(!this->irqEnabled) {
         this->initPollingTimer();
     } else {
-        // TODO: implement this
-        throw std::runtime_error("irq support not yet implemented");
+        this->initIrq();
     }
 }
 
@@ -66,7 +63,9 @@ Ft6336::Ft6336(const int busFd, const cbor_item_t *config) : busFd(busFd) {
  * This is a CBOR map with the following keys:
  *
  * - addr: Bus address for the touch controller
- * - irq: Whether the controller supports interrupts; set to `false` to use timer-driven polling
+ * - irq: Interrupt line of the controller; either a map with the keys `chip` (name of the GPIO
+ *   chip, such as "gpiochip2") and `line` (line number on that chip), or `false` to use timer
+ *   driven polling instead.
  * - size: Size of the the underlying display for touch coordinate conversion
  * - rotation: Degrees rotation of the touch panel/display, in 90° increments
  *
@@ -83,13 +82,31 @@ void Ft6336::readConfig(const cbor_item_t *inConfig) {
 
     // interrupt config
     if(auto irq = Util::CborMapGet(inConfig, "irq")) {
-        // boolean flag?
-        if(cbor_float_ctrl_is_ctrl(irq)) {
-            this->irqEnabled = cbor_get_bool(irq);
+        // boolean flag? (only false is meaningful, since we need to know the line otherwise)
+        if(cbor_isa_float_ctrl(irq) && cbor_float_ctrl_is_ctrl(irq)) {
+            if(cbor_get_bool(irq)) {
+                throw std::runtime_error("invalid irq config (expected map with chip and line)");
+            }
+            this->irqEnabled = false;
         }
-        else {
-            // TODO: implement irq support
-            throw std::runtime_error("interrupt support not yet implemented");
+        // map with the line info
+        else if(cbor_isa_map(irq)) {
+            auto chip = Util::CborMapGet(irq, "chip");
+            if(!chip || !cbor_isa_string(chip) || !cbor_string_is_definite(chip)) {
+                throw std::runtime_error("missing or invalid irq chip name");
+            }
+            this->irqChipName = std::string(reinterpret_cast<const char *>(
+                        cbor_string_handle(chip)), cbor_string_length(chip));
+
+            auto line = Util::CborMapGet(irq, "line");
+            if(!line) {
+                throw std::runtime_error("missing irq line");
+            }
+            this->irqLineNum = Util::CborReadUint(line);
+
+            this->irqEnabled = true;
+        } else {
+            throw std::runtime_error("invalid irq config (expected map or false)");
         }
     }
 
@@ -141,13 +158,84 @@ void Ft6336::initPollingTimer() {
     evtimer_add(this->pollingTimer, &tv);
 }
 
+/**
+ * @brief Initialize interrupt handling
+ *
+ * Switch the controller to trigger mode, where it pulses its INT line low once for each new touch
+ * report (including the one for a touch being lifted) and request falling edge events for that
+ * line. The touch state is then only read when the controller has something to report; if the
+ * panel isn't being touched, the bus remains idle.
+ */
+void Ft6336::initIrq() {
+    int err;
+
+    // request the line
+    this->irqChip = gpiod_chip_open_lookup(this->irqChipName.c_str());
+    if(!this->irqChip) {
+        throw std::system_error(errno, std::generic_category(),
+                fmt::format("open gpio chip '{}'", this->irqChipName));
+    }
+
+    this->irqLine = gpiod_chip_get_line(this->irqChip, this->irqLineNum);
+    if(!this->irqLine) {
+        throw std::system_error(errno, std::generic_category(),
+                fmt::format("get gpio line {}", this->irqLineNum));
+    }
+
+    err = gpiod_line_request_falling_edge_events(this->irqLine, "ft6336-irq");
+    if(err) {
+        throw std::system_error(errno, std::generic_category(), "request touch irq events");
+    }
+
+    // then watch its event fd
+    const auto fd = gpiod_line_event_get_fd(this->irqLine);
+    if(fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "get touch irq event fd");
+    }
+
+    this->irqEvent = event_new(EventLoop::Current()->getEvBase(), fd, EV_READ | EV_PERSIST,
+            [](auto, auto, auto ctx) {
+        try {
+            reinterpret_cast<Ft6336 *>(ctx)->handleIrq();
+        } catch(const std::exception &e) {
+            PLOG_WARNING << "failed to handle touch irq: " << e.what();
+        }
+    }, this);
+    if(!this->irqEvent) {
+        throw std::runtime_error("failed to allocate touch irq event");
+    }
+
+    event_add(this->irqEvent, nullptr);
+
+    // switch the controller to trigger mode
+    this->writeRegister(Register::InterruptMode, 0x01);
+
+    PLOG_DEBUG << fmt::format("Touch irq: {} line {}", this->irqChipName, this->irqLineNum);
+}
+
 /**
  * @brief Clean up resources associated with the controller
  */
 Ft6336::~Ft6336() {
+    if(this->busTime.samples) {
+        PLOG_DEBUG << fmt::format("Touch: {} reads, avg {} µs, max {} µs on bus",
+                this->busTime.samples, (this->busTime.total / this->busTime.samples) / 1000,
+                this->busTime.max / 1000);
+    }
+
     if(this->pollingTimer) {
         event_free(this->pollingTimer);
     }
+
+    if(this->irqEvent) {
+        event_free(this->irqEvent);
+    }
+    if(this->irqLine) {
+        gpiod_line_release(this->irqLine);
+    }
+    if(this->irqChip) {
+        gpiod_chip_close(this->irqChip);
+    }
 }
 
 
@@ -165,28 +253,11 @@ Ft6336::~Ft6336() {
  */
 void Ft6336::readRegisters(const Register start, std::span<uint8_t> outBuffer,
         const size_t numRegs) {
-    std::array<struct i2c_msg, 2> msgs;
-    for(auto &msg : msgs) {
-        memset(&msg, 0, sizeof(msg));
-        msg.addr = this->address;
-    }
-
     std::array<uint8_t, 1> readAddr{{static_cast<uint8_t>(start)}};
-    msgs[0].len = readAddr.size();
-    msgs[0].buf = readAddr.data();
-
-    msgs[1].flags = I2C_M_RD;
-    msgs[1].len = numRegs ? std::min(numRegs, outBuffer.size()) : outBuffer.size();
-    msgs[1].buf = outBuffer.data();
+    const auto length = numRegs ? std::min(numRegs, outBuffer.size()) : outBuffer.size();
 
-    struct i2c_rdwr_ioctl_data txns;
-    txns.msgs = msgs.data();
-    txns.nmsgs = msgs.size();
-
-    int err = ioctl(this->busFd, I2C_RDWR, &txns);
-    if(err < 0) {
-        throw std::system_error(errno, std::generic_category(), "read register");
-    }
+    this->bus->writeRead(I2cBus::Priority::Input, this->address, readAddr,
+            outBuffer.subspan(0, length));
 }
 
 /**
@@ -198,42 +269,114 @@ void Ft6336::readRegisters(const Register start, std::span<uint8_t> outBuffer,
  * @throws std::system_error IO error
  */
 void Ft6336::writeRegister(const Register reg, const uint8_t value) {
-    int err;
-
-    // build up the buffer to send
     std::array<uint8_t, 2> msg{{
         static_cast<uint8_t>(reg), value
     }};
 
-    // do it
-    err = ioctl(this->busFd, I2C_SLAVE, this->address);
-    if(err < 0) {
-        throw std::system_error(errno, std::generic_category(), "select device");
-    }
+    this->bus->write(I2cBus::Priority::Input, this->address, msg);
+}
 
-    err = write(this->busFd, msg.data(), msg.size());
-    if(err < 0) {
-        throw std::system_error(errno, std::generic_category(), "write register");
+
+
+/**
+ * @brief Handle the touch controller's interrupt
+ *
+ * Consume the pending edge event for the INT line, then read out the new touch state.
+ */
+void Ft6336::handleIrq() {
+    struct gpiod_line_event event{};
+
+    if(gpiod_line_event_read(this->irqLine, &event)) {
+        throw std::system_error(errno, std::generic_category(), "read touch irq event");
     }
-}
 
+    this->updateTouchState();
 
+    // edge timestamps are taken from CLOCK_MONOTONIC (on kernels since 5.7)
+    if(kLogIrqLatency) {
+        struct timespec now{};
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        const auto nsec = (now.tv_sec - event.ts.tv_sec) * 1'000'000'000LL +
+            (now.tv_nsec - event.ts.tv_nsec);
+        PLOG_VERBOSE << fmt::format("touch irq handled after {} µs", nsec / 1000);
+    }
+}
 
 /**
  * @brief Read touch controller state
  *
  * Read out the current state of the touch controller, including the location of a touch.
  *
- * This will read the entire bank of registers for touches (starting at P1_Xh, address 0x03; up to
- * P2_MISC at 0x0E) in one bus transaction to reduce the time needed. We'll also optimize this to
- * read only registers for the number of touches that actually are here.
+ * The touch status register and the register banks for both touch points (TD_STATUS at 0x02, up
+ * to P2_MISC at 0x0E) are read in a single burst; that's only a few more bytes on the bus than
+ * reading just the status, but saves an entire second transaction (with its bus turnaround and
+ * syscall) whenever the panel is touched.
+ *
+ * The read is performed asynchronously, so the event loop isn't held up by the bus. Only one read
+ * is in flight at a time; if another is requested meanwhile, it's issued once the pending read
+ * completed, so the latest state is always picked up.
  */
 void Ft6336::updateTouchState() {
-    std::array<uint8_t, 12> buffer;
-    std::fill(buffer.begin(), buffer.end(), 0);
+    if(!EventLoop::Current()->getRpcServer()->hasSubscribers(Rpc::BroadcastType::TouchEvent)) {
+        return;
+    } else if(this->isReadPending) {
+        this->isReadRequested = true;
+        return;
+    }
+
+    // read status and all touch points
+    std::array<uint8_t, 1> readAddr{{static_cast<uint8_t>(Register::TouchStatus)}};
+    I2cBus::Transaction txn{
+        I2cBus::Message::Write(this->address, readAddr),
+        I2cBus::Message::Read(this->address, kTouchStateSize),
+    };
+
+    const auto start = Ft6336::Now();
+    this->bus->transferAsync(I2cBus::Priority::Input, std::move(txn),
+            [weak = this->weak_from_this(), start](auto &&txn, auto error) {
+        auto self = weak.lock();
+        if(!self) {
+            return;
+        }
+
+        self->isReadPending = false;
+
+        try {
+            if(error) {
+                std::rethrow_exception(error);
+            }
+
+            self->recordBusTime(Ft6336::Now() - start);
+            self->handleTouchState(txn[1].data);
+        } catch(const std::exception &e) {
+            PLOG_WARNING << "failed to read touch state: " << e.what();
+        }
+
+        if(self->isReadRequested) {
+            self->isReadRequested = false;
+            self->updateTouchState();
+        }
+    });
+
+    this->isReadPending = true;
+}
+
+/**
+ * @brief Process touch controller state
+ *
+ * Decode the touch points from the register data read by updateTouchState(), and broadcast
+ * a touch update if anything changed.
+ *
+ * @param buffer Register data, starting at the touch status register
+ */
+void Ft6336::handleTouchState(std::span<const uint8_t> buffer) {
+    if(buffer.size() != kTouchStateSize) {
+        throw std::runtime_error(fmt::format("invalid touch state size: {}", buffer.size()));
+    }
 
     // get the number of active touch points
-    const auto numPoints = this->readRegister(Register::TouchStatus) & 0x0f;
+    const auto numPoints = buffer[0] & 0x0f;
 
     if(!numPoints) {
         bool changed{false};
@@ -255,16 +398,11 @@ void Ft6336::updateTouchState() {
         throw std::runtime_error(fmt::format("invalid number of touch points: {}", numPoints));
     }
 
-    // read the touch point data
-    this->readRegisters(Register::Point1XHigh, buffer, (numPoints == 2) ? 12 : 6);
-
     // process touch events
-    std::span<const uint8_t> regData = buffer;
-
-    this->decodeTouchPoint(0, regData.subspan<0, 6>());
+    this->decodeTouchPoint(0, buffer.subspan<1, 6>());
 
     if(numPoints == 2) {
-        this->decodeTouchPoint(1, regData.subspan<6, 6>());
+        this->decodeTouchPoint(1, buffer.subspan<7, 6>());
     } else {
         if(this->p2HasData) {
             this->clearTouchPoint(1);
@@ -275,6 +413,39 @@ void Ft6336::updateTouchState() {
     this->sendTouchStateUpdate();
 }
 
+/**
+ * @brief Record the time taken by a touch state read
+ *
+ * If enabled, the average and maximum are logged periodically. They're always logged when the
+ * driver is destroyed.
+ *
+ * @param nsec Time spent in the bus transaction, in nanoseconds
+ */
+void Ft6336::recordBusTime(const uint64_t nsec) {
+    auto &stats = this->busTime;
+
+    stats.samples++;
+    stats.total += nsec;
+    stats.max = std::max(stats.max, nsec);
+
+    if(kLogBusTime && !(stats.samples % kBusTimeLogInterval)) {
+        PLOG_VERBOSE << fmt::format("touch read: {} samples, avg {} µs, max {} µs",
+                stats.samples, (stats.total / stats.samples) / 1000, stats.max / 1000);
+    }
+}
+
+/**
+ * @brief Get the current time for bus time measurements
+ *
+ * @return Monotonic timestamp, in nanoseconds
+ */
+uint64_t Ft6336::Now() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000ULL) + ts.tv_nsec;
+}
+
 /**
  * @brief Clear cached data for a touch point.
  *
@@ -334,9 +505,15 @@ void Ft6336::decodeTouchPoint(const size_t point, std::span<const uint8_t, 6> re
 /**
  * @brief Send a touch position update message
  *
- * Notify all connected clients that the touch positions have changed.
+ * Notify all subscribed clients that the touch positions have changed. Nothing is serialized if
+ * there are no subscribers.
  */
 void Ft6336::sendTouchStateUpdate() {
+    auto &rpc = EventLoop::Current()->getRpcServer();
+    if(!rpc->hasSubscribers(Rpc::BroadcastType::TouchEvent)) {
+        return;
+    }
+
     cbor_item_t *temp{nullptr};
 
     /*
@@ -394,8 +571,8 @@ void Ft6336::sendTouchStateUpdate() {
 
     // now broadcast this packet
     try {
-        EventLoop::Current()->getRpcServer()->broadcastRaw(Rpc::BroadcastType::TouchEvent,
-                kRpcEndpointUiEvent, {reinterpret_cast<std::byte *>(rootBuf), serializedBytes});
+        rpc->broadcastRaw(Rpc::BroadcastType::TouchEvent, kRpcEndpointUiEvent,
+                {reinterpret_cast<std::byte *>(rootBuf), serializedBytes});
         free(rootBuf);
     } catch(const std::exception &) {
         free(rootBuf);
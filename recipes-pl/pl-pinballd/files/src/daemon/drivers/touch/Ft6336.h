@@ -6,13 +6,17 @@
 #include <cstdint>
 #include <memory>
 #include <span>
+#include <string>
 #include <utility>
 
 #include <uuid.h>
 
 #include "drivers/Driver.h"
 
+class I2cBus;
 struct cbor_item_t;
+struct gpiod_chip;
+struct gpiod_line;
 
 namespace drivers::touch {
 /**
@@ -36,6 +40,13 @@ class Ft6336: public DriverBase, public std::enable_shared_from_this<Ft6336> {
 
             Point1XHigh                 = 0x03,
 
+            /**
+             * @brief Interrupt mode
+             *
+             * When 0, the INT line is held asserted for as long as there are touches; when 1, it
+             * is pulsed once for every new touch report.
+             */
+            InterruptMode               = 0xA4,
             LibVersionH                 = 0xA1,
             LibVersionL                 = 0xA2,
             FirmwareVersion             = 0xA6,
@@ -46,14 +57,20 @@ class Ft6336: public DriverBase, public std::enable_shared_from_this<Ft6336> {
     public:
         using TouchPosition = std::pair<uint16_t, uint16_t>;
 
-        Ft6336(const int busFd, const cbor_item_t *config);
+        Ft6336(const std::shared_ptr<I2cBus> &bus, const cbor_item_t *config);
         ~Ft6336();
 
     private:
         void readConfig(const cbor_item_t *);
         void initPollingTimer();
+        void initIrq();
+
+        void handleIrq();
 
         void updateTouchState();
+        void handleTouchState(std::span<const uint8_t> buffer);
+        void recordBusTime(const uint64_t nsec);
+        static uint64_t Now();
         void clearTouchPoint(const size_t point);
         void decodeTouchPoint(const size_t point, std::span<const uint8_t, 6> regData);
 
@@ -111,14 +128,37 @@ class Ft6336: public DriverBase, public std::enable_shared_from_this<Ft6336> {
     private:
         /// Time interval for polling timer, in microseconds
         constexpr static const size_t kPollInterval{33'333};
+        /// Number of registers read for the touch state (TD_STATUS up to P2_MISC)
+        constexpr static const size_t kTouchStateSize{13};
+        /// Log the time between the INT edge and us handling it
+        constexpr static const bool kLogIrqLatency{false};
+        /// Periodically log the time spent reading touch state from the controller
+        constexpr static const bool kLogBusTime{false};
+        /// Number of touch state reads between bus time logs
+        constexpr static const size_t kBusTimeLogInterval{1000};
+
+        /**
+         * @brief Bus time statistics
+         *
+         * Time taken by the I²C transaction that reads the touch state (including any time it
+         * was queued behind other transfers on the bus) per read.
+         */
+        struct BusTimeStats {
+            /// Number of reads
+            uint64_t samples{0};
+            /// Total time spent, in nanoseconds
+            uint64_t total{0};
+            /// Longest read, in nanoseconds
+            uint64_t max{0};
+        };
 
         /// Device firmware version
         uint8_t firmwareVersion;
 
         /// I²C bus address for the controller
         uint8_t address{0};
-        /// File descriptor for the I²C bus the controller is on
-        int busFd{-1};
+        /// I²C bus the controller is on
+        std::shared_ptr<I2cBus> bus;
 
         /// Physical size of the display panel (in points)
         std::pair<uint16_t, uint16_t> size{0, 0};
@@ -129,6 +169,19 @@ class Ft6336: public DriverBase, public std::enable_shared_from_this<Ft6336> {
 
         /// Polling mode timer
         struct event *pollingTimer{nullptr};
+        /// Touch state read timing
+        BusTimeStats busTime;
+
+        /// Interrupt mode: name of the GPIO chip the controller's INT line is connected to
+        std::string irqChipName;
+        /// Interrupt mode: line number (on the GPIO chip) of the INT line
+        unsigned int irqLineNum{0};
+        /// Interrupt mode: GPIO chip for the INT line
+        struct gpiod_chip *irqChip{nullptr};
+        /// Interrupt mode: INT line, requested for falling edge events
+        struct gpiod_line *irqLine{nullptr};
+        /// Interrupt mode: event for the INT line's edge event fd
+        struct event *irqEvent{nullptr};
 
         /// Whether interrupts are enabled
         uintptr_t irqEnabled            :1{false};
@@ -136,6 +189,10 @@ class Ft6336: public DriverBase, public std::enable_shared_from_this<Ft6336> {
         uintptr_t p1HasData             :1{false};
         /// Does touch point 2 have valid data?
         uintptr_t p2HasData             :1{false};
+        /// Is a touch state read in flight?
+        uintptr_t isReadPending         :1{false};
+        /// Should the touch state be read again once the pending read completed?
+        uintptr_t isReadRequested       :1{false};
         /**
          * @brief Coordinate rotation flag
          *
@@ -93,6 +93,7 @@ int main(const int argc, char * const * argv) {
     std::shared_ptr<EventLoop> ev;
     std::shared_ptr<Probulator> probe;
     std::filesystem::path frontI2cBus;
+    bool rpcBatchedIo{false};
 
     // parse command line
     int c;
@@ -107,6 +108,8 @@ int main(const int argc, char * const * argv) {
             {"log-simple",              no_argument, 0, 0},
             // i2c bus on which the front panel lives
             {"front-i2c-bus",           required_argument, 0, 0},
+            // batch rpc socket IO (sendmmsg/recvmmsg)
+            {"rpc-batch",               no_argument, 0, 0},
             {nullptr,                   0, 0, 0},
         };
 
@@ -179,6 +182,10 @@ int main(const int argc, char * const * argv) {
                     frontI2cBus = fmt::format("/dev/i2c-{}", optarg);
                 }
             }
+            // use batched rpc IO
+            else if(index == 4) {
+                rpcBatchedIo = true;
+            }
         }
     }
 
@@ -193,7 +200,7 @@ int main(const int argc, char * const * argv) {
 
     // set up event loop and rpc
     try {
-        ev = std::make_shared<EventLoop>(socketPath);
+        ev = std::make_shared<EventLoop>(socketPath, rpcBatchedIo);
         ev->arm();
     } catch(const std::exception &e) {
         PLOG_ERROR << "Event loop setup failed: " << e.what();